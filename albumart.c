@@ -29,6 +29,7 @@
 #include <libgen.h>
 #include <setjmp.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <jpeglib.h>
 
@@ -37,6 +38,7 @@
 #include "sql.h"
 #include "utils.h"
 #include "image_utils.h"
+#include "thumbgen.h"
 #include "log.h"
 
 static int
@@ -50,22 +52,62 @@ art_cache_exists(const char *orig_path, char **cache_file)
 	return (!access(*cache_file, F_OK));
 }
 
-static char *
-save_resized_album_art(image_s *imsrc, const char *path)
+/* Embedded art is stored under its content hash, so that the tracks of an
+ * album embedding the same cover share one file and one ALBUM_ART row. */
+static int
+art_cache_hashed(uint64_t hash, int size, char **cache_file)
 {
-	int dstw, dsth;
-	image_s *imdst;
-	char *cache_file;
-	char cache_dir[MAXPATHLEN];
+	if( xasprintf(cache_file, "%s/art_cache/.hash/%02x/%016llx-%x.jpg", db_path,
+	              (unsigned int)(hash >> 56), (unsigned long long)hash, size) < 0 )
+		return 0;
 
-	if( !imsrc )
-		return NULL;
+	return (!access(*cache_file, F_OK));
+}
 
-	if( art_cache_exists(path, &cache_file) )
-		return cache_file;
+/* Scanner threads working on the same album may get here at the same time,
+ * so everything is written to a private file and moved into place. */
+static int
+art_cache_save(const char *cache_file, image_s *im, const uint8_t *data, int size)
+{
+	char cache_dir[MAXPATHLEN];
+	char tmp_file[MAXPATHLEN];
+	FILE *dstfile;
+	size_t nwritten;
+	int ret = 0;
 
 	strncpyt(cache_dir, cache_file, sizeof(cache_dir));
 	make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+	snprintf(tmp_file, sizeof(tmp_file), "%s.%lx", cache_file, (unsigned long)pthread_self());
+	if( im )
+		ret = image_save_to_jpeg_file(im, tmp_file) != NULL;
+	else if( (dstfile = fopen(tmp_file, "w")) )
+	{
+		nwritten = fwrite(data, 1, size, dstfile);
+		ret = (fclose(dstfile) == 0 && nwritten == size);
+		if( !ret )
+			DPRINTF(E_WARN, L_METADATA, "Embedded art error: wrote %lu/%d bytes\n",
+				(unsigned long)nwritten, size);
+	}
+	if( ret && rename(tmp_file, cache_file) == 0 )
+		return 1;
+	unlink(tmp_file);
+
+	return 0;
+}
+
+/* Scale 'imsrc' down into 'cache_file', which is handed back on success
+ * and freed otherwise */
+static char *
+save_resized_album_art(image_s *imsrc, char *cache_file)
+{
+	int dstw, dsth;
+	image_s *imdst;
+
+	if( !imsrc || !cache_file )
+	{
+		free(cache_file);
+		return NULL;
+	}
 
 	if( imsrc->width > imsrc->height )
 	{
@@ -84,10 +126,15 @@ save_resized_album_art(image_s *imsrc, const char *path)
 		return NULL;
 	}
 
-	cache_file = image_save_to_jpeg_file(imdst, cache_file);
+	if( art_cache_save(cache_file, imdst, NULL, 0) )
+	{
+		image_free(imdst);
+		return cache_file;
+	}
 	image_free(imdst);
-	
-	return cache_file;
+	free(cache_file);
+
+	return NULL;
 }
 
 /* And our main album art functions */
@@ -150,7 +197,7 @@ update_if_album_art(const char *path)
 			DPRINTF(E_DEBUG, L_METADATA, "New file %s looks like cover art for %s\n", path, dp->d_name);
 			snprintf(file, sizeof(file), "%s/%s", dir, dp->d_name);
 			art_id = find_album_art(file, NULL, 0);
-			ret = sql_exec(db, "UPDATE DETAILS set ALBUM_ART = %lld where PATH = '%q'", (long long)art_id, file);
+			ret = sql_exec(db, "UPDATE DETAILS_DATA set ALBUM_ART = %lld where PATH = '%q'", (long long)art_id, file);
 			if( ret != SQLITE_OK )
 				DPRINTF(E_WARN, L_METADATA, "Error setting %s as cover art for %s\n", match, dp->d_name);
 		}
@@ -163,110 +210,99 @@ check_embedded_art(const char *path, uint8_t *image_data, int image_size)
 {
 	int width = 0, height = 0;
 	char *art_path = NULL;
-	char *cache_dir;
-	FILE *dstfile;
 	image_s *imsrc;
-	static char last_path[PATH_MAX];
-	static unsigned int last_hash = 0;
-	static int last_success = 0;
-	unsigned int hash;
+	/* Per thread, as the scanner parses files on several of them */
+	static __thread uint64_t last_bad = 0;
+	uint64_t hash;
 
 	if( !image_data || !image_size || !path )
 	{
 		return NULL;
 	}
-	/* If the embedded image matches the embedded image from the last file we
-	 * checked, just make a hard link.  Better than storing it on the disk twice. */
-	hash = DJBHash(image_data, image_size);
-	if( hash == last_hash )
-	{
-		if( !last_success )
-			return NULL;
-		art_cache_exists(path, &art_path);
-		if( link(last_path, art_path) == 0 )
-		{
-			return(art_path);
-		}
-		else
-		{
-			if( errno == ENOENT )
-			{
-				cache_dir = strdup(art_path);
-				make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
-				free(cache_dir);
-				if( link(last_path, art_path) == 0 )
-					return(art_path);
-			}
-			DPRINTF(E_WARN, L_METADATA, "Linking %s to %s failed [%s]\n", art_path, last_path, strerror(errno));
-			free(art_path);
-			art_path = NULL;
-		}
-	}
-	last_hash = hash;
+	hash = hash64(image_data, image_size);
+	if( art_cache_hashed(hash, image_size, &art_path) )
+		return art_path;
+	/* Don't decode the same broken image for every track of an album */
+	if( !art_path || hash == last_bad )
+		goto end_art;
 
 	imsrc = image_new_from_jpeg(NULL, 0, image_data, image_size, 1, ROTATE_NONE);
 	if( !imsrc )
 	{
-		last_success = 0;
-		return NULL;
+		free(art_path);
+		art_path = NULL;
+		goto end_art;
 	}
 	width = imsrc->width;
 	height = imsrc->height;
 
 	if( width > 160 || height > 160 )
 	{
-		art_path = save_resized_album_art(imsrc, path);
+		art_path = save_resized_album_art(imsrc, art_path);
 	}
-	else if( width > 0 && height > 0 )
+	else if( width <= 0 || height <= 0 || !art_cache_save(art_path, NULL, image_data, image_size) )
 	{
-		size_t nwritten;
-		if( art_cache_exists(path, &art_path) )
-			goto end_art;
-		cache_dir = strdup(art_path);
-		make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
-		free(cache_dir);
-		dstfile = fopen(art_path, "w");
-		if( !dstfile )
-		{
-			free(art_path);
-			art_path = NULL;
-			goto end_art;
-		}
-		nwritten = fwrite((void *)image_data, 1, image_size, dstfile);
-		fclose(dstfile);
-		if( nwritten != image_size )
-		{
-			DPRINTF(E_WARN, L_METADATA, "Embedded art error: wrote %lu/%d bytes\n",
-				(unsigned long)nwritten, image_size);
-			remove(art_path);
-			free(art_path);
-			art_path = NULL;
-			goto end_art;
-		}
+		free(art_path);
+		art_path = NULL;
 	}
-end_art:
 	image_free(imsrc);
+end_art:
 	if( !art_path )
 	{
 		DPRINTF(E_WARN, L_METADATA, "Invalid embedded album art in %s\n", basename((char *)path));
-		last_success = 0;
+		last_bad = hash;
 		return NULL;
 	}
 	DPRINTF(E_DEBUG, L_METADATA, "Found new embedded album art in %s\n", basename((char *)path));
-	last_success = 1;
-	strcpy(last_path, art_path);
 
 	return(art_path);
 }
 
+/* What goes into ALBUM_ART for the cover art file 'file': the file itself
+ * if it is small enough, or else a copy scaled down into the art cache.
+ * When the thumbgen workers are running they make that copy, and only
+ * the JPEG header is read here. */
+static char *
+album_art_file(const char *file)
+{
+	image_s *imsrc;
+	char *art_file = NULL;
+	int width, height;
+
+	if( thumbgen_running() )
+	{
+		if( image_get_jpeg_resolution(file, &width, &height) != 0 || !width || !height )
+			return NULL;
+		if( width <= 160 && height <= 160 )
+			return strdup(file);
+		if( art_cache_exists(file, &art_file) || !art_file ||
+		    thumbgen_queue_album_art(file, art_file) == 0 )
+			return art_file;
+		free(art_file);
+		art_file = NULL;
+	}
+
+	imsrc = image_new_from_jpeg(file, 1, NULL, 0, 1, ROTATE_NONE);
+	if( !imsrc )
+		return NULL;
+	if( imsrc->width > 160 || imsrc->height > 160 )
+	{
+		art_cache_exists(file, &art_file);
+		art_file = save_resized_album_art(imsrc, art_file);
+	}
+	else
+		art_file = strdup(file);
+	image_free(imsrc);
+
+	return art_file;
+}
+
 static char *
 check_for_album_file(const char *path)
 {
 	char file[MAXPATHLEN];
 	char mypath[MAXPATHLEN];
 	struct album_art_name_s *album_art_name;
-	image_s *imsrc = NULL;
-	int width=0, height=0;
 	char *art_file, *p;
 	const char *dir;
 	struct stat st;
@@ -311,9 +347,9 @@ check_for_album_file(const char *path)
 		if( art_cache_exists(file, &art_file) )
 			goto existing_file;
 		free(art_file);
-		imsrc = image_new_from_jpeg(file, 1, NULL, 0, 1, ROTATE_NONE);
-		if( imsrc )
-			goto found_file;
+		art_file = album_art_file(file);
+		if( art_file )
+			return art_file;
 	}
 check_dir:
 	/* Then fall back to possible generic cover art file names */
@@ -328,39 +364,80 @@ existing_file:
 				return art_file;
 			}
 			free(art_file);
-			imsrc = image_new_from_jpeg(file, 1, NULL, 0, 1, ROTATE_NONE);
-			if( !imsrc )
+			art_file = album_art_file(file);
+			if( !art_file )
 				continue;
-found_file:
-			width = imsrc->width;
-			height = imsrc->height;
-			if( width > 160 || height > 160 )
-				art_file = save_resized_album_art(imsrc, file);
-			else
-				art_file = strdup(file);
-			image_free(imsrc);
 			return(art_file);
 		}
 	}
 	return NULL;
 }
 
-int64_t
-find_album_art(const char *path, uint8_t *image_data, int image_size)
+/* Locate (and cache a resized copy of) the cover art for 'path', without
+ * touching the database.  Returns a malloc'd file name or NULL. */
+char *
+find_album_art_file(const char *path, uint8_t *image_data, int image_size)
 {
 	char *album_art = NULL;
-	int64_t ret = 0;
 
 	if( (image_size && (album_art = check_embedded_art(path, image_data, image_size))) ||
 	    (album_art = check_for_album_file(path)) )
+		return album_art;
+
+	return NULL;
+}
+
+int64_t
+get_album_art_id(const char *album_art)
+{
+	int64_t ret;
+
+	if( !album_art )
+		return 0;
+	ret = sql_get_int_field(db, "SELECT ID from ALBUM_ART where PATH = '%q'", album_art);
+	if( !ret )
 	{
-		ret = sql_get_int_field(db, "SELECT ID from ALBUM_ART where PATH = '%q'", album_art);
-		if( !ret )
-		{
-			if( sql_exec(db, "INSERT into ALBUM_ART (PATH) VALUES ('%q')", album_art) == SQLITE_OK )
-				ret = sqlite3_last_insert_rowid(db);
-		}
+		if( sql_exec(db, "INSERT into ALBUM_ART (PATH) VALUES ('%q')", album_art) == SQLITE_OK )
+			ret = sqlite3_last_insert_rowid(db);
+	}
+
+	return ret;
+}
+
+void
+album_art_gc(void)
+{
+	char prefix[PATH_MAX];
+	char **result;
+	int rows, i, len, freed = 0;
+
+	if( sql_get_table(db, "SELECT ID, PATH from ALBUM_ART where REFS <= 0", &result, &rows, NULL) != SQLITE_OK )
+		return;
+	len = snprintf(prefix, sizeof(prefix), "%s/art_cache/", db_path);
+	for( i = 1; i <= rows; i++ )
+	{
+		/* Something may have picked it up again since */
+		if( sql_exec(db, "DELETE from ALBUM_ART where ID = %s and REFS <= 0", result[i*2]) != SQLITE_OK ||
+		    sqlite3_changes(db) != 1 )
+			continue;
+		/* Cover art files in the media_dirs are not ours to remove */
+		if( strncmp(result[i*2+1], prefix, len) == 0 )
+			unlink(result[i*2+1]);
+		freed++;
 	}
+	sqlite3_free_table(result);
+	if( freed )
+		DPRINTF(E_DEBUG, L_METADATA, "Dropped %d unused album art entries\n", freed);
+}
+
+int64_t
+find_album_art(const char *path, uint8_t *image_data, int image_size)
+{
+	char *album_art;
+	int64_t ret;
+
+	album_art = find_album_art_file(path, image_data, image_size);
+	ret = get_album_art_id(album_art);
 	free(album_art);
 
 	return ret;
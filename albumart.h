@@ -26,5 +26,11 @@
 
 void update_if_album_art(const char *path);
 int64_t find_album_art(const char *path, uint8_t *image_data, int image_size);
+char *find_album_art_file(const char *path, uint8_t *image_data, int image_size);
+int64_t get_album_art_id(const char *album_art);
+
+/* Drop the ALBUM_ART rows no item refers to any more, and their files
+ * in the art cache */
+void album_art_gc(void);
 
 #endif
@@ -0,0 +1,170 @@
+/* MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "dict.h"
+#include "upnpglobalvars.h"
+#include "sql.h"
+#include "log.h"
+
+#define DICT_CACHE_SIZE 1024	/* per dictionary, must be a power of 2 */
+
+struct dict_def {
+	const char *table;
+	int nocase;
+	const char *create;
+	const char *select;
+	const char *insert;
+	const char *purge;
+};
+
+#define DICT_DEF(table, column, collate, nocase) \
+	{ table, nocase, \
+	  "CREATE TABLE " table " (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL" collate ");", \
+	  "SELECT ID from " table " where NAME = ?", \
+	  "INSERT into " table " (NAME) values (?)", \
+	  "DELETE from " table " where ID not in (SELECT distinct " column " from DETAILS_DATA)" }
+
+static const struct dict_def dicts[DICT_MAX] = {
+	[DICT_ARTIST]  = DICT_DEF("ARTISTS", "ARTIST_ID", " COLLATE NOCASE", 1),
+	[DICT_ALBUM]   = DICT_DEF("ALBUMS", "ALBUM_ID", " COLLATE NOCASE", 1),
+	[DICT_GENRE]   = DICT_DEF("GENRES", "GENRE_ID", " COLLATE NOCASE", 1),
+	[DICT_CREATOR] = DICT_DEF("CREATORS", "CREATOR_ID", " COLLATE NOCASE", 1),
+	[DICT_DLNA_PN] = DICT_DEF("DLNA_PROFILES", "DLNA_PN_ID", "", 0),
+	[DICT_MIME]    = DICT_DEF("MIME_TYPES", "MIME_ID", "", 0),
+};
+
+struct dict_entry {
+	char *name;
+	int64_t id;
+};
+
+/* Shared by the inotify thread, the scanner's writer and the main loop,
+ * which flushes it once the scanner purged entries behind its back */
+static struct dict_entry cache[DICT_MAX][DICT_CACHE_SIZE];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int
+dict_hash(const char *str, int nocase)
+{
+	unsigned int hash = 5381;
+
+	for (; *str; str++)
+		hash = ((hash << 5) + hash) + (nocase ? tolower((unsigned char)*str) : (unsigned char)*str);
+
+	return hash & (DICT_CACHE_SIZE - 1);
+}
+
+static int64_t
+dict_get(enum dict_type type, const char *value, int add)
+{
+	const struct dict_def *d = &dicts[type];
+	struct dict_entry *e;
+	int64_t id;
+
+	if (!value)
+		return 0;
+
+	/* Held across the insert too, so that two threads do not both add
+	 * the same name */
+	pthread_mutex_lock(&cache_lock);
+	e = &cache[type][dict_hash(value, d->nocase)];
+	if (e->name && (d->nocase ? strcasecmp(e->name, value) : strcmp(e->name, value)) == 0)
+	{
+		id = e->id;
+		pthread_mutex_unlock(&cache_lock);
+		return id;
+	}
+
+	id = sql_get_int64_field_bind(db, d->select, "t", value);
+	if (id <= 0)
+	{
+		if (!add || sql_exec_bind(db, d->insert, "t", value) != SQLITE_OK)
+		{
+			pthread_mutex_unlock(&cache_lock);
+			return 0;
+		}
+		id = sqlite3_last_insert_rowid(db);
+	}
+
+	free(e->name);
+	e->name = strdup(value);
+	e->id = e->name ? id : 0;
+	pthread_mutex_unlock(&cache_lock);
+
+	return id;
+}
+
+int64_t
+dict_intern(enum dict_type type, const char *value)
+{
+	return dict_get(type, value, 1);
+}
+
+int64_t
+dict_lookup(enum dict_type type, const char *value)
+{
+	return dict_get(type, value, 0);
+}
+
+int
+dict_create_tables(void)
+{
+	int i, ret;
+
+	for (i = 0; i < DICT_MAX; i++)
+	{
+		ret = sql_exec(db, dicts[i].create);
+		if (ret != SQLITE_OK)
+			return ret;
+	}
+
+	return SQLITE_OK;
+}
+
+void
+dict_flush(void)
+{
+	int i, j;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < DICT_MAX; i++)
+	{
+		for (j = 0; j < DICT_CACHE_SIZE; j++)
+		{
+			free(cache[i][j].name);
+			cache[i][j].name = NULL;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void
+dict_purge(void)
+{
+	int i;
+
+	for (i = 0; i < DICT_MAX; i++)
+		sql_exec(db, dicts[i].purge);
+	dict_flush();
+}
@@ -0,0 +1,53 @@
+/* Interned metadata dictionaries
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __DICT_H__
+#define __DICT_H__
+
+#include <stdint.h>
+
+/* Repeated DETAILS strings are stored once in these tables and
+ * referenced by integer ID from DETAILS_DATA.  ID 0 means NULL. */
+enum dict_type {
+	DICT_ARTIST,
+	DICT_ALBUM,
+	DICT_GENRE,
+	DICT_CREATOR,
+	DICT_DLNA_PN,
+	DICT_MIME,
+	DICT_MAX
+};
+
+/* Return the ID for 'value', adding it to the dictionary if needed */
+int64_t dict_intern(enum dict_type type, const char *value);
+
+/* Return the ID for 'value', or 0 if it is not in the dictionary */
+int64_t dict_lookup(enum dict_type type, const char *value);
+
+/* Create the dictionary tables */
+int dict_create_tables(void);
+
+/* Drop entries that are no longer referenced, and the in-memory cache */
+void dict_purge(void);
+
+/* Forget the cached IDs, which every process that did not run
+ * dict_purge() itself has to do afterwards */
+void dict_flush(void);
+
+#endif
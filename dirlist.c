@@ -0,0 +1,220 @@
+/* MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "config.h"
+#include "dirlist.h"
+
+struct dir_stats dir_stats;
+
+#define ARENA_CHUNK 4096
+
+/* Accumulates a listing; names are stored as arena offsets until the
+ * arena stops moving. */
+struct dir_builder {
+	struct dir_list *list;
+	size_t *offsets;
+	int alloc;
+	size_t used, size;
+	dir_filter filter;
+	void *arg;
+};
+
+static int
+dir_add(struct dir_builder *b, const char *name, unsigned char type)
+{
+	size_t len;
+
+	if( !b->filter(name, type, b->arg) )
+		return 0;
+	if( b->list->count == b->alloc )
+	{
+		int alloc = b->alloc ? b->alloc * 2 : 64;
+		void *e = realloc(b->list->entries, alloc * sizeof(struct dir_entry));
+		void *o = e ? realloc(b->offsets, alloc * sizeof(size_t)) : NULL;
+		if( e )
+			b->list->entries = e;
+		if( !o )
+			return -1;
+		b->offsets = o;
+		b->alloc = alloc;
+	}
+	len = strlen(name) + 1;
+	if( b->used + len > b->size )
+	{
+		size_t size = b->size + (len > ARENA_CHUNK ? len : ARENA_CHUNK);
+		char *arena;
+		if( size < b->size * 2 )
+			size = b->size * 2;
+		arena = realloc(b->list->arena, size);
+		if( !arena )
+			return -1;
+		b->list->arena = arena;
+		b->size = size;
+	}
+	memcpy(b->list->arena + b->used, name, len);
+	b->offsets[b->list->count] = b->used;
+	b->list->entries[b->list->count].type = type;
+	b->list->count++;
+	b->used += len;
+
+	return 0;
+}
+
+#if defined(__linux__) && defined(SYS_getdents64)
+struct linux_dirent64 {
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+static int
+dir_read_all(int fd, struct dir_builder *b)
+{
+	char buf[32768] __attribute__((aligned(8)));
+	struct linux_dirent64 *d;
+	long n, pos;
+
+	lseek(fd, 0, SEEK_SET);
+	for (;;)
+	{
+		n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+		if( n < 0 )
+			return -1;
+		dir_stats.reads++;
+		if( n == 0 )
+			return 0;
+		for( pos = 0; pos < n; pos += d->d_reclen )
+		{
+			d = (struct linux_dirent64 *)(buf + pos);
+			if( dir_add(b, d->d_name, d->d_type) != 0 )
+				return -1;
+		}
+	}
+}
+#else
+static int
+dir_read_all(int fd, struct dir_builder *b)
+{
+	struct dirent *d;
+	DIR *dh;
+	int ret = 0;
+
+	fd = dup(fd);
+	if( fd < 0 )
+		return -1;
+	dh = fdopendir(fd);
+	if( !dh )
+	{
+		close(fd);
+		return -1;
+	}
+	rewinddir(dh);
+	while( ret == 0 && (d = readdir(dh)) != NULL )
+	{
+		dir_stats.reads++;
+#if HAVE_STRUCT_DIRENT_D_TYPE
+		ret = dir_add(b, d->d_name, d->d_type);
+#else
+		ret = dir_add(b, d->d_name, DT_UNKNOWN);
+#endif
+	}
+	closedir(dh);
+
+	return ret;
+}
+#endif
+
+static int
+cmp_collate(const void *a, const void *b)
+{
+	return strcoll(((const struct dir_entry *)a)->name, ((const struct dir_entry *)b)->name);
+}
+
+static int
+cmp_bytes(const void *a, const void *b)
+{
+	return strcmp(((const struct dir_entry *)a)->name, ((const struct dir_entry *)b)->name);
+}
+
+int
+dir_list_read(int fd, struct dir_list *list, dir_filter filter, void *arg, enum dir_sort sort)
+{
+	struct dir_builder b;
+	struct timespec start, end;
+	int i, err;
+
+	memset(list, 0, sizeof(*list));
+	memset(&b, 0, sizeof(b));
+	b.list = list;
+	b.filter = filter;
+	b.arg = arg;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if( dir_read_all(fd, &b) != 0 )
+	{
+		err = errno;
+		free(b.offsets);
+		dir_list_free(list);
+		errno = err;
+		return -1;
+	}
+	for( i = 0; i < list->count; i++ )
+		list->entries[i].name = list->arena + b.offsets[i];
+	free(b.offsets);
+	if( list->count > 1 )
+		qsort(list->entries, list->count, sizeof(struct dir_entry),
+		      sort == DIR_SORT_BYTES ? cmp_bytes : cmp_collate);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	dir_stats.dirs++;
+	dir_stats.entries += list->count;
+	dir_stats.usec += (end.tv_sec - start.tv_sec) * 1000000LL +
+	                  (end.tv_nsec - start.tv_nsec) / 1000;
+
+	return list->count;
+}
+
+void
+dir_list_free(struct dir_list *list)
+{
+	free(list->entries);
+	free(list->arena);
+	list->entries = NULL;
+	list->arena = NULL;
+	list->count = 0;
+}
+
+int
+dir_open_at(int dirfd, const char *name)
+{
+	dir_stats.opens++;
+	return openat(dirfd, name, O_RDONLY|O_DIRECTORY);
+}
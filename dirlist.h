@@ -0,0 +1,76 @@
+/* Bulk directory listing relative to directory file descriptors
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __DIRLIST_H__
+#define __DIRLIST_H__
+
+#include <stdint.h>
+#include <dirent.h>
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN 0
+#define DT_DIR 4
+#define DT_REG 8
+#define DT_LNK 10
+#endif
+
+struct dir_entry {
+	const char *name;
+	unsigned char type;	/* DT_* as reported by the directory, may be DT_UNKNOWN */
+};
+
+/* A directory listing.  All the names live in a single arena, so a
+ * listing costs two allocations however many entries it holds. */
+struct dir_list {
+	int count;
+	struct dir_entry *entries;
+	char *arena;
+};
+
+enum dir_sort {
+	DIR_SORT_COLLATE,	/* locale order, as alphasort() */
+	DIR_SORT_BYTES		/* strcmp() order, to merge with SQL results */
+};
+
+/* Return nonzero to keep an entry */
+typedef int (*dir_filter)(const char *name, unsigned char type, void *arg);
+
+/* Syscall and latency counters for the directory walker */
+struct dir_stats {
+	unsigned int dirs;	/* directories listed */
+	unsigned int entries;	/* entries kept */
+	unsigned int reads;	/* getdents/readdir batches */
+	unsigned int opens;	/* directories opened */
+	unsigned int stats;	/* stat calls on entries */
+	unsigned int access;	/* access checks */
+	uint64_t usec;		/* time spent listing */
+};
+
+extern struct dir_stats dir_stats;
+
+/* List the open directory 'fd', keeping the entries 'filter' accepts.
+ * Returns the number of entries, or -1 with errno set. */
+int dir_list_read(int fd, struct dir_list *list, dir_filter filter, void *arg, enum dir_sort sort);
+
+void dir_list_free(struct dir_list *list);
+
+/* Open the directory 'name' relative to 'dirfd' */
+int dir_open_at(int dirfd, const char *name);
+
+#endif
@@ -31,7 +31,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <setjmp.h>
+#include <pthread.h>
 #include <jpeglib.h>
 #ifdef HAVE_MACHINE_ENDIAN_H
 #include <machine/endian.h>
@@ -39,6 +41,20 @@
 #include <endian.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+/* AVX2 is picked at run time, for builds that can't assume it */
+#if defined(__SSE2__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#include <immintrin.h>
+#define SCALER_AVX2 1
+#else
+#define SCALER_AVX2 0
+#endif
+
 #include "upnpreplyparse.h"
 #include "image_utils.h"
 #include "log.h"
@@ -190,7 +206,7 @@ jpeg_memory_src(j_decompress_ptr cinfo, const unsigned char * buffer, size_t buf
 	src->pub.bytes_in_buffer = bufsize;
 }
 
-jmp_buf setjmp_buffer;
+static __thread jmp_buf setjmp_buffer;
 /* Don't exit on error like libjpeg likes to do */
 static void
 libjpeg_error_handler(j_common_ptr cinfo)
@@ -230,171 +246,204 @@ put_pix_alpha_replace(image_s *pimage, int32_t x, int32_t y, pix col)
 		pimage->buf[(y * pimage->width) + x] = col;
 }
 
-int
-image_get_jpeg_resolution(const char * path, int * width, int * height)
+#define JPEG_HEADER_READ (128*1024)
+#define JPEG_HEADER_MAX  (1024*1024)
+
+static const char xmp_ns[] = "http://ns.adobe.com/xap/1.0/";
+
+/* Walk the marker segments in buf[0..len).  Returns 0 once the frame
+ * header or the start of the scan is reached, -1 on anything that is not
+ * a JPEG, or 1 with *need set when the segments continue past 'len'. */
+static int
+jpeg_scan_segments(const uint8_t *buf, size_t len, struct jpeg_header *hdr, size_t *need)
 {
-	FILE *img;
-	unsigned char buf[8];
-	uint16_t offset, h, w;
-	int ret = 1;
-	size_t nread;
-	long size;
-	
+	size_t pos = 2, n;
+	const uint8_t *seg;
+	uint8_t marker;
 
-	img = fopen(path, "r");
-	if( !img )
+	if( len < 2 || buf[0] != 0xFF || buf[1] != 0xD8 )
 		return -1;
 
-	fseek(img, 0, SEEK_END);
-	size = ftell(img);
-	rewind(img);
+	for (;;)
+	{
+		while( pos + 1 < len && buf[pos] == 0xFF && buf[pos+1] == 0xFF )
+			pos++;
+		if( pos + 4 > len )
+		{
+			*need = pos + 4;
+			return 1;
+		}
+		if( buf[pos] != 0xFF )
+			return -1;
+		marker = buf[pos+1];
+		if( marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8) )
+		{
+			pos += 2;
+			continue;
+		}
+		if( marker == 0xD9 || marker == 0xDA )
+			return 0;
+		n = (buf[pos+2] << 8) | buf[pos+3];
+		if( n < 2 )
+			return -1;
+		if( pos + 2 + n > len )
+		{
+			*need = pos + 2 + n;
+			return 1;
+		}
+		seg = buf + pos + 4;
+		n -= 2;
+		if( marker == 0xE1 )
+		{
+			if( !hdr->exif_len && n > 6 && memcmp(seg, "Exif\0\0", 6) == 0 )
+			{
+				hdr->exif = seg;
+				hdr->exif_len = n;
+			}
+			else if( !hdr->xmp_len && n > sizeof(xmp_ns) &&
+			         memcmp(seg, xmp_ns, sizeof(xmp_ns)) == 0 )
+			{
+				hdr->xmp = seg + sizeof(xmp_ns);
+				hdr->xmp_len = n - sizeof(xmp_ns);
+			}
+		}
+		else if( marker >= 0xC0 && marker <= 0xC3 )
+		{
+			if( n >= 5 )
+			{
+				hdr->height = (seg[1] << 8) | seg[2];
+				hdr->width = (seg[3] << 8) | seg[4];
+			}
+			return 0;
+		}
+		pos += 4 + n;
+	}
+}
+
+int
+image_parse_jpeg_header(const uint8_t *buf, size_t len, struct jpeg_header *hdr)
+{
+	size_t need;
+
+	memset(hdr, 0, sizeof(*hdr));
+	return jpeg_scan_segments(buf, len, hdr, &need) < 0 ? -1 : 0;
+}
 
-	nread = fread(&buf, 2, 1, img);
-	if( (nread < 1) || (buf[0] != 0xFF) || (buf[1] != 0xD8) )
+/* Read everything in front of the compressed image data with as few
+ * reads as possible.  One read covers the common case of an EXIF block
+ * and a few tables; only very large APPn segments need a second one. */
+int
+image_read_jpeg_header(const char *path, struct jpeg_header *hdr)
+{
+	uint8_t *buf, *newbuf;
+	size_t len = 0, size = JPEG_HEADER_READ, need;
+	ssize_t n;
+	int fd, ret;
+
+	memset(hdr, 0, sizeof(*hdr));
+	fd = open(path, O_RDONLY);
+	if( fd < 0 )
+		return -1;
+	buf = malloc(size);
+	if( !buf )
 	{
-		fclose(img);
+		close(fd);
 		return -1;
 	}
-	memset(&buf, 0, sizeof(buf));
 
-	while( ftell(img) < size )
+	for (;;)
 	{
-		while( nread > 0 && buf[0] != 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
-
-		while( nread > 0 && buf[0] == 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
-
-		if( (buf[0] >= 0xc0) && (buf[0] <= 0xc3) )
+		while( len < size && (n = read(fd, buf + len, size - len)) > 0 )
+			len += n;
+		memset(hdr, 0, sizeof(*hdr));
+		ret = jpeg_scan_segments(buf, len, hdr, &need);
+		if( ret <= 0 || len < size )
+			break;
+		if( need > JPEG_HEADER_MAX )
 		{
-			nread = fread(&buf, 7, 1, img);
-			*width = 0;
-			*height = 0;
-			if( nread < 1 )
-				break;
-			memcpy(&h, buf+3, 2);
-			*height = SWAP16(h);
-			memcpy(&w, buf+5, 2);
-			*width = SWAP16(w);
 			ret = 0;
 			break;
 		}
-		else
+		size = need > size * 2 ? need : size * 2;
+		if( size > JPEG_HEADER_MAX )
+			size = JPEG_HEADER_MAX;
+		newbuf = realloc(buf, size);
+		if( !newbuf )
 		{
-			offset = 0;
-			nread = fread(&buf, 2, 1, img);
-			if( nread < 1 )
-				break;
-			memcpy(&offset, buf, 2);
-			offset = SWAP16(offset) - 2;
-			if( fseek(img, offset, SEEK_CUR) == -1 )
-				break;
+			ret = 0;
+			break;
 		}
+		buf = newbuf;
 	}
-	fclose(img);
-	return ret;
+	close(fd);
+
+	/* Truncated files still give us whatever segments were complete */
+	if( ret < 0 )
+	{
+		free(buf);
+		memset(hdr, 0, sizeof(*hdr));
+		return -1;
+	}
+	hdr->buf = buf;
+	hdr->len = len;
+	return 0;
+}
+
+void
+image_free_jpeg_header(struct jpeg_header *hdr)
+{
+	free(hdr->buf);
+	memset(hdr, 0, sizeof(*hdr));
 }
 
 int
-image_get_jpeg_date_xmp(const char * path, char ** date)
+image_get_jpeg_resolution(const char * path, int * width, int * height)
+{
+	struct jpeg_header hdr;
+
+	if( image_read_jpeg_header(path, &hdr) != 0 )
+		return -1;
+	*width = hdr.width;
+	*height = hdr.height;
+	image_free_jpeg_header(&hdr);
+
+	return (*width && *height) ? 0 : 1;
+}
+
+int
+image_get_xmp_date(const uint8_t *xmp, size_t len, char ** date)
 {
-	FILE *img;
-	unsigned char buf[8];
-	char *data = NULL, *newdata;
-	uint16_t offset;
 	struct NameValueParserData xml;
 	char * exif;
 	int ret = 1;
-	size_t nread;
 
-	img = fopen(path, "r");
-	if( !img )
-		return(-1);
+	if( !xmp || !len )
+		return 1;
 
-	nread = fread(&buf, 2, 1, img);
-	if( (nread < 1) || (buf[0] != 0xFF) || (buf[1] != 0xD8) )
+	ParseNameValue((const char *)xmp, len, &xml, 0);
+	exif = GetValueFromNameValueList(&xml, "DateTimeOriginal");
+	if( exif )
 	{
-		fclose(img);
-		return(-1);
+		*date = realloc(*date, strlen(exif)+1);
+		strcpy(*date, exif);
+		ret = 0;
 	}
-	memset(&buf, 0, sizeof(buf));
-
-	while( !feof(img) )
-	{
-		while( nread > 0 && buf[0] != 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
-
-		while( nread > 0 && buf[0] == 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
-
-		if( feof(img) )
-			break;
-
-		if( buf[0] == 0xE1 ) // APP1 marker
-		{
-			offset = 0;
-			nread = fread(&buf, 2, 1, img);
-			if( nread < 1 )
-				break;
-			memcpy(&offset, buf, 2);
-			offset = SWAP16(offset) - 2;
-
-			if( offset < 30 )
-			{
-				fseek(img, offset, SEEK_CUR);
-				continue;
-			}
+	ClearNameValueList(&xml);
 
-			newdata = realloc(data, 30);
-			if( !newdata )
-				break;
-			data = newdata;
+	return ret;
+}
 
-			nread = fread(data, 29, 1, img);
-			if( nread < 1 )
-				break;
-			offset -= 29;
-			if( strcmp(data, "http://ns.adobe.com/xap/1.0/") != 0 )
-			{
-				fseek(img, offset, SEEK_CUR);
-				continue;
-			}
+int
+image_get_jpeg_date_xmp(const char * path, char ** date)
+{
+	struct jpeg_header hdr;
+	int ret;
 
-			newdata = realloc(data, offset+1);
-			if( !newdata )
-				break;
-			data = newdata;
-			nread = fread(data, offset, 1, img);
-			if( nread < 1 )
-				break;
-
-			ParseNameValue(data, offset, &xml, 0);
-			exif = GetValueFromNameValueList(&xml, "DateTimeOriginal");
-			if( !exif )
-			{
-				ClearNameValueList(&xml);
-				break;
-			}
-			*date = realloc(*date, strlen(exif)+1);
-			strcpy(*date, exif);
-			ClearNameValueList(&xml);
+	if( image_read_jpeg_header(path, &hdr) != 0 )
+		return -1;
+	ret = image_get_xmp_date(hdr.xmp, hdr.xmp_len, date);
+	image_free_jpeg_header(&hdr);
 
-			ret = 0;
-			break;
-		}
-		else
-		{
-			offset = 0;
-			nread = fread(&buf, 2, 1, img);
-			if( nread < 1 )
-				break;
-			memcpy(&offset, buf, 2);
-			offset = SWAP16(offset) - 2;
-			fseek(img, offset, SEEK_CUR);
-		}
-	}
-	fclose(img);
-	free(data);
 	return ret;
 }
 
@@ -636,148 +685,529 @@ image_upsize(image_s * pdest, image_s * psrc, int32_t width, int32_t height)
 	}
 }
 
-void
-image_downsize(image_s * pdest, image_s * psrc, int32_t width, int32_t height)
+/* Area averaging downscaler, working on row pointers.  Source rows are
+ * weighted into a row of sums until they cover an output row, which is
+ * then reduced horizontally; every source pixel is read once and the
+ * horizontal pass runs once per output row.  The four bytes of a pixel
+ * are averaged independently, so their order does not matter.
+ *
+ * Weights are fixed point, SCALE_ONE being a whole output pixel.  They
+ * are telescoped, so those making up an output pixel add up to exactly
+ * SCALE_ONE in both directions.  Finished vertical sums are kept with 7
+ * fractional bits, which keeps them within the signed 16 bit lanes the
+ * SSE2 horizontal kernel multiplies. */
+#define SCALE_BITS 14
+#define SCALE_ONE  (1 << SCALE_BITS)
+#define ROW_SHIFT  7
+
+struct scaler {
+	int32_t srcw, srch, dstw, dsth;
+	int32_t taps;		/* source pixels per output pixel, rounded up to even */
+	int32_t *xstart;	/* first source pixel of each output pixel */
+	int16_t *xweight;	/* 'taps' weights for each, zero padded */
+	uint32_t *acc;		/* vertical sums, one per byte of a source row */
+	uint16_t *row;		/* finished sums, followed by 'taps' zeroed pixels */
+	int32_t sy, dy;		/* next source and output row */
+};
+
+static inline int32_t
+scale_weight(int64_t u, int32_t span)
 {
-	int32_t vx, vy;
-	pix vcol;
-	int32_t i, j;
-#if !defined __i386__ && !defined __x86_64__
-	int32_t rx, ry, rx_next, ry_next;
-	int red, green, blue, alpha;
-	int factor;
+	return (int32_t)((u * SCALE_ONE) / span);
+}
 
-	if((pdest == NULL) || (psrc == NULL))
-		return;
+static void
+vert_add_c(uint32_t *acc, const uint8_t *src, int n, int w)
+{
+	int i;
 
-	for(vy = 0; vy < height; vy++)
+	for( i = 0; i < n; i++ )
+		acc[i] += src[i] * w;
+}
+
+static void
+vert_finish_c(uint32_t *acc, uint16_t *row, int n)
+{
+	int i;
+
+	for( i = 0; i < n; i++ )
 	{
-		for(vx = 0; vx < width; vx++)
+		row[i] = (acc[i] + (1 << (ROW_SHIFT - 1))) >> ROW_SHIFT;
+		acc[i] = 0;
+	}
+}
+
+static void
+horiz_c(const struct scaler *s, pix *out)
+{
+	const int16_t *w = s->xweight;
+	const uint16_t *p;
+	uint8_t *o = (uint8_t *)out;
+	uint32_t sum[4];
+	int x, t, c;
+
+	for( x = 0; x < s->dstw; x++, w += s->taps, o += 4 )
+	{
+		p = s->row + s->xstart[x] * 4;
+		sum[0] = sum[1] = sum[2] = sum[3] = 0;
+		for( t = 0; t < s->taps; t++, p += 4 )
+			for( c = 0; c < 4; c++ )
+				sum[c] += p[c] * w[t];
+		for( c = 0; c < 4; c++ )
+			o[c] = (sum[c] + (1 << (SCALE_BITS + ROW_SHIFT - 1))) >> (SCALE_BITS + ROW_SHIFT);
+	}
+}
+
+#if defined(__SSE2__)
+static void
+vert_add_sse2(uint32_t *acc, const uint8_t *src, int n, int w)
+{
+	const __m128i z = _mm_setzero_si128();
+	const __m128i wv = _mm_set1_epi16(w);
+	__m128i s, h, lo, hi;
+	int i, k;
+
+	for( i = 0; i + 16 <= n; i += 16 )
+	{
+		s = _mm_loadu_si128((const __m128i *)(src + i));
+		for( k = 0; k < 2; k++ )
 		{
+			h = k ? _mm_unpackhi_epi8(s, z) : _mm_unpacklo_epi8(s, z);
+			/* 16x16 -> 32 bit products, from their low and high halves */
+			lo = _mm_mullo_epi16(h, wv);
+			hi = _mm_mulhi_epu16(h, wv);
+			_mm_storeu_si128((__m128i *)(acc + i + k * 8),
+			                 _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + i + k * 8)),
+			                               _mm_unpacklo_epi16(lo, hi)));
+			_mm_storeu_si128((__m128i *)(acc + i + k * 8 + 4),
+			                 _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + i + k * 8 + 4)),
+			                               _mm_unpackhi_epi16(lo, hi)));
+		}
+	}
+	vert_add_c(acc + i, src + i, n - i, w);
+}
 
-			rx = ((vx * psrc->width) / width);
-			ry = ((vy * psrc->height) / height);
+static void
+horiz_sse2(const struct scaler *s, pix *out)
+{
+	const __m128i round = _mm_set1_epi32(1 << (SCALE_BITS + ROW_SHIFT - 1));
+	const int16_t *w = s->xweight;
+	const uint16_t *p;
+	__m128i sum, v;
+	int x, t;
 
-			red = green = blue = alpha = 0;
+	for( x = 0; x < s->dstw; x++, w += s->taps )
+	{
+		p = s->row + s->xstart[x] * 4;
+		sum = _mm_setzero_si128();
+		for( t = 0; t < s->taps; t += 2, p += 8 )
+		{
+			/* two pixels, interleaved channel by channel to pair up with their weights */
+			v = _mm_loadu_si128((const __m128i *)p);
+			v = _mm_unpacklo_epi16(v, _mm_srli_si128(v, 8));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(v,
+			                    _mm_set1_epi32((uint16_t)w[t] | ((uint32_t)(uint16_t)w[t + 1] << 16))));
+		}
+		sum = _mm_srli_epi32(_mm_add_epi32(sum, round), SCALE_BITS + ROW_SHIFT);
+		sum = _mm_packs_epi32(sum, sum);
+		out[x] = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+	}
+}
+#endif
 
-			rx_next = rx + (psrc->width / width);
-			ry_next = ry + (psrc->width / width);
-			factor = 0;
+#if SCALER_AVX2
+__attribute__((target("avx2"))) static void
+vert_add_avx2(uint32_t *acc, const uint8_t *src, int n, int w)
+{
+	const __m256i wv = _mm256_set1_epi16(w);
+	__m256i h, lo, hi, p0, p1;
+	int i;
 
-			for( j = rx; j < rx_next; j++)
-			{
-				for( i = ry; i < ry_next; i++)
-				{
-					factor += 1;
-					vcol = get_pix(psrc, j, i);
+	for( i = 0; i + 16 <= n; i += 16 )
+	{
+		h = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+		lo = _mm256_mullo_epi16(h, wv);
+		hi = _mm256_mulhi_epu16(h, wv);
+		/* unpack works within 128 bit lanes, so the products come out
+		 * as acc[0..3], acc[8..11] and acc[4..7], acc[12..15] */
+		p0 = _mm256_unpacklo_epi16(lo, hi);
+		p1 = _mm256_unpackhi_epi16(lo, hi);
+		_mm256_storeu_si256((__m256i *)(acc + i),
+		                    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(acc + i)),
+		                                     _mm256_permute2x128_si256(p0, p1, 0x20)));
+		_mm256_storeu_si256((__m256i *)(acc + i + 8),
+		                    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(acc + i + 8)),
+		                                     _mm256_permute2x128_si256(p0, p1, 0x31)));
+	}
+	vert_add_c(acc + i, src + i, n - i, w);
+}
+#endif
 
-					red   += COL_RED(vcol);
-					green += COL_GREEN(vcol);
-					blue  += COL_BLUE(vcol);
-					alpha += COL_ALPHA(vcol);
-				}
-			}
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void
+vert_add_neon(uint32_t *acc, const uint8_t *src, int n, int w)
+{
+	uint16x8_t lo, hi;
+	int i;
 
-			red   /= factor;
-			green /= factor;
-			blue  /= factor;
-			alpha /= factor;
+	for( i = 0; i + 16 <= n; i += 16 )
+	{
+		uint8x16_t s = vld1q_u8(src + i);
+		lo = vmovl_u8(vget_low_u8(s));
+		hi = vmovl_u8(vget_high_u8(s));
+		vst1q_u32(acc + i, vmlal_n_u16(vld1q_u32(acc + i), vget_low_u16(lo), w));
+		vst1q_u32(acc + i + 4, vmlal_n_u16(vld1q_u32(acc + i + 4), vget_high_u16(lo), w));
+		vst1q_u32(acc + i + 8, vmlal_n_u16(vld1q_u32(acc + i + 8), vget_low_u16(hi), w));
+		vst1q_u32(acc + i + 12, vmlal_n_u16(vld1q_u32(acc + i + 12), vget_high_u16(hi), w));
+	}
+	vert_add_c(acc + i, src + i, n - i, w);
+}
 
-			/* on sature les valeurs */
-			red   = (red   > 255) ? 255 : ((red   < 0) ? 0 : red  );
-			green = (green > 255) ? 255 : ((green < 0) ? 0 : green);
-			blue  = (blue  > 255) ? 255 : ((blue  < 0) ? 0 : blue );
-			alpha = (alpha > 255) ? 255 : ((alpha < 0) ? 0 : alpha);
+static void
+horiz_neon(const struct scaler *s, pix *out)
+{
+	const int16_t *w = s->xweight;
+	const uint16_t *p;
+	uint32x4_t sum;
+	uint16x4_t v;
+	int x, t;
+
+	for( x = 0; x < s->dstw; x++, w += s->taps )
+	{
+		p = s->row + s->xstart[x] * 4;
+		sum = vdupq_n_u32(0);
+		for( t = 0; t < s->taps; t++, p += 4 )
+			sum = vmlal_n_u16(sum, vld1_u16(p), w[t]);
+		sum = vaddq_u32(sum, vdupq_n_u32(1 << (SCALE_BITS + ROW_SHIFT - 1)));
+		v = vmovn_u32(vshrq_n_u32(sum, SCALE_BITS + ROW_SHIFT));
+		vst1_lane_u32((uint32_t *)(out + x), vreinterpret_u32_u8(vmovn_u16(vcombine_u16(v, v))), 0);
+	}
+}
+#endif
+
+static void (*vert_add)(uint32_t *acc, const uint8_t *src, int n, int w);
+static void (*horiz)(const struct scaler *s, pix *out);
+/* Thumbnail workers build scalers concurrently */
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void
+scaler_pick_kernels(void)
+{
+#if defined(__SSE2__)
+	horiz = horiz_sse2;
+# if SCALER_AVX2
+	if( __builtin_cpu_supports("avx2") )
+	{
+		vert_add = vert_add_avx2;
+		return;
+	}
+# endif
+	vert_add = vert_add_sse2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	horiz = horiz_neon;
+	vert_add = vert_add_neon;
 #else
-	float rx,ry;
-	float width_scale, height_scale;
-	float red, green, blue, alpha;
-	int32_t half_square_width, half_square_height;
-	float round_width, round_height;
+	horiz = horiz_c;
+	vert_add = vert_add_c;
+#endif
+}
 
-	if( (pdest == NULL) || (psrc == NULL) )
+static void
+scaler_free(struct scaler *s)
+{
+	if( !s )
 		return;
+	free(s->xstart);
+	free(s->xweight);
+	free(s->acc);
+	free(s->row);
+	free(s);
+}
 
-	width_scale  = (float)psrc->width  / (float)width;
-	height_scale = (float)psrc->height / (float)height;
+/* Only for shrinking: 'dstw' and 'dsth' must not exceed the source size */
+static struct scaler *
+scaler_new(int32_t srcw, int32_t srch, int32_t dstw, int32_t dsth)
+{
+	struct scaler *s;
+	int64_t base, a, b;
+	int32_t x, i, last;
 
-	half_square_width  = (int32_t)(width_scale  / 2.0);
-	half_square_height = (int32_t)(height_scale / 2.0);
-	round_width  = (width_scale  / 2.0) - (float)half_square_width;
-	round_height = (height_scale / 2.0) - (float)half_square_height;
-	if(round_width  > 0.0)
-		half_square_width++;
-	else
-		round_width = 1.0;
-	if(round_height > 0.0)
-		half_square_height++;
-	else
-		round_height = 1.0;
+	if( dstw <= 0 || dsth <= 0 || dstw > srcw || dsth > srch )
+		return NULL;
+	s = calloc(1, sizeof(*s));
+	if( !s )
+		return NULL;
+	pthread_once(&kernels_once, scaler_pick_kernels);
+	s->srcw = srcw;
+	s->srch = srch;
+	s->dstw = dstw;
+	s->dsth = dsth;
+	s->taps = ((srcw + dstw - 1) / dstw + 2) & ~1;
+	s->xstart = malloc(dstw * sizeof(*s->xstart));
+	s->xweight = calloc((size_t)dstw * s->taps, sizeof(*s->xweight));
+	s->acc = calloc((size_t)srcw * 4, sizeof(*s->acc));
+	s->row = calloc((size_t)(srcw + s->taps) * 4, sizeof(*s->row));
+	if( !s->xstart || !s->xweight || !s->acc || !s->row )
+	{
+		DPRINTF(E_WARN, L_METADATA, "malloc failed\n");
+		scaler_free(s);
+		return NULL;
+	}
 
-	for(vy = 0;vy < height; vy++)  
+	/* Output pixel x covers [x*srcw, (x+1)*srcw) in units where source
+	 * pixel i covers [i*dstw, (i+1)*dstw) */
+	for( x = 0; x < dstw; x++ )
 	{
-		for(vx = 0;vx < width; vx++)
+		base = (int64_t)x * srcw;
+		s->xstart[x] = base / dstw;
+		last = (base + srcw - 1) / dstw;
+		for( i = s->xstart[x]; i <= last; i++ )
 		{
-			rx = vx * width_scale;
-			ry = vy * height_scale;
-			vcol = get_pix(psrc, (int32_t)rx, (int32_t)ry);
+			a = (int64_t)i * dstw;
+			b = a + dstw;
+			if( a < base )
+				a = base;
+			if( b > base + srcw )
+				b = base + srcw;
+			s->xweight[x * s->taps + i - s->xstart[x]] =
+				scale_weight(b - base, srcw) - scale_weight(a - base, srcw);
+		}
+	}
 
-			red = green = blue = alpha = 0.0;
+	return s;
+}
 
-			for(j=0;j<half_square_height<<1;j++)
-			{
-				for(i=0;i<half_square_width<<1;i++)
-				{
-					vcol = get_pix(psrc, ((int32_t)rx)-half_square_width+i,
-					                     ((int32_t)ry)-half_square_height+j);
-          
-					if(((j == 0) || (j == (half_square_height<<1)-1)) && 
-					   ((i == 0) || (i == (half_square_width<<1)-1)))
-					{
-						red   += round_width*round_height*(float)COL_RED  (vcol);
-						green += round_width*round_height*(float)COL_GREEN(vcol);
-						blue  += round_width*round_height*(float)COL_BLUE (vcol);
-						alpha += round_width*round_height*(float)COL_ALPHA(vcol);
-					}
-					else if((j == 0) || (j == (half_square_height<<1)-1))
-					{
-						red   += round_height*(float)COL_RED  (vcol);
-						green += round_height*(float)COL_GREEN(vcol);
-						blue  += round_height*(float)COL_BLUE (vcol);
-						alpha += round_height*(float)COL_ALPHA(vcol);
-					}
-					else if((i == 0) || (i == (half_square_width<<1)-1))
-					{
-						red   += round_width*(float)COL_RED  (vcol);
-						green += round_width*(float)COL_GREEN(vcol);
-						blue  += round_width*(float)COL_BLUE (vcol);
-						alpha += round_width*(float)COL_ALPHA(vcol);
-					}
-					else
-					{
-						red   += (float)COL_RED  (vcol);
-						green += (float)COL_GREEN(vcol);
-						blue  += (float)COL_BLUE (vcol);
-						alpha += (float)COL_ALPHA(vcol);
-					}
-				}
-			}
-      
-			red   /= width_scale*height_scale;
-			green /= width_scale*height_scale;
-			blue  /= width_scale*height_scale;
-			alpha /= width_scale*height_scale;
-      
-			/* on sature les valeurs */
-			red   = (red   > 255.0)? 255.0 : ((red   < 0.0)? 0.0:red  );
-			green = (green > 255.0)? 255.0 : ((green < 0.0)? 0.0:green);
-			blue  = (blue  > 255.0)? 255.0 : ((blue  < 0.0)? 0.0:blue );
-			alpha = (alpha > 255.0)? 255.0 : ((alpha < 0.0)? 0.0:alpha);
-#endif
-			put_pix_alpha_replace(pdest, vx, vy,
-					      COL_FULL((uint8_t)red, (uint8_t)green, (uint8_t)blue, (uint8_t)alpha));
+/* Feed the next source row.  Returns 1 when that completed output row
+ * number s->dy - 1, which is then in 'out', and 0 otherwise. */
+static int
+scaler_push(struct scaler *s, const pix *src, pix *out)
+{
+	/* Source row sy covers [sy*dsth, (sy+1)*dsth) in units where output
+	 * row dy covers [dy*srch, (dy+1)*srch); being shrunk, it reaches
+	 * into the next output row at most. */
+	int64_t a = (int64_t)s->sy * s->dsth;
+	int64_t b = a + s->dsth;
+	int64_t base = (int64_t)s->dy * s->srch;
+	int64_t end = base + s->srch;
+	int n = s->srcw * 4;
+	int done = 0;
+
+	if( s->sy >= s->srch )
+		return 0;
+	s->sy++;
+	vert_add(s->acc, (const uint8_t *)src, n,
+	         scale_weight((b < end ? b : end) - base, s->srch) - scale_weight(a - base, s->srch));
+	if( b >= end )
+	{
+		vert_finish_c(s->acc, s->row, n);
+		horiz(s, out);
+		s->dy++;
+		done = 1;
+		if( b > end )
+			vert_add(s->acc, (const uint8_t *)src, n, scale_weight(b - end, s->srch));
+	}
+
+	return done;
+}
+
+void
+image_downsize(image_s * pdest, image_s * psrc, int32_t width, int32_t height)
+{
+	struct scaler *s;
+	int32_t y, dy = 0;
+
+	if( (pdest == NULL) || (psrc == NULL) )
+		return;
+	s = scaler_new(psrc->width, psrc->height, width, height);
+	if( !s )
+		return;
+	for( y = 0; y < psrc->height; y++ )
+	{
+		if( scaler_push(s, psrc->buf + (size_t)y * psrc->width, pdest->buf + (size_t)dy * width) )
+			dy++;
+	}
+	scaler_free(s);
+}
+
+/* Output of image_resize_jpeg_stream(), handed on a buffer at a time */
+#define JPEG_STREAM_BUF (16*1024)
+
+struct jpeg_stream {
+	struct jpeg_destination_mgr jdst;
+	int (*write)(void *arg, const uint8_t *data, size_t len);
+	void *arg;
+	size_t written;
+	int failed;
+	struct scaler *scaler;
+	JSAMPROW line;		/* a decoded scanline */
+	JSAMPROW out;		/* a scanline to encode */
+	pix *src;
+	pix *dst;
+	JOCTET buf[JPEG_STREAM_BUF];
+};
+
+static void
+stream_flush(struct jpeg_stream *s, size_t len)
+{
+	/* Once the receiver is gone, the rest is dropped and the caller
+	 * stops at the next row */
+	if( !s->failed && len && s->write(s->arg, s->buf, len) != 0 )
+		s->failed = 1;
+	s->written += len;
+	s->jdst.next_output_byte = s->buf;
+	s->jdst.free_in_buffer = sizeof(s->buf);
+}
+
+static void
+stream_dst_init(j_compress_ptr cinfo)
+{
+	struct jpeg_stream *s = (void *)cinfo->dest;
+
+	s->jdst.next_output_byte = s->buf;
+	s->jdst.free_in_buffer = sizeof(s->buf);
+}
+
+static boolean
+stream_dst_empty(j_compress_ptr cinfo)
+{
+	stream_flush((void *)cinfo->dest, JPEG_STREAM_BUF);
+
+	return TRUE;
+}
+
+static void
+stream_dst_term(j_compress_ptr cinfo)
+{
+	struct jpeg_stream *s = (void *)cinfo->dest;
+
+	stream_flush(s, sizeof(s->buf) - s->jdst.free_in_buffer);
+}
+
+static void
+stream_free(struct jpeg_stream *s)
+{
+	scaler_free(s->scaler);
+	free(s->line);
+	free(s->out);
+	free(s->src);
+	free(s->dst);
+	free(s);
+}
+
+int
+image_resize_jpeg_stream(const char *path, int scale, int32_t width, int32_t height,
+                         int (*write)(void *arg, const uint8_t *data, size_t len), void *arg)
+{
+	struct jpeg_decompress_struct dinfo;
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr dpub, cpub;
+	struct jpeg_stream *s;
+	FILE *file;
+	uint8_t *p;
+	int32_t x, w, h;
+	int ret;
+
+	s = calloc(1, sizeof(*s));
+	if( !s )
+		return 1;
+	s->write = write;
+	s->arg = arg;
+	if( (file = fopen(path, "r")) == NULL )
+	{
+		free(s);
+		return 1;
+	}
+	dinfo.err = jpeg_std_error(&dpub);
+	dpub.error_exit = libjpeg_error_handler;
+	jpeg_create_decompress(&dinfo);
+	jpeg_stdio_src(&dinfo, file);
+	if( setjmp(setjmp_buffer) )
+	{
+		jpeg_destroy_decompress(&dinfo);
+		fclose(file);
+		stream_free(s);
+		return 1;
+	}
+	jpeg_read_header(&dinfo, TRUE);
+	dinfo.scale_denom = scale;
+	dinfo.do_fancy_upsampling = FALSE;
+	dinfo.do_block_smoothing = FALSE;
+	dinfo.dct_method = JDCT_IFAST;
+	jpeg_start_decompress(&dinfo);
+	w = dinfo.output_width;
+	h = dinfo.output_height;
+	if( dinfo.output_components != 3 && dinfo.output_components != 1 )
+		longjmp(setjmp_buffer, 1);
+	s->scaler = scaler_new(w, h, width, height);
+	s->line = malloc(w * dinfo.output_components);
+	s->out = malloc(width * 3);
+	s->src = malloc(w * sizeof(pix));
+	s->dst = malloc(width * sizeof(pix));
+	if( !s->scaler || !s->line || !s->out || !s->src || !s->dst )
+		longjmp(setjmp_buffer, 1);
+
+	cinfo.err = jpeg_std_error(&cpub);
+	cpub.error_exit = libjpeg_error_handler;
+	jpeg_create_compress(&cinfo);
+	if( setjmp(setjmp_buffer) )
+	{
+		ret = s->written ? -1 : 1;
+		jpeg_destroy_compress(&cinfo);
+		jpeg_destroy_decompress(&dinfo);
+		fclose(file);
+		stream_free(s);
+		return ret;
+	}
+	s->jdst.init_destination = stream_dst_init;
+	s->jdst.empty_output_buffer = stream_dst_empty;
+	s->jdst.term_destination = stream_dst_term;
+	cinfo.dest = &s->jdst;
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, JPEG_QUALITY, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	while( dinfo.output_scanline < dinfo.output_height && !s->failed )
+	{
+		jpeg_read_scanlines(&dinfo, &s->line, 1);
+		p = s->line;
+		if( dinfo.output_components == 3 )
+			for( x = 0; x < w; x++, p += 3 )
+				s->src[x] = COL(p[0], p[1], p[2]);
+		else
+			for( x = 0; x < w; x++, p++ )
+				s->src[x] = COL(p[0], p[0], p[0]);
+		if( !scaler_push(s->scaler, s->src, s->dst) )
+			continue;
+		for( x = 0, p = s->out; x < width; x++ )
+		{
+			*p++ = COL_RED(s->dst[x]);
+			*p++ = COL_GREEN(s->dst[x]);
+			*p++ = COL_BLUE(s->dst[x]);
 		}
+		jpeg_write_scanlines(&cinfo, &s->out, 1);
+	}
+	if( s->failed )
+	{
+		jpeg_abort_compress(&cinfo);
+		jpeg_abort_decompress(&dinfo);
+		ret = -1;
+	}
+	else
+	{
+		jpeg_finish_compress(&cinfo);
+		jpeg_finish_decompress(&dinfo);
+		ret = s->failed ? -1 : 0;
 	}
+	jpeg_destroy_compress(&cinfo);
+	jpeg_destroy_decompress(&dinfo);
+	fclose(file);
+	stream_free(s);
+
+	return ret;
 }
 
 image_s *
@@ -796,6 +1226,18 @@ image_resize(image_s * src_image, int32_t width, int32_t height)
 	return dst_image;
 }
 
+/* Largest size within 'boxw' x 'boxh' with the aspect ratio of 'srcw' x 'srch' */
+void
+image_fit(int srcw, int srch, int boxw, int boxh, int *dstw, int *dsth)
+{
+	*dstw = boxw;
+	*dsth = ((((boxw<<10)/srcw)*srch)>>10);
+	if( *dsth > boxh )
+	{
+		*dsth = boxh;
+		*dstw = (((boxh<<10)/srch) * srcw>>10);
+	}
+}
 
 unsigned char *
 image_save_to_jpeg_buf(image_s * pimage, int * size)
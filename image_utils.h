@@ -22,6 +22,7 @@
  * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <inttypes.h>
+#include <stddef.h>
 
 #define ROTATE_NONE 0x0
 #define ROTATE_90   0x1
@@ -36,9 +37,33 @@ typedef struct {
 	pix     *buf;
 } image_s;
 
+/* Leading marker segments of a JPEG file, up to the frame header */
+struct jpeg_header {
+	uint8_t       *buf;
+	size_t         len;
+	const uint8_t *exif;      /* APP1 payload, starting with "Exif\0\0" */
+	size_t         exif_len;
+	const uint8_t *xmp;       /* APP1 XMP packet */
+	size_t         xmp_len;
+	int            width;     /* from SOF0-3, or 0 */
+	int            height;
+};
+
 void
 image_free(image_s *pimage);
 
+int
+image_read_jpeg_header(const char *path, struct jpeg_header *hdr);
+
+int
+image_parse_jpeg_header(const uint8_t *buf, size_t len, struct jpeg_header *hdr);
+
+void
+image_free_jpeg_header(struct jpeg_header *hdr);
+
+int
+image_get_xmp_date(const uint8_t *xmp, size_t len, char ** date);
+
 int
 image_get_jpeg_date_xmp(const char * path, char ** date);
 
@@ -51,6 +76,18 @@ image_new_from_jpeg(const char *path, int is_file, const uint8_t *ptr, int size,
 image_s *
 image_resize(image_s * src_image, int32_t width, int32_t height);
 
+/* Decode the JPEG file 'path' at 1/'scale', shrink it to 'width' x 'height'
+ * and encode the result a scanline at a time, passing the output to
+ * 'write' in pieces as it is produced; a non-zero return from 'write'
+ * stops it.  Returns 0 when done, 1 if nothing was written because the
+ * image could not be shrunk that way, or -1 if it failed part way. */
+int
+image_resize_jpeg_stream(const char *path, int scale, int32_t width, int32_t height,
+                         int (*write)(void *arg, const uint8_t *data, size_t len), void *arg);
+
+void
+image_fit(int srcw, int srch, int boxw, int boxh, int *dstw, int *dsth);
+
 unsigned char *
 image_save_to_jpeg_buf(image_s * pimage, int * size);
 
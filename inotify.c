@@ -48,6 +48,9 @@
 #include "metadata.h"
 #include "albumart.h"
 #include "playlist.h"
+#include "process.h"
+#include "thumbgen.h"
+#include "probecache.h"
 #include "log.h"
 
 #define EVENT_SIZE  ( sizeof (struct inotify_event) )
@@ -363,7 +366,7 @@ inotify_insert_file(char * name, const char * path)
 	if( stat(path, &st) != 0 )
 		return -1;
 
-	ts = sql_get_int_field(db, "SELECT TIMESTAMP from DETAILS where PATH = '%q'", path);
+	ts = sql_get_int_field_bind(db, "SELECT TIMESTAMP from DETAILS where PATH = ?", "t", path);
 	if( !ts && is_playlist(path) && (sql_get_int_field(db, "SELECT ID from PLAYLISTS where PATH = '%q'", path) > 0) )
 	{
 		DPRINTF(E_DEBUG, L_INOTIFY, "Re-reading modified playlist (%s).\n", path);
@@ -561,7 +564,7 @@ static void RemoveFromDB(const char * id)
      if(!IsMediaPath(path))
      {
        DPRINTF(E_DEBUG, L_INOTIFY, "%s is a not virtual folder, removing\n", path);
-       sql_exec(db, "DELETE from DETAILS where ID ="
+       sql_exec(db, "DELETE from DETAILS_DATA where ID ="
                     " (SELECT DETAIL_ID from OBJECTS where OBJECT_ID = '%s')", id);
        sql_exec(db, "DELETE from OBJECTS where OBJECT_ID = '%s'", id);
      }
@@ -575,7 +578,6 @@ inotify_remove_file(const char * path)
 {
 	char sql[128];
 	char art_cache[PATH_MAX];
-	char *id;
 	char *ptr;
 	char **result;
 	int64_t detailID;
@@ -588,15 +590,16 @@ inotify_remove_file(const char * path)
 	/* Invalidate the scanner cache so we don't insert files into non-existent containers */
 	valid_cache = 0;
 	playlist = is_playlist(path);
-	id = sql_get_text_field(db, "SELECT ID from %s where PATH = '%q'", playlist?"PLAYLISTS":"DETAILS", path);
-	if( !id )
+	if( playlist )
+		detailID = sql_get_int64_field_bind(db, "SELECT ID from PLAYLISTS where PATH = ?", "t", path);
+	else
+		detailID = sql_get_int64_field_bind(db, "SELECT ID from DETAILS where PATH = ?", "t", path);
+	if( detailID <= 0 )
 		return 1;
-	detailID = strtoll(id, NULL, 10);
-	sqlite3_free(id);
 	if( playlist )
 	{
 		sql_exec(db, "DELETE from PLAYLISTS where ID = %lld", detailID);
-		sql_exec(db, "DELETE from DETAILS where ID ="
+		sql_exec(db, "DELETE from DETAILS_DATA where ID ="
 		             " (SELECT DETAIL_ID from OBJECTS where OBJECT_ID = '%s$%llX')",
 		         MUSIC_PLIST_ID, detailID);
 		sql_exec(db, "DELETE from OBJECTS where OBJECT_ID = '%s$%llX' or PARENT_ID = '%s$%llX'",
@@ -620,7 +623,8 @@ inotify_remove_file(const char * path)
 					         atoi(strrchr(result[i], '$') + 1));
 				}
 
-				children = sql_get_int_field(db, "SELECT count(*) from OBJECTS where PARENT_ID = '%s'", result[i]);
+				children = sql_get_int_field_bind(db, "SELECT count(*) from OBJECTS where PARENT_ID = ?",
+				                                  "t", result[i]);
 				if( children < 0 )
 					continue;
 				if( children < 2 )
@@ -631,7 +635,8 @@ inotify_remove_file(const char * path)
 					ptr = strrchr(result[i], '$');
 					if( ptr )
 						*ptr = '\0';
-					if( sql_get_int_field(db, "SELECT count(*) from OBJECTS where PARENT_ID = '%s'", result[i]) == 0 )
+					if( sql_get_int_field_bind(db, "SELECT count(*) from OBJECTS where PARENT_ID = ?",
+					                           "t", result[i]) == 0 )
 					{
 						RemoveFromDB(result[i]);
 					}
@@ -640,11 +645,13 @@ inotify_remove_file(const char * path)
 			sqlite3_free_table(result);
 		}
 		/* Now delete the actual objects */
-		sql_exec(db, "DELETE from DETAILS where ID = %lld", detailID);
-		sql_exec(db, "DELETE from OBJECTS where DETAIL_ID = %lld", detailID);
+		sql_exec_bind(db, "DELETE from DETAILS_DATA where ID = ?", "i", detailID);
+		sql_exec_bind(db, "DELETE from OBJECTS where DETAIL_ID = ?", "i", detailID);
 	}
 	snprintf(art_cache, sizeof(art_cache), "%s/art_cache%s", db_path, path);
 	remove(art_cache);
+	thumbgen_remove(path);
+	album_art_gc();
 
 	return 0;
 }
@@ -669,7 +676,7 @@ inotify_remove_directory(int fd, const char * path)
 			for( i=1; i <= rows; i++ )
 			{
 				detailID = strtoll(result[i], NULL, 10);
-				sql_exec(db, "DELETE from DETAILS where ID = %lld", detailID);
+				sql_exec(db, "DELETE from DETAILS_DATA where ID = %lld", detailID);
 				sql_exec(db, "DELETE from OBJECTS where DETAIL_ID = %lld", detailID);
 			}
 			ret = 0;
@@ -679,6 +686,7 @@ inotify_remove_directory(int fd, const char * path)
 	sqlite3_free(sql);
 	/* Clean up any album art entries in the deleted directory */
 	sql_exec(db, "DELETE from ALBUM_ART where (PATH > '%q/' and PATH <= '%q/%c')", path, path, 0xFF);
+	album_art_gc();
 
 	return ret;
 }
@@ -697,6 +705,9 @@ start_inotify(void)
 
 	sigfillset(&set);
 	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	/* Only this thread; the HTTP and SSDP side keeps its I/O priority */
+	if( process_set_idle_io() == -1 )
+		DPRINTF(E_INFO, L_INOTIFY, "Failed to set idle I/O priority: %s\n", strerror(errno));
         
 	pollfds[0].fd = inotify_init();
 	pollfds[0].events = POLLIN;
@@ -711,6 +722,8 @@ start_inotify(void)
 		sleep(1);
 	}
 	inotify_create_watches(pollfds[0].fd);
+	thumbgen_start();
+	probe_cache_open();
 	if (setpriority(PRIO_PROCESS, 0, 19) == -1)
 		DPRINTF(E_WARN, L_INOTIFY,  "Failed to reduce inotify thread priority\n");
 	sqlite3_release_memory(1<<31);
@@ -801,6 +814,8 @@ start_inotify(void)
 	}
 	inotify_remove_watches(pollfds[0].fd);
 quitting:
+	thumbgen_stop(0);
+	probe_cache_close();
 	close(pollfds[0].fd);
 
 	return 0;
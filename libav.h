@@ -83,6 +83,7 @@
 #endif
 
 #if LIBAVCODEC_VERSION_MAJOR < 55
+#define AV_CODEC_ID_NONE CODEC_ID_NONE
 #define AV_CODEC_ID_AAC CODEC_ID_AAC
 #define AV_CODEC_ID_AC3 CODEC_ID_AC3
 #define AV_CODEC_ID_ADPCM_IMA_QT CODEC_ID_ADPCM_IMA_QT
@@ -115,6 +116,45 @@ typedef AVMetadataTag AVDictionaryEntry;
 # endif
 #endif
 
+/* Before libavcodec 58.9, opening codecs from several threads (as
+ * avformat_find_stream_info() does) needs a lock manager. */
+#if LIBAVCODEC_VERSION_INT < ((58<<16)+(9<<8)+100) && LIBAVCODEC_VERSION_INT >= ((52<<16)+(59<<8)+0)
+#include <pthread.h>
+#define LAV_LOCKMGR 1
+static inline int
+lav_lockmgr(void **mutex, enum AVLockOp op)
+{
+	pthread_mutex_t **m = (pthread_mutex_t **)mutex;
+
+	switch (op)
+	{
+	case AV_LOCK_CREATE:
+		*m = malloc(sizeof(pthread_mutex_t));
+		if (!*m)
+			return 1;
+		return !!pthread_mutex_init(*m, NULL);
+	case AV_LOCK_OBTAIN:
+		return !!pthread_mutex_lock(*m);
+	case AV_LOCK_RELEASE:
+		return !!pthread_mutex_unlock(*m);
+	case AV_LOCK_DESTROY:
+		pthread_mutex_destroy(*m);
+		free(*m);
+		*m = NULL;
+		return 0;
+	}
+	return 1;
+}
+#endif
+
+static inline void
+lav_thread_init(void)
+{
+#ifdef LAV_LOCKMGR
+	av_lockmgr_register(lav_lockmgr);
+#endif
+}
+
 static inline int
 lav_open(AVFormatContext **ctx, const char *filename)
 {
@@ -131,6 +171,48 @@ lav_open(AVFormatContext **ctx, const char *filename)
 	return ret;
 }
 
+/* lav_open() with bounds on how much is read and decoded to find the
+ * streams.  A limit of 0 leaves it at the library default. */
+static inline int
+lav_open_bounded(AVFormatContext **ctx, const char *filename,
+                 int64_t probesize, int64_t analyzeduration)
+{
+#if LIBAVFORMAT_VERSION_INT >= ((53<<16)+(17<<8)+0)
+	AVDictionary *opts = NULL;
+	char buf[24];
+	int ret;
+
+	if (probesize)
+	{
+		snprintf(buf, sizeof(buf), "%lld", (long long)probesize);
+		av_dict_set(&opts, "probesize", buf, 0);
+	}
+	if (analyzeduration)
+	{
+		snprintf(buf, sizeof(buf), "%lld", (long long)analyzeduration);
+		av_dict_set(&opts, "analyzeduration", buf, 0);
+	}
+	ret = avformat_open_input(ctx, filename, NULL, &opts);
+	av_dict_free(&opts);
+	if (ret == 0)
+		avformat_find_stream_info(*ctx, NULL);
+	return ret;
+#else
+	return lav_open(ctx, filename);
+#endif
+}
+
+/* Bytes read from the file so far, where the library keeps count */
+static inline int64_t
+lav_bytes_read(AVFormatContext *ctx)
+{
+#if LIBAVFORMAT_VERSION_MAJOR >= 55
+	return ctx->pb ? ctx->pb->bytes_read : 0;
+#else
+	return 0;
+#endif
+}
+
 static inline void
 lav_close(AVFormatContext *ctx)
 {
@@ -222,3 +304,29 @@ lav_is_thumbnail_stream(AVStream *s, uint8_t **data, int *size)
 #endif
 	return 0;
 }
+
+/* Whether probing found the codec parameters of the first video and
+ * audio streams, which is what the DLNA profile is chosen from */
+static inline int
+lav_streams_complete(AVFormatContext *ctx)
+{
+	AVStream *s, *audio = NULL, *video = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ctx->nb_streams; i++)
+	{
+		s = ctx->streams[i];
+		if (lav_codec_type(s) == AVMEDIA_TYPE_AUDIO && !audio)
+			audio = s;
+		else if (lav_codec_type(s) == AVMEDIA_TYPE_VIDEO && !video &&
+		         !lav_is_thumbnail_stream(s, NULL, NULL))
+			video = s;
+	}
+	if (!video || lav_codec_id(video) == AV_CODEC_ID_NONE ||
+	    !lav_width(video) || !lav_height(video))
+		return 0;
+	if (audio && (lav_codec_id(audio) == AV_CODEC_ID_NONE ||
+	    !lav_sample_rate(audio) || !lav_channels(audio)))
+		return 0;
+	return 1;
+}
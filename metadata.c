@@ -40,6 +40,7 @@
 #include "tivo_utils.h"
 #include "metadata.h"
 #include "albumart.h"
+#include "dict.h"
 #include "utils.h"
 #include "sql.h"
 #include "log.h"
@@ -259,16 +260,38 @@ free_metadata(metadata_t *m, uint32_t flags)
 		free(m->resolution);
 }
 
+/* Make 'm' own all of its strings, so it can outlive the tags they came from */
+static void
+own_metadata(metadata_t *m, uint32_t *flags)
+{
+#define OWN(field, flag) \
+	if( m->field && !(*flags & flag) ) { m->field = strdup(m->field); *flags |= flag; }
+	OWN(title, FLAG_TITLE);
+	OWN(artist, FLAG_ARTIST);
+	OWN(album, FLAG_ALBUM);
+	OWN(genre, FLAG_GENRE);
+	OWN(creator, FLAG_CREATOR);
+	OWN(date, FLAG_DATE);
+	OWN(comment, FLAG_COMMENT);
+	OWN(dlna_pn, FLAG_DLNA_PN);
+	OWN(mime, FLAG_MIME);
+	OWN(duration, FLAG_DURATION);
+	OWN(resolution, FLAG_RESOLUTION);
+#undef OWN
+}
+
 int64_t
 GetFolderMetadata(const char *name, const char *path, const char *artist, const char *genre, int64_t album_art)
 {
 	int ret;
 
-	ret = sql_exec(db, "INSERT into DETAILS"
-	                   " (TITLE, PATH, CREATOR, ARTIST, GENRE, ALBUM_ART) "
+	ret = sql_exec(db, "INSERT into DETAILS_DATA"
+	                   " (TITLE, PATH, CREATOR_ID, ARTIST_ID, GENRE_ID, ALBUM_ART) "
 	                   "VALUES"
-	                   " ('%q', %Q, %Q, %Q, %Q, %lld);",
-	                   name, path, artist, artist, genre, album_art);
+	                   " ('%q', %Q, %lld, %lld, %lld, %lld);",
+	                   name, path, (long long)dict_intern(DICT_CREATOR, artist),
+	                   (long long)dict_intern(DICT_ARTIST, artist),
+	                   (long long)dict_intern(DICT_GENRE, genre), (long long)album_art);
 	if( ret != SQLITE_OK )
 		ret = 0;
 	else
@@ -277,23 +300,21 @@ GetFolderMetadata(const char *name, const char *path, const char *artist, const
 	return ret;
 }
 
-int64_t
-GetAudioMetadata(const char *path, char *name)
+int
+ParseAudioMetadata(const char *path, char *name, media_details_t *d)
 {
 	char type[4];
-	static char lang[6] = { '\0' };
+	static __thread char lang[6] = { '\0' };
 	struct stat file;
-	int64_t ret;
 	char *esc_tag;
 	int i;
-	int64_t album_art = 0;
 	struct song_metadata song;
 	metadata_t m;
 	uint32_t free_flags = FLAG_MIME|FLAG_DURATION|FLAG_DLNA_PN|FLAG_DATE;
 	memset(&m, '\0', sizeof(metadata_t));
 
 	if ( stat(path, &file) != 0 )
-		return 0;
+		return -1;
 	strip_ext(name);
 
 	if( ends_with(path, ".mp3") )
@@ -340,7 +361,7 @@ GetAudioMetadata(const char *path, char *name)
 	else
 	{
 		DPRINTF(E_WARN, L_METADATA, "Unhandled file extension on %s\n", path);
-		return 0;
+		return -1;
 	}
 
 	if( !(*lang) )
@@ -356,7 +377,7 @@ GetAudioMetadata(const char *path, char *name)
 		DPRINTF(E_WARN, L_METADATA, "Cannot extract tags from %s!\n", path);
         	freetags(&song);
 		free_metadata(&m, free_flags);
-		return 0;
+		return -1;
 	}
 
 	if( song.dlna_pn )
@@ -452,33 +473,37 @@ GetAudioMetadata(const char *path, char *name)
 		}
 	}
 
-	album_art = find_album_art(path, song.image, song.image_size);
-
-	ret = sql_exec(db, "INSERT into DETAILS"
-	                   " (PATH, SIZE, TIMESTAMP, DURATION, CHANNELS, BITRATE, SAMPLERATE, DATE,"
-	                   "  TITLE, CREATOR, ARTIST, ALBUM, GENRE, COMMENT, DISC, TRACK, DLNA_PN, MIME, ALBUM_ART) "
-	                   "VALUES"
-	                   " (%Q, %lld, %lld, '%s', %d, %d, %d, %Q, %Q, %Q, %Q, %Q, %Q, %Q, %d, %d, %Q, '%s', %lld);",
-	                   path, (long long)file.st_size, (long long)file.st_mtime, m.duration, song.channels, song.bitrate,
-	                   song.samplerate, m.date, m.title, m.creator, m.artist, m.album, m.genre, m.comment, song.disc,
-	                   song.track, m.dlna_pn, song.mime?song.mime:m.mime, album_art);
-	if( ret != SQLITE_OK )
-	{
-		DPRINTF(E_ERROR, L_METADATA, "Error inserting details for '%s'!\n", path);
-		ret = 0;
-	}
-	else
+	if( song.mime )
 	{
-		ret = sqlite3_last_insert_rowid(db);
+		free(m.mime);
+		m.mime = strdup(song.mime);
 	}
+	m.channels = song.channels;
+	m.bitrate = song.bitrate;
+	m.frequency = song.samplerate;
+	m.disc = song.disc;
+	m.track = song.track;
+
+	memset(d, '\0', sizeof(*d));
+	d->type = TYPE_AUDIO;
+	d->path = path;
+	d->name = name;
+	d->size = file.st_size;
+	d->mtime = file.st_mtime;
+	d->album_art = find_album_art_file(path, song.image, song.image_size);
+	/* Most of the strings still point into the tags */
+	own_metadata(&m, &free_flags);
+	d->m = m;
+	d->free_flags = free_flags;
+	d->seek = song.seek_index;
+	memset(&song.seek_index, '\0', sizeof(song.seek_index));
         freetags(&song);
-	free_metadata(&m, free_flags);
 
-	return ret;
+	return 0;
 }
 
 /* For libjpeg error handling */
-jmp_buf setjmp_buffer;
+static __thread jmp_buf setjmp_buffer;
 static void
 libjpeg_error_handler(j_common_ptr cinfo)
 {
@@ -487,38 +512,40 @@ libjpeg_error_handler(j_common_ptr cinfo)
 	return;
 }
 
-int64_t
-GetImageMetadata(const char *path, char *name)
+int
+ParseImageMetadata(const char *path, char *name, media_details_t *d)
 {
 	ExifData *ed;
 	ExifEntry *e = NULL;
-	ExifLoader *l;
+	struct jpeg_header hdr, th;
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 	FILE *infile;
-	int width=0, height=0, thumb=0;
+	int width=0, height=0, thumb=0, thumb_size=0;
+	off_t thumb_offset = 0;
+	void *thumb_data;
 	char make[32], model[64] = {'\0'};
 	char b[1024];
 	struct stat file;
-	int64_t ret;
-	image_s *imsrc;
 	metadata_t m;
 	uint32_t free_flags = 0xFFFFFFFF;
 	memset(&m, '\0', sizeof(metadata_t));
 
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, "Parsing %s...\n", path);
 	if ( stat(path, &file) != 0 )
-		return 0;
+		return -1;
 	strip_ext(name);
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * size: %jd\n", file.st_size);
 
 	/* MIME hard-coded to JPEG for now, until we add PNG support */
 	m.mime = strdup("image/jpeg");
 
-	l = exif_loader_new();
-	exif_loader_write_file(l, path);
-	ed = exif_loader_get_data(l);
-	exif_loader_unref(l);
+	/* EXIF, XMP and the frame size all live in the leading segments,
+	 * so read those once instead of opening the file for each of them */
+	image_read_jpeg_header(path, &hdr);
+	if( !hdr.exif_len )
+		goto no_exifdata;
+	ed = exif_data_new_from_data(hdr.exif, hdr.exif_len);
 	if( !ed )
 		goto no_exifdata;
 
@@ -539,7 +566,7 @@ GetImageMetadata(const char *path, char *name)
 	}
 	else {
 		/* One last effort to get the date from XMP */
-		image_get_jpeg_date_xmp(path, &m.date);
+		image_get_xmp_date(hdr.xmp, hdr.xmp_len, &m.date);
 	}
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * date: %s\n", m.date);
 
@@ -580,16 +607,20 @@ GetImageMetadata(const char *path, char *name)
 
 	if( ed->size )
 	{
+		/* libexif only hands out a copy of the thumbnail; find where it
+		 * is in the file so it can be sent from there */
+		thumb_data = memmem(hdr.exif, hdr.exif_len, ed->data, ed->size);
+		if( thumb_data )
+		{
+			thumb_offset = (const uint8_t *)thumb_data - hdr.buf;
+			thumb_size = ed->size;
+		}
 		/* We might need to verify that the thumbnail is 160x160 or smaller */
 		if( ed->size > 12000 )
 		{
-			imsrc = image_new_from_jpeg(NULL, 0, ed->data, ed->size, 1, ROTATE_NONE);
-			if( imsrc )
-			{
- 				if( (imsrc->width <= 160) && (imsrc->height <= 160) )
-					thumb = 1;
-				image_free(imsrc);
-			}
+			if( image_parse_jpeg_header(ed->data, ed->size, &th) == 0 &&
+			    th.width && (th.width <= 160) && (th.height <= 160) )
+				thumb = 1;
 		}
 		else
 			thumb = 1;
@@ -599,8 +630,11 @@ GetImageMetadata(const char *path, char *name)
 	exif_data_unref(ed);
 
 no_exifdata:
+	width = hdr.width;
+	height = hdr.height;
+	image_free_jpeg_header(&hdr);
 	/* If SOF parsing fails, then fall through to reading the JPEG data with libjpeg to get the resolution */
-	if( image_get_jpeg_resolution(path, &width, &height) != 0 || !width || !height )
+	if( !width || !height )
 	{
 		infile = fopen(path, "r");
 		if( infile )
@@ -625,7 +659,7 @@ no_exifdata:
 	if( !width || !height )
 	{
 		free_metadata(&m, free_flags);
-		return 0;
+		return -1;
 	}
 	if( width <= 640 && height <= 480 )
 		m.dlna_pn = strdup("JPEG_SM");
@@ -635,39 +669,98 @@ no_exifdata:
 		m.dlna_pn = strdup("JPEG_LRG");
 	xasprintf(&m.resolution, "%dx%d", width, height);
 
-	ret = sql_exec(db, "INSERT into DETAILS"
-	                   " (PATH, TITLE, SIZE, TIMESTAMP, DATE, RESOLUTION,"
-	                    " ROTATION, THUMBNAIL, CREATOR, DLNA_PN, MIME) "
-	                   "VALUES"
-	                   " (%Q, '%q', %lld, %lld, %Q, %Q, %u, %d, %Q, %Q, %Q);",
-	                   path, name, (long long)file.st_size, (long long)file.st_mtime, m.date,
-	                   m.resolution, m.rotation, thumb, m.creator, m.dlna_pn, m.mime);
-	if( ret != SQLITE_OK )
+	memset(d, '\0', sizeof(*d));
+	d->type = TYPE_IMAGES;
+	d->path = path;
+	d->name = name;
+	d->size = file.st_size;
+	d->mtime = file.st_mtime;
+	d->thumb = thumb;
+	d->thumb_offset = thumb_offset;
+	d->thumb_size = thumb_size;
+	d->m = m;
+	d->free_flags = free_flags;
+
+	return 0;
+}
+
+struct video_probe_stats video_probe_stats;
+
+/* How much of a video libavformat may read, and decode, to find its
+ * streams.  The library defaults of 5MB and 5s make it read far more
+ * than these containers need for their headers; a file that comes out
+ * incomplete is opened once more with the defaults. */
+static const struct {
+	const char *ext;
+	int64_t probesize;		/* bytes */
+	int64_t analyzeduration;	/* microseconds */
+} video_probe_profiles[] = {
+	{ ".mp4",  256*1024, 500000 },
+	{ ".m4v",  256*1024, 500000 },
+	{ ".mov",  256*1024, 500000 },
+	{ ".3gp",  256*1024, 500000 },
+	{ ".mkv",  512*1024, 1000000 },
+	{ ".webm", 512*1024, 1000000 },
+	{ ".avi",  512*1024, 1000000 },
+	{ ".divx", 512*1024, 1000000 },
+	{ ".xvid", 512*1024, 1000000 },
+	{ ".asf",  256*1024, 1000000 },
+	{ ".wmv",  256*1024, 1000000 },
+	{ ".flv",  256*1024, 1000000 },
+	{ ".mpg",  1024*1024, 1500000 },
+	{ ".mpeg", 1024*1024, 1500000 },
+	{ ".vob",  1024*1024, 1500000 },
+	{ ".ts",   2048*1024, 2000000 },
+	{ ".m2ts", 2048*1024, 2000000 },
+	{ ".mts",  2048*1024, 2000000 },
+	{ ".m2t",  2048*1024, 2000000 },
+	{ ".tp",   2048*1024, 2000000 },
+	{ ".trp",  2048*1024, 2000000 },
+	{ NULL, 0, 0 }
+};
+
+static int
+open_video(AVFormatContext **ctx, const char *path)
+{
+	int i, ret;
+
+	for( i = 0; video_probe_profiles[i].ext; i++ )
 	{
-		DPRINTF(E_ERROR, L_METADATA, "Error inserting details for '%s'!\n", path);
-		ret = 0;
+		if( ends_with(path, video_probe_profiles[i].ext) )
+			break;
 	}
-	else
+	ret = lav_open_bounded(ctx, path, video_probe_profiles[i].probesize,
+	                       video_probe_profiles[i].analyzeduration);
+	if( ret == 0 && video_probe_profiles[i].ext && !lav_streams_complete(*ctx) )
 	{
-		ret = sqlite3_last_insert_rowid(db);
+		DPRINTF(E_DEBUG, L_METADATA, "Probing %s again without limits\n", path);
+		__sync_fetch_and_add(&video_probe_stats.bytes, lav_bytes_read(*ctx));
+		__sync_fetch_and_add(&video_probe_stats.retries, 1);
+		lav_close(*ctx);
+		*ctx = NULL;
+		ret = lav_open(ctx, path);
+	}
+	if( ret == 0 )
+	{
+		DPRINTF(E_DEBUG, L_METADATA, "Probing %s read %lld bytes\n", path, (long long)lav_bytes_read(*ctx));
+		__sync_fetch_and_add(&video_probe_stats.bytes, lav_bytes_read(*ctx));
+		__sync_fetch_and_add(&video_probe_stats.files, 1);
 	}
-	free_metadata(&m, free_flags);
 
 	return ret;
 }
 
-int64_t
-GetVideoMetadata(const char *path, char *name)
+int
+ParseVideoMetadata(const char *path, char *name, media_details_t *d)
 {
 	struct stat file;
 	int ret, i;
-	struct tm *modtime;
+	struct tm modtime;
 	AVFormatContext *ctx = NULL;
 	AVStream *astream = NULL, *vstream = NULL;
 	int audio_stream = -1, video_stream = -1;
 	enum audio_profiles audio_profile = PROFILE_AUDIO_UNKNOWN;
 	char fourcc[4];
-	int64_t album_art = 0;
 	char nfo[MAXPATHLEN], *ext;
 	struct song_metadata video;
 	metadata_t m;
@@ -679,17 +772,17 @@ GetVideoMetadata(const char *path, char *name)
 
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, "Parsing video %s...\n", name);
 	if ( stat(path, &file) != 0 )
-		return 0;
+		return -1;
 	strip_ext(name);
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * size: %jd\n", file.st_size);
 
-	ret = lav_open(&ctx, path);
+	ret = open_video(&ctx, path);
 	if( ret != 0 )
 	{
 		char err[128];
 		av_strerror(ret, err, sizeof(err));
 		DPRINTF(E_WARN, L_METADATA, "Opening %s failed! [%s]\n", path, err);
-		return 0;
+		return -1;
 	}
 	//dump_format(ctx, 0, NULL, 0);
 	for( i=0; i < ctx->nb_streams; i++)
@@ -719,7 +812,7 @@ GetVideoMetadata(const char *path, char *name)
 		if( !is_audio(path) )
 			DPRINTF(E_WARN, L_METADATA, "File %s does not contain a video stream.\n", basepath);
 		free(path_cpy);
-		return 0;
+		return -1;
 	}
 
 	if( astream )
@@ -1530,38 +1623,251 @@ video_no_dlna:
 	if( !m.date )
 	{
 		m.date = malloc(20);
-		modtime = localtime(&file.st_mtime);
-		strftime(m.date, 20, "%FT%T", modtime);
+		localtime_r(&file.st_mtime, &modtime);
+		strftime(m.date, 20, "%FT%T", &modtime);
 	}
 
 	if( !m.title )
 		m.title = strdup(name);
 
-	album_art = find_album_art(path, m.thumb_data, m.thumb_size);
+	memset(d, '\0', sizeof(*d));
+	d->type = TYPE_VIDEO;
+	d->path = path;
+	d->name = name;
+	d->size = file.st_size;
+	d->mtime = file.st_mtime;
+	d->album_art = find_album_art_file(path, m.thumb_data, m.thumb_size);
+	/* program and transport streams, which renderers like to seek by time */
+	if( strncmp(ctx->iformat->name, "mpeg", 4) == 0 )
+		seek_index_mpeg(path, &d->seek);
 	freetags(&video);
 	lav_close(ctx);
+	free(path_cpy);
+	m.thumb_data = NULL;
+	m.thumb_size = 0;
+	d->m = m;
+	d->free_flags = free_flags;
 
-	ret = sql_exec(db, "INSERT into DETAILS"
-	                   " (PATH, SIZE, TIMESTAMP, DURATION, DATE, CHANNELS, BITRATE, SAMPLERATE, RESOLUTION,"
-	                   "  TITLE, CREATOR, ARTIST, GENRE, COMMENT, DLNA_PN, MIME, ALBUM_ART) "
-	                   "VALUES"
-	                   " (%Q, %lld, %lld, %Q, %Q, %u, %u, %u, %Q, '%q', %Q, %Q, %Q, %Q, %Q, '%q', %lld);",
-	                   path, (long long)file.st_size, (long long)file.st_mtime, m.duration,
-	                   m.date, m.channels, m.bitrate, m.frequency, m.resolution,
-			   m.title, m.creator, m.artist, m.genre, m.comment, m.dlna_pn,
-                           m.mime, album_art);
+	return 0;
+}
+
+/* MIME types ParseVideoMetadata() would end up with for the usual
+ * containers, guessed from the file extension instead */
+static const struct {
+	const char *ext;
+	const char *mime;
+} video_mime_types[] = {
+	{ ".avi", "video/x-msvideo" },
+	{ ".divx", "video/x-msvideo" },
+	{ ".xvid", "video/x-msvideo" },
+	{ ".asf", "video/x-ms-wmv" },
+	{ ".wmv", "video/x-ms-wmv" },
+	{ ".mov", "video/quicktime" },
+	{ ".mp4", "video/mp4" },
+	{ ".m4v", "video/mp4" },
+	{ ".3gp", "video/mp4" },
+	{ ".mkv", "video/x-matroska" },
+	{ ".flv", "video/x-flv" },
+#ifdef TIVO_SUPPORT
+	{ ".TiVo", "video/x-tivo-mpeg" },
+#endif
+	{ NULL, "video/mpeg" }
+};
+
+/* Just enough to list a video without opening it: its name, size and
+ * date, and a MIME type going by the extension.  The fast scan adds
+ * videos this way and runs ParseVideoMetadata() on them later. */
+int
+ParseVideoQuick(const char *path, char *name, media_details_t *d)
+{
+	struct stat file;
+	struct tm modtime;
+	metadata_t m;
+	int i;
+
+	memset(&m, '\0', sizeof(m));
+	if( stat(path, &file) != 0 )
+		return -1;
+	strip_ext(name);
+
+	for( i = 0; video_mime_types[i].ext; i++ )
+	{
+		if( ends_with(path, video_mime_types[i].ext) )
+			break;
+	}
+	m.mime = strdup(video_mime_types[i].mime);
+	m.title = strdup(name);
+	m.date = malloc(20);
+	if( m.date )
+	{
+		localtime_r(&file.st_mtime, &modtime);
+		strftime(m.date, 20, "%FT%T", &modtime);
+	}
+
+	memset(d, '\0', sizeof(*d));
+	d->type = TYPE_VIDEO;
+	d->path = path;
+	d->name = name;
+	d->size = file.st_size;
+	d->mtime = file.st_mtime;
+	d->m = m;
+	d->free_flags = 0xFFFFFFFF;
+
+	return 0;
+}
+
+void
+FreeMetadataDetails(media_details_t *d)
+{
+	free_metadata(&d->m, d->free_flags);
+	free(d->album_art);
+	d->album_art = NULL;
+	seek_index_free(&d->seek);
+}
+
+/* Write out what Parse*Metadata() found, and return the new DETAILS ID.
+ * Videos may instead update the row given in d->id, which keeps its ID.
+ * 'd' stays valid until FreeMetadataDetails(). */
+int64_t
+CommitMetadata(media_details_t *d)
+{
+	metadata_t *m = &d->m;
+	int64_t album_art;
+	int64_t ret;
+
+	album_art = get_album_art_id(d->album_art);
+	d->album_art_id = album_art;
+	switch( d->type )
+	{
+	case TYPE_AUDIO:
+		ret = sql_exec(db, "INSERT into DETAILS_DATA"
+		                   " (PATH, SIZE, TIMESTAMP, DURATION, CHANNELS, BITRATE, SAMPLERATE, DATE,"
+		                   "  TITLE, CREATOR_ID, ARTIST_ID, ALBUM_ID, GENRE_ID, COMMENT, DISC, TRACK,"
+		                   "  DLNA_PN_ID, MIME_ID, ALBUM_ART, SEEKABLE) "
+		                   "VALUES"
+		                   " (%Q, %lld, %lld, '%s', %d, %d, %d, %Q, %Q, %lld, %lld, %lld, %lld, %Q, %d, %d, %lld, %lld, %lld, %d);",
+		                   d->path, (long long)d->size, (long long)d->mtime, m->duration, m->channels, m->bitrate,
+		                   m->frequency, m->date, m->title,
+		                   (long long)dict_intern(DICT_CREATOR, m->creator),
+		                   (long long)dict_intern(DICT_ARTIST, m->artist),
+		                   (long long)dict_intern(DICT_ALBUM, m->album),
+		                   (long long)dict_intern(DICT_GENRE, m->genre), m->comment, m->disc, m->track,
+		                   (long long)dict_intern(DICT_DLNA_PN, m->dlna_pn),
+		                   (long long)dict_intern(DICT_MIME, m->mime), (long long)album_art,
+		                   d->seek.len > 0);
+		break;
+	case TYPE_IMAGES:
+		ret = sql_exec(db, "INSERT into DETAILS_DATA"
+		                   " (PATH, TITLE, SIZE, TIMESTAMP, DATE, RESOLUTION,"
+		                    " ROTATION, THUMBNAIL, THUMB_OFFSET, THUMB_SIZE, CREATOR_ID, DLNA_PN_ID, MIME_ID) "
+		                   "VALUES"
+		                   " (%Q, '%q', %lld, %lld, %Q, %Q, %u, %d, %lld, %d, %lld, %lld, %lld);",
+		                   d->path, d->name, (long long)d->size, (long long)d->mtime, m->date,
+		                   m->resolution, m->rotation, d->thumb,
+		                   (long long)d->thumb_offset, d->thumb_size,
+		                   (long long)dict_intern(DICT_CREATOR, m->creator),
+		                   (long long)dict_intern(DICT_DLNA_PN, m->dlna_pn),
+		                   (long long)dict_intern(DICT_MIME, m->mime));
+		break;
+	case TYPE_VIDEO:
+		/* Update in place: a REPLACE would reset the columns not listed
+		 * here and skip the delete triggers, leaking ALBUM_ART references */
+		if( d->id )
+		{
+			ret = sql_exec(db, "UPDATE DETAILS_DATA set"
+			                   " PATH = %Q, SIZE = %lld, TIMESTAMP = %lld, DURATION = %Q, DATE = %Q,"
+			                   " CHANNELS = %u, BITRATE = %u, SAMPLERATE = %u, RESOLUTION = %Q, TITLE = '%q',"
+			                   " CREATOR_ID = %lld, ARTIST_ID = %lld, GENRE_ID = %lld, COMMENT = %Q,"
+			                   " DLNA_PN_ID = %lld, MIME_ID = %lld, ALBUM_ART = %lld, SEEKABLE = %d "
+			                   "where ID = %lld",
+			                   d->path, (long long)d->size, (long long)d->mtime, m->duration,
+			                   m->date, m->channels, m->bitrate, m->frequency, m->resolution, m->title,
+			                   (long long)dict_intern(DICT_CREATOR, m->creator),
+			                   (long long)dict_intern(DICT_ARTIST, m->artist),
+			                   (long long)dict_intern(DICT_GENRE, m->genre), m->comment,
+			                   (long long)dict_intern(DICT_DLNA_PN, m->dlna_pn),
+			                   (long long)dict_intern(DICT_MIME, m->mime), (long long)album_art,
+			                   d->seek.len > 0, (long long)d->id);
+			/* The row may have been removed while the video was read */
+			if( ret == SQLITE_OK && sqlite3_changes(db) == 0 )
+				ret = SQLITE_NOTFOUND;
+		}
+		else
+			ret = sql_exec(db, "INSERT into DETAILS_DATA"
+			                   " (PATH, SIZE, TIMESTAMP, DURATION, DATE, CHANNELS, BITRATE, SAMPLERATE, RESOLUTION,"
+			                   "  TITLE, CREATOR_ID, ARTIST_ID, GENRE_ID, COMMENT, DLNA_PN_ID, MIME_ID, ALBUM_ART, SEEKABLE) "
+			                   "VALUES"
+			                   " (%Q, %lld, %lld, %Q, %Q, %u, %u, %u, %Q, '%q', %lld, %lld, %lld, %Q, %lld, %lld, %lld, %d);",
+			                   d->path, (long long)d->size, (long long)d->mtime, m->duration,
+			                   m->date, m->channels, m->bitrate, m->frequency, m->resolution, m->title,
+			                   (long long)dict_intern(DICT_CREATOR, m->creator),
+			                   (long long)dict_intern(DICT_ARTIST, m->artist),
+			                   (long long)dict_intern(DICT_GENRE, m->genre), m->comment,
+			                   (long long)dict_intern(DICT_DLNA_PN, m->dlna_pn),
+			                   (long long)dict_intern(DICT_MIME, m->mime), (long long)album_art,
+			                   d->seek.len > 0);
+		break;
+	default:
+		ret = SQLITE_ERROR;
+		break;
+	}
 	if( ret != SQLITE_OK )
 	{
-		DPRINTF(E_ERROR, L_METADATA, "Error inserting details for '%s'!\n", path);
+		DPRINTF(E_ERROR, L_METADATA, "Error inserting details for '%s'!\n", d->path);
 		ret = 0;
 	}
 	else
 	{
-		ret = sqlite3_last_insert_rowid(db);
-		check_for_captions(path, ret);
+		ret = d->id ? d->id : sqlite3_last_insert_rowid(db);
+		/* Captions were looked for when the row was first added */
+		if( d->type == TYPE_VIDEO && !d->id )
+			check_for_captions(d->path, ret);
+		if( d->seek.len )
+			sql_exec_bind(db, "INSERT or REPLACE into SEEK_INDEX (ID, DATA) VALUES (?, ?)",
+			              "ib", (int64_t)ret, d->seek.data, d->seek.len);
 	}
-	free_metadata(&m, free_flags);
-	free(path_cpy);
+
+	return ret;
+}
+
+int64_t
+GetAudioMetadata(const char *path, char *name)
+{
+	media_details_t d;
+	int64_t ret;
+
+	if( ParseAudioMetadata(path, name, &d) != 0 )
+		return 0;
+	ret = CommitMetadata(&d);
+	FreeMetadataDetails(&d);
+
+	return ret;
+}
+
+int64_t
+GetImageMetadata(const char *path, char *name)
+{
+	media_details_t d;
+	int64_t ret;
+
+	if( ParseImageMetadata(path, name, &d) != 0 )
+		return 0;
+	ret = CommitMetadata(&d);
+	FreeMetadataDetails(&d);
+
+	return ret;
+}
+
+int64_t
+GetVideoMetadata(const char *path, char *name)
+{
+	media_details_t d;
+	int64_t ret;
+
+	if( ParseVideoMetadata(path, name, &d) != 0 )
+		return 0;
+	ret = CommitMetadata(&d);
+	FreeMetadataDetails(&d);
 
 	return ret;
 }
@@ -24,6 +24,8 @@
 #ifndef __METADATA_H__
 #define __METADATA_H__
 
+#include "seekindex.h"
+
 typedef struct metadata_s {
 	char *       title;
 	char *       artist;
@@ -91,6 +93,53 @@ check_for_captions(const char *path, int64_t detailID);
 int64_t
 GetFolderMetadata(const char *name, const char *path, const char *artist, const char *genre, int64_t album_art);
 
+/* A parsed media file, kept apart from its database insert so that the
+ * parsing can run on a scanner worker thread while a single thread owns
+ * the database.  Filled by Parse*Metadata(), consumed by CommitMetadata(). */
+typedef struct media_details_s {
+	int          type;		/* TYPE_AUDIO, TYPE_VIDEO or TYPE_IMAGES */
+	const char * path;
+	const char * name;
+	off_t        size;
+	time_t       mtime;
+	int          thumb;
+	off_t        thumb_offset;	/* where the EXIF thumbnail is in the file */
+	int          thumb_size;
+	char *       album_art;	/* cover art file, resolved but not yet in ALBUM_ART */
+	int64_t      album_art_id;	/* set by CommitMetadata() */
+	int64_t      id;		/* DETAILS row to replace, or 0 to add one */
+	int          cached;		/* filled from the probe cache */
+	struct seek_index seek;		/* for time seeking, if the format allows */
+	metadata_t   m;
+	uint32_t     free_flags;
+} media_details_t;
+
+/* What opening videos with libavformat cost, for the scanner statistics */
+struct video_probe_stats {
+	unsigned long files;
+	unsigned long retries;	/* probed again without limits */
+	uint64_t bytes;
+};
+extern struct video_probe_stats video_probe_stats;
+
+int
+ParseAudioMetadata(const char *path, char *name, media_details_t *d);
+
+int
+ParseImageMetadata(const char *path, char *name, media_details_t *d);
+
+int
+ParseVideoMetadata(const char *path, char *name, media_details_t *d);
+
+int
+ParseVideoQuick(const char *path, char *name, media_details_t *d);
+
+int64_t
+CommitMetadata(media_details_t *d);
+
+void
+FreeMetadataDetails(media_details_t *d);
+
 int64_t
 GetAudioMetadata(const char *path, char *name);
 
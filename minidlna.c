@@ -90,8 +90,11 @@
 #include "process.h"
 #include "upnpevents.h"
 #include "scanner.h"
+#include "dict.h"
 #include "inotify.h"
 #include "log.h"
+#include "snapshot.h"
+#include "thumbgen.h"
 #include "tivo_beacon.h"
 #include "tivo_utils.h"
 
@@ -255,12 +258,12 @@ getfriendlyname(char *buf, int len)
 }
 
 static int
-open_db(sqlite3 **sq3)
+open_db_file(const char *name, sqlite3 **sq3)
 {
 	char path[PATH_MAX];
 	int new_db = 0;
 
-	snprintf(path, sizeof(path), "%s/files.db", db_path);
+	snprintf(path, sizeof(path), "%s/%s", db_path, name);
 	if (access(path, F_OK) != 0)
 	{
 		new_db = 1;
@@ -279,6 +282,12 @@ open_db(sqlite3 **sq3)
 	return new_db;
 }
 
+static int
+open_db(sqlite3 **sq3)
+{
+	return open_db_file("files.db", sq3);
+}
+
 static struct media_dir_s*
 ParseUPNPMediaDir(const char *media_option) {
   media_types type = ALL_MEDIA;
@@ -368,94 +377,221 @@ ParseUPNPMediaDir(const char *media_option) {
   return this_dir;
 }
 
+/* The media_dirs still to be scanned into a database whose build was
+ * interrupted, as a NULL-terminated array.  Returns NULL if it was built
+ * with other media_dirs and has to be started over. */
+static struct media_dir_s **
+pending_media_dirs(void)
+{
+	struct media_dir_s *media_path, **pending;
+	int n = 0, done = 0;
+
+	if (sql_get_int_field(db, "PRAGMA user_version") != DB_VERSION)
+		return NULL;
+	for (media_path = media_dirs; media_path; media_path = media_path->next)
+		n++;
+	pending = calloc(n + 1, sizeof(*pending));
+	if (!pending)
+		return NULL;
+	n = 0;
+	for (media_path = media_dirs; media_path; media_path = media_path->next)
+	{
+		if (sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'media_dir' and VALUE = %Q",
+		                      media_path->path) <= 0)
+			pending[n++] = media_path;
+		else if (media_dir_matches(media_path))
+			done++;
+		else
+			break;
+	}
+	if (media_path ||
+	    sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'media_dir'") != done)
+	{
+		free(pending);
+		return NULL;
+	}
+
+	return pending;
+}
+
+/* Scan into the global db.  With 'dirs' set, only those media_dirs are
+ * added to the current database (after an incremental rescan of the
+ * others if enabled), and a brand new database is filled in place.
+ * Otherwise a complete database is built next to the one being served
+ * and renamed over it when done. */
 static void
-check_db(sqlite3 *db, int new_db, pid_t *scanner_pid)
+run_scanner(struct media_dir_s **dirs, int new_db)
 {
-	struct media_dir_s *media_path = NULL;
-	char cmd[PATH_MAX*2];
-	char **result;
-	int i, rows = 0;
-	int ret;
+	char path[PATH_MAX], new_path[PATH_MAX];
 
-	if (!new_db)
+	if (dirs || new_db)
 	{
-		/* Check if any new media dirs appeared */
-		media_path = media_dirs;
-		while (media_path)
-		{
-			ret = sql_get_int_field(db, "SELECT TIMESTAMP from DETAILS where PATH = %Q AND TIMESTAMP != '' ", media_path->path);
-			if (ret != media_path->types)
-			{
-				ret = 1;
-				goto rescan;
-			}
-			media_path = media_path->next;
-		}
-		/* Check if any media dirs disappeared */
-		sql_get_table(db, "SELECT VALUE from SETTINGS where KEY = 'media_dir'", &result, &rows, NULL);
-		for (i=1; i <= rows; i++)
+		open_db(&db);
+		if (dirs)
+			start_partial_scanner(dirs, GETFLAG(RESCAN_MASK));
+		else
+			start_scanner();
+		sql_close(db);
+		return;
+	}
+
+	/* Nothing is served from a replacement database before it is complete */
+	CLEARFLAG(FAST_SCAN_MASK);
+	snprintf(path, sizeof(path), "%s/files.db", db_path);
+	snprintf(new_path, sizeof(new_path), "%s/files.db.new", db_path);
+	/* Finish a replacement database an earlier scanner left behind */
+	if (access(new_path, F_OK) == 0)
+	{
+		open_db_file("files.db.new", &db);
+		dirs = pending_media_dirs();
+		if (dirs)
 		{
-			media_path = media_dirs;
-			while (media_path)
-			{
-				if (strcmp(result[i], media_path->path) == 0)
-					break;
-				media_path = media_path->next;
-			}
-			if (!media_path)
-			{
-				ret = 2;
-				sqlite3_free_table(result);
-				goto rescan;
-			}
+			DPRINTF(E_WARN, L_GENERAL, "Resuming the interrupted rebuild of %s\n", path);
+			start_partial_scanner(dirs, 0);
+			free(dirs);
+			sql_close(db);
+			if (rename(new_path, path) != 0)
+				DPRINTF(E_ERROR, L_GENERAL, "Unable to replace %s: %s\n", path, strerror(errno));
+			return;
 		}
-		sqlite3_free_table(result);
+		sql_close(db);
 	}
+	unlink(new_path);
+	open_db_file("files.db.new", &db);
+	if (CreateDatabase() != 0)
+	{
+		DPRINTF(E_ERROR, L_GENERAL, "ERROR: Failed to create sqlite database!\n");
+		sql_close(db);
+		unlink(new_path);
+		return;
+	}
+	start_scanner();
+	sql_close(db);
+	if (rename(new_path, path) != 0)
+		DPRINTF(E_ERROR, L_GENERAL, "Unable to replace %s: %s\n", path, strerror(errno));
+}
+
+/* Returns 1 if a replacement database is being built by the scanner, in
+ * which case the caller has to reopen files.db once scanning is done. */
+static int
+check_db(int new_db, pid_t *scanner_pid)
+{
+	struct media_dir_s *media_path = NULL;
+	struct media_dir_s **added = NULL;
+	char **result;
+	char cmd[PATH_MAX*2];
+	int i, rows = 0, dirs = 0, n_added = 0;
+	int ret, swap;
 
-	ret = db_upgrade(db);
+	ret = new_db ? 0 : db_upgrade(db);
 	if (ret != 0)
 	{
-rescan:
 		if (ret < 0)
 			DPRINTF(E_WARN, L_GENERAL, "Creating new database at %s/files.db\n", db_path);
-		else if (ret == 1)
-			DPRINTF(E_WARN, L_GENERAL, "New media_dir '%s' detected; rescanning...\n", media_path->path);
-		else if (ret == 2)
-			DPRINTF(E_WARN, L_GENERAL, "Removed media_dir detected; rescanning...\n");
 		else
 			DPRINTF(E_WARN, L_GENERAL, "Database version mismatch (%d=>%d); need to recreate...\n",
 				ret, DB_VERSION);
-		sqlite3_close(db);
-
+		/* Its schema does not match this code, so it cannot be served
+		 * while the scanner works; start over with an empty one */
+		sql_close(db);
 		snprintf(cmd, sizeof(cmd), "rm -rf %s/files.db %s/art_cache", db_path, db_path);
 		if (system(cmd) != 0)
 			DPRINTF(E_FATAL, L_GENERAL, "Failed to clean old file cache!  Exiting...\n");
-
 		open_db(&db);
+		new_db = 1;
+	}
+	if (new_db)
+	{
 		if (CreateDatabase() != 0)
 			DPRINTF(E_FATAL, L_GENERAL, "ERROR: Failed to create sqlite database!  Exiting...\n");
-#if USE_FORK
-		scanning = 1;
-		sqlite3_close(db);
-		*scanner_pid = fork();
-		open_db(&db);
-		if (*scanner_pid == 0) /* child (scanner) process */
+		goto scan;
+	}
+	snapshot_tracking(GETFLAG(BROWSE_SNAPSHOT_MASK));
+
+	for (media_path = media_dirs; media_path; media_path = media_path->next)
+		dirs++;
+	if (sql_get_table(db, "SELECT VALUE from SETTINGS where KEY = 'media_dir'", &result, &rows, NULL) != SQLITE_OK)
+		goto scan;
+	/* Going between one and several media_dirs changes the top level of the tree */
+	if (!GETFLAG(MERGE_MEDIA_DIRS_MASK) && rows && (rows > 1) != (dirs > 1))
+	{
+		DPRINTF(E_WARN, L_GENERAL, "Media_dir layout changed; rescanning...\n");
+		sqlite3_free_table(result);
+		goto scan;
+	}
+	/* Drop media dirs that disappeared or changed their media types */
+	for (i = 1; i <= rows; i++)
+	{
+		for (media_path = media_dirs; media_path; media_path = media_path->next)
 		{
-			start_scanner();
-			sqlite3_close(db);
-			log_close();
-			freeoptions();
-			free(children);
-			exit(EXIT_SUCCESS);
+			if (strcmp(result[i], media_path->path) == 0)
+				break;
 		}
-		else if (*scanner_pid < 0)
+		if (!media_path)
+			DPRINTF(E_WARN, L_GENERAL, "Removed media_dir '%s' detected\n", result[i]);
+		else if (sql_get_int_field(db, "SELECT TIMESTAMP from DETAILS where PATH = %Q AND TIMESTAMP != '' ",
+		                           media_path->path) != media_path->types)
+			DPRINTF(E_WARN, L_GENERAL, "Media types of '%s' changed\n", result[i]);
+		else
+			continue;
+		remove_media_dir(result[i]);
+	}
+	sqlite3_free_table(result);
+
+	/* Check if any new media dirs appeared, including ones whose scan never finished */
+	added = calloc(dirs + 1, sizeof(*added));
+	if (!added)
+		return 0;
+	for (media_path = media_dirs; media_path; media_path = media_path->next)
+	{
+		if (sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'media_dir' and VALUE = %Q",
+		                      media_path->path) > 0)
+			continue;
+		if (scan_interrupted(media_path))
+			DPRINTF(E_WARN, L_GENERAL, "Scan of media_dir '%s' was interrupted; resuming...\n", media_path->path);
+		else
 		{
-			start_scanner();
+			DPRINTF(E_WARN, L_GENERAL, "New media_dir '%s' detected; scanning...\n", media_path->path);
+			if (sql_get_int_field(db, "SELECT count(*) from DETAILS_DATA where PATH = %Q", media_path->path) > 0)
+				remove_media_dir(media_path->path);
 		}
+		added[n_added++] = media_path;
+	}
+	/* A fast scan whose second pass did not finish also needs the scanner */
+	if (!n_added && !GETFLAG(RESCAN_MASK) &&
+	    sql_get_int_field(db, "SELECT count(*) from ENRICH") <= 0)
+	{
+		free(added);
+		return 0;
+	}
+
+scan:
+	/* Keep serving the current database while the scanner works */
+	swap = (!new_db && !added);
+	scanning = 1;
+	sql_close(db);
+#if USE_FORK
+	*scanner_pid = fork();
+	if (*scanner_pid == 0) /* child (scanner) process */
+	{
+		run_scanner(added, new_db);
+		log_close();
+		freeoptions();
+		free(children);
+		exit(EXIT_SUCCESS);
+	}
+	else if (*scanner_pid < 0)
+	{
+		*scanner_pid = 0;
+		run_scanner(added, new_db);
+	}
 #else
-		start_scanner();
+	run_scanner(added, new_db);
 #endif
-	}
+	open_db(&db);
+	free(added);
+
+	return swap;
 }
 
 static int
@@ -606,6 +742,10 @@ init(int argc, char **argv)
 	runtime_vars.port = 8200;
 	runtime_vars.notify_interval = 895;	/* seconds between SSDP announces */
 	runtime_vars.max_connections = 50;
+	runtime_vars.scanner_threads = 0;
+	runtime_vars.scanner_read_rate = 0;
+	runtime_vars.scanner_stream_rate = 1024;
+	runtime_vars.resized_cache_size = 256;
 	runtime_vars.root_container = NULL;
 	runtime_vars.ifaces[0] = NULL;
 
@@ -773,6 +913,15 @@ init(int argc, char **argv)
 		case MAX_CONNECTIONS:
 			runtime_vars.max_connections = atoi(ary_options[i].value);
 			break;
+		case SCANNER_THREADS:
+			runtime_vars.scanner_threads = atoi(ary_options[i].value);
+			break;
+		case SCANNER_READ_RATE:
+			runtime_vars.scanner_read_rate = atoi(ary_options[i].value);
+			break;
+		case SCANNER_STREAM_READ_RATE:
+			runtime_vars.scanner_stream_rate = atoi(ary_options[i].value);
+			break;
 		case MERGE_MEDIA_DIRS:
 			if (strtobool(ary_options[i].value))
 				SETFLAG(MERGE_MEDIA_DIRS_MASK);
@@ -781,6 +930,25 @@ init(int argc, char **argv)
 			if (strtobool(ary_options[i].value))
 				SETFLAG(WIDE_LINKS_MASK);
 			break;
+		case BROWSE_SNAPSHOT:
+			if (strtobool(ary_options[i].value))
+				SETFLAG(BROWSE_SNAPSHOT_MASK);
+			break;
+		case INCREMENTAL_RESCAN:
+			if (strtobool(ary_options[i].value))
+				SETFLAG(RESCAN_MASK);
+			break;
+		case FAST_SCAN:
+			if (strtobool(ary_options[i].value))
+				SETFLAG(FAST_SCAN_MASK);
+			break;
+		case MP3_FRAME_SCAN:
+			if (strtobool(ary_options[i].value))
+				SETFLAG(MP3_FRAME_SCAN_MASK);
+			break;
+		case RESIZED_CACHE_SIZE:
+			runtime_vars.resized_cache_size = atoi(ary_options[i].value);
+			break;
 		default:
 			DPRINTF(E_ERROR, L_GENERAL, "Unknown option in file %s\n",
 				optionsfile);
@@ -885,6 +1053,9 @@ init(int argc, char **argv)
 			if (system(buf) != 0)
 				DPRINTF(E_FATAL, L_GENERAL, "Failed to clean old file cache. EXITING\n");
 			break;
+		case 'r':
+			SETFLAG(RESCAN_MASK);
+			break;
 		case 'u':
 			if (i+1 != argc)
 			{
@@ -926,9 +1097,9 @@ init(int argc, char **argv)
 			"\t\t[-t notify_interval] [-P pid_filename]\n"
 			"\t\t[-s serial] [-m model_number]\n"
 #ifdef __linux__
-			"\t\t[-w url] [-R] [-L] [-S] [-V] [-h]\n"
+			"\t\t[-w url] [-r] [-R] [-L] [-S] [-V] [-h]\n"
 #else
-			"\t\t[-w url] [-R] [-L] [-V] [-h]\n"
+			"\t\t[-w url] [-r] [-R] [-L] [-V] [-h]\n"
 #endif
 			"\nNotes:\n\tNotify interval is in seconds. Default is 895 seconds.\n"
 			"\tDefault pid file is %s.\n"
@@ -936,6 +1107,7 @@ init(int argc, char **argv)
 			"\t-w sets the presentation url. Default is http address on port 80\n"
 			"\t-v enables verbose output\n"
 			"\t-h displays this text\n"
+			"\t-r rescans for changes made while not running\n"
 			"\t-R forces a full rescan\n"
 			"\t-L do not create playlists\n"
 #ifdef __linux__
@@ -1032,6 +1204,7 @@ init(int argc, char **argv)
 		DPRINTF(E_ERROR, L_GENERAL, "Allocation failed\n");
 		return 1;
 	}
+	process_share_connections();
 
 	return 0;
 }
@@ -1050,10 +1223,12 @@ main(int argc, char **argv)
 	fd_set readset;	/* for select() */
 	fd_set writeset;
 	struct timeval timeout, timeofday, lastnotifytime = {0, 0};
-	time_t lastupdatetime = 0;
+	time_t lastupdatetime = 0, lastrenditiontime = 0;
 	int max_fd = -1;
 	int last_changecnt = 0;
+	int keep_snapshot;
 	pid_t scanner_pid = 0;
+	int db_swap;
 	pthread_t inotify_thread = 0;
 #ifdef TIVO_SUPPORT
 	uint8_t beacon_interval = 5;
@@ -1085,7 +1260,7 @@ main(int argc, char **argv)
 		if (updateID == -1)
 			ret = -1;
 	}
-	check_db(db, ret, &scanner_pid);
+	db_swap = check_db(ret > 0, &scanner_pid);
 #ifdef HAVE_INOTIFY
 	if( GETFLAG(INOTIFY_MASK) )
 	{
@@ -1200,11 +1375,36 @@ main(int argc, char **argv)
 		{
 			if (!scanner_pid || kill(scanner_pid, 0) != 0)
 			{
+				if (db_swap)
+				{
+					/* Pick up the database the scanner built next to ours */
+					sql_close(db);
+					open_db(NULL);
+					db_swap = 0;
+				}
+				/* The scanner purged dictionary entries, whose IDs can
+				 * be handed out again, from under our cache */
+				dict_flush();
 				scanning = 0;
 				updateID++;
 			}
 		}
 
+		snapshot_update();
+
+		/* Account for the renditions served since, which is not a change
+		 * to the content clients browse.  The scanner holds the database
+		 * for long stretches, so wait for it to finish. */
+		if (!scanning && timeofday.tv_sec >= lastrenditiontime + 5)
+		{
+			int changes = sqlite3_total_changes(db);
+
+			thumbgen_update_renditions();
+			if (last_changecnt == changes)
+				last_changecnt = sqlite3_total_changes(db);
+			lastrenditiontime = timeofday.tv_sec;
+		}
+
 		/* select open sockets (SSDP, HTTP listen, and all HTTP soap sockets) */
 		FD_ZERO(&readset);
 
@@ -1373,8 +1573,12 @@ shutdown:
 	process_reap_children();
 	free(children);
 
+	/* Changes no client was told about yet would not be in a snapshot
+	 * tagged with the updateID saved here */
+	keep_snapshot = !scanning && sqlite3_total_changes(db) == last_changecnt;
 	sql_exec(db, "UPDATE SETTINGS set VALUE = '%u' where KEY = 'UPDATE_ID'", updateID);
-	sqlite3_close(db);
+	sql_close(db);
+	snapshot_close(keep_snapshot);
 
 	upnpevents_removeSubscribers();
 
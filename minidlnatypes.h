@@ -49,6 +49,10 @@ struct runtime_vars_s {
 	int port;	/* HTTP Port */
 	int notify_interval;	/* seconds between SSDP announces */
 	int max_connections;	/* max number of simultaneous conenctions */
+	int scanner_threads;	/* media file parser threads, 1 to scan serially */
+	int scanner_read_rate;	/* KB/s read by the scanner, 0 for no limit */
+	int scanner_stream_rate;	/* KB/s while clients are connected, 0 to pause */
+	int resized_cache_size;	/* MB of resized images kept, 0 for just JPEG_TN/SM */
 	const char *root_container;	/* root ObjectID (instead of "0") */
 	const char *ifaces[MAX_LAN_ADDR];	/* list of configured network interfaces */
 };
@@ -65,7 +65,15 @@ static const struct {
 	{ FORCE_SORT_CRITERIA, "force_sort_criteria" },
 	{ MAX_CONNECTIONS, "max_connections" },
 	{ MERGE_MEDIA_DIRS, "merge_media_dirs" },
-	{ WIDE_LINKS, "wide_links" }
+	{ WIDE_LINKS, "wide_links" },
+	{ BROWSE_SNAPSHOT, "browse_snapshot" },
+	{ INCREMENTAL_RESCAN, "incremental_rescan" },
+	{ SCANNER_THREADS, "scanner_threads" },
+	{ SCANNER_READ_RATE, "scanner_read_rate" },
+	{ SCANNER_STREAM_READ_RATE, "scanner_stream_read_rate" },
+	{ FAST_SCAN, "fast_scan" },
+	{ MP3_FRAME_SCAN, "mp3_frame_scan" },
+	{ RESIZED_CACHE_SIZE, "resized_cache_size" }
 };
 
 int
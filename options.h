@@ -58,7 +58,15 @@ enum upnpconfigoptions {
 	FORCE_SORT_CRITERIA,		/* force sorting by a given sort criteria */
 	MAX_CONNECTIONS,		/* maximum number of simultaneous connections */
 	MERGE_MEDIA_DIRS,		/* don't add an extra directory level when there are multiple media dirs */
-	WIDE_LINKS			/* allow following symlinks outside the defined media_dirs */
+	WIDE_LINKS,			/* allow following symlinks outside the defined media_dirs */
+	BROWSE_SNAPSHOT,		/* serve plain Browse requests from a memory-mapped snapshot */
+	INCREMENTAL_RESCAN,		/* catch up on changes made while not running at startup */
+	SCANNER_THREADS,		/* number of threads parsing media files during a scan */
+	SCANNER_READ_RATE,		/* ceiling on scanner disk reads, KB/s */
+	SCANNER_STREAM_READ_RATE,	/* ceiling on scanner disk reads while clients are connected */
+	FAST_SCAN,			/* list videos by name first, read their metadata afterwards */
+	MP3_FRAME_SCAN,			/* count every frame of MP3s without a Xing or VBRI header */
+	RESIZED_CACHE_SIZE		/* MB of resized images kept in the art cache */
 };
 
 /* readoptionsfile()
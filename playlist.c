@@ -119,6 +119,7 @@ fill_playlists(void)
 	struct song_metadata plist;
 	struct stat file;
 	char type[4];
+	char id[64];
 	int64_t plID, detailID;
 	char sql_buf[] = "SELECT ID, NAME, PATH from PLAYLISTS where ITEMS > FOUND";
 
@@ -160,8 +161,8 @@ fill_playlists(void)
 		while( next_plist_track(&plist, &file, NULL, type) == 0 )
 		{
 			hash = gen_dir_hash(plist.path);
-			if( sql_get_int_field(db, "SELECT 1 from OBJECTS where OBJECT_ID = '%s$%llX$%d'",
-			                      MUSIC_PLIST_ID, plID, plist.track) == 1 )
+			snprintf(id, sizeof(id), "%s$%llX$%d", MUSIC_PLIST_ID, (long long)plID, plist.track);
+			if( sql_get_int_field_bind(db, "SELECT 1 from OBJECTS where OBJECT_ID = ?", "t", id) == 1 )
 			{
 				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "%d: already in database\n", plist.track);
 				found++;
@@ -220,7 +221,7 @@ found:
 				             detailID);
 				if( !last_dir )
 				{
-					last_dir = sql_get_text_field(db, "SELECT PATH from DETAILS where ID = %lld", detailID);
+					last_dir = sql_get_text_field_bind(db, "SELECT PATH from DETAILS where ID = ?", "i", detailID);
 					if( last_dir )
 					{
 						fname = strrchr(last_dir, '/');
@@ -0,0 +1,513 @@
+/* Persistent cache of parsed media metadata
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "upnpglobalvars.h"
+#include "probecache.h"
+#include "albumart.h"
+#include "utils.h"
+#include "sql.h"
+#include "log.h"
+
+/* Bump whenever the parsers start to extract something different, so
+ * that entries from older versions are parsed again */
+#define PROBE_CACHE_VERSION 5
+
+/* Cached cover art is small; anything bigger is not ours */
+#define PROBE_ART_MAX (512*1024)
+
+static const char create_probes[] =
+	"CREATE TABLE PROBES ("
+	"DEV INTEGER NOT NULL, "
+	"INODE INTEGER NOT NULL, "
+	"SIZE INTEGER, "
+	"MTIME INTEGER, "
+	"STRICT INTEGER, "
+	"TYPE INTEGER, "
+	"NAME TEXT, "
+	"TITLE TEXT, "
+	"ARTIST TEXT, "
+	"CREATOR TEXT, "
+	"ALBUM TEXT, "
+	"GENRE TEXT, "
+	"COMMENT TEXT, "
+	"DISC INTEGER, "
+	"TRACK INTEGER, "
+	"CHANNELS INTEGER, "
+	"BITRATE INTEGER, "
+	"FREQUENCY INTEGER, "
+	"ROTATION INTEGER, "
+	"RESOLUTION TEXT, "
+	"DURATION TEXT, "
+	"DATE TEXT, "
+	"MIME TEXT, "
+	"DLNA_PN TEXT, "
+	"THUMB INTEGER, "
+	"ALBUM_ART TEXT, "
+	"ART_HASH INTEGER, "
+	"SEEK BLOB, "
+	"THUMB_OFFSET INTEGER, "
+	"THUMB_SIZE INTEGER, "
+	"USED INTEGER, "
+	"PRIMARY KEY (DEV, INODE)"
+	");";
+
+/* Embedded cover art, so that it outlives a wiped art_cache */
+static const char create_art[] =
+	"CREATE TABLE ART ("
+	"HASH INTEGER PRIMARY KEY, "
+	"DATA BLOB"
+	");";
+
+#define PROBE_COLUMNS "TITLE, ARTIST, CREATOR, ALBUM, GENRE, COMMENT, DISC, TRACK, CHANNELS, " \
+                      "BITRATE, FREQUENCY, ROTATION, RESOLUTION, DURATION, DATE, MIME, DLNA_PN, " \
+                      "THUMB, ALBUM_ART, ART_HASH, SEEK, THUMB_OFFSET, THUMB_SIZE"
+
+enum probe_column {
+	COL_TITLE, COL_ARTIST, COL_CREATOR, COL_ALBUM, COL_GENRE, COL_COMMENT,
+	COL_DISC, COL_TRACK, COL_CHANNELS, COL_BITRATE, COL_FREQUENCY, COL_ROTATION,
+	COL_RESOLUTION, COL_DURATION, COL_DATE, COL_MIME, COL_DLNA_PN,
+	COL_THUMB, COL_ALBUM_ART, COL_ART_HASH, COL_SEEK, COL_THUMB_OFFSET, COL_THUMB_SIZE
+};
+
+static struct {
+	pthread_mutex_t lock;
+	sqlite3 *db;
+	pid_t pid;
+	int users;
+	sqlite3_stmt *lookup;
+	sqlite3_stmt *touch;
+	sqlite3_stmt *store;
+	sqlite3_stmt *art_get;
+	sqlite3_stmt *art_put;
+	unsigned long hits;
+	unsigned long misses;
+} pc = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int
+prepare(const char *sql, sqlite3_stmt **stmt)
+{
+	return sqlite3_prepare_v2(pc.db, sql, -1, stmt, NULL);
+}
+
+static int
+probe_cache_init(const char *path)
+{
+	int version;
+
+	if( sqlite3_open(path, &pc.db) != SQLITE_OK )
+		return -1;
+	sqlite3_busy_timeout(pc.db, 5000);
+	sql_exec(pc.db, "pragma page_size = 4096");
+	sql_exec(pc.db, "pragma journal_mode = OFF");
+	sql_exec(pc.db, "pragma synchronous = OFF;");
+
+	version = sql_get_int_field(pc.db, "pragma user_version");
+	if( version != PROBE_CACHE_VERSION )
+	{
+		if( version )
+			DPRINTF(E_WARN, L_SCANNER, "Discarding probe cache version %d\n", version);
+		sql_exec(pc.db, "DROP TABLE if exists PROBES");
+		sql_exec(pc.db, "DROP TABLE if exists ART");
+		if( sql_exec(pc.db, create_probes) != SQLITE_OK ||
+		    sql_exec(pc.db, create_art) != SQLITE_OK )
+			return -1;
+		sql_exec(pc.db, "pragma user_version = %d;", PROBE_CACHE_VERSION);
+	}
+
+	if( prepare("SELECT " PROBE_COLUMNS " from PROBES"
+	            " where DEV = ? and INODE = ? and SIZE = ? and MTIME = ? and STRICT = ? and TYPE = ? and NAME = ?",
+	            &pc.lookup) != SQLITE_OK ||
+	    prepare("UPDATE PROBES set USED = ? where DEV = ? and INODE = ?", &pc.touch) != SQLITE_OK ||
+	    prepare("INSERT or REPLACE into PROBES (DEV, INODE, SIZE, MTIME, STRICT, TYPE, NAME, USED, " PROBE_COLUMNS ")"
+	            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+	            &pc.store) != SQLITE_OK ||
+	    prepare("SELECT DATA from ART where HASH = ?", &pc.art_get) != SQLITE_OK ||
+	    prepare("INSERT or IGNORE into ART (HASH, DATA) VALUES (?, ?)", &pc.art_put) != SQLITE_OK )
+		return -1;
+
+	return 0;
+}
+
+static void
+probe_cache_finalize(void)
+{
+	sqlite3_finalize(pc.lookup);
+	sqlite3_finalize(pc.touch);
+	sqlite3_finalize(pc.store);
+	sqlite3_finalize(pc.art_get);
+	sqlite3_finalize(pc.art_put);
+	pc.lookup = pc.touch = pc.store = pc.art_get = pc.art_put = NULL;
+	sqlite3_close(pc.db);
+	pc.db = NULL;
+}
+
+void
+probe_cache_open(void)
+{
+	char path[PATH_MAX];
+
+	pthread_mutex_lock(&pc.lock);
+	/* A connection must not be used across fork(); leave the parent's alone */
+	if( pc.db && pc.pid != getpid() )
+	{
+		pc.db = NULL;
+		pc.lookup = pc.touch = pc.store = pc.art_get = pc.art_put = NULL;
+		pc.users = 0;
+	}
+	if( pc.users++ == 0 )
+	{
+		pc.hits = pc.misses = 0;
+		pc.pid = getpid();
+		snprintf(path, sizeof(path), "%s/probe.db", db_path);
+		if( probe_cache_init(path) != 0 )
+		{
+			/* Only a cache; start over rather than do without */
+			DPRINTF(E_WARN, L_SCANNER, "Recreating unusable probe cache %s\n", path);
+			probe_cache_finalize();
+			unlink(path);
+			if( probe_cache_init(path) != 0 )
+			{
+				DPRINTF(E_ERROR, L_SCANNER, "Unable to open probe cache %s\n", path);
+				probe_cache_finalize();
+			}
+		}
+	}
+	pthread_mutex_unlock(&pc.lock);
+}
+
+void
+probe_cache_close(void)
+{
+	pthread_mutex_lock(&pc.lock);
+	if( pc.users > 0 && --pc.users == 0 && pc.db && pc.pid == getpid() )
+	{
+		if( pc.hits || pc.misses )
+			DPRINTF(E_INFO, L_SCANNER, "Probe cache: %lu hits, %lu misses\n", pc.hits, pc.misses);
+		probe_cache_finalize();
+	}
+	pthread_mutex_unlock(&pc.lock);
+}
+
+static int
+usable(void)
+{
+	return pc.db && pc.pid == getpid();
+}
+
+static const char *
+file_name(const char *path)
+{
+	const char *base = strrchr(path, '/');
+
+	return base ? base + 1 : path;
+}
+
+static char *
+column_strdup(sqlite3_stmt *stmt, int col)
+{
+	const unsigned char *text = sqlite3_column_text(stmt, col);
+
+	return text ? strdup((const char *)text) : NULL;
+}
+
+/* Embedded art is saved under its hash by check_embedded_art().  Cover
+ * art files depend on where the media file is, so only this is cached. */
+static int
+is_embedded_art(const char *path)
+{
+	char prefix[PATH_MAX];
+	int len;
+
+	len = snprintf(prefix, sizeof(prefix), "%s/art_cache/.hash/", db_path);
+	return strncmp(path, prefix, len) == 0;
+}
+
+/* Put back an art_cache file from its saved copy.  Called locked. */
+static int
+restore_art(const char *path, int64_t hash)
+{
+	const void *data;
+	char *dir;
+	FILE *f;
+	int len, ret = -1;
+
+	if( !hash || !is_embedded_art(path) )
+		return -1;
+	sqlite3_bind_int64(pc.art_get, 1, hash);
+	if( sqlite3_step(pc.art_get) == SQLITE_ROW )
+	{
+		data = sqlite3_column_blob(pc.art_get, 0);
+		len = sqlite3_column_bytes(pc.art_get, 0);
+		dir = strdup(path);
+		if( dir )
+		{
+			make_dir(dirname(dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+			free(dir);
+		}
+		f = fopen(path, "w");
+		if( f )
+		{
+			if( fwrite(data, 1, len, f) == (size_t)len )
+				ret = 0;
+			if( fclose(f) != 0 )
+				ret = -1;
+			if( ret != 0 )
+				unlink(path);
+		}
+	}
+	sqlite3_reset(pc.art_get);
+
+	return ret;
+}
+
+/* Keep a copy of an art_cache file.  Called locked; returns its hash or 0. */
+static int64_t
+save_art(const char *path)
+{
+	struct stat st;
+	uint8_t *data;
+	int64_t hash = 0;
+	int fd;
+
+	if( !is_embedded_art(path) )
+		return 0;
+	fd = open(path, O_RDONLY);
+	if( fd < 0 )
+		return 0;
+	if( fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= PROBE_ART_MAX &&
+	    (data = malloc(st.st_size)) )
+	{
+		if( read(fd, data, st.st_size) == st.st_size )
+		{
+			hash = (int64_t)hash64(data, st.st_size);
+			/* 0 means no saved copy */
+			if( !hash )
+				hash = 1;
+			sqlite3_bind_int64(pc.art_put, 1, hash);
+			sqlite3_bind_blob(pc.art_put, 2, data, st.st_size, SQLITE_STATIC);
+			if( sqlite3_step(pc.art_put) != SQLITE_DONE )
+				hash = 0;
+			sqlite3_reset(pc.art_put);
+		}
+		free(data);
+	}
+	close(fd);
+
+	return hash;
+}
+
+int
+probe_cache_lookup(const char *path, char *name, int type, media_details_t *d)
+{
+	struct stat file;
+	metadata_t *m;
+	char *art = NULL;
+	int found = 0, art_ok = 1, len;
+
+	if( stat(path, &file) != 0 )
+		return -1;
+
+	pthread_mutex_lock(&pc.lock);
+	if( !usable() )
+	{
+		pthread_mutex_unlock(&pc.lock);
+		return -1;
+	}
+	sqlite3_bind_int64(pc.lookup, 1, (int64_t)file.st_dev);
+	sqlite3_bind_int64(pc.lookup, 2, (int64_t)file.st_ino);
+	sqlite3_bind_int64(pc.lookup, 3, (int64_t)file.st_size);
+	sqlite3_bind_int64(pc.lookup, 4, (int64_t)file.st_mtime);
+	sqlite3_bind_int(pc.lookup, 5, GETFLAG(DLNA_STRICT_MASK) ? 1 : 0);
+	sqlite3_bind_int(pc.lookup, 6, type);
+	/* Untagged files are titled after their name */
+	sqlite3_bind_text(pc.lookup, 7, file_name(path), -1, SQLITE_STATIC);
+	if( sqlite3_step(pc.lookup) == SQLITE_ROW )
+	{
+		memset(d, '\0', sizeof(*d));
+		m = &d->m;
+		m->title = column_strdup(pc.lookup, COL_TITLE);
+		m->artist = column_strdup(pc.lookup, COL_ARTIST);
+		m->creator = column_strdup(pc.lookup, COL_CREATOR);
+		m->album = column_strdup(pc.lookup, COL_ALBUM);
+		m->genre = column_strdup(pc.lookup, COL_GENRE);
+		m->comment = column_strdup(pc.lookup, COL_COMMENT);
+		m->disc = sqlite3_column_int(pc.lookup, COL_DISC);
+		m->track = sqlite3_column_int(pc.lookup, COL_TRACK);
+		m->channels = sqlite3_column_int(pc.lookup, COL_CHANNELS);
+		m->bitrate = sqlite3_column_int(pc.lookup, COL_BITRATE);
+		m->frequency = sqlite3_column_int(pc.lookup, COL_FREQUENCY);
+		m->rotation = sqlite3_column_int(pc.lookup, COL_ROTATION);
+		m->resolution = column_strdup(pc.lookup, COL_RESOLUTION);
+		m->duration = column_strdup(pc.lookup, COL_DURATION);
+		m->date = column_strdup(pc.lookup, COL_DATE);
+		m->mime = column_strdup(pc.lookup, COL_MIME);
+		m->dlna_pn = column_strdup(pc.lookup, COL_DLNA_PN);
+		d->thumb = sqlite3_column_int(pc.lookup, COL_THUMB);
+		d->thumb_offset = sqlite3_column_int64(pc.lookup, COL_THUMB_OFFSET);
+		d->thumb_size = sqlite3_column_int(pc.lookup, COL_THUMB_SIZE);
+		art = column_strdup(pc.lookup, COL_ALBUM_ART);
+		if( (len = sqlite3_column_bytes(pc.lookup, COL_SEEK)) > 0 &&
+		    (d->seek.data = malloc(len)) )
+		{
+			memcpy(d->seek.data, sqlite3_column_blob(pc.lookup, COL_SEEK), len);
+			d->seek.len = d->seek.alloc = len;
+		}
+		if( art && access(art, F_OK) != 0 &&
+		    restore_art(art, sqlite3_column_int64(pc.lookup, COL_ART_HASH)) != 0 )
+			art_ok = 0;
+		found = 1;
+	}
+	sqlite3_reset(pc.lookup);
+	if( found )
+	{
+		sqlite3_bind_int64(pc.touch, 1, (int64_t)time(NULL));
+		sqlite3_bind_int64(pc.touch, 2, (int64_t)file.st_dev);
+		sqlite3_bind_int64(pc.touch, 3, (int64_t)file.st_ino);
+		sqlite3_step(pc.touch);
+		sqlite3_reset(pc.touch);
+	}
+	if( found && art_ok )
+		pc.hits++;
+	else
+		pc.misses++;
+	pthread_mutex_unlock(&pc.lock);
+
+	if( !found )
+		return -1;
+
+	d->type = type;
+	d->path = path;
+	d->name = name;
+	d->size = file.st_size;
+	d->mtime = file.st_mtime;
+	d->album_art = art;
+	d->free_flags = 0xFFFFFFFF;
+	/* Without its saved copy the embedded art has to come out of the file */
+	if( !art_ok )
+	{
+		FreeMetadataDetails(d);
+		return -1;
+	}
+	/* Cover art files may have been added, changed or left behind by a
+	 * move; finding them again is cheap next to parsing the file */
+	if( !art )
+		d->album_art = find_album_art_file(path, NULL, 0);
+	strip_ext(name);
+	d->cached = 1;
+
+	return 0;
+}
+
+static void
+bind_text(sqlite3_stmt *stmt, int col, const char *text)
+{
+	if( text )
+		sqlite3_bind_text(stmt, col, text, -1, SQLITE_STATIC);
+	else
+		sqlite3_bind_null(stmt, col);
+}
+
+void
+probe_cache_store(const media_details_t *d)
+{
+	const metadata_t *m = &d->m;
+	sqlite3_stmt *s;
+	struct stat file;
+	int64_t hash = 0;
+	const int c = 9;	/* first of PROBE_COLUMNS */
+
+	if( d->cached )
+		return;
+	/* Changed since it was parsed; the next scan will see it again */
+	if( stat(d->path, &file) != 0 || file.st_size != d->size || file.st_mtime != d->mtime )
+		return;
+
+	pthread_mutex_lock(&pc.lock);
+	if( !usable() )
+	{
+		pthread_mutex_unlock(&pc.lock);
+		return;
+	}
+	if( d->album_art )
+		hash = save_art(d->album_art);
+	s = pc.store;
+	sqlite3_bind_int64(s, 1, (int64_t)file.st_dev);
+	sqlite3_bind_int64(s, 2, (int64_t)file.st_ino);
+	sqlite3_bind_int64(s, 3, (int64_t)file.st_size);
+	sqlite3_bind_int64(s, 4, (int64_t)file.st_mtime);
+	sqlite3_bind_int(s, 5, GETFLAG(DLNA_STRICT_MASK) ? 1 : 0);
+	sqlite3_bind_int(s, 6, d->type);
+	bind_text(s, 7, file_name(d->path));
+	sqlite3_bind_int64(s, 8, (int64_t)time(NULL));
+	bind_text(s, c + COL_TITLE, m->title);
+	bind_text(s, c + COL_ARTIST, m->artist);
+	bind_text(s, c + COL_CREATOR, m->creator);
+	bind_text(s, c + COL_ALBUM, m->album);
+	bind_text(s, c + COL_GENRE, m->genre);
+	bind_text(s, c + COL_COMMENT, m->comment);
+	sqlite3_bind_int(s, c + COL_DISC, m->disc);
+	sqlite3_bind_int(s, c + COL_TRACK, m->track);
+	sqlite3_bind_int(s, c + COL_CHANNELS, m->channels);
+	sqlite3_bind_int(s, c + COL_BITRATE, m->bitrate);
+	sqlite3_bind_int(s, c + COL_FREQUENCY, m->frequency);
+	sqlite3_bind_int(s, c + COL_ROTATION, m->rotation);
+	bind_text(s, c + COL_RESOLUTION, m->resolution);
+	bind_text(s, c + COL_DURATION, m->duration);
+	bind_text(s, c + COL_DATE, m->date);
+	bind_text(s, c + COL_MIME, m->mime);
+	bind_text(s, c + COL_DLNA_PN, m->dlna_pn);
+	sqlite3_bind_int(s, c + COL_THUMB, d->thumb);
+	sqlite3_bind_int64(s, c + COL_THUMB_OFFSET, (int64_t)d->thumb_offset);
+	sqlite3_bind_int(s, c + COL_THUMB_SIZE, d->thumb_size);
+	/* Cover art files are looked up again on every hit */
+	if( hash )
+		bind_text(s, c + COL_ALBUM_ART, d->album_art);
+	sqlite3_bind_int64(s, c + COL_ART_HASH, hash);
+	if( d->seek.len )
+		sqlite3_bind_blob(s, c + COL_SEEK, d->seek.data, d->seek.len, SQLITE_STATIC);
+	if( sqlite3_step(s) != SQLITE_DONE )
+		DPRINTF(E_WARN, L_SCANNER, "Error caching details for %s: %s\n", d->path, sqlite3_errmsg(pc.db));
+	sqlite3_reset(s);
+	sqlite3_clear_bindings(s);
+	pthread_mutex_unlock(&pc.lock);
+}
+
+void
+probe_cache_expire(time_t since)
+{
+	pthread_mutex_lock(&pc.lock);
+	if( usable() )
+	{
+		sql_exec(pc.db, "DELETE from PROBES where USED < %lld", (long long)since);
+		sql_exec(pc.db, "DELETE from ART where HASH not in (SELECT ART_HASH from PROBES)");
+	}
+	pthread_mutex_unlock(&pc.lock);
+}
@@ -0,0 +1,46 @@
+/* Persistent cache of parsed media metadata
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PROBECACHE_H__
+#define __PROBECACHE_H__
+
+#include <time.h>
+#include "metadata.h"
+
+/* The cache lives in its own file next to files.db, so that it survives
+ * a rebuild of the database.  Entries are keyed by device and inode and
+ * only used while the name, size and modification time still match.
+ * Only embedded cover art is kept; art files are looked up again. */
+void probe_cache_open(void);
+void probe_cache_close(void);
+
+/* Fill 'd' like Parse*Metadata() would for the file at 'path' of the
+ * given type.  Returns 0 on a hit, -1 if the file has to be parsed. */
+int probe_cache_lookup(const char *path, char *name, int type, media_details_t *d);
+
+/* Remember what was parsed, once it made it into the database */
+void probe_cache_store(const media_details_t *d);
+
+/* How long entries for files that have gone missing are kept */
+#define PROBE_CACHE_KEEP (30*24*60*60)
+
+/* Drop entries no full scan has come across since 'since' */
+void probe_cache_expire(time_t since);
+
+#endif
@@ -37,6 +37,11 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "upnpglobalvars.h"
 #include "process.h"
@@ -46,6 +51,10 @@
 struct child *children = NULL;
 int number_of_children = 0;
 
+/* Copy of number_of_children in memory shared with the scanner process,
+ * which is forked before most connections are made. */
+static volatile int *shared_children = NULL;
+
 static void
 add_process_info(pid_t pid, struct client_cache_s *client)
 {
@@ -64,7 +73,7 @@ add_process_info(pid_t pid, struct client_cache_s *client)
 	}
 }
 
-static inline void
+static inline int
 remove_process_info(pid_t pid)
 {
 	struct child *child;
@@ -78,8 +87,10 @@ remove_process_info(pid_t pid)
 		child->pid = 0;
 		if (child->client)
 			child->client->connections--;
-		break;
+		return 1;
 	}
+
+	return 0;
 }
 
 pid_t
@@ -100,6 +111,8 @@ process_fork(struct client_cache_s *client)
 			client->connections++;
 		add_process_info(pid, client);
 		number_of_children++;
+		if (shared_children)
+			*shared_children = number_of_children;
 	}
 
 	return pid;
@@ -119,9 +132,71 @@ process_handle_child_termination(int signal)
 			else
 				break;
 		}
-		number_of_children--;
-		remove_process_info(pid);
+		/* The scanner and the snapshot builder are plain fork()s,
+		 * reaped here too but never counted as connections */
+		if (remove_process_info(pid))
+			number_of_children--;
 	}
+	if (shared_children)
+		*shared_children = number_of_children;
+}
+
+int
+process_share_connections(void)
+{
+	void *p;
+
+	if (shared_children)
+		return 0;
+	p = mmap(NULL, sizeof(int), PROT_READ|PROT_WRITE,
+	         MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		DPRINTF(E_WARN, L_GENERAL, "Failed to map shared connection count: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	shared_children = p;
+	*shared_children = number_of_children;
+
+	return 0;
+}
+
+int
+process_active_connections(void)
+{
+	return shared_children ? *shared_children : number_of_children;
+}
+
+#ifdef __linux__
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+#endif
+
+int
+process_set_idle_io(void)
+{
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	/* who = 0 is the calling thread; threads created afterwards inherit it */
+	return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+	               IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int
+process_set_idle_cpu(void)
+{
+#if defined(__linux__) && defined(SYS_gettid)
+	/* Linux keeps a nice value per thread */
+	return setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
 }
 
 int
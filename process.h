@@ -57,6 +57,34 @@ pid_t process_fork(struct client_cache_s *client);
  */
 void process_handle_child_termination(int signal);
 
+/**
+ * Keep a copy of the number of running connection children in shared memory,
+ * so that processes forked afterwards (the scanner) can see it.
+ * @return 0 on success, -1 if the shared mapping could not be created.
+ */
+int process_share_connections(void);
+
+/**
+ * Number of connection children currently running.  Accurate in forked
+ * processes once process_share_connections() has been called.
+ */
+int process_active_connections(void);
+
+/**
+ * Put the calling thread in the idle I/O scheduling class, so that its disk
+ * reads are only served when nothing else is waiting.  Threads it creates
+ * afterwards inherit the class.
+ * @return 0 on success, -1 if it is not supported.
+ */
+int process_set_idle_io(void);
+
+/**
+ * Give the calling thread the lowest CPU priority, leaving the rest of the
+ * process alone where the system allows it.
+ * @return 0 on success, -1 if it is not supported.
+ */
+int process_set_idle_cpu(void);
+
 /**
  * Daemonize the current process by forking itself and redirecting standard
  * input, standard output and standard error to /dev/null.
@@ -19,14 +19,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <ctype.h>
 #include <libgen.h>
 #include <inttypes.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/resource.h>
+#include <pthread.h>
 
 #include "config.h"
 
@@ -45,35 +50,33 @@
 #include "scanner.h"
 #include "albumart.h"
 #include "containers.h"
+#include "dict.h"
+#include "dirlist.h"
+#include "process.h"
+#include "thumbgen.h"
+#include "probecache.h"
 #include "log.h"
 
-#if SCANDIR_CONST
-typedef const struct dirent scan_filter;
-#else
-typedef struct dirent scan_filter;
-#endif
 #ifndef AV_LOG_PANIC
 #define AV_LOG_PANIC AV_LOG_FATAL
 #endif
 
 int valid_cache = 0;
 
-struct virtual_item
-{
-	int64_t objectID;
-	char parentID[64];
-	char name[256];
-};
-
 int64_t
 get_next_available_id(const char *table, const char *parentID)
 {
 		char *ret, *base;
 		int64_t objectID = 0;
 
-		ret = sql_get_text_field(db, "SELECT OBJECT_ID from %s where ID = "
-		                             "(SELECT max(ID) from %s where PARENT_ID = '%s')",
-		                             table, table, parentID);
+		if( strcmp(table, "OBJECTS") == 0 )
+			ret = sql_get_text_field_bind(db, "SELECT OBJECT_ID from OBJECTS where ID = "
+			                                  "(SELECT max(ID) from OBJECTS where PARENT_ID = ?)",
+			                                  "t", parentID);
+		else
+			ret = sql_get_text_field(db, "SELECT OBJECT_ID from %s where ID = "
+			                             "(SELECT max(ID) from %s where PARENT_ID = '%s')",
+			                             table, table, parentID);
 		if( ret )
 		{
 			base = strrchr(ret, '$');
@@ -85,301 +88,357 @@ get_next_available_id(const char *table, const char *parentID)
 		return objectID;
 }
 
-int
-insert_container(const char *item, const char *rootParent, const char *refID, const char *class,
-                 const char *artist, const char *genre, const char *album_art, int64_t *objectID, int64_t *parentID)
-{
-	char *result;
-	char *base;
-	int ret = 0;
-
-	result = sql_get_text_field(db, "SELECT OBJECT_ID from OBJECTS o "
-	                                "left join DETAILS d on (o.DETAIL_ID = d.ID)"
-	                                " where o.PARENT_ID = '%s'"
-			                " and o.NAME like '%q'"
-			                " and d.ARTIST %s %Q"
-	                                " and o.CLASS = 'container.%s' limit 1",
-	                                rootParent, item, artist?"like":"is", artist, class);
-	if( result )
+/* The virtual containers (albums, artists, genres, dates, cameras) and
+ * the next free child number of each container, kept in memory while
+ * scanning so that placing a file does not need to ask the database.
+ * Outside of a scan every lookup goes to the database. */
+#define VC_HASH_SIZE 4096
+
+struct vcontainer {
+	struct vcontainer *key_next;
+	struct vcontainer *id_next;
+	char *key;		/* parent, folded name, artist and class; NULL for top level ones */
+	int64_t detailID;
+	int64_t artistID;
+	int64_t children;	/* next free child number, -1 until needed */
+	char id[];		/* OBJECT_ID, followed by the key */
+};
+
+static struct {
+	int enabled;
+	int loaded;
+	struct vcontainer *by_key[VC_HASH_SIZE];
+	struct vcontainer *by_id[VC_HASH_SIZE];
+} vc;
+
+static unsigned int
+vc_hash(const char *str)
+{
+	unsigned int hash = 5381;
+
+	for (; *str; str++)
+		hash = ((hash << 5) + hash) + (unsigned char)*str;
+
+	return hash & (VC_HASH_SIZE - 1);
+}
+
+/* Names are compared like 'NAME like ?' did: ASCII case-insensitively */
+static char *
+vc_key(const char *parent, const char *name, int64_t artistID, const char *cls)
+{
+	char *key, *p;
+
+	if( xasprintf(&key, "%s\x1f%s\x1f%lld\x1f%s", parent, name, (long long)artistID, cls) < 0 )
+		return NULL;
+	for( p = key + strlen(parent) + 1; *p != '\x1f'; p++ )
+		*p = tolower((unsigned char)*p);
+
+	return key;
+}
+
+static struct vcontainer *
+vc_find_id(const char *id)
+{
+	struct vcontainer *c;
+
+	for( c = vc.by_id[vc_hash(id)]; c; c = c->id_next )
+		if( strcmp(c->id, id) == 0 )
+			return c;
+	return NULL;
+}
+
+static struct vcontainer *
+vc_find_key(const char *key)
+{
+	struct vcontainer *c;
+
+	for( c = vc.by_key[vc_hash(key)]; c; c = c->key_next )
+		if( strcmp(c->key, key) == 0 )
+			return c;
+	return NULL;
+}
+
+static struct vcontainer *
+vc_add(const char *id, const char *key, int64_t detailID, int64_t artistID, int64_t children)
+{
+	struct vcontainer *c;
+	size_t idlen = strlen(id) + 1;
+	unsigned int h;
+
+	c = malloc(sizeof(*c) + idlen + (key ? strlen(key) + 1 : 0));
+	if( !c )
+		return NULL;
+	memcpy(c->id, id, idlen);
+	c->detailID = detailID;
+	c->artistID = artistID;
+	c->children = children;
+	h = vc_hash(id);
+	c->id_next = vc.by_id[h];
+	vc.by_id[h] = c;
+	c->key = NULL;
+	c->key_next = NULL;
+	if( key )
 	{
-		base = strrchr(result, '$');
-		if( base )
-			*parentID = strtoll(base+1, NULL, 16);
-		else
-			*parentID = 0;
-		*objectID = get_next_available_id("OBJECTS", result);
+		c->key = strcpy(c->id + idlen, key);
+		h = vc_hash(key);
+		c->key_next = vc.by_key[h];
+		vc.by_key[h] = c;
 	}
-	else
+
+	return c;
+}
+
+/* Forget everything, after containers were removed from the database */
+static void
+vc_flush(void)
+{
+	struct vcontainer *c, *next;
+	int i;
+
+	for( i = 0; i < VC_HASH_SIZE; i++ )
 	{
-		int64_t detailID = 0;
-		*objectID = 0;
-		*parentID = get_next_available_id("OBJECTS", rootParent);
-		if( refID )
+		for( c = vc.by_id[i]; c; c = next )
 		{
-			result = sql_get_text_field(db, "SELECT DETAIL_ID from OBJECTS where OBJECT_ID = %Q", refID);
-			if( result )
-				detailID = strtoll(result, NULL, 10);
-		}
-		if( !detailID )
-		{
-			detailID = GetFolderMetadata(item, NULL, artist, genre, (album_art ? strtoll(album_art, NULL, 10) : 0));
+			next = c->id_next;
+			free(c);
 		}
-		ret = sql_exec(db, "INSERT into OBJECTS"
-		                   " (OBJECT_ID, PARENT_ID, REF_ID, DETAIL_ID, CLASS, NAME) "
-		                   "VALUES"
-		                   " ('%s$%llX', '%s', %Q, %lld, 'container.%s', '%q')",
-		                   rootParent, (long long)*parentID, rootParent,
-		                   refID, (long long)detailID, class, item);
 	}
-	sqlite3_free(result);
+	memset(vc.by_id, 0, sizeof(vc.by_id));
+	memset(vc.by_key, 0, sizeof(vc.by_key));
+	vc.loaded = 0;
+}
 
-	return ret;
+/* Pick up the containers earlier scans left in the database, once */
+static void
+vc_load(void)
+{
+	char **result, *key;
+	int rows, i;
+
+	if( vc.loaded )
+		return;
+	vc.loaded = 1;
+	if( sql_get_table(db, "SELECT o.OBJECT_ID, o.PARENT_ID, o.NAME, o.DETAIL_ID, ifnull(d.ARTIST_ID, 0), o.CLASS"
+	                      " from OBJECTS o left join DETAILS_DATA d on (d.ID = o.DETAIL_ID)"
+	                      " where o.CLASS glob 'container.*' and"
+	                      " (o.PARENT_ID = '"MUSIC_GENRE_ID"' or o.PARENT_ID glob '"MUSIC_GENRE_ID"$*' or"
+	                      "  o.PARENT_ID = '"MUSIC_ARTIST_ID"' or o.PARENT_ID glob '"MUSIC_ARTIST_ID"$*' or"
+	                      "  o.PARENT_ID = '"MUSIC_ALBUM_ID"' or"
+	                      "  o.PARENT_ID = '"IMAGE_DATE_ID"' or"
+	                      "  o.PARENT_ID = '"IMAGE_CAMERA_ID"' or o.PARENT_ID glob '"IMAGE_CAMERA_ID"$*')",
+	                      &result, &rows, NULL) != SQLITE_OK )
+		return;
+	for( i = 1; i <= rows; i++ )
+	{
+		char **row = result + i * 6;
+		int64_t artistID = strtoll(row[4], NULL, 10);
+
+		if( !row[2] || !row[5] )
+			continue;
+		key = vc_key(row[1], row[2], artistID, row[5]);
+		if( key && !vc_find_key(key) )
+			vc_add(row[0], key, strtoll(row[3] ? row[3] : "0", NULL, 10), artistID, -1);
+		free(key);
+	}
+	sqlite3_free_table(result);
+	DPRINTF(E_DEBUG, L_SCANNER, "Loaded %d virtual containers\n", rows);
 }
 
 static void
-insert_containers(const char *name, const char *path, const char *refID, const char *class, int64_t detailID)
+vc_enable(int enable)
 {
-	char sql[128];
-	char **result;
+	vc_flush();
+	vc.enabled = enable;
+}
+
+/* Allocate the number of a new child of 'parent' */
+static int64_t
+next_child_id(const char *parent)
+{
+	struct vcontainer *c;
+
+	if( !vc.enabled )
+		return get_next_available_id("OBJECTS", parent);
+	c = vc_find_id(parent);
+	if( !c )
+		c = vc_add(parent, NULL, 0, 0, -1);
+	if( !c )
+		return get_next_available_id("OBJECTS", parent);
+	if( c->children < 0 )
+		c->children = get_next_available_id("OBJECTS", parent);
+
+	return c->children++;
+}
+
+/* Find or create the container 'item' of class 'class' under 'rootParent',
+ * and return its OBJECT_ID in 'id' */
+static int
+insert_container(const char *item, const char *rootParent, const char *refID, const char *class,
+                 const char *artist, const char *genre, int64_t album_art, char *id, size_t idlen)
+{
+	struct vcontainer *c;
+	char *result = NULL;
+	char *key;
+	char cls[64];
+	int64_t artistID, detailID = 0;
 	int ret;
-	int cols, row;
-	int64_t objectID, parentID;
 
-	if( strstr(class, "imageItem") )
+	snprintf(cls, sizeof(cls), "container.%s", class);
+	/* An artist that was never interned cannot have a container yet */
+	artistID = dict_lookup(DICT_ARTIST, artist);
+	if( vc.enabled )
 	{
-		char *date_taken = NULL, *camera = NULL;
-		static struct virtual_item last_date;
-		static struct virtual_item last_cam;
-		static struct virtual_item last_camdate;
-		static long long last_all_objectID = 0;
-
-		snprintf(sql, sizeof(sql), "SELECT DATE, CREATOR from DETAILS where ID = %lld", (long long)detailID);
-		ret = sql_get_table(db, sql, &result, &row, &cols);
-		if( ret == SQLITE_OK )
+		vc_load();
+		if( !artist || artistID )
 		{
-			date_taken = result[2];
-			camera = result[3];
+			key = vc_key(rootParent, item, artistID, cls);
+			c = key ? vc_find_key(key) : NULL;
+			free(key);
+			if( c )
+			{
+				strncpyt(id, c->id, idlen);
+				return 0;
+			}
 		}
-		if( date_taken )
-			date_taken[10] = '\0';
-		else
-			date_taken = _("Unknown Date");
-		if( !camera )
-			camera = _("Unknown Camera");
+	}
+	else if( !artist || artistID )
+		result = sql_get_text_field_bind(db, "SELECT OBJECT_ID from OBJECTS o "
+		                                     "left join DETAILS_DATA d on (o.DETAIL_ID = d.ID)"
+		                                     " where o.PARENT_ID = ? and o.NAME like ?"
+		                                     " and d.ARTIST_ID = ? and o.CLASS = ? limit 1",
+		                                     "ttit", rootParent, item, artistID, cls);
+	if( result )
+	{
+		strncpyt(id, result, idlen);
+		sqlite3_free(result);
+		return 0;
+	}
 
-		if( valid_cache && strcmp(last_date.name, date_taken) == 0 )
+	if( refID )
+	{
+		c = vc.enabled ? vc_find_id(refID) : NULL;
+		if( c && c->key )
 		{
-			last_date.objectID++;
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last date item: %s/%s/%X\n", last_date.name, last_date.parentID, last_date.objectID);
+			detailID = c->detailID;
+			artistID = c->artistID;
 		}
 		else
 		{
-			insert_container(date_taken, IMAGE_DATE_ID, NULL, "album.photoAlbum", NULL, NULL, NULL, &objectID, &parentID);
-			sprintf(last_date.parentID, IMAGE_DATE_ID"$%llX", (unsigned long long)parentID);
-			last_date.objectID = objectID;
-			strncpyt(last_date.name, date_taken, sizeof(last_date.name));
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached date item: %s/%s/%X\n", last_date.name, last_date.parentID, last_date.objectID);
+			detailID = sql_get_int64_field_bind(db, "SELECT DETAIL_ID from OBJECTS where OBJECT_ID = ?",
+			                                     "t", refID);
+			if( detailID > 0 )
+				artistID = sql_get_int64_field_bind(db, "SELECT ARTIST_ID from DETAILS_DATA where ID = ?",
+				                                     "i", detailID);
 		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-		             last_date.parentID, (long long)last_date.objectID, last_date.parentID, refID, class, (long long)detailID, name);
+		if( detailID < 0 )
+			detailID = 0;
+	}
+	if( !detailID )
+	{
+		detailID = GetFolderMetadata(item, NULL, artist, genre, album_art);
+		artistID = dict_lookup(DICT_ARTIST, artist);
+	}
+	snprintf(id, idlen, "%s$%llX", rootParent, (long long)next_child_id(rootParent));
+	ret = sql_exec_bind(db, "INSERT into OBJECTS"
+	                        " (OBJECT_ID, PARENT_ID, REF_ID, DETAIL_ID, CLASS, NAME) "
+	                        "VALUES (?, ?, ?, ?, ?, ?)",
+	                        "tttitt", id, rootParent, refID, detailID, cls, item);
+	if( vc.enabled && ret == SQLITE_OK )
+	{
+		key = vc_key(rootParent, item, artistID > 0 ? artistID : 0, cls);
+		if( key )
+			vc_add(id, key, detailID, artistID, 0);
+		free(key);
+	}
 
-		if( !valid_cache || strcmp(camera, last_cam.name) != 0 )
-		{
-			insert_container(camera, IMAGE_CAMERA_ID, NULL, "storageFolder", NULL, NULL, NULL, &objectID, &parentID);
-			sprintf(last_cam.parentID, IMAGE_CAMERA_ID"$%llX", (long long)parentID);
-			strncpyt(last_cam.name, camera, sizeof(last_cam.name));
-			/* Invalidate last_camdate cache */
-			last_camdate.name[0] = '\0';
-		}
-		if( valid_cache && strcmp(last_camdate.name, date_taken) == 0 )
+	return ret;
+}
+
+/* Add a reference to the item 'refID' to the container 'parent' */
+static void
+insert_child(const char *parent, const char *refID, const char *class, int64_t detailID, const char *name)
+{
+	sql_exec(db, "INSERT into OBJECTS"
+	             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
+	             "VALUES"
+	             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
+	             parent, (long long)next_child_id(parent), parent, refID, class, (long long)detailID, name);
+}
+
+static void
+insert_containers(const char *name, const char *refID, const char *class, int64_t detailID,
+                  const media_details_t *d)
+{
+	const metadata_t *m = &d->m;
+
+	if( strstr(class, "imageItem") )
+	{
+		char date_buf[11], date_id[64], cam_id[64], camdate_id[64];
+		const char *date_taken = _("Unknown Date");
+		const char *camera = m->creator ? m->creator : _("Unknown Camera");
+
+		if( m->date )
 		{
-			last_camdate.objectID++;
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last camdate item: %s/%s/%s/%X\n", camera, last_camdate.name, last_camdate.parentID, last_camdate.objectID);
+			strncpyt(date_buf, m->date, sizeof(date_buf));
+			date_taken = date_buf;
 		}
-		else
-		{
-			insert_container(date_taken, last_cam.parentID, NULL, "album.photoAlbum", NULL, NULL, NULL, &objectID, &parentID);
-			sprintf(last_camdate.parentID, "%s$%llX", last_cam.parentID, (long long)parentID);
-			last_camdate.objectID = objectID;
-			strncpyt(last_camdate.name, date_taken, sizeof(last_camdate.name));
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached camdate item: %s/%s/%s/%X\n", camera, last_camdate.name, last_camdate.parentID, last_camdate.objectID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-		             last_camdate.parentID, last_camdate.objectID, last_camdate.parentID, refID, class, (long long)detailID, name);
+
+		insert_container(date_taken, IMAGE_DATE_ID, NULL, "album.photoAlbum", NULL, NULL, 0, date_id, sizeof(date_id));
+		insert_child(date_id, refID, class, detailID, name);
+
+		insert_container(camera, IMAGE_CAMERA_ID, NULL, "storageFolder", NULL, NULL, 0, cam_id, sizeof(cam_id));
+		insert_container(date_taken, cam_id, NULL, "album.photoAlbum", NULL, NULL, 0, camdate_id, sizeof(camdate_id));
+		insert_child(camdate_id, refID, class, detailID, name);
+
 		/* All Images */
-		if( !last_all_objectID )
-		{
-			last_all_objectID = get_next_available_id("OBJECTS", IMAGE_ALL_ID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('"IMAGE_ALL_ID"$%llX', '"IMAGE_ALL_ID"', '%s', '%s', %lld, %Q)",
-		             last_all_objectID++, refID, class, (long long)detailID, name);
+		insert_child(IMAGE_ALL_ID, refID, class, detailID, name);
 	}
 	else if( strstr(class, "audioItem") )
 	{
-		snprintf(sql, sizeof(sql), "SELECT ALBUM, ARTIST, GENRE, ALBUM_ART from DETAILS where ID = %lld", (long long)detailID);
-		ret = sql_get_table(db, sql, &result, &row, &cols);
-		if( ret != SQLITE_OK )
-			return;
-		if( !row )
-		{
-			sqlite3_free_table(result);
-			return;
-		}
-		char *album = result[4], *artist = result[5], *genre = result[6];
-		char *album_art = result[7];
-		static struct virtual_item last_album;
-		static struct virtual_item last_artist;
-		static struct virtual_item last_artistAlbum;
-		static struct virtual_item last_artistAlbumAll;
-		static struct virtual_item last_genre;
-		static struct virtual_item last_genreArtist;
-		static struct virtual_item last_genreArtistAll;
-		static long long last_all_objectID = 0;
+		const char *album = m->album, *artist = m->artist, *genre = m->genre;
+		int64_t album_art = d->album_art_id;
+		char album_id[64], artist_id[64], all_albums_id[64], artist_album_id[64];
+		char genre_id[64], all_artists_id[64], genre_artist_id[64];
 
 		if( album )
 		{
-			if( valid_cache && strcmp(album, last_album.name) == 0 )
-			{
-				last_album.objectID++;
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last album item: %s/%s/%X\n", last_album.name, last_album.parentID, last_album.objectID);
-			}
-			else
-			{
-				strncpyt(last_album.name, album, sizeof(last_album.name));
-				insert_container(album, MUSIC_ALBUM_ID, NULL, "album.musicAlbum", artist, genre, album_art, &objectID, &parentID);
-				sprintf(last_album.parentID, MUSIC_ALBUM_ID"$%llX", (long long)parentID);
-				last_album.objectID = objectID;
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached album item: %s/%s/%X\n", last_album.name, last_album.parentID, last_album.objectID);
-			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_album.parentID, last_album.objectID, last_album.parentID, refID, class, (long long)detailID, name);
+			insert_container(album, MUSIC_ALBUM_ID, NULL, "album.musicAlbum", artist, genre, album_art,
+			                 album_id, sizeof(album_id));
+			insert_child(album_id, refID, class, detailID, name);
 		}
 		if( artist )
 		{
-			if( !valid_cache || strcmp(artist, last_artist.name) != 0 )
-			{
-				insert_container(artist, MUSIC_ARTIST_ID, NULL, "person.musicArtist", NULL, genre, NULL, &objectID, &parentID);
-				sprintf(last_artist.parentID, MUSIC_ARTIST_ID"$%llX", (long long)parentID);
-				strncpyt(last_artist.name, artist, sizeof(last_artist.name));
-				last_artistAlbum.name[0] = '\0';
-				/* Add this file to the "- All Albums -" container as well */
-				insert_container(_("- All Albums -"), last_artist.parentID, NULL, "album", artist, genre, NULL, &objectID, &parentID);
-				sprintf(last_artistAlbumAll.parentID, "%s$%llX", last_artist.parentID, (long long)parentID);
-				last_artistAlbumAll.objectID = objectID;
-			}
-			else
-			{
-				last_artistAlbumAll.objectID++;
-			}
-			if( valid_cache && strcmp(album?album:_("Unknown Album"), last_artistAlbum.name) == 0 )
-			{
-				last_artistAlbum.objectID++;
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last artist/album item: %s/%s/%X\n", last_artist.name, last_artist.parentID, last_artist.objectID);
-			}
-			else
-			{
-				insert_container(album?album:_("Unknown Album"), last_artist.parentID, album?last_album.parentID:NULL,
-				                 "album.musicAlbum", artist, genre, album_art, &objectID, &parentID);
-				sprintf(last_artistAlbum.parentID, "%s$%llX", last_artist.parentID, (long long)parentID);
-				last_artistAlbum.objectID = objectID;
-				strncpyt(last_artistAlbum.name, album ? album : _("Unknown Album"), sizeof(last_artistAlbum.name));
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached artist/album item: %s/%s/%X\n", last_artist.name, last_artist.parentID, last_artist.objectID);
-			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_artistAlbum.parentID, last_artistAlbum.objectID, last_artistAlbum.parentID, refID, class, (long long)detailID, name);
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_artistAlbumAll.parentID, last_artistAlbumAll.objectID, last_artistAlbumAll.parentID, refID, class, (long long)detailID, name);
+			insert_container(artist, MUSIC_ARTIST_ID, NULL, "person.musicArtist", NULL, genre, 0,
+			                 artist_id, sizeof(artist_id));
+			/* Add this file to the "- All Albums -" container as well */
+			insert_container(_("- All Albums -"), artist_id, NULL, "album", artist, genre, 0,
+			                 all_albums_id, sizeof(all_albums_id));
+			insert_container(album?album:_("Unknown Album"), artist_id, album?album_id:NULL,
+			                 "album.musicAlbum", artist, genre, album_art, artist_album_id, sizeof(artist_album_id));
+			insert_child(artist_album_id, refID, class, detailID, name);
+			insert_child(all_albums_id, refID, class, detailID, name);
 		}
 		if( genre )
 		{
-			if( !valid_cache || strcmp(genre, last_genre.name) != 0 )
-			{
-				insert_container(genre, MUSIC_GENRE_ID, NULL, "genre.musicGenre", NULL, NULL, NULL, &objectID, &parentID);
-				sprintf(last_genre.parentID, MUSIC_GENRE_ID"$%llX", (long long)parentID);
-				strncpyt(last_genre.name, genre, sizeof(last_genre.name));
-				/* Add this file to the "- All Artists -" container as well */
-				insert_container(_("- All Artists -"), last_genre.parentID, NULL, "person", NULL, genre, NULL, &objectID, &parentID);
-				sprintf(last_genreArtistAll.parentID, "%s$%llX", last_genre.parentID, (long long)parentID);
-				last_genreArtistAll.objectID = objectID;
-			}
-			else
-			{
-				last_genreArtistAll.objectID++;
-			}
-			if( valid_cache && strcmp(artist?artist:_("Unknown Artist"), last_genreArtist.name) == 0 )
-			{
-				last_genreArtist.objectID++;
-			}
-			else
-			{
-				insert_container(artist?artist:_("Unknown Artist"), last_genre.parentID, artist?last_artist.parentID:NULL,
-				                 "person.musicArtist", NULL, genre, NULL, &objectID, &parentID);
-				sprintf(last_genreArtist.parentID, "%s$%llX", last_genre.parentID, (long long)parentID);
-				last_genreArtist.objectID = objectID;
-				strncpyt(last_genreArtist.name, artist ? artist : _("Unknown Artist"), sizeof(last_genreArtist.name));
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached genre/artist item: %s/%s/%X\n", last_genreArtist.name, last_genreArtist.parentID, last_genreArtist.objectID);
-			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_genreArtist.parentID, last_genreArtist.objectID, last_genreArtist.parentID, refID, class, (long long)detailID, name);
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_genreArtistAll.parentID, last_genreArtistAll.objectID, last_genreArtistAll.parentID, refID, class, (long long)detailID, name);
+			insert_container(genre, MUSIC_GENRE_ID, NULL, "genre.musicGenre", NULL, NULL, 0,
+			                 genre_id, sizeof(genre_id));
+			/* Add this file to the "- All Artists -" container as well */
+			insert_container(_("- All Artists -"), genre_id, NULL, "person", NULL, genre, 0,
+			                 all_artists_id, sizeof(all_artists_id));
+			insert_container(artist?artist:_("Unknown Artist"), genre_id, artist?artist_id:NULL,
+			                 "person.musicArtist", NULL, genre, 0, genre_artist_id, sizeof(genre_artist_id));
+			insert_child(genre_artist_id, refID, class, detailID, name);
+			insert_child(all_artists_id, refID, class, detailID, name);
 		}
 		/* All Music */
-		if( !last_all_objectID )
-		{
-			last_all_objectID = get_next_available_id("OBJECTS", MUSIC_ALL_ID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('"MUSIC_ALL_ID"$%llX', '"MUSIC_ALL_ID"', '%s', '%s', %lld, %Q)",
-		             last_all_objectID++, refID, class, (long long)detailID, name);
+		insert_child(MUSIC_ALL_ID, refID, class, detailID, name);
 	}
 	else if( strstr(class, "videoItem") )
 	{
-		static long long last_all_objectID = 0;
-
 		/* All Videos */
-		if( !last_all_objectID )
-		{
-			last_all_objectID = get_next_available_id("OBJECTS", VIDEO_ALL_ID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('"VIDEO_ALL_ID"$%llX', '"VIDEO_ALL_ID"', '%s', '%s', %lld, %Q)",
-		             last_all_objectID++, refID, class, (long long)detailID, name);
-		return;
-	}
-	else
-	{
+		insert_child(VIDEO_ALL_ID, refID, class, detailID, name);
 		return;
 	}
-	sqlite3_free_table(result);
 	valid_cache = 1;
 }
 
@@ -445,51 +504,115 @@ insert_directory(const char *name, const char *path, const char *base, const cha
 	return detailID;
 }
 
-int
-insert_file(char *name, const char *path, const char *parentID, int object, media_types types)
+/* Outcome of parse_file() */
+enum parse_result {
+	PARSE_OK,		/* details parsed, ready to commit */
+	PARSE_QUICK,		/* a video listed by name only, see scan_enrich() */
+	PARSE_PLAYLIST,		/* a playlist, which the committing thread reads itself */
+	PARSE_SKIP,		/* not to be added, quietly */
+	PARSE_FAILED
+};
+
+/* Set while a fast scan is walking the media_dirs */
+static int quick_scan = 0;
+static void scan_enrich(void);
+
+/* The part of inserting a file that does not touch the database, and so
+ * may run on a scanner worker thread. */
+static enum parse_result
+parse_file(char *name, const char *path, media_types types, media_details_t *d)
 {
-	char class[32];
-	char objectID[64];
-	int64_t detailID = 0;
-	char base[8];
-	char *typedir_parentID;
-	char *baseid;
-	char *orig_name = NULL;
+	char *orig_name;
 
 	if( (types & TYPE_IMAGES) && is_image(name) )
 	{
 		if( is_album_art(name) )
-			return -1;
-		strcpy(base, IMAGE_DIR_ID);
-		strcpy(class, "item.imageItem.photo");
-		detailID = GetImageMetadata(path, name);
+			return PARSE_SKIP;
+		if( probe_cache_lookup(path, name, TYPE_IMAGES, d) == 0 ||
+		    ParseImageMetadata(path, name, d) == 0 )
+			return PARSE_OK;
 	}
 	else if( (types & TYPE_VIDEO) && is_video(name) )
 	{
+		if( probe_cache_lookup(path, name, TYPE_VIDEO, d) == 0 )
+			return PARSE_OK;
+		if( quick_scan && ParseVideoQuick(path, name, d) == 0 )
+			return PARSE_QUICK;
  		orig_name = strdup(name);
-		strcpy(base, VIDEO_DIR_ID);
-		strcpy(class, "item.videoItem");
-		detailID = GetVideoMetadata(path, name);
-		if( !detailID )
+		if( ParseVideoMetadata(path, name, d) == 0 )
+		{
+			free(orig_name);
+			return PARSE_OK;
+		}
+		if( orig_name )
 			strcpy(name, orig_name);
+		free(orig_name);
 	}
 	else if( is_playlist(name) )
 	{
+		return PARSE_PLAYLIST;
+	}
+	if( (types & TYPE_AUDIO) && is_audio(name) )
+	{
+		if( probe_cache_lookup(path, name, TYPE_AUDIO, d) == 0 ||
+		    ParseAudioMetadata(path, name, d) == 0 )
+			return PARSE_OK;
+	}
+
+	return PARSE_FAILED;
+}
+
+static int
+commit_file(char *name, const char *path, const char *parentID, int object,
+            enum parse_result parsed, media_details_t *d)
+{
+	char class[32];
+	char objectID[64];
+	int64_t detailID = 0;
+	char base[8];
+	char *typedir_parentID;
+	char *baseid;
+
+	switch( parsed )
+	{
+	case PARSE_OK:
+	case PARSE_QUICK:
+		break;
+	case PARSE_PLAYLIST:
 		if( insert_playlist(path, name) == 0 )
 			return 1;
+		/* fall through */
+	case PARSE_FAILED:
+		DPRINTF(E_WARN, L_SCANNER, "Unsuccessful getting details for %s!\n", path);
+		/* fall through */
+	default:
+		return -1;
 	}
-	if( !detailID && (types & TYPE_AUDIO) && is_audio(name) )
+
+	switch( d->type )
 	{
+	case TYPE_IMAGES:
+		strcpy(base, IMAGE_DIR_ID);
+		strcpy(class, "item.imageItem.photo");
+		break;
+	case TYPE_VIDEO:
+		strcpy(base, VIDEO_DIR_ID);
+		strcpy(class, "item.videoItem");
+		break;
+	default:
 		strcpy(base, MUSIC_DIR_ID);
 		strcpy(class, "item.audioItem.musicTrack");
-		detailID = GetAudioMetadata(path, name);
+		break;
 	}
-	free(orig_name);
+	detailID = CommitMetadata(d);
 	if( !detailID )
 	{
+		FreeMetadataDetails(d);
 		DPRINTF(E_WARN, L_SCANNER, "Unsuccessful getting details for %s!\n", path);
 		return -1;
 	}
+	if( parsed == PARSE_OK )
+		probe_cache_store(d);
 
 	sprintf(objectID, "%s%s$%X", BROWSEDIR_ID, parentID, object);
 
@@ -518,13 +641,28 @@ insert_file(char *name, const char *path, const char *parentID, int object, medi
 	             " ('%s%s$%X', '%s%s', '%s', '%s', %lld, '%q')",
 	             base, parentID, object, base, parentID, objectID, class, detailID, name);
 
-	insert_containers(name, path, objectID, class, detailID);
+	if( parsed == PARSE_QUICK )
+		sql_exec(db, "INSERT into ENRICH (DETAIL_ID) VALUES (%lld)", (long long)detailID);
+	else
+		insert_containers(name, objectID, class, detailID, d);
+	if( d->type == TYPE_IMAGES )
+		thumbgen_queue_photo(path, d->m.resolution, d->m.rotation);
+	FreeMetadataDetails(d);
 	return 0;
 }
 
+int
+insert_file(char *name, const char *path, const char *parentID, int object, media_types types)
+{
+	media_details_t d;
+
+	return commit_file(name, path, parentID, object, parse_file(name, path, types, &d), &d);
+}
+
 int
 CreateDatabase(void)
 {
+	char path[PATH_MAX];
 	int ret, i;
 	const char *containers[] = { "0","-1",   "root",
 	                        MUSIC_ID, "0", _("Music"),
@@ -549,12 +687,21 @@ CreateDatabase(void)
 			0 };
 
 	ret = sql_exec(db, create_objectTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = dict_create_tables();
 	if( ret != SQLITE_OK )
 		goto sql_failed;
 	ret = sql_exec(db, create_detailTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_detailView_sqlite);
 	if( ret != SQLITE_OK )
 		goto sql_failed;
 	ret = sql_exec(db, create_albumArtTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_albumArtTriggers_sqlite);
 	if( ret != SQLITE_OK )
 		goto sql_failed;
 	ret = sql_exec(db, create_captionTable_sqlite);
@@ -569,9 +716,41 @@ CreateDatabase(void)
 	ret = sql_exec(db, create_settingsTable_sqlite);
 	if( ret != SQLITE_OK )
 		goto sql_failed;
+	ret = sql_exec(db, create_enrichTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_seekIndexTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_seekIndexTrigger_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_renditionTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_renditionTrigger_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_exec(db, create_snapshotDirtyTable_sqlite);
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	if( GETFLAG(BROWSE_SNAPSHOT_MASK) )
+	{
+		ret = sql_exec(db, create_snapshotDirtyTriggers_sqlite);
+		if( ret != SQLITE_OK )
+			goto sql_failed;
+	}
 	ret = sql_exec(db, "INSERT into SETTINGS values ('UPDATE_ID', '0')");
 	if( ret != SQLITE_OK )
 		goto sql_failed;
+	/* Tells browse snapshots of an earlier database apart from this one's */
+	ret = sql_exec(db, "INSERT into SETTINGS values ('GENERATION', abs(random()))");
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	snprintf(path, sizeof(path), "%s/browse.snap", db_path);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/browse.live", db_path);
+	unlink(path);
 	for( i=0; containers[i]; i=i+3 )
 	{
 		ret = sql_exec(db, "INSERT into OBJECTS (OBJECT_ID, PARENT_ID, DETAIL_ID, CLASS, NAME)"
@@ -605,10 +784,14 @@ CreateDatabase(void)
 	sql_exec(db, "create INDEX IDX_OBJECTS_PARENT_ID ON OBJECTS(PARENT_ID);");
 	sql_exec(db, "create INDEX IDX_OBJECTS_DETAIL_ID ON OBJECTS(DETAIL_ID);");
 	sql_exec(db, "create INDEX IDX_OBJECTS_CLASS ON OBJECTS(CLASS);");
-	sql_exec(db, "create INDEX IDX_DETAILS_PATH ON DETAILS(PATH);");
-	sql_exec(db, "create INDEX IDX_DETAILS_ID ON DETAILS(ID);");
+	sql_exec(db, "create INDEX IDX_DETAILS_PATH ON DETAILS_DATA(PATH);");
+	sql_exec(db, "create INDEX IDX_DETAILS_ID ON DETAILS_DATA(ID);");
 	sql_exec(db, "create INDEX IDX_ALBUM_ART ON ALBUM_ART(ID);");
+	sql_exec(db, "create INDEX IDX_ALBUM_ART_PATH ON ALBUM_ART(PATH);");
+	sql_exec(db, "create INDEX IDX_RENDITIONS_USED ON RENDITIONS(USED);");
 	sql_exec(db, "create INDEX IDX_SCANNER_OPT ON OBJECTS(PARENT_ID, NAME, OBJECT_ID);");
+	/* Versioned from the start, so that an interrupted first scan can be resumed */
+	sql_exec(db, "pragma user_version = %d;", DB_VERSION);
 
 sql_failed:
 	if( ret != SQLITE_OK )
@@ -616,144 +799,557 @@ sql_failed:
 	return (ret != SQLITE_OK);
 }
 
-static inline int
-filter_hidden(scan_filter *d)
+/* Add or drop the SNAPSHOT_DIRTY triggers, so that nothing is recorded
+ * for a browse snapshot that is not in use.  Any snapshot on disk is
+ * stale once they come back, as changes went unrecorded meanwhile. */
+int
+snapshot_tracking(int enable)
 {
-	return (d->d_name[0] != '.');
-}
+	int have, ret;
 
-static int
-filter_type(scan_filter *d)
-{
-#if HAVE_STRUCT_DIRENT_D_TYPE
-	return ( (d->d_type == DT_DIR) ||
-	         (d->d_type == DT_LNK) ||
-	         (d->d_type == DT_UNKNOWN)
-	       );
-#else
-	return 1;
-#endif
-}
+	have = sql_get_int_field(db, "SELECT count(*) from sqlite_master where type = 'trigger' and name in"
+	                             " ('SNAPSHOT_DIRTY_ADD', 'SNAPSHOT_DIRTY_REMOVE', 'SNAPSHOT_DIRTY_DETAILS')");
+	if( have == (enable ? 3 : 0) )
+		return 0;
+	ret = sql_exec(db, "DROP TRIGGER if exists SNAPSHOT_DIRTY_ADD;"
+	                   "DROP TRIGGER if exists SNAPSHOT_DIRTY_REMOVE;"
+	                   "DROP TRIGGER if exists SNAPSHOT_DIRTY_DETAILS;"
+	                   "DELETE from SNAPSHOT_DIRTY");
+	if( ret == SQLITE_OK && enable )
+	{
+		ret = sql_exec(db, create_snapshotDirtyTriggers_sqlite);
+		if( ret == SQLITE_OK )
+			ret = sql_exec(db, "UPDATE SETTINGS set VALUE = abs(random()) where KEY = 'GENERATION'");
+	}
+	if( ret != SQLITE_OK )
+		DPRINTF(E_ERROR, L_DB_SQL, "Unable to %s browse snapshot tracking\n", enable ? "enable" : "disable");
 
-static int
-filter_a(scan_filter *d)
-{
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-		   (is_audio(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
+	return (ret != SQLITE_OK);
 }
 
+/* Keep folders, and the files of the media types scanned in this directory */
 static int
-filter_av(scan_filter *d)
+filter_entry(const char *name, unsigned char type, void *arg)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-		   (is_audio(d->d_name) ||
-		    is_video(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
+	media_types types = *(media_types *)arg;
+
+	if( name[0] == '.' )
+		return 0;
+	if( type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN )
+		return 1;
+	if( type != DT_REG )
+		return 0;
+	return ( ((types & TYPE_AUDIO) && (is_audio(name) || is_playlist(name))) ||
+	         ((types & TYPE_VIDEO) && is_video(name)) ||
+	         ((types & TYPE_IMAGES) && is_image(name)) );
 }
 
-static int
-filter_ap(scan_filter *d)
+/* The type of a listed entry, going to the filesystem only when the
+ * directory did not say, or for symlinks. */
+static enum file_types
+entry_type(int dirfd, const struct dir_entry *e, const char *full_path, media_types dir_types)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-		   (is_audio(d->d_name) ||
-		    is_image(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
+	if( e->type == DT_DIR )
+		return TYPE_DIR;
+	if( e->type == DT_REG )
+		return TYPE_FILE;
+	dir_stats.stats++;
+	return resolve_unknown_type_at(dirfd, e->name, full_path, dir_types);
 }
 
-static int
-filter_v(scan_filter *d)
+/* Directory mtime to record in DETAILS.TIMESTAMP before listing it.  A
+ * directory modified within the last second may still be changing under
+ * us, so it is not trusted and will be listed again on the next rescan. */
+static time_t
+dir_mtime(int fd)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-	           is_video(d->d_name)))
-	       );
+	struct stat st;
+
+	if( fstat(fd, &st) != 0 || st.st_mtime >= time(NULL) - 1 )
+		return 0;
+	return st.st_mtime;
 }
 
-static int
-filter_vp(scan_filter *d)
+/* Scan checkpoints.  While a media_dir is being scanned, SETTINGS holds
+ * 'scan_resume' (the media_dir) and 'scan_checkpoint': the highest OBJECTS,
+ * DETAILS_DATA, ALBUM_ART and PLAYLISTS IDs at the time the last directory
+ * was completed, followed by that directory's path.  Directories are
+ * completed in a fixed order, so an interrupted scan can drop whatever was
+ * written after the checkpoint and carry on from there. */
+static int checkpointing = 0;
+
+static void
+scan_checkpoint(const char *path)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-		   (is_video(d->d_name) ||
-	            is_image(d->d_name))))
-	       );
+	if( !checkpointing )
+		return;
+	sql_exec_bind(db, "UPDATE SETTINGS set VALUE ="
+	                  " (SELECT ifnull(max(ID), 0) from OBJECTS) || ' ' ||"
+	                  " (SELECT ifnull(max(ID), 0) from DETAILS_DATA) || ' ' ||"
+	                  " (SELECT ifnull(max(ID), 0) from ALBUM_ART) || ' ' ||"
+	                  " (SELECT ifnull(max(ID), 0) from PLAYLISTS) || ' ' || ?"
+	                  " where KEY = 'scan_checkpoint'", "t", path);
 }
 
-static int
-filter_p(scan_filter *d)
+/* The top level container of a media_dir, if it has one */
+static char *
+media_dir_container(const char *path)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-		   is_image(d->d_name)))
-	       );
+	return sql_get_text_field(db, "SELECT OBJECT_ID from OBJECTS o join DETAILS_DATA d on (d.ID = o.DETAIL_ID)"
+	                              " where d.PATH = %Q and o.OBJECT_ID glob '%s$*' and REF_ID is NULL",
+	                              path, BROWSEDIR_ID);
 }
 
-static int
-filter_avp(scan_filter *d)
+/* Returns 1 if what the database holds for 'media_path' was scanned
+ * with its current media types and the current top level layout. */
+int
+media_dir_matches(struct media_dir_s *media_path)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (is_reg(d) &&
-		   (is_audio(d->d_name) ||
-		    is_image(d->d_name) ||
-		    is_video(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
-}
+	char *container;
+	int top;
 
-static void
-ScanDirectory(const char *dir, const char *parent, media_types dir_types)
+	if( sql_get_int_field(db, "SELECT TIMESTAMP from DETAILS_DATA where PATH = %Q and TIMESTAMP != ''"
+	                          " order by ID limit 1", media_path->path) != media_path->types )
+		return 0;
+	container = media_dir_container(media_path->path);
+	top = (media_path->vfolder || (!GETFLAG(MERGE_MEDIA_DIRS_MASK) && media_dirs->next));
+	sqlite3_free(container);
+
+	return (top == (container != NULL));
+}
+
+/* Returns 1 if the scan of 'media_path' was interrupted, and can be
+ * picked up from its last checkpoint with the current settings. */
+int
+scan_interrupted(struct media_dir_s *media_path)
 {
-	struct dirent **namelist;
-	int i, n, startID = 0;
-	char *full_path;
-	char *name = NULL;
-	static long long unsigned int fileno = 0;
-	enum file_types type;
+	if( sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'scan_resume' and VALUE = %Q",
+	                      media_path->path) <= 0 )
+		return 0;
+	if( sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'scan_checkpoint'") <= 0 )
+		return 0;
+
+	return media_dir_matches(media_path);
+}
 
+/* Drop what an interrupted scan wrote after its last checkpoint, and
+ * return the path of the last directory it completed. */
+static char *
+scan_resume(const char *media_dir)
+{
+	long long objects, details, art, playlists;
+	char *val, *path = NULL;
+	int n = 0, orphans;
 
-	DPRINTF(parent?E_INFO:E_WARN, L_SCANNER, _("Scanning %s\n"), dir);
-	switch( dir_types )
+	val = sql_get_text_field(db, "SELECT VALUE from SETTINGS where KEY = 'scan_checkpoint'");
+	if( !val )
+		return NULL;
+	if( sscanf(val, "%lld %lld %lld %lld %n", &objects, &details, &art, &playlists, &n) == 4 && n &&
+	    strncmp(val + n, media_dir, strlen(media_dir)) == 0 )
+		path = strdup(val + n);
+	sqlite3_free(val);
+	if( !path )
+		return NULL;
+
+	sql_exec(db, "BEGIN");
+	sql_exec(db, "DELETE from OBJECTS where ID > %lld or DETAIL_ID > %lld", objects, details);
+	orphans = sqlite3_changes(db);
+	sql_exec(db, "DELETE from DETAILS_DATA where ID > %lld", details);
+	sql_exec(db, "DELETE from CAPTIONS where ID > %lld", details);
+	sql_exec(db, "DELETE from ALBUM_ART where ID > %lld", art);
+	sql_exec(db, "DELETE from PLAYLISTS where ID > %lld", playlists);
+	sql_exec(db, "COMMIT");
+	valid_cache = 0;
+	vc_flush();
+
+	DPRINTF(E_WARN, L_SCANNER, "Resuming scan of %s after %s (%d orphaned objects removed)\n",
+	        media_dir, path, orphans);
+	return path;
+}
+
+/* Parallel scanning.  ScanDirectory() queues what it finds on a ring of
+ * jobs, worker threads parse the files (tags, EXIF, libav probing), and
+ * the walking thread commits finished jobs to the database strictly in
+ * the order they were queued, so the result matches a serial scan.
+ * Folders go through the ring too, to keep them in order with the files
+ * around them.  With a single scanner thread, jobs are run in place. */
+enum scan_job_kind {
+	JOB_FILE,
+	JOB_DIR,
+	JOB_DIR_END,
+	JOB_ENRICH	/* parentID is the item's own OBJECT_ID */
+};
+
+struct scan_job {
+	enum scan_job_kind kind;
+	int done;
+	char *name;
+	char *path;
+	char *parentID;
+	int object;
+	media_types types;
+	time_t mtime;
+	int64_t detailID;
+	enum parse_result parsed;
+	media_details_t d;
+};
+
+static void enrich_commit(struct scan_job *job);
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* a job was queued, or the pool is stopping */
+	pthread_cond_t done;	/* a job was parsed */
+	struct scan_job *ring;
+	unsigned int size;
+	unsigned int head;	/* next job to commit */
+	unsigned int next;	/* next job to parse */
+	unsigned int tail;	/* next free slot */
+	int stop;
+	int nthreads;
+	pthread_t *threads;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static long long unsigned int scan_files = 0;
+
+/* Read rate limiting.  What the scanner actually reads from disk, through
+ * its own code and the parsing libraries alike, comes from /proc/self/io;
+ * parser threads check it before each file and sleep off any excess.  While
+ * clients are connected the stream rate applies, and 0 pauses the scan. */
+static struct {
+	pthread_mutex_t lock;
+	int rate;		/* KB/s the current window was started with */
+	int64_t bytes;		/* read_bytes at the start of the window */
+	int64_t start;		/* window start, usecs */
+	int paused;
+	int64_t waited;		/* usecs spent sleeping, for the stats */
+} throttle = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t
+io_read_bytes(void)
+{
+	char buf[512], *p;
+	ssize_t len;
+	int fd;
+
+	fd = open("/proc/self/io", O_RDONLY);
+	if( fd < 0 )
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if( len <= 0 )
+		return -1;
+	buf[len] = '\0';
+	p = strstr(buf, "\nread_bytes:");
+	if( !p )
+		return -1;
+
+	return strtoll(p + 12, NULL, 10);
+}
+
+static int64_t
+now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+scan_throttle(void)
+{
+	int64_t bytes, now, allowed, delay = 0;
+	int rate, busy;
+
+	for (;;)
 	{
-		case ALL_MEDIA:
-			n = scandir(dir, &namelist, filter_avp, alphasort);
-			break;
-		case TYPE_AUDIO:
-			n = scandir(dir, &namelist, filter_a, alphasort);
-			break;
-		case TYPE_AUDIO|TYPE_VIDEO:
-			n = scandir(dir, &namelist, filter_av, alphasort);
-			break;
-		case TYPE_AUDIO|TYPE_IMAGES:
-			n = scandir(dir, &namelist, filter_ap, alphasort);
-			break;
-		case TYPE_VIDEO:
-			n = scandir(dir, &namelist, filter_v, alphasort);
+		busy = process_active_connections() > 0;
+		rate = busy ? runtime_vars.scanner_stream_rate : runtime_vars.scanner_read_rate;
+		if( rate > 0 || !busy || quitting )
 			break;
-		case TYPE_VIDEO|TYPE_IMAGES:
-			n = scandir(dir, &namelist, filter_vp, alphasort);
-			break;
-		case TYPE_IMAGES:
-			n = scandir(dir, &namelist, filter_p, alphasort);
+		pthread_mutex_lock(&throttle.lock);
+		if( !throttle.paused )
+			DPRINTF(E_INFO, L_SCANNER, "Clients connected, pausing scan\n");
+		throttle.paused = 1;
+		throttle.waited += 1000000;
+		pthread_mutex_unlock(&throttle.lock);
+		sleep(1);
+	}
+
+	pthread_mutex_lock(&throttle.lock);
+	if( throttle.paused )
+		DPRINTF(E_INFO, L_SCANNER, "Resuming scan\n");
+	throttle.paused = 0;
+	if( rate <= 0 )
+	{
+		pthread_mutex_unlock(&throttle.lock);
+		return;
+	}
+	bytes = io_read_bytes();
+	now = now_usecs();
+	if( bytes < 0 )
+	{
+		/* No I/O accounting in this kernel */
+		pthread_mutex_unlock(&throttle.lock);
+		return;
+	}
+	allowed = (now - throttle.start) * rate * 1024 / 1000000;
+	if( rate != throttle.rate || !throttle.start )
+	{
+		throttle.rate = rate;
+		throttle.start = now;
+		throttle.bytes = bytes;
+	}
+	else if( bytes - throttle.bytes > allowed )
+	{
+		delay = (bytes - throttle.bytes - allowed) * 1000000 / ((int64_t)rate * 1024);
+		delay = MIN(delay, 5000000);
+		throttle.waited += delay;
+	}
+	else if( now - throttle.start > 1000000 )
+	{
+		/* Under budget: don't let idle time build up into a burst */
+		throttle.start = now;
+		throttle.bytes = bytes;
+	}
+	pthread_mutex_unlock(&throttle.lock);
+
+	if( delay )
+		usleep(delay);
+}
+
+static void *
+scan_worker(void *arg)
+{
+	struct scan_job *job;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;)
+	{
+		while( pool.next == pool.tail && !pool.stop )
+			pthread_cond_wait(&pool.work, &pool.lock);
+		if( pool.next == pool.tail )
 			break;
-		default:
-			n = -1;
-			errno = EINVAL;
+		job = &pool.ring[pool.next++ % pool.size];
+		pthread_mutex_unlock(&pool.lock);
+		if( job->kind == JOB_FILE || job->kind == JOB_ENRICH )
+		{
+			scan_throttle();
+			job->parsed = parse_file(job->name, job->path, job->types, &job->d);
+		}
+		pthread_mutex_lock(&pool.lock);
+		job->done = 1;
+		pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+static void
+scan_commit(struct scan_job *job)
+{
+	char objectID[64];
+
+	switch( job->kind )
+	{
+	case JOB_FILE:
+		if( commit_file(job->name, job->path, job->parentID, job->object, job->parsed, &job->d) == 0 )
+			scan_files++;
+		break;
+	case JOB_DIR:
+		insert_directory(job->name, job->path, BROWSEDIR_ID, job->parentID, job->object);
+		break;
+	case JOB_DIR_END:
+		/* TIMESTAMP holds the directory mtime, for incremental rescans */
+		snprintf(objectID, sizeof(objectID), "%s%s", BROWSEDIR_ID, job->parentID);
+		sql_exec_bind(db, "UPDATE DETAILS_DATA set TIMESTAMP = ? where ID ="
+		                  " (SELECT DETAIL_ID from OBJECTS where OBJECT_ID = ?)", "it",
+		              (int64_t)job->mtime, objectID);
+		scan_checkpoint(job->path);
+		break;
+	case JOB_ENRICH:
+		enrich_commit(job);
+		break;
+	}
+	free(job->name);
+	free(job->path);
+	free(job->parentID);
+}
+
+/* Commit finished jobs in queue order, waiting for the workers until no
+ * more than 'keep' jobs are left queued. */
+static void
+scan_drain(unsigned int keep)
+{
+	struct scan_job *job;
+
+	if( !pool.nthreads )
+		return;
+	pthread_mutex_lock(&pool.lock);
+	while( pool.head != pool.tail )
+	{
+		job = &pool.ring[pool.head % pool.size];
+		if( !job->done )
+		{
+			if( pool.tail - pool.head <= keep )
+				break;
+			pthread_cond_wait(&pool.done, &pool.lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool.lock);
+		scan_commit(job);
+		pthread_mutex_lock(&pool.lock);
+		pool.head++;
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* Let the workers parse everything queued, then commit it all in one
+ * transaction, so that the write lock is only held for the inserts */
+static void
+scan_commit_parsed(void)
+{
+	unsigned int i;
+
+	if( !pool.nthreads )
+		return;
+	pthread_mutex_lock(&pool.lock);
+	for( i = pool.head; i != pool.tail; i++ )
+	{
+		while( !pool.ring[i % pool.size].done )
+			pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	sql_exec(db, "BEGIN");
+	scan_drain(0);
+	sql_exec(db, "COMMIT");
+}
+
+/* Queue a job; takes ownership of 'name' */
+static void
+scan_queue(enum scan_job_kind kind, char *name, const char *path, const char *parentID,
+           int object, media_types types, time_t mtime, int64_t detailID)
+{
+	struct scan_job local, *job = &local;
+
+	if( pool.nthreads )
+	{
+		scan_drain(pool.size - 1);
+		job = &pool.ring[pool.tail % pool.size];
+	}
+	job->kind = kind;
+	job->done = 0;
+	job->name = name;
+	job->path = strdup(path);
+	job->parentID = strdup(parentID);
+	job->object = object;
+	job->types = types;
+	job->mtime = mtime;
+	job->detailID = detailID;
+
+	if( !pool.nthreads )
+	{
+		if( kind == JOB_FILE || kind == JOB_ENRICH )
+		{
+			scan_throttle();
+			job->parsed = parse_file(job->name, job->path, job->types, &job->d);
+		}
+		scan_commit(job);
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.tail++;
+	pthread_cond_signal(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void
+scan_pool_start(void)
+{
+	int i, n = runtime_vars.scanner_threads;
+
+	if( n <= 0 )
+	{
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		n = MIN(MAX(n, 1), 8);
+	}
+	pool.nthreads = 0;
+	if( n <= 1 )
+		return;
+
+	pool.size = n * 4;
+	pool.ring = calloc(pool.size, sizeof(struct scan_job));
+	pool.threads = calloc(n, sizeof(pthread_t));
+	if( !pool.ring || !pool.threads )
+		goto serial;
+	pool.head = pool.next = pool.tail = 0;
+	pool.stop = 0;
+	for( i = 0; i < n; i++ )
+	{
+		if( pthread_create(&pool.threads[i], NULL, scan_worker, NULL) != 0 )
 			break;
+		pool.nthreads++;
+	}
+	if( pool.nthreads )
+	{
+		DPRINTF(E_INFO, L_SCANNER, "Scanning with %d parser threads\n", pool.nthreads);
+		return;
 	}
+serial:
+	DPRINTF(E_WARN, L_SCANNER, "Failed to start scanner threads, scanning serially\n");
+	free(pool.ring);
+	free(pool.threads);
+	pool.ring = NULL;
+	pool.threads = NULL;
+}
+
+static void
+scan_pool_stop(void)
+{
+	int i;
+
+	if( !pool.nthreads )
+		return;
+	scan_drain(0);
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	for( i = 0; i < pool.nthreads; i++ )
+		pthread_join(pool.threads[i], NULL);
+	pool.nthreads = 0;
+	free(pool.ring);
+	free(pool.threads);
+	pool.ring = NULL;
+	pool.threads = NULL;
+}
+
+/* Scan the directory 'dir', open as 'fd'.  When resuming an interrupted
+ * scan, 'resume' is the path relative to 'dir' of the last directory that
+ * was completed below it, or "" if none was; entries up to that point are
+ * already in the database. */
+static void
+ScanDirectory(int fd, const char *dir, const char *parent, media_types dir_types, const char *resume)
+{
+	struct dir_list list;
+	int i, n, subfd, id, startID = 0, nextID = 0;
+	char *full_path;
+	char *name = NULL;
+	char first[NAME_MAX+1];
+	const char *rest = NULL;
+	enum file_types type;
+
+
+	DPRINTF(parent?E_INFO:E_WARN, L_SCANNER, _("Scanning %s\n"), dir);
+	n = dir_list_read(fd, &list, filter_entry, &dir_types, DIR_SORT_COLLATE);
 	if( n < 0 )
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Error scanning %s [%s]\n",
@@ -765,6 +1361,7 @@ ScanDirectory(const char *dir, const char *parent, media_types dir_types)
 	if (!full_path)
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Memory allocation failed scanning %s\n", dir);
+		dir_list_free(&list);
 		return;
 	}
 
@@ -772,49 +1369,94 @@ ScanDirectory(const char *dir, const char *parent, media_types dir_types)
 	{
 		startID = get_next_available_id("OBJECTS", BROWSEDIR_ID);
 	}
+	if( resume )
+	{
+		/* Entries may have come or gone since, so never reuse an ID */
+		snprintf(full_path, PATH_MAX, "%s%s", BROWSEDIR_ID, THISORNUL(parent));
+		nextID = get_next_available_id("OBJECTS", full_path);
+		rest = strchr(resume, '/');
+		snprintf(first, sizeof(first), "%.*s", rest ? (int)(rest - resume) : (int)strlen(resume), resume);
+		if( rest )
+			rest++;
+	}
 
 	for (i=0; i < n; i++)
 	{
+		const struct dir_entry *e = &list.entries[i];
+		char *resume_id = NULL;
 #if !USE_FORK
 		if( quitting )
 			break;
 #endif
-		type = TYPE_UNKNOWN;
-		snprintf(full_path, PATH_MAX, "%s/%s", dir, namelist[i]->d_name);
-		name = escape_tag(namelist[i]->d_name, 1);
-		if( is_dir(namelist[i]) == 1 )
-		{
-			type = TYPE_DIR;
-		}
-		else if( is_reg(namelist[i]) == 1 )
-		{
-			type = TYPE_FILE;
-		}
-		else
+		if( resume && *first )
 		{
-			type = resolve_unknown_type(full_path, dir_types);
+			int cmp = strcoll(e->name, first);
+			/* Done already, unless it is the directory that was in progress */
+			if( cmp < 0 || (cmp == 0 && !rest) )
+				continue;
+			if( cmp == 0 )
+			{
+				snprintf(full_path, PATH_MAX, "%s/%s", dir, e->name);
+				resume_id = sql_get_text_field(db, "SELECT OBJECT_ID from OBJECTS o"
+				                                   " join DETAILS_DATA d on (d.ID = o.DETAIL_ID)"
+				                                   " where d.PATH = %Q and o.PARENT_ID = '%s%s'",
+				                                   full_path, BROWSEDIR_ID, THISORNUL(parent));
+			}
 		}
-		if( (type == TYPE_DIR) && (access(full_path, R_OK|X_OK) == 0) )
+		snprintf(full_path, PATH_MAX, "%s/%s", dir, e->name);
+		type = entry_type(fd, e, full_path, dir_types);
+		if( type == TYPE_DIR )
 		{
 			char *parent_id;
-			insert_directory(name, full_path, BROWSEDIR_ID, THISORNUL(parent), i+startID);
-			xasprintf(&parent_id, "%s$%X", THISORNUL(parent), i+startID);
-			ScanDirectory(full_path, parent_id, dir_types);
+			time_t mtime;
+			dir_stats.access++;
+			if( faccessat(fd, e->name, R_OK|X_OK, 0) != 0 ||
+			    (subfd = dir_open_at(fd, e->name)) < 0 )
+			{
+				sqlite3_free(resume_id);
+				continue;
+			}
+			if( resume_id )
+			{
+				/* Finish the directory the interrupted scan was in.  Its
+				 * mtime is not recorded, so that a rescan lists it again. */
+				parent_id = strdup(resume_id + strlen(BROWSEDIR_ID));
+				sqlite3_free(resume_id);
+				ScanDirectory(subfd, full_path, parent_id, dir_types, rest);
+				mtime = 0;
+			}
+			else
+			{
+				id = MAX(i + startID, nextID);
+				nextID = id + 1;
+				mtime = dir_mtime(subfd);
+				name = escape_tag(e->name, 1);
+				scan_queue(JOB_DIR, name, full_path, THISORNUL(parent), id, dir_types, 0, 0);
+				xasprintf(&parent_id, "%s$%X", THISORNUL(parent), id);
+				ScanDirectory(subfd, full_path, parent_id, dir_types, NULL);
+			}
+			close(subfd);
+			scan_queue(JOB_DIR_END, NULL, full_path, parent_id, 0, dir_types, mtime, 0);
 			free(parent_id);
 		}
-		else if( type == TYPE_FILE && (access(full_path, R_OK) == 0) )
+		else if( type == TYPE_FILE )
 		{
-			if( insert_file(name, full_path, THISORNUL(parent), i+startID, dir_types) == 0 )
-				fileno++;
+			/* Unreadable files are reported when their metadata is parsed */
+			id = MAX(i + startID, nextID);
+			nextID = id + 1;
+			name = escape_tag(e->name, 1);
+			scan_queue(JOB_FILE, name, full_path, THISORNUL(parent), id, dir_types, 0, 0);
+			sqlite3_free(resume_id);
 		}
-		free(name);
-		free(namelist[i]);
+		else
+			sqlite3_free(resume_id);
 	}
-	free(namelist);
+	dir_list_free(&list);
 	free(full_path);
 	if( !parent )
 	{
-		DPRINTF(E_WARN, L_SCANNER, _("Scanning %s finished (%llu files)!\n"), dir, fileno);
+		scan_drain(0);
+		DPRINTF(E_WARN, L_SCANNER, _("Scanning %s finished (%llu files)!\n"), dir, scan_files);
 	}
 }
 
@@ -853,26 +1495,36 @@ _notify_stop(void)
 #endif
 }
 
-void
-start_scanner()
+static void
+scan_media_dir(struct media_dir_s *media_path)
 {
-	struct media_dir_s *media_path;
 	char path[MAXPATHLEN];
-	char *parent_id = NULL;
-
-	if (setpriority(PRIO_PROCESS, 0, 15) == -1)
-		DPRINTF(E_WARN, L_INOTIFY,  "Failed to reduce scanner thread priority\n");
-	_notify_start();
+	char *parent_id;
+	char *bname;
+	char *checkpoint = NULL;
+	const char *resume = NULL;
+	int64_t id;
+	int fd;
 
-	setlocale(LC_COLLATE, "");
-
-	av_register_all();
-	av_log_set_level(AV_LOG_PANIC);
-	for( media_path = media_dirs; media_path != NULL; media_path = media_path->next )
+	if( scan_interrupted(media_path) && (checkpoint = scan_resume(media_path->path)) )
+	{
+		parent_id = media_dir_container(media_path->path);
+		if( parent_id )
+		{
+			char *p = strdup(parent_id + strlen(BROWSEDIR_ID));
+			sqlite3_free(parent_id);
+			parent_id = p;
+		}
+		resume = checkpoint + strlen(media_path->path);
+		if( *resume == '/' )
+			resume++;
+	}
+	else
 	{
-		int64_t id;
+		if( sql_get_int_field(db, "SELECT count(*) from DETAILS_DATA where PATH = %Q", media_path->path) > 0 )
+			remove_media_dir(media_path->path);
+		sql_exec(db, "DELETE from SETTINGS where KEY in ('scan_resume', 'scan_checkpoint')");
 		parent_id = GetParentID(media_path);
-		char *bname = NULL;
 		strncpyt(path, media_path->path, sizeof(path));
 		bname = basename(path);
 		/* If there are multiple media locations, add a level to the ContentDirectory */
@@ -886,21 +1538,82 @@ start_scanner()
 			id = GetFolderMetadata(bname, media_path->path, NULL, NULL, 0);
 
 		/* Use TIMESTAMP to store the media type */
-		sql_exec(db, "UPDATE DETAILS set TIMESTAMP = %d where ID = %lld", media_path->types, (long long)id);
-		ScanDirectory(media_path->path, parent_id, media_path->types);
-		sql_exec(db, "INSERT into SETTINGS values (%Q, %Q)", "media_dir", media_path->path);
-		if(parent_id != NULL)
-		{
-			free(parent_id);
-			parent_id = NULL;
-		}
+		sql_exec(db, "UPDATE DETAILS_DATA set TIMESTAMP = %d where ID = %lld", media_path->types, (long long)id);
+		sql_exec(db, "INSERT into SETTINGS values ('scan_resume', %Q)", media_path->path);
+		sql_exec(db, "INSERT into SETTINGS values ('scan_checkpoint', '')");
 	}
-	_notify_stop();
-	/* Create this index after scanning, so it doesn't slow down the scanning process.
-	 * This index is very useful for large libraries used with an XBox360 (or any
-	 * client that uses UPnPSearch on large containers). */
-	sql_exec(db, "create INDEX IDX_SEARCH_OPT ON OBJECTS(OBJECT_ID, CLASS, DETAIL_ID);");
+	checkpointing = 1;
+	if( !checkpoint )
+		scan_checkpoint(media_path->path);
+	fd = dir_open_at(AT_FDCWD, media_path->path);
+	if( fd >= 0 )
+	{
+		ScanDirectory(fd, media_path->path, parent_id, media_path->types, resume);
+		close(fd);
+	}
+	else
+		DPRINTF(E_WARN, L_SCANNER, "Error scanning %s [%s]\n", media_path->path, strerror(errno));
+	scan_drain(0);
+	checkpointing = 0;
+#if !USE_FORK
+	/* Leave the checkpoint for the next start to pick up */
+	if( quitting )
+	{
+		free(checkpoint);
+		free(parent_id);
+		return;
+	}
+#endif
+	sql_exec(db, "DELETE from SETTINGS where KEY in ('scan_resume', 'scan_checkpoint')");
+	sql_exec(db, "INSERT into SETTINGS values (%Q, %Q)", "media_dir", media_path->path);
+	free(checkpoint);
+	free(parent_id);
+}
+
+static void
+scanner_init(void)
+{
+	if (setpriority(PRIO_PROCESS, 0, 15) == -1)
+		DPRINTF(E_WARN, L_INOTIFY,  "Failed to reduce scanner thread priority\n");
+	/* Before the parser threads are started, so they inherit it */
+	if (process_set_idle_io() == -1)
+		DPRINTF(E_INFO, L_SCANNER, "Failed to set idle I/O priority: %s\n", strerror(errno));
+	_notify_start();
+
+	setlocale(LC_COLLATE, "");
 
+	av_register_all();
+	av_log_set_level(AV_LOG_PANIC);
+	lav_thread_init();
+	thumbgen_start();
+	probe_cache_open();
+	quick_scan = GETFLAG(FAST_SCAN_MASK) ? 1 : 0;
+	scan_pool_start();
+	vc_enable(1);
+	memset(&dir_stats, 0, sizeof(dir_stats));
+	memset(&sql_counters, 0, sizeof(sql_counters));
+	memset(&video_probe_stats, 0, sizeof(video_probe_stats));
+	scan_files = 0;
+	throttle.start = 0;
+	throttle.waited = 0;
+}
+
+static void
+scanner_done(void)
+{
+	int64_t size, cache;
+
+	scan_pool_stop();
+	DPRINTF(E_INFO, L_SCANNER, "%llu files added with %lu queries and %lu writes (%.2f queries per file)\n",
+	        scan_files, sql_counters.reads, sql_counters.writes,
+	        scan_files ? (double)sql_counters.reads / scan_files : 0.0);
+	if( throttle.waited )
+		DPRINTF(E_INFO, L_SCANNER, "Scan yielded to clients or the read limit for %lld ms\n",
+		        (long long)(throttle.waited / 1000));
+	vc_enable(0);
+	probe_cache_close();
+	/* Album art in the database may still be waiting to be resized */
+	thumbgen_stop(1);
 	if( GETFLAG(NO_PLAYLIST_MASK) )
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Playlist creation disabled\n");	  
@@ -910,7 +1623,528 @@ start_scanner()
 		fill_playlists();
 	}
 
+	DPRINTF(E_INFO, L_SCANNER, "Walked %u directories, %u entries: %u directory reads, "
+	        "%u opens, %u stats, %u access checks, %llu ms listing\n",
+	        dir_stats.dirs, dir_stats.entries, dir_stats.reads, dir_stats.opens,
+	        dir_stats.stats, dir_stats.access, (unsigned long long)dir_stats.usec / 1000);
+	if( video_probe_stats.files )
+		DPRINTF(E_INFO, L_SCANNER, "Probed %lu videos, %llu KB read per video, %lu probed again without limits\n",
+		        video_probe_stats.files,
+		        (unsigned long long)(video_probe_stats.bytes / video_probe_stats.files / 1024),
+		        video_probe_stats.retries);
+	dict_purge();
+	size = sql_get_db_size(db, &cache);
+	DPRINTF(E_INFO, L_DB_SQL, "Database size %lld KB, page cache limit %lld KB\n",
+		(long long)size / 1024, (long long)cache / 1024);
+}
+
+void
+start_scanner()
+{
+	struct media_dir_s *media_path;
+	time_t start = time(NULL);
+
+	scanner_init();
+	for( media_path = media_dirs; media_path != NULL; media_path = media_path->next )
+		scan_media_dir(media_path);
+	scan_enrich();
+	/* Every file still around has just been looked up or stored */
+	if( !quitting )
+		probe_cache_expire(start - PROBE_CACHE_KEEP);
+	_notify_stop();
+	/* Create this index after scanning, so it doesn't slow down the scanning process.
+	 * This index is very useful for large libraries used with an XBox360 (or any
+	 * client that uses UPnPSearch on large containers). */
+	sql_exec(db, "create INDEX IDX_SEARCH_OPT ON OBJECTS(OBJECT_ID, CLASS, DETAIL_ID);");
+
+	scanner_done();
 	DPRINTF(E_DEBUG, L_SCANNER, "Initial file scan completed\n");
 	//JM: Set up a db version number, so we know if we need to rebuild due to a new structure.
 	sql_exec(db, "pragma user_version = %d;", DB_VERSION);
 }
+
+/* Drop the rows for 'path' and everything below it: items and folders,
+ * playlists, captions, album art references and cached thumbnails. */
+static int
+remove_subtree(const char *path)
+{
+	char art_cache[MAXPATHLEN];
+	char *sql, **result;
+	int rows, i, ret;
+
+	valid_cache = 0;
+	sql = sqlite3_mprintf("SELECT ID from PLAYLISTS where PATH > '%q/' and PATH <= '%q/%c'",
+	                      path, path, 0xFF);
+	if( sql_get_table(db, sql, &result, &rows, NULL) == SQLITE_OK )
+	{
+		for( i = 1; i <= rows; i++ )
+		{
+			long long plID = strtoll(result[i], NULL, 10);
+			sql_exec(db, "DELETE from OBJECTS where OBJECT_ID = '%s$%llX' or PARENT_ID = '%s$%llX'",
+			         MUSIC_PLIST_ID, plID, MUSIC_PLIST_ID, plID);
+		}
+		sqlite3_free_table(result);
+	}
+	sqlite3_free(sql);
+	sql_exec(db, "DELETE from PLAYLISTS where PATH > '%q/' and PATH <= '%q/%c'", path, path, 0xFF);
+	sql_exec(db, "DELETE from OBJECTS where DETAIL_ID in (SELECT ID from DETAILS_DATA"
+	             " where (PATH > '%q/' and PATH <= '%q/%c') or PATH = '%q')",
+	             path, path, 0xFF, path);
+	ret = sql_exec(db, "DELETE from DETAILS_DATA where (PATH > '%q/' and PATH <= '%q/%c') or PATH = '%q'",
+	               path, path, 0xFF, path);
+	sql_exec(db, "DELETE from ALBUM_ART where PATH > '%q/' and PATH <= '%q/%c'", path, path, 0xFF);
+	sql_exec(db, "DELETE from ALBUM_ART where PATH > '%q/art_cache%q/' and PATH <= '%q/art_cache%q/%c'",
+	         db_path, path, db_path, path, 0xFF);
+	sql_exec(db, "DELETE from CAPTIONS where PATH > '%q/' and PATH <= '%q/%c'", path, path, 0xFF);
+
+	snprintf(art_cache, sizeof(art_cache), "%s/art_cache%s", db_path, path);
+	remove_dir(art_cache);
+
+	return ret;
+}
+
+/* Generated containers (genre, artist, album, date, per-type folders, ...)
+ * are at least two levels deep; prune the ones left without children,
+ * then any folder details nothing refers to any more. */
+static void
+prune_containers(void)
+{
+	int changes;
+
+	do {
+		sql_exec(db, "DELETE from OBJECTS where CLASS glob 'container*'"
+		             " and OBJECT_ID glob '*$*$*' and OBJECT_ID not glob '%q$*'"
+		             " and OBJECT_ID not glob '%q$*'"
+		             " and OBJECT_ID not in (SELECT distinct PARENT_ID from OBJECTS)",
+		             BROWSEDIR_ID, MUSIC_PLIST_ID);
+		changes = sqlite3_changes(db);
+	} while( changes > 0 );
+	vc_flush();
+	sql_exec(db, "DELETE from DETAILS_DATA where PATH is NULL and ID not in"
+	             " (SELECT distinct DETAIL_ID from OBJECTS where DETAIL_ID is not NULL)");
+}
+
+/* Drop everything that was scanned from media_dir 'path'.  Runs as a
+ * single transaction so clients see either the old or the new tree. */
+int
+remove_media_dir(const char *path)
+{
+	int ret;
+
+	DPRINTF(E_WARN, L_SCANNER, "Removing media_dir %s from the database\n", path);
+	sql_exec(db, "BEGIN");
+	ret = remove_subtree(path);
+	prune_containers();
+	album_art_gc();
+	sql_exec(db, "DELETE from SETTINGS where KEY = 'media_dir' and VALUE = %Q", path);
+	if( sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'scan_resume' and VALUE = %Q", path) > 0 )
+		sql_exec(db, "DELETE from SETTINGS where KEY in ('scan_resume', 'scan_checkpoint')");
+	sql_exec(db, "COMMIT");
+
+	return ret;
+}
+
+static struct {
+	unsigned int dirs, listed, added, changed, removed;
+} rescan_stats;
+
+static void
+rescan_remove_file(int64_t detailID, const char *path)
+{
+	char art_cache[MAXPATHLEN];
+
+	sql_exec_bind(db, "DELETE from OBJECTS where DETAIL_ID = ?", "i", detailID);
+	sql_exec_bind(db, "DELETE from DETAILS_DATA where ID = ?", "i", detailID);
+	snprintf(art_cache, sizeof(art_cache), "%s/art_cache%s", db_path, path);
+	if( strlen(art_cache) > 4 )
+		strcpy(strchr(art_cache, '\0')-4, ".jpg");
+	remove(art_cache);
+	thumbgen_remove(path);
+}
+
+/* Second pass of a fast scan.  The videos listed in ENRICH only have a
+ * name, size and date; read them through the worker pool like any other
+ * file, overwrite their DETAILS row in place and add them to the virtual
+ * containers.  Batches are committed one at a time, so clients browsing
+ * meanwhile see the details fill in as the main process bumps the
+ * SystemUpdateID.  Whatever is left when interrupted stays in ENRICH for
+ * the next start. */
+#define ENRICH_BATCH 64
+
+static unsigned int enrich_removed;
+
+static media_types
+media_dir_types(const char *path)
+{
+	struct media_dir_s *m, *best = NULL;
+	size_t len;
+
+	for( m = media_dirs; m; m = m->next )
+	{
+		len = strlen(m->path);
+		if( strncmp(path, m->path, len) == 0 && (path[len] == '/' || path[len] == '\0') &&
+		    (!best || len > strlen(best->path)) )
+			best = m;
+	}
+
+	return best ? best->types : TYPE_VIDEO;
+}
+
+static void
+enrich_commit(struct scan_job *job)
+{
+	char *parent, *sep;
+	int object;
+
+	sql_exec(db, "DELETE from ENRICH where DETAIL_ID = %lld", (long long)job->detailID);
+	if( job->parsed == PARSE_OK && job->d.type == TYPE_VIDEO )
+	{
+		job->d.id = job->detailID;
+		if( CommitMetadata(&job->d) )
+		{
+			probe_cache_store(&job->d);
+			insert_containers(job->name, job->parentID, "item.videoItem", job->detailID, &job->d);
+		}
+		FreeMetadataDetails(&job->d);
+		return;
+	}
+
+	/* Not a video after all; a full scan would have added it as audio,
+	 * or not at all */
+	rescan_remove_file(job->detailID, job->path);
+	enrich_removed++;
+	parent = strdup(job->parentID + strlen(BROWSEDIR_ID));
+	sep = parent ? strrchr(parent, '$') : NULL;
+	if( sep )
+	{
+		object = strtol(sep + 1, NULL, 16);
+		*sep = '\0';
+		commit_file(job->name, job->path, parent, object, job->parsed, &job->d);
+	}
+	else if( job->parsed == PARSE_OK )
+		FreeMetadataDetails(&job->d);
+	free(parent);
+}
+
+static void
+scan_enrich(void)
+{
+	char *sql, **result, *name;
+	int rows, i, total, done = 0;
+	int64_t id, last = 0;
+
+	quick_scan = 0;
+	sql_exec(db, "DELETE from ENRICH where DETAIL_ID not in (SELECT ID from DETAILS_DATA)");
+	total = sql_get_int_field(db, "SELECT count(*) from ENRICH");
+	if( total <= 0 )
+		return;
+	DPRINTF(E_WARN, L_SCANNER, "Reading the details of %d videos\n", total);
+	enrich_removed = 0;
+	while( !quitting )
+	{
+		sql = sqlite3_mprintf("SELECT e.DETAIL_ID, d.PATH, o.OBJECT_ID from ENRICH e"
+		                      " join DETAILS_DATA d on (d.ID = e.DETAIL_ID)"
+		                      " join OBJECTS o on (o.DETAIL_ID = e.DETAIL_ID and o.REF_ID is NULL)"
+		                      " where e.DETAIL_ID > %lld order by e.DETAIL_ID limit %d",
+		                      (long long)last, ENRICH_BATCH);
+		if( sql_get_table(db, sql, &result, &rows, NULL) != SQLITE_OK )
+			rows = -1;
+		sqlite3_free(sql);
+		if( rows <= 0 )
+		{
+			if( rows == 0 )
+				sqlite3_free_table(result);
+			break;
+		}
+		for( i = 1; i <= rows; i++ )
+		{
+			const char *path = result[i*3+1];
+
+			/* Probing videos is slow; don't hold the database meanwhile */
+			if( pool.nthreads && pool.tail - pool.head >= pool.size )
+				scan_commit_parsed();
+			id = strtoll(result[i*3], NULL, 10);
+			name = strdup(strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+			if( name )
+				scan_queue(JOB_ENRICH, name, path, result[i*3+2], 0,
+				           media_dir_types(path), 0, id);
+			last = id;
+		}
+		scan_commit_parsed();
+		sqlite3_free_table(result);
+		done += rows;
+		DPRINTF(E_INFO, L_SCANNER, "Read the details of %d/%d videos\n", done, total);
+	}
+	if( quitting )
+		return;
+	/* Rows without a browse object of their own */
+	sql_exec(db, "DELETE from ENRICH");
+	if( enrich_removed )
+		prune_containers();
+}
+
+/* Add a file or directory the database does not know about yet.  'd_name'
+ * is relative to the directory 'dirfd'.  Returns 1 if something was inserted. */
+static int
+rescan_insert(int dirfd, const char *d_name, const char *full_path, enum file_types type,
+              const char *parent, media_types dir_types)
+{
+	char *container, *name, *parent_id;
+	int64_t detailID;
+	int objectID, fd, ret = 0;
+	time_t mtime;
+
+	if( type == TYPE_FILE && is_playlist(d_name) &&
+	    sql_get_int_field_bind(db, "SELECT ID from PLAYLISTS where PATH = ?", "t", full_path) > 0 )
+		return 0;
+	if( type == TYPE_DIR )
+	{
+		dir_stats.access++;
+		if( faccessat(dirfd, d_name, R_OK|X_OK, 0) != 0 )
+			return 0;
+	}
+	else if( type != TYPE_FILE )
+		return 0;
+	xasprintf(&container, "%s%s", BROWSEDIR_ID, THISORNUL(parent));
+	objectID = get_next_available_id("OBJECTS", container);
+	free(container);
+	name = escape_tag(d_name, 1);
+	if( type == TYPE_DIR && (fd = dir_open_at(dirfd, d_name)) >= 0 )
+	{
+		mtime = dir_mtime(fd);
+		detailID = insert_directory(name, full_path, BROWSEDIR_ID, THISORNUL(parent), objectID);
+		xasprintf(&parent_id, "%s$%X", THISORNUL(parent), objectID);
+		ScanDirectory(fd, full_path, parent_id, dir_types, NULL);
+		close(fd);
+		free(parent_id);
+		/* The rest of the rescan reads back what was found below */
+		scan_drain(0);
+		sql_exec_bind(db, "UPDATE DETAILS_DATA set TIMESTAMP = ? where ID = ?", "ii",
+		              (int64_t)mtime, detailID);
+		ret = 1;
+	}
+	else if( type == TYPE_FILE )
+	{
+		scan_throttle();
+		ret = (insert_file(name, full_path, THISORNUL(parent), objectID, dir_types) == 0);
+	}
+	free(name);
+
+	return ret;
+}
+
+/* Bring the children of one already-indexed directory up to date.  When
+ * the directory mtime still matches the one recorded at the last scan no
+ * entries were added or removed, so only the known children are checked;
+ * otherwise the directory is listed and merged against the database. */
+static void
+RescanDirectory(int parentfd, const char *dname, const char *dir, const char *parent,
+                int64_t dirID, media_types dir_types)
+{
+	struct dir_list list = { 0 };
+	struct stat st;
+	char **result, *sql, *full_path;
+	const char *name;
+	size_t len = strlen(dir) + 1;
+	int rows, i = 0, j = 0, n = 0, cmp, listed, on_disk, container, fd;
+	int64_t detailID;
+	time_t mtime;
+
+	fd = dir_open_at(parentfd, dname);
+	if( fd < 0 )
+	{
+		DPRINTF(E_WARN, L_SCANNER, "Error scanning %s [%s]\n", dir, strerror(errno));
+		return;
+	}
+	rescan_stats.dirs++;
+	mtime = dir_mtime(fd);
+	listed = (!dirID || !mtime ||
+	          mtime != sql_get_int64_field_bind(db, "SELECT TIMESTAMP from DETAILS_DATA where ID = ?",
+	                                           "i", dirID));
+	if( listed )
+	{
+		n = dir_list_read(fd, &list, filter_entry, &dir_types, DIR_SORT_BYTES);
+		if( n < 0 )
+		{
+			DPRINTF(E_WARN, L_SCANNER, "Error scanning %s [%s]\n", dir, strerror(errno));
+			n = listed = 0;
+		}
+		else
+			rescan_stats.listed++;
+	}
+
+	sql = sqlite3_mprintf("SELECT o.OBJECT_ID, d.ID, d.PATH, d.SIZE, d.TIMESTAMP, o.CLASS"
+	                      " from OBJECTS o join DETAILS_DATA d on (d.ID = o.DETAIL_ID)"
+	                      " where o.PARENT_ID = '%s%q' and d.PATH > '%q/' and d.PATH <= '%q/%c'"
+	                      " order by d.PATH",
+	                      BROWSEDIR_ID, THISORNUL(parent), dir, dir, 0xFF);
+	if( sql_get_table(db, sql, &result, &rows, NULL) != SQLITE_OK )
+	{
+		sqlite3_free(sql);
+		dir_list_free(&list);
+		close(fd);
+		return;
+	}
+	sqlite3_free(sql);
+
+	full_path = malloc(PATH_MAX);
+	while( full_path && (i < rows || j < n) )
+	{
+		char **row = result + (i + 1) * 6;
+
+		if( i >= rows )
+			cmp = 1;
+		else if( j >= n )
+			cmp = -1;
+		else
+			cmp = strcmp(row[2] + len, list.entries[j].name);
+
+		if( cmp > 0 )
+		{
+			/* Only on disk: new entry */
+			name = list.entries[j].name;
+			snprintf(full_path, PATH_MAX, "%s/%s", dir, name);
+			if( rescan_insert(fd, name, full_path, entry_type(fd, &list.entries[j], full_path, dir_types),
+			                  parent, dir_types) )
+				rescan_stats.added++;
+			j++;
+			continue;
+		}
+
+		/* Known to the database.  Unless the directory was listed,
+		 * it is presumed to still be there until stat() says otherwise. */
+		i++;
+		name = row[2] + len;
+		if( cmp == 0 || !listed )
+		{
+			if( cmp == 0 )
+				j++;
+			dir_stats.stats++;
+			on_disk = (fstatat(fd, name, &st, 0) == 0);
+		}
+		else
+			on_disk = 0;
+		container = (strncmp(row[5], "container", 9) == 0);
+		detailID = strtoll(row[1], NULL, 10);
+
+		if( on_disk && container && S_ISDIR(st.st_mode) )
+		{
+			RescanDirectory(fd, name, row[2], row[0] + strlen(BROWSEDIR_ID), detailID, dir_types);
+			continue;
+		}
+		if( on_disk && !container && !S_ISDIR(st.st_mode) )
+		{
+			if( st.st_size == strtoll(row[3] ? row[3] : "0", NULL, 10) &&
+			    st.st_mtime == strtoll(row[4] ? row[4] : "0", NULL, 10) )
+				continue;
+			DPRINTF(E_DEBUG, L_SCANNER, "%s changed since the last scan\n", row[2]);
+			rescan_remove_file(detailID, row[2]);
+			rescan_insert(fd, name, row[2], TYPE_FILE, parent, dir_types);
+			rescan_stats.changed++;
+			continue;
+		}
+
+		/* Gone, or replaced by something of the other type */
+		DPRINTF(E_DEBUG, L_SCANNER, "%s was removed\n", row[2]);
+		if( container )
+			remove_subtree(row[2]);
+		else
+			rescan_remove_file(detailID, row[2]);
+		rescan_stats.removed++;
+		if( on_disk && rescan_insert(fd, name, row[2],
+		                             S_ISDIR(st.st_mode) ? TYPE_DIR : TYPE_FILE, parent, dir_types) )
+			rescan_stats.added++;
+	}
+	free(full_path);
+	dir_list_free(&list);
+	sqlite3_free_table(result);
+	close(fd);
+
+	if( listed && dirID )
+		sql_exec_bind(db, "UPDATE DETAILS_DATA set TIMESTAMP = ? where ID = ?", "ii",
+		              (int64_t)mtime, dirID);
+}
+
+/* Forget playlists and captions whose files went away */
+static void
+rescan_cleanup(void)
+{
+	char **result;
+	int rows, i;
+
+	if( sql_get_table(db, "SELECT ID, PATH from PLAYLISTS", &result, &rows, NULL) == SQLITE_OK )
+	{
+		for( i = 1; i <= rows; i++ )
+		{
+			long long plID = strtoll(result[i*2], NULL, 10);
+			if( access(result[i*2+1], F_OK) == 0 )
+				continue;
+			sql_exec(db, "DELETE from OBJECTS where OBJECT_ID = '%s$%llX' or PARENT_ID = '%s$%llX'",
+			         MUSIC_PLIST_ID, plID, MUSIC_PLIST_ID, plID);
+			sql_exec(db, "DELETE from PLAYLISTS where ID = %lld", plID);
+		}
+		sqlite3_free_table(result);
+	}
+	if( sql_get_table(db, "SELECT PATH from CAPTIONS", &result, &rows, NULL) == SQLITE_OK )
+	{
+		for( i = 1; i <= rows; i++ )
+		{
+			if( access(result[i], F_OK) != 0 )
+				sql_exec(db, "DELETE from CAPTIONS where PATH = %Q", result[i]);
+		}
+		sqlite3_free_table(result);
+	}
+	prune_containers();
+	album_art_gc();
+}
+
+/* Catch up with changes made while we were not running, for every
+ * media_dir that was completely scanned before. */
+static void
+start_rescan(void)
+{
+	struct media_dir_s *media_path;
+	char *id;
+
+	memset(&rescan_stats, 0, sizeof(rescan_stats));
+	for( media_path = media_dirs; media_path != NULL; media_path = media_path->next )
+	{
+		if( sql_get_int_field(db, "SELECT count(*) from SETTINGS where KEY = 'media_dir' and VALUE = %Q",
+		                      media_path->path) <= 0 )
+			continue;
+		DPRINTF(E_WARN, L_SCANNER, "Rescanning %s\n", media_path->path);
+		/* The top level container, unless the media_dir is merged into BROWSEDIR_ID */
+		id = sql_get_text_field(db, "SELECT OBJECT_ID from OBJECTS o join DETAILS_DATA d on (d.ID = o.DETAIL_ID)"
+		                            " where d.PATH = %Q and o.OBJECT_ID glob '%s$*' and REF_ID is NULL",
+		                            media_path->path, BROWSEDIR_ID);
+		RescanDirectory(AT_FDCWD, media_path->path, media_path->path, id ? id + strlen(BROWSEDIR_ID) : NULL, 0, media_path->types);
+		sqlite3_free(id);
+	}
+	rescan_cleanup();
+	DPRINTF(E_WARN, L_SCANNER, "Rescan finished: %u directories (%u listed), "
+	        "%u new, %u changed, %u removed\n", rescan_stats.dirs, rescan_stats.listed,
+	        rescan_stats.added, rescan_stats.changed, rescan_stats.removed);
+}
+
+/* Update an existing database: with 'rescan' set, first catch up on what
+ * changed in the media_dirs already indexed, then scan the new media_dirs
+ * in the NULL-terminated 'dirs' array.  The content of the others is left
+ * alone. */
+void
+start_partial_scanner(struct media_dir_s **dirs, int rescan)
+{
+	scanner_init();
+	if( rescan )
+		start_rescan();
+	for( ; *dirs; dirs++ )
+	{
+		DPRINTF(E_WARN, L_SCANNER, "Scanning new media_dir %s\n", (*dirs)->path);
+		scan_media_dir(*dirs);
+	}
+	scan_enrich();
+	_notify_stop();
+	/* Missing if the initial scan was interrupted */
+	sql_exec(db, "create INDEX IF NOT EXISTS IDX_SEARCH_OPT ON OBJECTS(OBJECT_ID, CLASS, DETAIL_ID);");
+	scanner_done();
+	DPRINTF(E_DEBUG, L_SCANNER, "Partial file scan completed\n");
+}
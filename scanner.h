@@ -83,4 +83,19 @@ CreateDatabase(void);
 void
 start_scanner();
 
+void
+start_partial_scanner(struct media_dir_s **dirs, int rescan);
+
+int
+remove_media_dir(const char *path);
+
+int
+media_dir_matches(struct media_dir_s *media_path);
+
+int
+scan_interrupted(struct media_dir_s *media_path);
+
+int
+snapshot_tracking(int enable);
+
 #endif
@@ -31,7 +31,9 @@ char create_objectTable_sqlite[] = "CREATE TABLE OBJECTS ("
 					"DETAIL_ID INTEGER DEFAULT NULL, "
                                         "NAME TEXT DEFAULT NULL);";
 
-char create_detailTable_sqlite[] = "CREATE TABLE DETAILS ("
+/* CREATOR, ARTIST, ALBUM, GENRE, DLNA_PN and MIME are interned in the
+ * dict.c tables; readers go through the DETAILS view below. */
+char create_detailTable_sqlite[] = "CREATE TABLE DETAILS_DATA ("
 					"ID INTEGER PRIMARY KEY AUTOINCREMENT, "
 					"PATH TEXT DEFAULT NULL, "
 					"SIZE INTEGER, "
@@ -40,10 +42,10 @@ char create_detailTable_sqlite[] = "CREATE TABLE DETAILS ("
 					"DURATION TEXT, "
 					"BITRATE INTEGER, "
 					"SAMPLERATE INTEGER, "
-					"CREATOR TEXT COLLATE NOCASE, "
-					"ARTIST TEXT COLLATE NOCASE, "
-					"ALBUM TEXT COLLATE NOCASE, "
-					"GENRE TEXT COLLATE NOCASE, "
+					"CREATOR_ID INTEGER DEFAULT 0, "
+					"ARTIST_ID INTEGER DEFAULT 0, "
+					"ALBUM_ID INTEGER DEFAULT 0, "
+					"GENRE_ID INTEGER DEFAULT 0, "
 					"COMMENT TEXT, "
 					"CHANNELS INTEGER, "
 					"DISC INTEGER, "
@@ -51,16 +53,57 @@ char create_detailTable_sqlite[] = "CREATE TABLE DETAILS ("
 					"DATE DATE, "
 					"RESOLUTION TEXT, "
 					"THUMBNAIL BOOL DEFAULT 0, "
+					"THUMB_OFFSET INTEGER, "
+					"THUMB_SIZE INTEGER, "
+					"SEEKABLE BOOL DEFAULT 0, "
 					"ALBUM_ART INTEGER DEFAULT 0, "
 					"ROTATION INTEGER, "
-					"DLNA_PN TEXT, "
-                                        "MIME TEXT);";
+					"DLNA_PN_ID INTEGER DEFAULT 0, "
+                                        "MIME_ID INTEGER DEFAULT 0);";
+
+char create_detailView_sqlite[] = "CREATE VIEW DETAILS as SELECT "
+					"d.ID as ID, d.PATH as PATH, d.SIZE as SIZE, "
+					"d.TIMESTAMP as TIMESTAMP, d.TITLE as TITLE, "
+					"d.DURATION as DURATION, d.BITRATE as BITRATE, "
+					"d.SAMPLERATE as SAMPLERATE, c.NAME as CREATOR, "
+					"a.NAME as ARTIST, al.NAME as ALBUM, g.NAME as GENRE, "
+					"d.COMMENT as COMMENT, d.CHANNELS as CHANNELS, "
+					"d.DISC as DISC, d.TRACK as TRACK, d.DATE as DATE, "
+					"d.RESOLUTION as RESOLUTION, d.THUMBNAIL as THUMBNAIL, "
+					"d.ALBUM_ART as ALBUM_ART, d.ROTATION as ROTATION, "
+					"d.SEEKABLE as SEEKABLE, "
+					"p.NAME as DLNA_PN, m.NAME as MIME "
+					"from DETAILS_DATA d "
+					"left join CREATORS c on (c.ID = d.CREATOR_ID) "
+					"left join ARTISTS a on (a.ID = d.ARTIST_ID) "
+					"left join ALBUMS al on (al.ID = d.ALBUM_ID) "
+					"left join GENRES g on (g.ID = d.GENRE_ID) "
+					"left join DLNA_PROFILES p on (p.ID = d.DLNA_PN_ID) "
+					"left join MIME_TYPES m on (m.ID = d.MIME_ID);";
 
 char create_albumArtTable_sqlite[] = "CREATE TABLE ALBUM_ART ("
 					"ID INTEGER PRIMARY KEY AUTOINCREMENT, "
-					"PATH TEXT NOT NULL"
+					"PATH TEXT NOT NULL, "
+					"REFS INTEGER DEFAULT 0"
                                         ");";
 
+/* REFS counts the DETAILS_DATA rows using a piece of art, so that
+ * album_art_gc() can tell which ones are gone. */
+char create_albumArtTriggers_sqlite[] = "CREATE TRIGGER ALBUM_ART_REF"
+					" AFTER INSERT ON DETAILS_DATA WHEN new.ALBUM_ART > 0 BEGIN"
+					" UPDATE ALBUM_ART set REFS = REFS + 1 where ID = new.ALBUM_ART;"
+					" END;"
+					"CREATE TRIGGER ALBUM_ART_UNREF"
+					" AFTER DELETE ON DETAILS_DATA WHEN old.ALBUM_ART > 0 BEGIN"
+					" UPDATE ALBUM_ART set REFS = REFS - 1 where ID = old.ALBUM_ART;"
+					" END;"
+					"CREATE TRIGGER ALBUM_ART_REREF"
+					" AFTER UPDATE OF ALBUM_ART ON DETAILS_DATA"
+					" WHEN old.ALBUM_ART is not new.ALBUM_ART BEGIN"
+					" UPDATE ALBUM_ART set REFS = REFS - 1 where ID = old.ALBUM_ART;"
+					" UPDATE ALBUM_ART set REFS = REFS + 1 where ID = new.ALBUM_ART;"
+					" END;";
+
 char create_captionTable_sqlite[] = "CREATE TABLE CAPTIONS ("
 					"ID INTEGER PRIMARY KEY, "
 					"PATH TEXT NOT NULL"
@@ -79,6 +122,64 @@ char create_playlistTable_sqlite[] = "CREATE TABLE PLAYLISTS ("
 					"FOUND INTEGER DEFAULT 0"
 					");";
 
+/* Videos added by a fast scan whose metadata has not been read yet */
+char create_enrichTable_sqlite[] = "CREATE TABLE ENRICH ("
+					"DETAIL_ID INTEGER PRIMARY KEY"
+					");";
+
+/* Time to byte offset index of a seekable item, see seekindex.h.  Rows go
+ * away with their DETAILS_DATA row. */
+char create_seekIndexTable_sqlite[] = "CREATE TABLE SEEK_INDEX ("
+					"ID INTEGER PRIMARY KEY, "
+					"DATA BLOB NOT NULL"
+					");";
+
+char create_seekIndexTrigger_sqlite[] = "CREATE TRIGGER SEEK_INDEX_CLEANUP"
+					" AFTER DELETE ON DETAILS_DATA BEGIN"
+					" DELETE from SEEK_INDEX where ID = old.ID;"
+					" END;";
+
+/* Resized images kept in the art cache, with when they were last served,
+ * so the least recently used go first once resized_cache_size is used up */
+char create_renditionTable_sqlite[] = "CREATE TABLE RENDITIONS ("
+					"PATH TEXT PRIMARY KEY, "
+					"DETAIL_ID INTEGER, "
+					"SIZE INTEGER, "
+					"USED INTEGER"
+					");";
+
+char create_renditionTrigger_sqlite[] = "CREATE TRIGGER RENDITIONS_CLEANUP"
+					" AFTER DELETE ON DETAILS_DATA BEGIN"
+					" DELETE from RENDITIONS where DETAIL_ID = old.ID;"
+					" END;";
+
+/* Containers whose children changed since the browse snapshot was last
+ * written, so that it can be brought up to date one container at a time.
+ * A container marked again is replaced under a new rowid, past the ID the
+ * snapshot builder read.  The triggers only exist while browse_snapshot
+ * is enabled; see snapshot_tracking(). */
+char create_snapshotDirtyTable_sqlite[] = "CREATE TABLE SNAPSHOT_DIRTY ("
+					"ID INTEGER PRIMARY KEY, "
+					"PARENT_ID TEXT UNIQUE"
+					");";
+
+char create_snapshotDirtyTriggers_sqlite[] = "CREATE TRIGGER SNAPSHOT_DIRTY_ADD"
+					" AFTER INSERT ON OBJECTS BEGIN"
+					" INSERT or REPLACE into SNAPSHOT_DIRTY (PARENT_ID) VALUES (new.PARENT_ID);"
+					" END;"
+					"CREATE TRIGGER SNAPSHOT_DIRTY_REMOVE"
+					" AFTER DELETE ON OBJECTS BEGIN"
+					" INSERT or REPLACE into SNAPSHOT_DIRTY (PARENT_ID) VALUES (old.PARENT_ID);"
+					" END;"
+					"CREATE TRIGGER SNAPSHOT_DIRTY_DETAILS"
+					" AFTER UPDATE OF SIZE, TITLE, DURATION, BITRATE, SAMPLERATE,"
+					" ARTIST_ID, ALBUM_ID, GENRE_ID, COMMENT, CHANNELS, TRACK, DATE,"
+					" RESOLUTION, THUMBNAIL, CREATOR_ID, DLNA_PN_ID, MIME_ID,"
+					" ALBUM_ART, ROTATION, DISC, SEEKABLE ON DETAILS_DATA BEGIN"
+					" INSERT or REPLACE into SNAPSHOT_DIRTY (PARENT_ID)"
+					" SELECT DISTINCT PARENT_ID from OBJECTS where DETAIL_ID = new.ID;"
+					" END;";
+
 char create_settingsTable_sqlite[] = "CREATE TABLE SETTINGS ("
 					"KEY TEXT NOT NULL, "
 					"VALUE TEXT"
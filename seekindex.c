@@ -0,0 +1,352 @@
+/* Time to byte offset indexes of media files
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "seekindex.h"
+#include "log.h"
+
+/* Points sampled through an MPEG stream, evenly spaced by size */
+#define SEEK_SAMPLES 128
+/* Read at a time while looking for a clock reference */
+#define SEEK_CHUNK (32*1024)
+/* Give up on a sample after this much; PCRs are at most 100ms apart */
+#define SEEK_SCAN_MAX (1024*1024)
+
+/* 33 bit, 90 kHz system clock */
+#define CLOCK_MASK ((1LL << 33) - 1)
+
+static inline uint32_t
+get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline uint32_t
+point_ms(const uint8_t *data, int i)
+{
+	return get_le32(data + i * SEEK_POINT_SIZE);
+}
+
+static inline uint64_t
+point_offset(const uint8_t *data, int i)
+{
+	const uint8_t *p = data + i * SEEK_POINT_SIZE + 4;
+
+	return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+int
+seek_index_add(struct seek_index *idx, uint32_t ms, uint64_t offset)
+{
+	uint8_t *p;
+	int n = idx->len / SEEK_POINT_SIZE;
+
+	if( n && (ms <= point_ms(idx->data, n - 1) || offset <= point_offset(idx->data, n - 1)) )
+		return 0;
+	if( idx->len + SEEK_POINT_SIZE > idx->alloc )
+	{
+		p = realloc(idx->data, idx->alloc ? idx->alloc * 2 : 64 * SEEK_POINT_SIZE);
+		if( !p )
+			return -1;
+		idx->data = p;
+		idx->alloc = idx->alloc ? idx->alloc * 2 : 64 * SEEK_POINT_SIZE;
+	}
+	p = idx->data + idx->len;
+	put_le32(p, ms);
+	put_le32(p + 4, offset);
+	put_le32(p + 8, offset >> 32);
+	idx->len += SEEK_POINT_SIZE;
+
+	return 0;
+}
+
+void
+seek_index_free(struct seek_index *idx)
+{
+	free(idx->data);
+	memset(idx, 0, sizeof(*idx));
+}
+
+uint32_t
+seek_index_duration(const uint8_t *data, int len)
+{
+	int n = len / SEEK_POINT_SIZE;
+
+	return n ? point_ms(data, n - 1) : 0;
+}
+
+int64_t
+seek_index_lookup(const uint8_t *data, int len, uint32_t ms)
+{
+	int n = len / SEEK_POINT_SIZE;
+	int lo = 0, hi = n - 1, mid;
+	uint64_t off_lo, off_hi;
+	uint32_t ms_lo, ms_hi;
+
+	if( n < 2 || ms > point_ms(data, hi) )
+		return -1;
+
+	/* last point at or before 'ms' */
+	while( lo < hi )
+	{
+		mid = (lo + hi + 1) / 2;
+		if( point_ms(data, mid) <= ms )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	if( lo == n - 1 )
+		return point_offset(data, lo);
+
+	ms_lo = point_ms(data, lo);
+	ms_hi = point_ms(data, lo + 1);
+	off_lo = point_offset(data, lo);
+	off_hi = point_offset(data, lo + 1);
+
+	return off_lo + (off_hi - off_lo) * (ms - ms_lo) / (ms_hi - ms_lo);
+}
+
+struct mpeg_scan {
+	int fd;
+	off_t size;
+	int ts;		/* transport stream packet size, 0 for a program stream */
+	int pid;	/* PID carrying the PCR, -1 until seen */
+	uint8_t *buf;
+};
+
+static inline int64_t
+ts_pcr(const uint8_t *p)
+{
+	return ((int64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+}
+
+static inline int64_t
+ps_scr(const uint8_t *b)
+{
+	/* MPEG-2 pack header */
+	if( (b[0] & 0xC0) == 0x40 )
+		return ((int64_t)((b[0] >> 3) & 0x07) << 30) | ((b[0] & 0x03) << 28) |
+		       (b[1] << 20) | (((b[2] >> 3) & 0x1F) << 15) | ((b[2] & 0x03) << 13) |
+		       (b[3] << 5) | (b[4] >> 3);
+	/* MPEG-1 pack header */
+	if( (b[0] & 0xF0) == 0x20 )
+		return ((int64_t)((b[0] >> 1) & 0x07) << 30) | (b[1] << 22) |
+		       ((b[2] >> 1) << 15) | (b[3] << 7) | (b[4] >> 1);
+	return -1;
+}
+
+/* The first clock reference in 'buf', or with 'last' set the final one,
+ * and the offset of the packet carrying it */
+static int
+mpeg_clock_in(struct mpeg_scan *s, int len, int last, int64_t *clock, int *at)
+{
+	const uint8_t *buf = s->buf, *p;
+	int i, pid, pre, found = 0;
+	int64_t clk;
+
+	if( s->ts )
+	{
+		pre = s->ts - 188;
+		for( i = 0; i + pre + 2 * s->ts < len; i++ )
+		{
+			if( buf[i + pre] == 0x47 && buf[i + pre + s->ts] == 0x47 &&
+			    buf[i + pre + 2 * s->ts] == 0x47 )
+				break;
+		}
+		for( ; i + s->ts <= len; i += s->ts )
+		{
+			p = buf + i + pre;
+			if( p[0] != 0x47 )
+				break;
+			/* adaptation field with a PCR */
+			if( !(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10) )
+				continue;
+			pid = ((p[1] & 0x1F) << 8) | p[2];
+			if( s->pid < 0 )
+				s->pid = pid;
+			else if( pid != s->pid )
+				continue;
+			*clock = ts_pcr(p);
+			*at = i;
+			found = 1;
+			if( !last )
+				break;
+		}
+	}
+	else
+	{
+		for( i = 0; i + 14 <= len; i++ )
+		{
+			if( buf[i] || buf[i + 1] || buf[i + 2] != 0x01 || buf[i + 3] != 0xBA )
+				continue;
+			if( (clk = ps_scr(buf + i + 4)) < 0 )
+				continue;
+			*clock = clk;
+			*at = i;
+			found = 1;
+			if( !last )
+				break;
+		}
+	}
+
+	return found;
+}
+
+/* Clock reference at or after 'pos' */
+static int
+mpeg_clock_at(struct mpeg_scan *s, off_t pos, int64_t *clock, off_t *offset)
+{
+	int n, at, scanned = 0;
+	int overlap = s->ts ? 3 * s->ts : 14;
+
+	while( scanned < SEEK_SCAN_MAX && pos < s->size )
+	{
+		n = pread(s->fd, s->buf, SEEK_CHUNK, pos);
+		if( n <= overlap )
+			break;
+		if( mpeg_clock_in(s, n, 0, clock, &at) )
+		{
+			*offset = pos + at;
+			return 0;
+		}
+		pos += n - overlap;
+		scanned += n - overlap;
+	}
+
+	return -1;
+}
+
+/* Last clock reference in the file */
+static int
+mpeg_clock_last(struct mpeg_scan *s, int64_t *clock)
+{
+	int n, at, scanned = 0;
+	off_t pos = s->size;
+
+	while( scanned < SEEK_SCAN_MAX && pos > 0 )
+	{
+		pos = (pos > SEEK_CHUNK) ? pos - SEEK_CHUNK : 0;
+		n = pread(s->fd, s->buf, SEEK_CHUNK, pos);
+		if( n <= 0 )
+			break;
+		if( mpeg_clock_in(s, n, 1, clock, &at) )
+			return 0;
+		scanned += n;
+	}
+
+	return -1;
+}
+
+/* Time elapsed from 'prev' to 'clk', in 90 kHz units, or -1 if the clock
+ * went back or jumped, as it does at a discontinuity */
+static int64_t
+clock_step(int64_t prev, int64_t clk)
+{
+	int64_t d = (clk - prev) & CLOCK_MASK;
+
+	return (d > 90000LL * 3600) ? -1 : d;
+}
+
+int
+seek_index_mpeg(const char *path, struct seek_index *idx)
+{
+	struct mpeg_scan s;
+	struct stat st;
+	int64_t clk, prev, step, t = 0;
+	off_t off;
+	int i, n, sizes[] = { 188, 192 };
+
+	memset(idx, 0, sizeof(*idx));
+	s.fd = open(path, O_RDONLY);
+	if( s.fd < 0 )
+		return -1;
+	if( fstat(s.fd, &st) != 0 || !(s.buf = malloc(SEEK_CHUNK)) )
+	{
+		close(s.fd);
+		return -1;
+	}
+	s.size = st.st_size;
+	s.pid = -1;
+	s.ts = 0;
+
+	/* transport stream, plain or with a 4 byte timestamp per packet */
+	n = pread(s.fd, s.buf, SEEK_CHUNK, 0);
+	for( i = 0; n > 0 && i < 2 && !s.ts; i++ )
+	{
+		int j, k = sizes[i] - 188;
+
+		for( j = 0; j < sizes[i] && k + j + 3 * sizes[i] < n; j++ )
+		{
+			if( s.buf[k + j] == 0x47 && s.buf[k + j + sizes[i]] == 0x47 &&
+			    s.buf[k + j + 2 * sizes[i]] == 0x47 && s.buf[k + j + 3 * sizes[i]] == 0x47 )
+			{
+				s.ts = sizes[i];
+				break;
+			}
+		}
+	}
+
+	if( mpeg_clock_at(&s, 0, &prev, &off) != 0 )
+		goto fail;
+	seek_index_add(idx, 0, 0);
+
+	for( i = 1; i < SEEK_SAMPLES; i++ )
+	{
+		if( mpeg_clock_at(&s, s.size / SEEK_SAMPLES * i, &clk, &off) != 0 )
+			continue;
+		if( (step = clock_step(prev, clk)) < 0 )
+			continue;
+		t += step;
+		prev = clk;
+		if( seek_index_add(idx, t / 90, off) != 0 )
+			goto fail;
+	}
+
+	if( mpeg_clock_last(&s, &clk) == 0 && (step = clock_step(prev, clk)) >= 0 )
+		t += step;
+	if( seek_index_add(idx, t / 90, s.size) != 0 || idx->len < 3 * SEEK_POINT_SIZE )
+		goto fail;
+
+	DPRINTF(E_DEBUG, L_METADATA, "Indexed %d points over %lld ms of %s\n",
+		idx->len / SEEK_POINT_SIZE, (long long)(t / 90), path);
+	free(s.buf);
+	close(s.fd);
+	return 0;
+
+fail:
+	seek_index_free(idx);
+	free(s.buf);
+	close(s.fd);
+	return -1;
+}
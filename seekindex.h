@@ -0,0 +1,52 @@
+/* Time to byte offset indexes of media files
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SEEKINDEX_H__
+#define __SEEKINDEX_H__
+
+#include <stdint.h>
+
+/* An index is a list of points, each a play time in milliseconds and the
+ * byte offset of the data to send from there on, both ascending.  It is
+ * kept packed, 12 little-endian bytes a point, the way SEEK_INDEX stores
+ * it.  The last point marks the end of the stream and its duration. */
+#define SEEK_POINT_SIZE 12
+
+struct seek_index {
+	uint8_t *data;
+	int len;
+	int alloc;
+};
+
+/* Append a point; ones that do not move both time and offset forward
+ * are dropped.  Returns -1 only when out of memory. */
+int seek_index_add(struct seek_index *idx, uint32_t ms, uint64_t offset);
+void seek_index_free(struct seek_index *idx);
+
+/* Sample the clock references of an MPEG transport or program stream */
+int seek_index_mpeg(const char *path, struct seek_index *idx);
+
+/* Offset to start sending from for 'ms' into a packed index, interpolated
+ * between points, or -1 when past its end */
+int64_t seek_index_lookup(const uint8_t *data, int len, uint32_t ms);
+
+/* Play time covered by a packed index */
+uint32_t seek_index_duration(const uint8_t *data, int len);
+
+#endif
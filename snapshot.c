@@ -0,0 +1,695 @@
+/* MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "snapshot.h"
+#include "upnpglobalvars.h"
+#include "utils.h"
+#include "sql.h"
+#include "log.h"
+
+/* The snapshot is a single file laid out as
+ *
+ *   header | string table | nodes[node_count] | parents[parent_count]
+ *
+ * Every node holds SNAPSHOT_COLUMNS offsets into the string table (0 is
+ * SQL NULL).  Nodes are grouped by PARENT_ID, so the children of any
+ * container are contiguous, and the parents array is sorted by PARENT_ID
+ * for a binary search.  Strings are stored exactly as they are in the
+ * database, which already holds them XML-escaped. */
+#define SNAPSHOT_MAGIC   "MDSNAP3"
+#define SNAPSHOT_SETTLE  10	/* seconds without changes before a rebuild */
+
+/* The one in use, which the builder also starts from */
+#define SNAPSHOT_LIVE    "browse.live"
+/* Left behind by a clean shutdown, for the next run to start with.  It is
+ * renamed to SNAPSHOT_LIVE before use, so that a crash, after which
+ * UPDATE_ID restarts from an older value, never leaves one to be served. */
+#define SNAPSHOT_SAVED   "browse.snap"
+
+struct snapshot_hdr {
+	char magic[8];
+	uint32_t update_id;
+	uint32_t node_count;
+	uint32_t parent_count;
+	uint32_t pad;
+	int64_t generation;	/* GENERATION in SETTINGS of the database it came from */
+	uint64_t strtab_off;
+	uint64_t strtab_len;
+	uint64_t nodes_off;
+	uint64_t parents_off;
+};
+
+struct snapshot_node {
+	uint32_t col[SNAPSHOT_COLUMNS];
+};
+
+struct snapshot_parent {
+	uint32_t id;
+	uint32_t first;
+	uint32_t count;
+};
+
+static struct {
+	void *base;
+	size_t len;
+	const struct snapshot_hdr *hdr;
+	const char *strtab;
+	const struct snapshot_node *nodes;
+	const struct snapshot_parent *parents;
+} snap;
+
+static pid_t builder_pid;
+static int64_t db_generation;
+static uint32_t built_for;
+static uint32_t seen_update_id;
+static time_t seen_time;
+
+/* Build-time string table with de-duplication */
+struct strtab {
+	char *data;
+	size_t len;
+	size_t size;
+	uint32_t *hash;
+	uint32_t hash_size;
+	uint32_t hash_used;
+};
+
+static int
+strtab_grow_hash(struct strtab *t)
+{
+	uint32_t *old = t->hash;
+	uint32_t old_size = t->hash_size;
+	uint32_t i, h;
+
+	t->hash_size = old_size ? old_size * 2 : 4096;
+	t->hash = calloc(t->hash_size, sizeof(uint32_t));
+	if (!t->hash)
+		return -1;
+	for (i = 0; i < old_size; i++)
+	{
+		if (!old[i])
+			continue;
+		h = DJBHash((uint8_t *)t->data + old[i], strlen(t->data + old[i]));
+		while (t->hash[h & (t->hash_size - 1)])
+			h++;
+		t->hash[h & (t->hash_size - 1)] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+static uint32_t
+strtab_add(struct strtab *t, const char *str)
+{
+	uint32_t h, off;
+	size_t len;
+
+	if (!str)
+		return 0;
+	len = strlen(str);
+	if (t->hash_used * 2 >= t->hash_size && strtab_grow_hash(t) != 0)
+		return UINT32_MAX;
+	h = DJBHash((uint8_t *)str, len);
+	while ((off = t->hash[h & (t->hash_size - 1)]))
+	{
+		if (strcmp(t->data + off, str) == 0)
+			return off;
+		h++;
+	}
+	if (t->len + len + 1 > t->size)
+	{
+		char *data;
+		size_t size = t->size ? t->size * 2 : 65536;
+		while (t->len + len + 1 > size)
+			size *= 2;
+		if (size > UINT32_MAX || !(data = realloc(t->data, size)))
+			return UINT32_MAX;
+		t->data = data;
+		t->size = size;
+	}
+	off = t->len;
+	memcpy(t->data + off, str, len + 1);
+	t->len += len + 1;
+	t->hash[h & (t->hash_size - 1)] = off;
+	t->hash_used++;
+
+	return off;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len)
+	{
+		n = write(fd, p, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Nodes and containers as they are put together, grouped by PARENT_ID */
+struct builder {
+	struct strtab t;
+	struct snapshot_node *nodes;
+	struct snapshot_parent *parents;
+	size_t nsize, psize;
+	uint32_t n, np;
+};
+
+static int
+builder_add(struct builder *b, const char * const *col)
+{
+	uint32_t off;
+	int i;
+
+	if (b->n >= b->nsize)
+	{
+		struct snapshot_node *tmpn;
+		size_t nsize = b->nsize ? b->nsize * 2 : 4096;
+		tmpn = realloc(b->nodes, nsize * sizeof(*b->nodes));
+		if (!tmpn)
+			return -1;
+		b->nodes = tmpn;
+		b->nsize = nsize;
+	}
+	for (i = 0; i < SNAPSHOT_COLUMNS; i++)
+	{
+		off = strtab_add(&b->t, col[i]);
+		if (off == UINT32_MAX)
+			return -1;
+		b->nodes[b->n].col[i] = off;
+	}
+	if (!b->np || strcmp(b->t.data + b->parents[b->np-1].id, b->t.data + b->nodes[b->n].col[1]) != 0)
+	{
+		if (b->np >= b->psize)
+		{
+			struct snapshot_parent *tmpp;
+			size_t psize = b->psize ? b->psize * 2 : 1024;
+			tmpp = realloc(b->parents, psize * sizeof(*b->parents));
+			if (!tmpp)
+				return -1;
+			b->parents = tmpp;
+			b->psize = psize;
+		}
+		b->parents[b->np].id = b->nodes[b->n].col[1];
+		b->parents[b->np].first = b->n;
+		b->parents[b->np].count = 0;
+		b->np++;
+	}
+	b->parents[b->np-1].count++;
+	b->n++;
+
+	return 0;
+}
+
+static int
+builder_add_rows(struct builder *b, sqlite3_stmt *stmt)
+{
+	const char *col[SNAPSHOT_COLUMNS];
+	int i, rc;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		for (i = 0; i < SNAPSHOT_COLUMNS; i++)
+			col[i] = (const char *)sqlite3_column_text(stmt, i);
+		if (builder_add(b, col) != 0)
+			return SQLITE_NOMEM;
+	}
+
+	return rc;
+}
+
+/* Copy the children of one container over from an earlier snapshot */
+static int
+builder_copy(struct builder *b, const struct snapshot_hdr *old, const struct snapshot_parent *p)
+{
+	const char *strtab = (const char *)old + old->strtab_off;
+	const struct snapshot_node *nodes = (const void *)((const char *)old + old->nodes_off);
+	const char *col[SNAPSHOT_COLUMNS];
+	uint32_t i;
+	int c;
+
+	for (i = p->first; i < p->first + p->count; i++)
+	{
+		for (c = 0; c < SNAPSHOT_COLUMNS; c++)
+			col[c] = nodes[i].col[c] ? strtab + nodes[i].col[c] : NULL;
+		if (builder_add(b, col) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static const struct snapshot_hdr *
+map_file(const char *path, size_t *len)
+{
+	const struct snapshot_hdr *hdr;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*hdr))
+	{
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	hdr = base;
+	if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->strtab_off != sizeof(*hdr) || hdr->strtab_len == 0 ||
+	    hdr->nodes_off != hdr->strtab_off + hdr->strtab_len ||
+	    hdr->parents_off != hdr->nodes_off + (uint64_t)hdr->node_count * sizeof(struct snapshot_node) ||
+	    hdr->parents_off + (uint64_t)hdr->parent_count * sizeof(struct snapshot_parent) > (uint64_t)st.st_size ||
+	    ((const char *)base)[hdr->strtab_off + hdr->strtab_len - 1] != '\0')
+	{
+		DPRINTF(E_WARN, L_GENERAL, "Ignoring invalid browse snapshot %s\n", path);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	*len = st.st_size;
+
+	return hdr;
+}
+
+#define SNAPSHOT_QUERY \
+	"SELECT o.OBJECT_ID, o.PARENT_ID, o.REF_ID, o.DETAIL_ID, o.CLASS," \
+	" d.SIZE, d.TITLE, d.DURATION, d.BITRATE, d.SAMPLERATE, d.ARTIST," \
+	" d.ALBUM, d.GENRE, d.COMMENT, d.CHANNELS, d.TRACK, d.DATE, d.RESOLUTION," \
+	" d.THUMBNAIL, d.CREATOR, d.DLNA_PN, d.MIME, d.ALBUM_ART, d.ROTATION, d.DISC," \
+	" d.SEEKABLE " \
+	"from OBJECTS o left join DETAILS d on (d.ID = o.DETAIL_ID)"
+
+int
+snapshot_build(sqlite3 *db, const char *path, uint32_t update_id)
+{
+	struct builder b;
+	struct snapshot_hdr hdr;
+	const struct snapshot_hdr *old = NULL;
+	const struct snapshot_parent *oldp = NULL;
+	size_t oldlen = 0;
+	char **dirty = NULL;
+	int64_t generation, last_dirty;
+	char tmp[PATH_MAX];
+	sqlite3_stmt *stmt = NULL;
+	uint32_t i = 0;
+	int j = 1, ndirty = 0, cmp, rc, fd, ret = -1;
+
+	memset(&b, 0, sizeof(b));
+	if (strtab_grow_hash(&b.t) != 0 || !(b.t.data = malloc(65536)))
+		goto out;
+	/* offset 0 is reserved for NULL */
+	b.t.size = 65536;
+	b.t.data[0] = '\0';
+	b.t.len = 1;
+
+	/* Read everything in one transaction, so that whatever changes
+	 * meanwhile is marked dirty past 'last_dirty' */
+	if (sql_exec(db, "BEGIN") != SQLITE_OK)
+		goto out;
+	generation = sql_get_int64_field(db, "SELECT VALUE from SETTINGS where KEY = 'GENERATION'");
+	last_dirty = sql_get_int64_field(db, "SELECT max(ID) from SNAPSHOT_DIRTY");
+
+	/* Only the containers marked dirty since the last snapshot of this same
+	 * database have to be read again, unless that is most of them */
+	old = generation > 0 ? map_file(path, &oldlen) : NULL;
+	if (old && old->generation == generation &&
+	    sql_get_table(db, "SELECT PARENT_ID from SNAPSHOT_DIRTY order by PARENT_ID",
+	                  &dirty, &ndirty, NULL) == SQLITE_OK &&
+	    (uint32_t)ndirty < old->parent_count / 2)
+	{
+		oldp = (const void *)((const char *)old + old->parents_off);
+		rc = sqlite3_prepare_v2(db, SNAPSHOT_QUERY " where o.PARENT_ID = ? order by o.ID",
+		                        -1, &stmt, NULL);
+	}
+	else
+		rc = sqlite3_prepare_v2(db, SNAPSHOT_QUERY " order by o.PARENT_ID, o.ID", -1, &stmt, NULL);
+	if (rc != SQLITE_OK)
+	{
+		DPRINTF(E_ERROR, L_DB_SQL, "prepare failed: %s\n", sqlite3_errmsg(db));
+		sql_exec(db, "ROLLBACK");
+		goto out;
+	}
+
+	if (!oldp)
+		rc = builder_add_rows(&b, stmt);
+	else
+	{
+		DPRINTF(E_DEBUG, L_DB_SQL, "Updating browse snapshot for %d changed containers\n", ndirty);
+		/* Both lists are sorted by PARENT_ID */
+		rc = SQLITE_DONE;
+		while (rc == SQLITE_DONE && (i < old->parent_count || j <= ndirty))
+		{
+			if (i >= old->parent_count)
+				cmp = 1;
+			else if (j > ndirty)
+				cmp = -1;
+			else
+				cmp = strcmp((const char *)old + old->strtab_off + oldp[i].id, dirty[j]);
+			if (cmp < 0)
+			{
+				if (builder_copy(&b, old, &oldp[i]) != 0)
+					rc = SQLITE_NOMEM;
+				i++;
+				continue;
+			}
+			sqlite3_bind_text(stmt, 1, dirty[j], -1, SQLITE_STATIC);
+			rc = builder_add_rows(&b, stmt);
+			sqlite3_reset(stmt);
+			j++;
+			if (cmp == 0)
+				i++;
+		}
+	}
+	sqlite3_finalize(stmt);
+	sql_exec(db, "COMMIT");
+	if (rc != SQLITE_DONE)
+	{
+		DPRINTF(E_ERROR, L_DB_SQL, "Browse snapshot query failed: %s\n", sqlite3_errmsg(db));
+		goto out;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.update_id = update_id;
+	hdr.generation = generation;
+	hdr.node_count = b.n;
+	hdr.parent_count = b.np;
+	hdr.strtab_off = sizeof(hdr);
+	hdr.strtab_len = (b.t.len + 7) & ~(size_t)7;
+	hdr.nodes_off = hdr.strtab_off + hdr.strtab_len;
+	hdr.parents_off = hdr.nodes_off + (uint64_t)b.n * sizeof(*b.nodes);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		DPRINTF(E_ERROR, L_GENERAL, "Unable to create %s: %s\n", tmp, strerror(errno));
+		goto out;
+	}
+	if (write_all(fd, &hdr, sizeof(hdr)) != 0 ||
+	    write_all(fd, b.t.data, b.t.len) != 0 ||
+	    write_all(fd, "\0\0\0\0\0\0\0", hdr.strtab_len - b.t.len) != 0 ||
+	    write_all(fd, b.nodes, (size_t)b.n * sizeof(*b.nodes)) != 0 ||
+	    write_all(fd, b.parents, (size_t)b.np * sizeof(*b.parents)) != 0)
+	{
+		DPRINTF(E_ERROR, L_GENERAL, "Unable to write %s: %s\n", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+	if (rename(tmp, path) != 0)
+	{
+		unlink(tmp);
+		goto out;
+	}
+	/* Whatever was marked dirty up to here is in the file now */
+	sql_exec(db, "DELETE from SNAPSHOT_DIRTY where ID <= %lld", (long long)last_dirty);
+	DPRINTF(E_DEBUG, L_DB_SQL, "Browse snapshot %u written: %u objects, %u containers, %llu bytes\n",
+		update_id, b.n, b.np, (unsigned long long)(hdr.parents_off + (uint64_t)b.np * sizeof(*b.parents)));
+	ret = 0;
+out:
+	if (dirty)
+		sqlite3_free_table(dirty);
+	if (old)
+		munmap((void *)old, oldlen);
+	free(b.t.data);
+	free(b.t.hash);
+	free(b.nodes);
+	free(b.parents);
+
+	return ret;
+}
+
+static void
+snapshot_unmap(void)
+{
+	if (snap.base)
+		munmap(snap.base, snap.len);
+	memset(&snap, 0, sizeof(snap));
+}
+
+static int
+snapshot_map(const char *path)
+{
+	const struct snapshot_hdr *hdr;
+	size_t len;
+
+	hdr = map_file(path, &len);
+	if (!hdr)
+		return -1;
+
+	snapshot_unmap();
+	snap.base = (void *)hdr;
+	snap.len = len;
+	snap.hdr = hdr;
+	snap.strtab = (const char *)hdr + hdr->strtab_off;
+	snap.nodes = (const struct snapshot_node *)((const char *)hdr + hdr->nodes_off);
+	snap.parents = (const struct snapshot_parent *)((const char *)hdr + hdr->parents_off);
+	DPRINTF(E_INFO, L_GENERAL, "Browse snapshot %u mapped: %u objects, %u containers, %lu KB\n",
+		hdr->update_id, hdr->node_count, hdr->parent_count, (unsigned long)(snap.len / 1024));
+
+	return 0;
+}
+
+static inline int
+snapshot_valid(void)
+{
+	return snap.hdr && snap.hdr->update_id == updateID;
+}
+
+static const struct snapshot_parent *
+snapshot_find(const char *parent)
+{
+	uint32_t lo = 0, hi = snap.hdr->parent_count;
+	uint32_t mid;
+	int cmp;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(parent, snap.strtab + snap.parents[mid].id);
+		if (cmp == 0)
+			return &snap.parents[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+int
+snapshot_child_count(const char *parent)
+{
+	const struct snapshot_parent *p;
+
+	if (!snapshot_valid())
+		return -1;
+	p = snapshot_find(parent);
+
+	return p ? (int)p->count : 0;
+}
+
+int
+snapshot_browse(const char *parent, int start, int count, snapshot_cb cb, void *args)
+{
+	static char *scratch;
+	static size_t scratch_size;
+	const struct snapshot_parent *p;
+	const struct snapshot_node *node;
+	char *argv[SNAPSHOT_COLUMNS];
+	uint32_t i, end;
+	size_t len, need;
+	int c, returned = 0;
+
+	if (!snapshot_valid())
+		return -1;
+	p = snapshot_find(parent);
+	if (!p)
+		return -1;
+	if (start < 0 || (uint32_t)start >= p->count)
+		return 0;
+	end = p->count;
+	if (count >= 0 && (uint32_t)count < end - start)
+		end = start + count;
+
+	for (i = p->first + start; i < p->first + end; i++)
+	{
+		node = &snap.nodes[i];
+		/* The callback rewrites some strings in place, so hand it a copy */
+		for (need = 0, c = 0; c < SNAPSHOT_COLUMNS; c++)
+			if (node->col[c])
+				need += strlen(snap.strtab + node->col[c]) + 1;
+		if (need > scratch_size)
+		{
+			char *tmp = realloc(scratch, need);
+			if (!tmp)
+				break;
+			scratch = tmp;
+			scratch_size = need;
+		}
+		for (need = 0, c = 0; c < SNAPSHOT_COLUMNS; c++)
+		{
+			if (!node->col[c])
+			{
+				argv[c] = NULL;
+				continue;
+			}
+			len = strlen(snap.strtab + node->col[c]) + 1;
+			argv[c] = memcpy(scratch + need, snap.strtab + node->col[c], len);
+			need += len;
+		}
+		if (cb(args, SNAPSHOT_COLUMNS, argv, NULL) != 0)
+			break;
+		returned++;
+	}
+
+	return returned;
+}
+
+size_t
+snapshot_footprint(uint32_t *objects)
+{
+	if (objects)
+		*objects = snap.hdr ? snap.hdr->node_count : 0;
+	return snap.len;
+}
+
+void
+snapshot_update(void)
+{
+	char path[PATH_MAX], saved[PATH_MAX];
+	time_t now;
+	pid_t pid;
+
+	if (!GETFLAG(BROWSE_SNAPSHOT_MASK) || scanning)
+		return;
+	if (snapshot_valid())
+		return;
+	/* Never to be served again once updateID moved on */
+	snapshot_unmap();
+
+	snprintf(path, sizeof(path), "%s/" SNAPSHOT_LIVE, db_path);
+	if (builder_pid)
+	{
+		if (kill(builder_pid, 0) == 0)
+			return;
+		builder_pid = 0;
+		if (snapshot_map(path) == 0 && !snapshot_valid())
+			snapshot_unmap();
+		return;
+	}
+
+	now = time(NULL);
+	if (!seen_time)
+	{
+		/* The snapshot a clean shutdown left is current as long as it
+		 * came from this database and nothing changed since */
+		seen_time = now;
+		seen_update_id = updateID;
+		db_generation = sql_get_int64_field(db, "SELECT VALUE from SETTINGS where KEY = 'GENERATION'");
+		snprintf(saved, sizeof(saved), "%s/" SNAPSHOT_SAVED, db_path);
+		if (rename(saved, path) == 0 && snapshot_map(path) == 0)
+		{
+			if (snap.hdr->generation == db_generation && snapshot_valid())
+				return;
+			snapshot_unmap();
+		}
+	}
+	if (updateID != seen_update_id)
+	{
+		seen_update_id = updateID;
+		seen_time = now;
+	}
+	if (built_for == updateID || now - seen_time < SNAPSHOT_SETTLE)
+		return;
+	built_for = updateID;
+
+	/* Forked like the scanner, outside the connection count, so that it
+	 * neither takes a max_connections slot nor looks like a client */
+	pid = fork();
+	if (pid == 0)
+	{
+		sqlite3 *sdb;
+		char dbfile[PATH_MAX];
+		int ret = 1;
+
+		setpriority(PRIO_PROCESS, 0, 19);
+		snprintf(dbfile, sizeof(dbfile), "%s/files.db", db_path);
+		if (sqlite3_open(dbfile, &sdb) == SQLITE_OK)
+		{
+			sqlite3_busy_timeout(sdb, 5000);
+			ret = snapshot_build(sdb, path, seen_update_id);
+			sqlite3_close(sdb);
+		}
+		_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	else if (pid > 0)
+		builder_pid = pid;
+}
+
+void
+snapshot_close(int keep)
+{
+	char path[PATH_MAX], saved[PATH_MAX];
+
+	/* Keep it for the next run only if it is exactly what the database
+	 * holds under the UPDATE_ID saved along with it */
+	if (keep && snapshot_valid())
+	{
+		snprintf(path, sizeof(path), "%s/" SNAPSHOT_LIVE, db_path);
+		snprintf(saved, sizeof(saved), "%s/" SNAPSHOT_SAVED, db_path);
+		rename(path, saved);
+	}
+	snapshot_unmap();
+}
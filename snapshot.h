@@ -0,0 +1,59 @@
+/* Read-only Browse snapshot of the content tree
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+/* Number of columns handed to the Browse callback for each object:
+ * OBJECT_ID, PARENT_ID, REF_ID followed by the upnpsoap.c COLUMNS list. */
+#define SNAPSHOT_COLUMNS 26
+
+typedef int (*snapshot_cb)(void *args, int argc, char **argv, char **azColName);
+
+/* Write a snapshot of the whole OBJECTS/DETAILS tree to 'path',
+ * tagged with 'update_id'.  An earlier snapshot of the same database at
+ * 'path' is brought up to date, reading only the containers marked in
+ * SNAPSHOT_DIRTY since.  Returns 0 on success. */
+int snapshot_build(sqlite3 *db, const char *path, uint32_t update_id);
+
+/* Called from the main loop.  Maps a freshly built snapshot if one
+ * matching the current updateID is on disk, or starts a background
+ * rebuild once the content has been stable for a little while. */
+void snapshot_update(void);
+
+/* Feed the direct children of 'parent' to 'cb' in the same column
+ * layout as the Browse SQL query.  Returns -1 if the snapshot cannot
+ * answer for this container (not mapped, stale, or unknown parent). */
+int snapshot_browse(const char *parent, int start, int count,
+                    snapshot_cb cb, void *args);
+
+/* Number of direct children of 'parent', or -1 if unknown. */
+int snapshot_child_count(const char *parent);
+
+/* Currently mapped size in bytes, and object count */
+size_t snapshot_footprint(uint32_t *objects);
+
+/* With 'keep' set, the snapshot is left for the next run if it is still
+ * current; the caller has to know that nothing changed past updateID. */
+void snapshot_close(int keep);
+
+#endif
@@ -16,13 +16,18 @@
  * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "sql.h"
 #include "upnpglobalvars.h"
 #include "log.h"
 
+struct sql_counters sql_counters;
+
 int
 sql_exec(sqlite3 *db, const char *fmt, ...)
 {
@@ -32,6 +37,7 @@ sql_exec(sqlite3 *db, const char *fmt, ...)
 	va_list ap;
 	//DPRINTF(E_DEBUG, L_DB_SQL, "SQL: %s\n", sql);
 
+	sql_counters.writes++;
 	va_start(ap, fmt);
 	sql = sqlite3_vmprintf(fmt, ap);
 	va_end(ap);
@@ -54,6 +60,7 @@ sql_get_table(sqlite3 *db, const char *sql, char ***pazResult, int *pnRow, int *
 	char *errMsg = NULL;
 	//DPRINTF(E_DEBUG, L_DB_SQL, "SQL: %s\n", sql);
 	
+	sql_counters.reads++;
 	ret = sqlite3_get_table(db, sql, pazResult, pnRow, pnColumn, &errMsg);
 	if( ret != SQLITE_OK )
 	{
@@ -78,6 +85,7 @@ sql_get_int_field(sqlite3 *db, const char *fmt, ...)
 	sql = sqlite3_vmprintf(fmt, ap);
 	va_end(ap);
 
+	sql_counters.reads++;
 	//DPRINTF(E_DEBUG, L_DB_SQL, "sql: %s\n", sql);
 
 	switch (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL))
@@ -137,6 +145,7 @@ sql_get_int64_field(sqlite3 *db, const char *fmt, ...)
 	sql = sqlite3_vmprintf(fmt, ap);
 	va_end(ap);
 
+	sql_counters.reads++;
 	//DPRINTF(E_DEBUG, L_DB_SQL, "sql: %s\n", sql);
 
 	switch (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL))
@@ -192,6 +201,7 @@ sql_get_text_field(sqlite3 *db, const char *fmt, ...)
 	char            *str;
 	sqlite3_stmt    *stmt;
 
+	sql_counters.reads++;
 	if (db == NULL)
 	{
 		DPRINTF(E_WARN, L_DB_SQL, "db is NULL\n");
@@ -259,6 +269,612 @@ sql_get_text_field(sqlite3 *db, const char *fmt, ...)
 	return str;
 }
 
+/* Prepared statement cache.
+ *
+ * Recurring lookups are prepared once per connection and kept around,
+ * keyed by their (constant) SQL text.  Parameters are bound positionally
+ * from a type string: 'i' binds an int64_t, 't' binds a const char *
+ * (NULL binds SQL NULL).  The main thread and the inotify thread share
+ * one connection, so a statement that is already being stepped by the
+ * other thread is simply prepared one-off instead of waiting for it. */
+#define STMT_CACHE_SIZE 48
+
+struct stmt_cache_s {
+	sqlite3 *db;
+	const char *sql;
+	sqlite3_stmt *stmt;
+	int busy;
+	unsigned long calls;
+	unsigned long prepares;
+	uint64_t usecs;
+};
+
+static struct stmt_cache_s stmt_cache[STMT_CACHE_SIZE];
+static pthread_mutex_t stmt_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t
+sql_now_usecs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static struct stmt_cache_s *
+stmt_acquire(sqlite3 *db, const char *sql, sqlite3_stmt **stmt)
+{
+	struct stmt_cache_s *e, *slot = NULL;
+	int i;
+
+	*stmt = NULL;
+	pthread_mutex_lock(&stmt_cache_mutex);
+	for (i = 0; i < STMT_CACHE_SIZE; i++)
+	{
+		e = &stmt_cache[i];
+		if (!e->sql)
+		{
+			if (!slot)
+				slot = e;
+			continue;
+		}
+		if (e->db != db || (e->sql != sql && strcmp(e->sql, sql) != 0))
+			continue;
+		if (e->busy)
+		{
+			/* In use by the other thread; fall back to a one-off */
+			slot = NULL;
+			break;
+		}
+		e->busy = 1;
+		e->calls++;
+		*stmt = e->stmt;
+		pthread_mutex_unlock(&stmt_cache_mutex);
+		return e;
+	}
+	if (slot)
+	{
+		slot->db = db;
+		slot->sql = sql;
+		slot->busy = 1;
+	}
+	pthread_mutex_unlock(&stmt_cache_mutex);
+
+	if (sqlite3_prepare_v2(db, sql, -1, stmt, NULL) != SQLITE_OK)
+	{
+		DPRINTF(E_ERROR, L_DB_SQL, "prepare failed: %s\n%s\n", sqlite3_errmsg(db), sql);
+		if (slot)
+		{
+			pthread_mutex_lock(&stmt_cache_mutex);
+			memset(slot, 0, sizeof(*slot));
+			pthread_mutex_unlock(&stmt_cache_mutex);
+		}
+		*stmt = NULL;
+		return NULL;
+	}
+	if (slot)
+	{
+		slot->stmt = *stmt;
+		slot->calls++;
+		slot->prepares++;
+	}
+
+	return slot;
+}
+
+static void
+stmt_release(struct stmt_cache_s *e, sqlite3_stmt *stmt, uint64_t start)
+{
+	if (!e)
+	{
+		sqlite3_finalize(stmt);
+		return;
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	pthread_mutex_lock(&stmt_cache_mutex);
+	e->usecs += sql_now_usecs() - start;
+	e->busy = 0;
+	pthread_mutex_unlock(&stmt_cache_mutex);
+}
+
+static int
+stmt_bind(sqlite3_stmt *stmt, const char *types, va_list ap)
+{
+	const char *str;
+	const void *blob;
+	int pos, ret = SQLITE_OK;
+
+	for (pos = 1; types && *types && ret == SQLITE_OK; types++, pos++)
+	{
+		switch (*types)
+		{
+			case 'i':
+				ret = sqlite3_bind_int64(stmt, pos, va_arg(ap, int64_t));
+				break;
+			case 't':
+				str = va_arg(ap, const char *);
+				if (str)
+					ret = sqlite3_bind_text(stmt, pos, str, -1, SQLITE_STATIC);
+				else
+					ret = sqlite3_bind_null(stmt, pos);
+				break;
+			case 'b':
+				blob = va_arg(ap, const void *);
+				ret = sqlite3_bind_blob(stmt, pos, blob, va_arg(ap, int), SQLITE_STATIC);
+				break;
+			default:
+				DPRINTF(E_ERROR, L_DB_SQL, "Unknown bind type '%c'\n", *types);
+				ret = SQLITE_MISUSE;
+				break;
+		}
+	}
+
+	return ret;
+}
+
+static int
+stmt_step(sqlite3_stmt *stmt)
+{
+	int counter, result;
+
+	for (counter = 0;
+	     ((result = sqlite3_step(stmt)) == SQLITE_BUSY || result == SQLITE_LOCKED) && counter < 2;
+	     counter++)
+	{
+		/* While SQLITE_BUSY has a built in timeout,
+		 * SQLITE_LOCKED does not, so sleep */
+		if (result == SQLITE_LOCKED)
+			sleep(1);
+		sqlite3_reset(stmt);
+	}
+
+	return result;
+}
+
+static sqlite3_stmt *
+stmt_run(sqlite3 *db, const char *sql, const char *types, va_list ap,
+         struct stmt_cache_s **entry, int *result)
+{
+	sqlite3_stmt *stmt;
+
+	*entry = stmt_acquire(db, sql, &stmt);
+	if (!stmt)
+		return NULL;
+	if (stmt_bind(stmt, types, ap) != SQLITE_OK)
+	{
+		DPRINTF(E_ERROR, L_DB_SQL, "bind failed: %s\n%s\n", sqlite3_errmsg(db), sql);
+		*result = SQLITE_ERROR;
+	}
+	else
+		*result = stmt_step(stmt);
+
+	return stmt;
+}
+
+int
+sql_exec_bind(sqlite3 *db, const char *sql, const char *types, ...)
+{
+	struct stmt_cache_s *e;
+	sqlite3_stmt *stmt;
+	uint64_t start = sql_now_usecs();
+	int result, ret;
+	va_list ap;
+
+	sql_counters.writes++;
+	va_start(ap, types);
+	stmt = stmt_run(db, sql, types, ap, &e, &result);
+	va_end(ap);
+	if (!stmt)
+		return SQLITE_ERROR;
+
+	if (result == SQLITE_DONE || result == SQLITE_ROW)
+		ret = SQLITE_OK;
+	else
+	{
+		DPRINTF(E_ERROR, L_DB_SQL, "SQL ERROR %d [%s]\n%s\n", result, sqlite3_errmsg(db), sql);
+		ret = result;
+	}
+	stmt_release(e, stmt, start);
+
+	return ret;
+}
+
+int64_t
+sql_get_int64_field_bind(sqlite3 *db, const char *sql, const char *types, ...)
+{
+	struct stmt_cache_s *e;
+	sqlite3_stmt *stmt;
+	uint64_t start = sql_now_usecs();
+	int result;
+	int64_t ret;
+	va_list ap;
+
+	sql_counters.reads++;
+	va_start(ap, types);
+	stmt = stmt_run(db, sql, types, ap, &e, &result);
+	va_end(ap);
+	if (!stmt)
+		return -1;
+
+	switch (result)
+	{
+		case SQLITE_DONE:
+			/* no rows returned */
+			ret = 0;
+			break;
+		case SQLITE_ROW:
+			if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+				ret = 0;
+			else
+				ret = sqlite3_column_int64(stmt, 0);
+			break;
+		default:
+			DPRINTF(E_WARN, L_DB_SQL, "%s: step failed: %s\n%s\n", __func__, sqlite3_errmsg(db), sql);
+			ret = -1;
+			break;
+	}
+	stmt_release(e, stmt, start);
+
+	return ret;
+}
+
+char *
+sql_get_text_field_bind(sqlite3 *db, const char *sql, const char *types, ...)
+{
+	struct stmt_cache_s *e;
+	sqlite3_stmt *stmt;
+	uint64_t start = sql_now_usecs();
+	int result, len;
+	char *str = NULL;
+	va_list ap;
+
+	sql_counters.reads++;
+	if (db == NULL)
+	{
+		DPRINTF(E_WARN, L_DB_SQL, "db is NULL\n");
+		return NULL;
+	}
+
+	va_start(ap, types);
+	stmt = stmt_run(db, sql, types, ap, &e, &result);
+	va_end(ap);
+	if (!stmt)
+		return NULL;
+
+	switch (result)
+	{
+		case SQLITE_DONE:
+			/* no rows returned */
+			break;
+		case SQLITE_ROW:
+			if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+				break;
+			len = sqlite3_column_bytes(stmt, 0);
+			if ((str = sqlite3_malloc(len + 1)) == NULL)
+			{
+				DPRINTF(E_ERROR, L_DB_SQL, "malloc failed\n");
+				break;
+			}
+			memcpy(str, sqlite3_column_text(stmt, 0), len + 1);
+			break;
+		default:
+			DPRINTF(E_WARN, L_DB_SQL, "SQL step failed: %s\n%s\n", sqlite3_errmsg(db), sql);
+			break;
+	}
+	stmt_release(e, stmt, start);
+
+	return str;
+}
+
+void *
+sql_get_blob_field_bind(sqlite3 *db, int *len, const char *sql, const char *types, ...)
+{
+	struct stmt_cache_s *e;
+	sqlite3_stmt *stmt;
+	uint64_t start = sql_now_usecs();
+	int result;
+	void *data = NULL;
+	va_list ap;
+
+	sql_counters.reads++;
+	*len = 0;
+	va_start(ap, types);
+	stmt = stmt_run(db, sql, types, ap, &e, &result);
+	va_end(ap);
+	if (!stmt)
+		return NULL;
+
+	switch (result)
+	{
+		case SQLITE_DONE:
+			/* no rows returned */
+			break;
+		case SQLITE_ROW:
+			if (sqlite3_column_type(stmt, 0) != SQLITE_BLOB)
+				break;
+			*len = sqlite3_column_bytes(stmt, 0);
+			if ((data = sqlite3_malloc(*len)) == NULL)
+			{
+				DPRINTF(E_ERROR, L_DB_SQL, "malloc failed\n");
+				*len = 0;
+				break;
+			}
+			memcpy(data, sqlite3_column_blob(stmt, 0), *len);
+			break;
+		default:
+			DPRINTF(E_WARN, L_DB_SQL, "SQL step failed: %s\n%s\n", sqlite3_errmsg(db), sql);
+			break;
+	}
+	stmt_release(e, stmt, start);
+
+	return data;
+}
+
+void
+sql_stmt_stats(void)
+{
+	struct stmt_cache_s *e;
+	int i;
+
+	pthread_mutex_lock(&stmt_cache_mutex);
+	for (i = 0; i < STMT_CACHE_SIZE; i++)
+	{
+		e = &stmt_cache[i];
+		if (!e->sql || !e->calls)
+			continue;
+		DPRINTF(E_DEBUG, L_DB_SQL, "%8lu calls %3lu prepares %10llu us [%s]\n",
+			e->calls, e->prepares, (unsigned long long)e->usecs, e->sql);
+	}
+	pthread_mutex_unlock(&stmt_cache_mutex);
+}
+
+void
+sql_stmt_flush(sqlite3 *db)
+{
+	struct stmt_cache_s *e;
+	int i;
+
+	pthread_mutex_lock(&stmt_cache_mutex);
+	for (i = 0; i < STMT_CACHE_SIZE; i++)
+	{
+		e = &stmt_cache[i];
+		if (!e->sql || (db && e->db != db))
+			continue;
+		if (e->stmt)
+			sqlite3_finalize(e->stmt);
+		memset(e, 0, sizeof(*e));
+	}
+	pthread_mutex_unlock(&stmt_cache_mutex);
+}
+
+int
+sql_close(sqlite3 *db)
+{
+	sql_stmt_stats();
+	sql_stmt_flush(db);
+
+	return sqlite3_close(db);
+}
+
+int64_t
+sql_get_db_size(sqlite3 *db, int64_t *cache_bytes)
+{
+	int64_t page_size, pages, cache;
+
+	page_size = sql_get_int64_field(db, "PRAGMA page_size");
+	pages = sql_get_int64_field(db, "PRAGMA page_count");
+	if (cache_bytes)
+	{
+		/* A negative cache_size is a limit in KiB rather than pages */
+		cache = sql_get_int64_field(db, "PRAGMA cache_size");
+		*cache_bytes = (cache < 0) ? -cache * 1024 : cache * page_size;
+	}
+
+	return pages * page_size;
+}
+
+/* Schema migrations, applied in place by db_upgrade().  Each step takes
+ * the database from version 'from' to 'from + 1' and is spelled out in
+ * full rather than shared with scanner_sqlite.h, since the current schema
+ * keeps moving while an old step must always produce the same result. */
+static const char * const migrate_9_to_10[] = {
+	"CREATE TABLE ARTISTS (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL COLLATE NOCASE)",
+	"CREATE TABLE ALBUMS (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL COLLATE NOCASE)",
+	"CREATE TABLE GENRES (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL COLLATE NOCASE)",
+	"CREATE TABLE CREATORS (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL COLLATE NOCASE)",
+	"CREATE TABLE DLNA_PROFILES (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL)",
+	"CREATE TABLE MIME_TYPES (ID INTEGER PRIMARY KEY, NAME TEXT UNIQUE NOT NULL)",
+	"INSERT or IGNORE into ARTISTS (NAME) SELECT ARTIST from DETAILS where ARTIST is not NULL",
+	"INSERT or IGNORE into ALBUMS (NAME) SELECT ALBUM from DETAILS where ALBUM is not NULL",
+	"INSERT or IGNORE into GENRES (NAME) SELECT GENRE from DETAILS where GENRE is not NULL",
+	"INSERT or IGNORE into CREATORS (NAME) SELECT CREATOR from DETAILS where CREATOR is not NULL",
+	"INSERT or IGNORE into DLNA_PROFILES (NAME) SELECT DLNA_PN from DETAILS where DLNA_PN is not NULL",
+	"INSERT or IGNORE into MIME_TYPES (NAME) SELECT MIME from DETAILS where MIME is not NULL",
+	"CREATE TABLE DETAILS_DATA ("
+		"ID INTEGER PRIMARY KEY AUTOINCREMENT, PATH TEXT DEFAULT NULL, "
+		"SIZE INTEGER, TIMESTAMP INTEGER, TITLE TEXT COLLATE NOCASE, "
+		"DURATION TEXT, BITRATE INTEGER, SAMPLERATE INTEGER, "
+		"CREATOR_ID INTEGER DEFAULT 0, ARTIST_ID INTEGER DEFAULT 0, "
+		"ALBUM_ID INTEGER DEFAULT 0, GENRE_ID INTEGER DEFAULT 0, "
+		"COMMENT TEXT, CHANNELS INTEGER, DISC INTEGER, TRACK INTEGER, "
+		"DATE DATE, RESOLUTION TEXT, THUMBNAIL BOOL DEFAULT 0, "
+		"ALBUM_ART INTEGER DEFAULT 0, ROTATION INTEGER, "
+		"DLNA_PN_ID INTEGER DEFAULT 0, MIME_ID INTEGER DEFAULT 0)",
+	"INSERT into DETAILS_DATA (ID, PATH, SIZE, TIMESTAMP, TITLE, DURATION, BITRATE, "
+		"SAMPLERATE, CREATOR_ID, ARTIST_ID, ALBUM_ID, GENRE_ID, COMMENT, CHANNELS, "
+		"DISC, TRACK, DATE, RESOLUTION, THUMBNAIL, ALBUM_ART, ROTATION, DLNA_PN_ID, MIME_ID) "
+		"SELECT d.ID, d.PATH, d.SIZE, d.TIMESTAMP, d.TITLE, d.DURATION, d.BITRATE, "
+		"d.SAMPLERATE, ifnull(c.ID, 0), ifnull(a.ID, 0), ifnull(al.ID, 0), ifnull(g.ID, 0), "
+		"d.COMMENT, d.CHANNELS, d.DISC, d.TRACK, d.DATE, d.RESOLUTION, d.THUMBNAIL, "
+		"d.ALBUM_ART, d.ROTATION, ifnull(p.ID, 0), ifnull(m.ID, 0) "
+		"from DETAILS d "
+		"left join CREATORS c on (c.NAME = d.CREATOR) "
+		"left join ARTISTS a on (a.NAME = d.ARTIST) "
+		"left join ALBUMS al on (al.NAME = d.ALBUM) "
+		"left join GENRES g on (g.NAME = d.GENRE) "
+		"left join DLNA_PROFILES p on (p.NAME = d.DLNA_PN) "
+		"left join MIME_TYPES m on (m.NAME = d.MIME)",
+	"DROP TABLE DETAILS",
+	"CREATE VIEW DETAILS as SELECT "
+		"d.ID as ID, d.PATH as PATH, d.SIZE as SIZE, "
+		"d.TIMESTAMP as TIMESTAMP, d.TITLE as TITLE, "
+		"d.DURATION as DURATION, d.BITRATE as BITRATE, "
+		"d.SAMPLERATE as SAMPLERATE, c.NAME as CREATOR, "
+		"a.NAME as ARTIST, al.NAME as ALBUM, g.NAME as GENRE, "
+		"d.COMMENT as COMMENT, d.CHANNELS as CHANNELS, "
+		"d.DISC as DISC, d.TRACK as TRACK, d.DATE as DATE, "
+		"d.RESOLUTION as RESOLUTION, d.THUMBNAIL as THUMBNAIL, "
+		"d.ALBUM_ART as ALBUM_ART, d.ROTATION as ROTATION, "
+		"p.NAME as DLNA_PN, m.NAME as MIME "
+		"from DETAILS_DATA d "
+		"left join CREATORS c on (c.ID = d.CREATOR_ID) "
+		"left join ARTISTS a on (a.ID = d.ARTIST_ID) "
+		"left join ALBUMS al on (al.ID = d.ALBUM_ID) "
+		"left join GENRES g on (g.ID = d.GENRE_ID) "
+		"left join DLNA_PROFILES p on (p.ID = d.DLNA_PN_ID) "
+		"left join MIME_TYPES m on (m.ID = d.MIME_ID)",
+	"create INDEX IDX_DETAILS_PATH ON DETAILS_DATA(PATH)",
+	"create INDEX IDX_DETAILS_ID ON DETAILS_DATA(ID)",
+	NULL
+};
+
+/* Version 11 tracks the videos a fast scan has yet to read */
+static const char * const migrate_10_to_11[] = {
+	"CREATE TABLE ENRICH (DETAIL_ID INTEGER PRIMARY KEY)",
+	NULL
+};
+
+/* Version 12 keeps time seek indexes of MPEG streams and MP3s */
+static const char * const migrate_11_to_12[] = {
+	"CREATE TABLE SEEK_INDEX (ID INTEGER PRIMARY KEY, DATA BLOB NOT NULL)",
+	"CREATE TRIGGER SEEK_INDEX_CLEANUP AFTER DELETE ON DETAILS_DATA BEGIN"
+		" DELETE from SEEK_INDEX where ID = old.ID; END",
+	NULL
+};
+
+/* Version 13 reference counts ALBUM_ART, which embedded art now shares */
+static const char * const migrate_12_to_13[] = {
+	"ALTER TABLE ALBUM_ART ADD COLUMN REFS INTEGER DEFAULT 0",
+	"CREATE TEMP TABLE ART_REFS (ID INTEGER PRIMARY KEY, N INTEGER)",
+	"INSERT into ART_REFS SELECT ALBUM_ART, count(*) from DETAILS_DATA"
+		" where ALBUM_ART > 0 group by ALBUM_ART",
+	"UPDATE ALBUM_ART set REFS = ifnull((SELECT N from ART_REFS where ART_REFS.ID = ALBUM_ART.ID), 0)",
+	"DROP TABLE ART_REFS",
+	"CREATE TRIGGER ALBUM_ART_REF AFTER INSERT ON DETAILS_DATA WHEN new.ALBUM_ART > 0 BEGIN"
+		" UPDATE ALBUM_ART set REFS = REFS + 1 where ID = new.ALBUM_ART; END",
+	"CREATE TRIGGER ALBUM_ART_UNREF AFTER DELETE ON DETAILS_DATA WHEN old.ALBUM_ART > 0 BEGIN"
+		" UPDATE ALBUM_ART set REFS = REFS - 1 where ID = old.ALBUM_ART; END",
+	"CREATE TRIGGER ALBUM_ART_REREF AFTER UPDATE OF ALBUM_ART ON DETAILS_DATA"
+		" WHEN old.ALBUM_ART is not new.ALBUM_ART BEGIN"
+		" UPDATE ALBUM_ART set REFS = REFS - 1 where ID = old.ALBUM_ART;"
+		" UPDATE ALBUM_ART set REFS = REFS + 1 where ID = new.ALBUM_ART; END",
+	"create INDEX IDX_ALBUM_ART_PATH ON ALBUM_ART(PATH)",
+	NULL
+};
+
+/* Version 14 keeps track of the resized renditions cached on disk */
+static const char * const migrate_13_to_14[] = {
+	"CREATE TABLE RENDITIONS (PATH TEXT PRIMARY KEY, DETAIL_ID INTEGER, SIZE INTEGER, USED INTEGER)",
+	"CREATE TRIGGER RENDITIONS_CLEANUP AFTER DELETE ON DETAILS_DATA BEGIN"
+		" DELETE from RENDITIONS where DETAIL_ID = old.ID; END",
+	"create INDEX IDX_RENDITIONS_USED ON RENDITIONS(USED)",
+	NULL
+};
+
+/* Version 15 locates EXIF thumbnails; older photos keep using libexif */
+static const char * const migrate_14_to_15[] = {
+	"ALTER TABLE DETAILS_DATA ADD COLUMN THUMB_OFFSET INTEGER",
+	"ALTER TABLE DETAILS_DATA ADD COLUMN THUMB_SIZE INTEGER",
+	NULL
+};
+
+/* Version 16 marks the containers the browse snapshot has to read again */
+static const char * const migrate_15_to_16[] = {
+	"CREATE TABLE SNAPSHOT_DIRTY (ID INTEGER PRIMARY KEY, PARENT_ID TEXT UNIQUE)",
+	"INSERT into SETTINGS values ('GENERATION', abs(random()))",
+	NULL
+};
+
+/* Version 17 flags the items with a seek index, so Browse can tell from the row */
+static const char * const migrate_16_to_17[] = {
+	"ALTER TABLE DETAILS_DATA ADD COLUMN SEEKABLE BOOL DEFAULT 0",
+	"UPDATE DETAILS_DATA set SEEKABLE = 1 where ID in (SELECT ID from SEEK_INDEX)",
+	"DROP VIEW DETAILS",
+	"CREATE VIEW DETAILS as SELECT "
+		"d.ID as ID, d.PATH as PATH, d.SIZE as SIZE, "
+		"d.TIMESTAMP as TIMESTAMP, d.TITLE as TITLE, "
+		"d.DURATION as DURATION, d.BITRATE as BITRATE, "
+		"d.SAMPLERATE as SAMPLERATE, c.NAME as CREATOR, "
+		"a.NAME as ARTIST, al.NAME as ALBUM, g.NAME as GENRE, "
+		"d.COMMENT as COMMENT, d.CHANNELS as CHANNELS, "
+		"d.DISC as DISC, d.TRACK as TRACK, d.DATE as DATE, "
+		"d.RESOLUTION as RESOLUTION, d.THUMBNAIL as THUMBNAIL, "
+		"d.ALBUM_ART as ALBUM_ART, d.ROTATION as ROTATION, "
+		"d.SEEKABLE as SEEKABLE, "
+		"p.NAME as DLNA_PN, m.NAME as MIME "
+		"from DETAILS_DATA d "
+		"left join CREATORS c on (c.ID = d.CREATOR_ID) "
+		"left join ARTISTS a on (a.ID = d.ARTIST_ID) "
+		"left join ALBUMS al on (al.ID = d.ALBUM_ID) "
+		"left join GENRES g on (g.ID = d.GENRE_ID) "
+		"left join DLNA_PROFILES p on (p.ID = d.DLNA_PN_ID) "
+		"left join MIME_TYPES m on (m.ID = d.MIME_ID)",
+	/* Dropped for snapshot_tracking() to put back with SEEKABLE */
+	"DROP TRIGGER if exists SNAPSHOT_DIRTY_DETAILS",
+	NULL
+};
+
+static const struct {
+	int from;
+	const char * const *steps;
+} migrations[] = {
+	{ 9, migrate_9_to_10 },
+	{ 10, migrate_10_to_11 },
+	{ 11, migrate_11_to_12 },
+	{ 12, migrate_12_to_13 },
+	{ 13, migrate_13_to_14 },
+	{ 14, migrate_14_to_15 },
+	{ 15, migrate_15_to_16 },
+	{ 16, migrate_16_to_17 },
+	{ 0, NULL }
+};
+
+static int
+db_migrate(sqlite3 *db, int from)
+{
+	const char * const *steps = NULL;
+	int i, ret = SQLITE_OK;
+
+	for (i = 0; migrations[i].steps; i++)
+	{
+		if (migrations[i].from == from)
+			steps = migrations[i].steps;
+	}
+	if (!steps)
+		return -1;
+
+	DPRINTF(E_WARN, L_DB_SQL, "Migrating database from version %d to %d\n", from, from + 1);
+	/* ROLLBACK is undefined without a journal, so keep one in memory for
+	 * the duration of the migration. */
+	sql_exec(db, "PRAGMA journal_mode = MEMORY");
+	ret = sql_exec(db, "BEGIN");
+	for (i = 0; steps[i] && ret == SQLITE_OK; i++)
+		ret = sql_exec(db, "%s", steps[i]);
+	if (ret == SQLITE_OK)
+		ret = sql_exec(db, "PRAGMA user_version = %d", from + 1);
+	if (ret == SQLITE_OK)
+		ret = sql_exec(db, "COMMIT");
+	if (ret != SQLITE_OK)
+	{
+		DPRINTF(E_ERROR, L_DB_SQL, "Migration to version %d failed\n", from + 1);
+		sql_exec(db, "ROLLBACK");
+	}
+	sql_exec(db, "PRAGMA journal_mode = OFF");
+
+	return (ret == SQLITE_OK) ? 0 : -1;
+}
+
 int
 db_upgrade(sqlite3 *db)
 {
@@ -272,9 +888,12 @@ db_upgrade(sqlite3 *db)
 		return -2;
 	if (db_vers < 1)
 		return -1;
-	if (db_vers < 9)
-		return db_vers;
-	sql_exec(db, "PRAGMA user_version = %d", DB_VERSION);
+	while (db_vers < DB_VERSION)
+	{
+		if (db_migrate(db, db_vers) != 0)
+			return db_vers;
+		db_vers++;
+	}
 
 	return 0;
 }
@@ -34,11 +34,35 @@
 #define sqlite3_prepare_v2 sqlite3_prepare
 #endif
 
+/* Statements run through the helpers below, for the scanner statistics */
+struct sql_counters {
+	unsigned long reads;
+	unsigned long writes;
+};
+extern struct sql_counters sql_counters;
+
 int sql_exec(sqlite3 *db, const char *fmt, ...);
 int sql_get_table(sqlite3 *db, const char *zSql, char ***pazResult, int *pnRow, int *pnColumn);
 int sql_get_int_field(sqlite3 *db, const char *fmt, ...);
 int64_t sql_get_int64_field(sqlite3 *db, const char *fmt, ...);
 char * sql_get_text_field(sqlite3 *db, const char *fmt, ...);
+
+/* Cached-statement variants.  'sql' must be a string constant; it is
+ * prepared once per connection and parameters are bound positionally
+ * according to 'types' ('i' = int64_t, 't' = const char *, 'b' = a blob
+ * as const void * followed by its int length). */
+int sql_exec_bind(sqlite3 *db, const char *sql, const char *types, ...);
+int64_t sql_get_int64_field_bind(sqlite3 *db, const char *sql, const char *types, ...);
+char * sql_get_text_field_bind(sqlite3 *db, const char *sql, const char *types, ...);
+/* Copy of a blob, to be released with sqlite3_free() */
+void * sql_get_blob_field_bind(sqlite3 *db, int *len, const char *sql, const char *types, ...);
+#define sql_get_int_field_bind(db, sql, types, ...) \
+	((int)sql_get_int64_field_bind(db, sql, types, ##__VA_ARGS__))
+int64_t sql_get_db_size(sqlite3 *db, int64_t *cache_bytes);
+void sql_stmt_stats(void);
+void sql_stmt_flush(sqlite3 *db);
+int sql_close(sqlite3 *db);
+
 int db_upgrade(sqlite3 *db);
 
 #endif
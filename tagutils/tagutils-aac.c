@@ -61,9 +61,8 @@ _aac_findatom(FILE *fin, long max_offset, char *which_atom, int *atom_size)
 
 // _get_aactags
 static int
-_get_aactags(char *file, struct song_metadata *psong)
+_get_aactags(char *file, FILE *fin, struct song_metadata *psong)
 {
-	FILE *fin;
 	long atom_offset;
 	unsigned int atom_length;
 
@@ -74,14 +73,6 @@ _get_aactags(char *file, struct song_metadata *psong)
 	int genre;
 	int len;
 
-	if(!(fin = fopen(file, "rb")))
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Cannot open file %s for reading\n", file);
-		return -1;
-	}
-
-	fseek(fin, 0, SEEK_SET);
-
 	atom_offset = _aac_lookforatom(fin, "moov:udta:meta:ilst", &atom_length);
 	if(atom_offset != -1)
 	{
@@ -167,7 +158,6 @@ _get_aactags(char *file, struct song_metadata *psong)
 			current_offset += current_size;
 		}
 	}
-	fclose(fin);
 	free(current_data);
 
 	if(atom_offset == -1)
@@ -185,8 +175,7 @@ _aac_lookforatom(FILE *aac_fp, char *atom_path, unsigned int *atom_length)
 	char *cur_p, *end_p;
 	char atom_name[5];
 
-	fseek(aac_fp, 0, SEEK_END);
-	file_size = ftell(aac_fp);
+	file_size = _file_size(aac_fp);
 	rewind(aac_fp);
 
 	end_p = atom_path;
@@ -257,9 +246,8 @@ _aac_check_extended_descriptor(FILE *infile)
 
 // _get_aacfileinfo
 int
-_get_aacfileinfo(char *file, struct song_metadata *psong)
+_get_aacfileinfo(char *file, FILE *infile, struct song_metadata *psong)
 {
-	FILE *infile;
 	long atom_offset;
 	int atom_length;
 	int sample_size;
@@ -273,16 +261,7 @@ _get_aacfileinfo(char *file, struct song_metadata *psong)
 	psong->vbr_scale = -1;
 	psong->channels = 2; // A "normal" default in case we can't find this information
 
-	infile = fopen(file, "rb");
-	if(!infile)
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", file);
-		return -1;
-	}
-
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
-	fseek(infile, 0, SEEK_SET);
+	file_size = _file_size(infile);
 
 	// move to 'mvhd' atom
 	atom_offset = _aac_lookforatom(infile, "moov:mvhd", (unsigned int*)&atom_length);
@@ -291,10 +270,7 @@ _get_aacfileinfo(char *file, struct song_metadata *psong)
 		fseek(infile, 12, SEEK_CUR);
 		if(fread((void*)&sample_size, 1, sizeof(int), infile) != sizeof(int) ||
 		   fread((void*)&samples, 1, sizeof(int), infile) != sizeof(int))
-		{
-			fclose(infile);
 			return -1;
-		}
 
 		sample_size = ntohl(sample_size);
 		samples = ntohl(samples);
@@ -408,6 +384,5 @@ bad_esds:
 			break;
 	}
 
-	fclose(infile);
 	return 0;
 }
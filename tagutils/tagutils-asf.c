@@ -87,71 +87,180 @@ cpu_to_be32(uint32_t cpu32)
 #endif
 }
 
-static inline uint8_t
-fget_byte(FILE *fp)
+/* The header object is read into memory in one go, and each object in it
+ * is parsed through one of these.  Reads past the end of the view give
+ * zeros and set 'error', so callers only check where it matters. */
+struct asf_buf {
+	const uint8_t *p;
+	const uint8_t *end;
+	int error;
+};
+
+static inline const uint8_t *
+asf_get(struct asf_buf *b, uint64_t n)
 {
-	uint8_t d;
+	const uint8_t *p = b->p;
 
-	if (fread(&d, sizeof(d), 1, fp) != 1)
-		return 0;
-	return d;
+	if((uint64_t)(b->end - b->p) < n)
+	{
+		b->p = b->end;
+		b->error = 1;
+		return NULL;
+	}
+	b->p += n;
+	return p;
 }
 
 static inline uint16_t
-fget_le16(FILE *fp)
+asf_get_le16(struct asf_buf *b)
 {
-	uint16_t d;
+	const uint8_t *p = asf_get(b, 2);
 
-	if (fread(&d, sizeof(d), 1, fp) != 1)
-		return 0;
-	d = le16_to_cpu(d);
-	return d;
+	return p ? p[0] | (p[1] << 8) : 0;
 }
 
 static inline uint32_t
-fget_le32(FILE *fp)
+asf_get_le32(struct asf_buf *b)
 {
-	uint32_t d;
+	const uint8_t *p = asf_get(b, 4);
 
-	if (fread(&d, sizeof(d), 1, fp) != 1)
-		return 0;
-	d = le32_to_cpu(d);
-	return d;
+	return p ? p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24) : 0;
 }
 
-// NOTE: support U+0000 ~ U+FFFF only.
-static int
-utf16le_to_utf8(char *dst, int n, uint16_t utf16le)
+static inline uint64_t
+asf_get_le64(struct asf_buf *b)
 {
-	uint16_t wc = le16_to_cpu(utf16le);
-	if (wc < 0x80)
-	{
-		if (n < 1)
-			return 0;
-		*dst++ = wc & 0xff;
-		return 1;
-	}
-	else if (wc < 0x800)
+	uint64_t lo = asf_get_le32(b);
+
+	return lo | ((uint64_t)asf_get_le32(b) << 32);
+}
+
+/* Copy up to 'len' bytes into a fixed size structure, zero filling it */
+static inline int
+asf_copy(struct asf_buf *b, void *dst, int len, int want)
+{
+	const uint8_t *p;
+
+	memset(dst, 0, want);
+	if(len > want)
+		len = want;
+	if(!(p = asf_get(b, len)))
+		return -1;
+	memcpy(dst, p, len);
+	return 0;
+}
+
+/* Split off the next 'n' bytes as a view of their own */
+static struct asf_buf
+asf_sub(struct asf_buf *b, uint64_t n)
+{
+	struct asf_buf sub = { b->p, b->p, 0 };
+
+	if(asf_get(b, n))
+		sub.end = b->p;
+	else
+		sub.error = 1;
+	return sub;
+}
+
+/* Step to the next object of a list, returning its GUID and a view of
+ * its contents, or NULL at the end of the list. */
+static const GUID *
+asf_next_object(struct asf_buf *b, struct asf_buf *obj)
+{
+	const uint8_t *id;
+	uint64_t size;
+
+	if(!(id = asf_get(b, sizeof(GUID))))
+		return NULL;
+	size = asf_get_le64(b);
+	if(b->error || size < sizeof(asf_object_t) ||
+	   size - sizeof(asf_object_t) > (uint64_t)(b->end - b->p))
 	{
-		if (n < 2)
-			return 0;
-		*dst++ = 0xc0 | (wc>>6);
-		*dst++ = 0x80 | (wc & 0x3f);
-		return 2;
+		DPRINTF(E_ERROR, L_SCANNER, "Size overrun reading header object %llu\n",
+			(unsigned long long)size);
+		b->error = 1;
+		return NULL;
 	}
-	else
+	*obj = asf_sub(b, size - sizeof(asf_object_t));
+
+	return (const GUID *)id;
+}
+
+// UTF-16LE to UTF-8, up to 'n' bytes of it.  Runs of plain ASCII, which
+// most tags are, go four code units at a time.
+static int
+utf16le_to_utf8(char *dst, int n, const uint8_t *src, int size)
+{
+	uint64_t w;
+	uint32_t wc, wc2;
+	int i = 0, j = 0;
+
+	while(j + 1 < size)
 	{
-		if (n < 3)
-			return 0;
-		*dst++ = 0xe0 | (wc>>12);
-		*dst++ = 0x80 | ((wc>>6) & 0x3f);
-		*dst++ = 0x80 | (wc & 0x3f);
-		return 3;
+		if((j + 8 <= size) && (i + 4 <= n))
+		{
+			memcpy(&w, &src[j], sizeof(w));
+			if(!(le64_to_cpu(w) & 0xFF80FF80FF80FF80ULL))
+			{
+				dst[i++] = src[j];
+				dst[i++] = src[j + 2];
+				dst[i++] = src[j + 4];
+				dst[i++] = src[j + 6];
+				j += 8;
+				continue;
+			}
+		}
+
+		wc = src[j] | (src[j + 1] << 8);
+		j += 2;
+		if((wc >= 0xD800) && (wc < 0xDC00) && (j + 1 < size))
+		{
+			wc2 = src[j] | (src[j + 1] << 8);
+			if((wc2 >= 0xDC00) && (wc2 < 0xE000))
+			{
+				wc = 0x10000 + ((wc - 0xD800) << 10) + (wc2 - 0xDC00);
+				j += 2;
+			}
+		}
+
+		if(wc < 0x80)
+		{
+			if(n - i < 1)
+				break;
+			dst[i++] = wc;
+		}
+		else if(wc < 0x800)
+		{
+			if(n - i < 2)
+				break;
+			dst[i++] = 0xc0 | (wc >> 6);
+			dst[i++] = 0x80 | (wc & 0x3f);
+		}
+		else if(wc < 0x10000)
+		{
+			if(n - i < 3)
+				break;
+			dst[i++] = 0xe0 | (wc >> 12);
+			dst[i++] = 0x80 | ((wc >> 6) & 0x3f);
+			dst[i++] = 0x80 | (wc & 0x3f);
+		}
+		else
+		{
+			if(n - i < 4)
+				break;
+			dst[i++] = 0xf0 | (wc >> 18);
+			dst[i++] = 0x80 | ((wc >> 12) & 0x3f);
+			dst[i++] = 0x80 | ((wc >> 6) & 0x3f);
+			dst[i++] = 0x80 | (wc & 0x3f);
+		}
 	}
+
+	return i;
 }
 
 static int
-_asf_read_file_properties(FILE *fp, asf_file_properties_t *p, uint32_t size)
+_asf_read_file_properties(struct asf_buf *b, asf_file_properties_t *p, uint32_t size)
 {
 	int len;
 
@@ -163,10 +272,7 @@ _asf_read_file_properties(FILE *fp, asf_file_properties_t *p, uint32_t size)
 	p->ID = ASF_FileProperties;
 	p->Size = size;
 
-	if(len != fread(&p->FileID, 1, len, fp))
-		return -1;
-
-	return 0;
+	return asf_copy(b, &p->FileID, len, len);
 }
 
 static void
@@ -193,16 +299,11 @@ _pick_dlna_profile(struct song_metadata *psong, uint16_t format)
 }
 
 static int
-_asf_read_audio_stream(FILE *fp, struct song_metadata *psong, int size)
+_asf_read_audio_stream(struct asf_buf *b, struct song_metadata *psong, int size)
 {
 	asf_audio_stream_t s;
-	int len;
 
-	len = sizeof(s) - sizeof(s.Hdr);
-	if(len > size)
-		len = size;
-
-	if(len != fread(&s.wfx, 1, len, fp))
+	if(asf_copy(b, &s.wfx, size, sizeof(s) - sizeof(s.Hdr)))
 		return -1;
 
 	psong->channels = le16_to_cpu(s.wfx.nChannels);
@@ -216,26 +317,18 @@ _asf_read_audio_stream(FILE *fp, struct song_metadata *psong, int size)
 }
 
 static int
-_asf_read_media_stream(FILE *fp, struct song_metadata *psong, uint32_t size)
+_asf_read_media_stream(struct asf_buf *b, struct song_metadata *psong, uint32_t size)
 {
 	asf_media_stream_t s;
 	avi_audio_format_t wfx;
-	int len;
 
-	len = sizeof(s) - sizeof(s.Hdr);
-	if(len > size)
-		len = size;
-
-	memset(&s, 0, sizeof(s));
-
-	if(len != fread(&s.MajorType, 1, len, fp))
+	if(asf_copy(b, &s.MajorType, size, sizeof(s) - sizeof(s.Hdr)))
 		return -1;
 
 	if(IsEqualGUID(&s.MajorType, &ASF_MediaTypeAudio) &&
-	   IsEqualGUID(&s.FormatType, &ASF_FormatTypeWave) && s.FormatSize >= sizeof(wfx))
+	   IsEqualGUID(&s.FormatType, &ASF_FormatTypeWave) && le32_to_cpu(s.FormatSize) >= sizeof(wfx))
 	{
-
-		if(sizeof(wfx) != fread(&wfx, 1, sizeof(wfx), fp))
+		if(asf_copy(b, &wfx, sizeof(wfx), sizeof(wfx)))
 			return -1;
 
 		psong->channels = le16_to_cpu(wfx.nChannels);
@@ -250,24 +343,19 @@ _asf_read_media_stream(FILE *fp, struct song_metadata *psong, uint32_t size)
 }
 
 static int
-_asf_read_stream_object(FILE *fp, struct song_metadata *psong, uint32_t size)
+_asf_read_stream_object(struct asf_buf *b, struct song_metadata *psong)
 {
 	asf_stream_object_t s;
 	int len;
 
 	len = sizeof(s) - sizeof(asf_object_t);
-	if(size < len)
-		return -1;
-
-	memset(&s, 0, sizeof(s));
-
-	if(len != fread(&s.StreamType, 1, len, fp))
+	if(asf_copy(b, &s.StreamType, len, len))
 		return -1;
 
 	if(IsEqualGUID(&s.StreamType, &ASF_AudioStream))
-		_asf_read_audio_stream(fp, psong, s.TypeSpecificSize);
+		_asf_read_audio_stream(b, psong, le32_to_cpu(s.TypeSpecificSize));
 	else if(IsEqualGUID(&s.StreamType, &ASF_StreamBufferStream))
-		_asf_read_media_stream(fp, psong, s.TypeSpecificSize);
+		_asf_read_media_stream(b, psong, le32_to_cpu(s.TypeSpecificSize));
 	else if(!IsEqualGUID(&s.StreamType, &ASF_VideoStream))
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Unknown asf stream type.\n");
@@ -277,121 +365,79 @@ _asf_read_stream_object(FILE *fp, struct song_metadata *psong, uint32_t size)
 }
 
 static int
-_asf_read_extended_stream_object(FILE *fp, struct song_metadata *psong, uint32_t size)
+_asf_read_extended_stream_object(struct asf_buf *b, struct song_metadata *psong)
 {
 	int i, len;
-	long off;
-	asf_object_t tmp;
+	const GUID *id;
+	struct asf_buf obj;
 	asf_extended_stream_object_t xs;
-	asf_stream_name_t nm;
-	asf_payload_extension_t pe;
-
-	if(size < sizeof(asf_extended_stream_object_t))
-		return -1;
-
-	memset(&xs, 0, sizeof(xs));
 
 	len = sizeof(xs) - offsetof(asf_extended_stream_object_t, StartTime);
-	if(len != fread(&xs.StartTime, 1, len, fp))
+	if(asf_copy(b, &xs.StartTime, len, len))
 		return -1;
-	off = sizeof(xs);
 
-	for(i = 0; i < xs.StreamNameCount; i++)
+	for(i = 0; i < le16_to_cpu(xs.StreamNameCount); i++)
 	{
-		if(off + sizeof(nm) > size)
-			return -1;
-		if(sizeof(nm) != fread(&nm, 1, sizeof(nm), fp))
-			return -1;
-		off += sizeof(nm);
-		if(off + nm.Length > sizeof(asf_extended_stream_object_t))
-			return -1;
-		if(nm.Length > 0)
-			fseek(fp, nm.Length, SEEK_CUR);
-		off += nm.Length;
+		asf_get_le16(b);                // language ID index
+		asf_get(b, asf_get_le16(b));
 	}
 
-	for(i = 0; i < xs.PayloadExtensionSystemCount; i++)
+	for(i = 0; i < le16_to_cpu(xs.PayloadExtensionSystemCount); i++)
 	{
-		if(off + sizeof(pe) > size)
-			return -1;
-		if(sizeof(pe) != fread(&pe, 1, sizeof(pe), fp))
-			return -1;
-		off += sizeof(pe);
-		if(pe.InfoLength > 0)
-			fseek(fp, pe.InfoLength, SEEK_CUR);
-		off += pe.InfoLength;
+		asf_get(b, sizeof(GUID) + 2);   // extension system ID, data size
+		asf_get(b, asf_get_le32(b));
 	}
 
-	if(off < size)
+	if(b->error)
+		return -1;
+
+	if(b->p < b->end && (id = asf_next_object(b, &obj)))
 	{
-		if(sizeof(tmp) != fread(&tmp, 1, sizeof(tmp), fp))
-			return -1;
-		if(IsEqualGUID(&tmp.ID, &ASF_StreamHeader))
-			_asf_read_stream_object(fp, psong, tmp.Size);
+		if(IsEqualGUID(id, &ASF_StreamHeader))
+			_asf_read_stream_object(&obj, psong);
 	}
 
 	return 0;
 }
 
 static int
-_asf_read_header_extension(FILE *fp, struct song_metadata *psong, uint32_t size)
+_asf_read_header_extension(struct asf_buf *b, struct song_metadata *psong)
 {
-	off_t pos;
-	long off;
-	asf_header_extension_t ext;
-	asf_object_t tmp;
-
-	if(size < sizeof(asf_header_extension_t))
-		return -1;
+	const GUID *id;
+	struct asf_buf data, obj;
 
-	if(sizeof(ext.Reserved1) != fread(&ext.Reserved1, 1, sizeof(ext.Reserved1), fp))
+	asf_get(b, sizeof(GUID) + 2);           // Reserved1, Reserved2
+	data = asf_sub(b, asf_get_le32(b));
+	if(b->error)
 		return -1;
-	ext.Reserved2 = fget_le16(fp);
-	ext.DataSize = fget_le32(fp);
 
-	pos = ftell(fp);
-	off = 0;
-	while(off < ext.DataSize)
+	while((id = asf_next_object(&data, &obj)))
 	{
-		if(sizeof(asf_header_extension_t) + off > size)
-			break;
-		if(sizeof(tmp) != fread(&tmp, 1, sizeof(tmp), fp))
-			break;
-		if(off + tmp.Size > ext.DataSize)
-			break;
-		if(IsEqualGUID(&tmp.ID, &ASF_ExtendedStreamPropertiesObject))
-			_asf_read_extended_stream_object(fp, psong, tmp.Size);
-
-		off += tmp.Size;
-		fseek(fp, pos + off, SEEK_SET);
+		if(IsEqualGUID(id, &ASF_ExtendedStreamPropertiesObject))
+			_asf_read_extended_stream_object(&obj, psong);
 	}
 
 	return 0;
 }
 
 static int
-_asf_load_string(FILE *fp, int type, int size, char *buf, int len)
+_asf_load_string(struct asf_buf *b, int type, int size, char *buf, int len)
 {
-	unsigned char data[2048];
-	uint16_t wc;
-	int i, j;
-	int16_t *wd16;
-	int32_t *wd32;
-	int64_t *wd64;
+	const uint8_t *data;
+	struct asf_buf v;
+	int i;
 
 	i = 0;
-	if(size && (size <= sizeof(data)) && (size == fread(data, 1, size, fp)))
+	if(size && (data = asf_get(b, size)))
 	{
+		v.p = data;
+		v.end = data + size;
+		v.error = 0;
 
 		switch(type)
 		{
 		case ASF_VT_UNICODE:
-			for(j = 0; j < size; j += 2)
-			{
-				wd16 = (int16_t *) &data[j];
-				wc = (uint16_t)*wd16;
-				i += utf16le_to_utf8(&buf[i], len - i, wc);
-			}
+			i = utf16le_to_utf8(buf, len - 1, data, size);
 			break;
 		case ASF_VT_BYTEARRAY:
 			for(i = 0; i < size; i++)
@@ -404,78 +450,58 @@ _asf_load_string(FILE *fp, int type, int size, char *buf, int len)
 		case ASF_VT_BOOL:
 		case ASF_VT_DWORD:
 			if(size >= 4)
-			{
-				wd32 = (int32_t *) &data[0];
-				i = snprintf(buf, len, "%d", le32_to_cpu(*wd32));
-			}
+				i = snprintf(buf, len, "%d", (int32_t)asf_get_le32(&v));
 			break;
 		case ASF_VT_QWORD:
 			if(size >= 8)
-			{
-				wd64 = (int64_t *) &data[0];
-				i = snprintf(buf, len, "%lld", (long long)le64_to_cpu(*wd64));
-			}
+				i = snprintf(buf, len, "%lld", (long long)asf_get_le64(&v));
 			break;
 		case ASF_VT_WORD:
 			if(size >= 2)
-			{
-				wd16 = (int16_t *) &data[0];
-				i = snprintf(buf, len, "%d", le16_to_cpu(*wd16));
-			}
+				i = snprintf(buf, len, "%d", (int16_t)asf_get_le16(&v));
 			break;
 		}
-
-		size = 0;
+		if(i >= len)
+			i = len - 1;
 	}
-	else fseek(fp, size, SEEK_CUR);
 
 	buf[i] = 0;
 	return i;
 }
 
 static void *
-_asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
+_asf_load_picture(struct asf_buf *b, int size, void *bm, int *bm_size)
 {
 	int i;
+	uint16_t wc;
 	char buf[256];
-#if 0
+	struct asf_buf pic;
+
 	//
 	// Picture type       $xx
 	// Data length	  $xx $xx $xx $xx
 	// MIME type          <text string> $00
 	// Description        <text string> $00
 	// Picture data       <binary data>
-
-	char pic_type;
-	long pic_size;
-
-	pic_type = fget_byte(fp); size -= 1;
-	pic_size = fget_le32(fp); size -= 4;
-#else
-	fseek(fp, 5, SEEK_CUR);
-	size -= 5;
-#endif
-	for(i = 0; i < sizeof(buf) - 1; i++)
+	pic = asf_sub(b, size);
+	asf_get(&pic, 5);
+	for(i = 0; (wc = asf_get_le16(&pic)); )
 	{
-		buf[i] = fget_le16(fp); size -= 2;
-		if(!buf[i])
-			break;
+		if(i < sizeof(buf) - 1)
+			buf[i++] = wc;
 	}
 	buf[i] = '\0';
-	if(i == sizeof(buf) - 1)
-	{
-		while(fget_le16(fp))
-			size -= 2;
-	}
 
+	size = 0;
 	if(!strcasecmp(buf, "image/jpeg") ||
 	   !strcasecmp(buf, "image/jpg") ||
 	   !strcasecmp(buf, "image/peg"))
 	{
 
-		while(0 != fget_le16(fp))
-			size -= 2;
+		while(0 != asf_get_le16(&pic))
+			;
 
+		size = pic.end - pic.p;
 		if(size > 0)
 		{
 			if(!(bm = malloc(size)))
@@ -484,13 +510,7 @@ _asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
 			}
 			else
 			{
-				*bm_size = size;
-				if(size > *bm_size || fread(bm, 1, size, fp) != size)
-				{
-					DPRINTF(E_ERROR, L_SCANNER, "Overrun %d bytes required\n", size);
-					free(bm);
-					bm = NULL;
-				}
+				memcpy(bm, pic.p, size);
 			}
 		}
 		else
@@ -510,37 +530,28 @@ _asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
 }
 
 static int
-_get_asffileinfo(char *file, struct song_metadata *psong)
+_get_asffileinfo(char *file, FILE *fp, struct song_metadata *psong)
 {
-	FILE *fp;
 	asf_object_t hdr;
-	asf_object_t tmp;
+	const GUID *id;
+	struct asf_buf b, obj;
+	uint8_t *data;
+	size_t len;
 	unsigned long NumObjects;
 	unsigned short TitleLength;
 	unsigned short AuthorLength;
-	unsigned short CopyrightLength;
-	unsigned short DescriptionLength;
-	unsigned short RatingLength;
 	unsigned short NumEntries;
 	unsigned short NameLength;
 	unsigned short ValueType;
 	unsigned short ValueLength;
-	off_t pos;
 	char buf[2048];
 	asf_file_properties_t FileProperties;
 
 	psong->vbr_scale = -1;
 
-	if(!(fp = fopen(file, "rb")))
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", file);
-		return -1;
-	}
-
 	if(sizeof(hdr) != fread(&hdr, 1, sizeof(hdr), fp))
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Error reading %s\n", file);
-		fclose(fp);
 		return -1;
 	}
 	hdr.Size = le64_to_cpu(hdr.Size);
@@ -548,77 +559,76 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 	if(!IsEqualGUID(&hdr.ID, &ASF_HeaderObject))
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Not a valid header\n");
-		fclose(fp);
 		return -1;
 	}
-	NumObjects = fget_le32(fp);
-	fseek(fp, 2, SEEK_CUR); // Reserved le16
+	if(hdr.Size <= sizeof(hdr) || hdr.Size > ASF_MAX_HEADER)
+	{
+		DPRINTF(E_ERROR, L_SCANNER, "Invalid header size %llu [%s]\n",
+			(unsigned long long)hdr.Size, file);
+		return -1;
+	}
 
-	pos = ftell(fp);
-	while(NumObjects > 0)
+	/* everything after this is in the header object */
+	len = hdr.Size - sizeof(hdr);
+	if(!(data = malloc(len)))
 	{
-		if(sizeof(tmp) != fread(&tmp, 1, sizeof(tmp), fp))
-			break;
-		tmp.Size = le64_to_cpu(tmp.Size);
+		DPRINTF(E_ERROR, L_SCANNER, "Couldn't allocate %lu bytes\n", (unsigned long)len);
+		return -1;
+	}
+	b.p = data;
+	b.end = data + fread(data, 1, len, fp);
+	b.error = 0;
 
-		if(pos + tmp.Size > hdr.Size)
-		{
-			DPRINTF(E_ERROR, L_SCANNER, "Size overrun reading header object %llu\n",
-				(unsigned long long)tmp.Size);
-			break;
-		}
+	NumObjects = asf_get_le32(&b);
+	asf_get(&b, 2); // Reserved le16
 
-		if(IsEqualGUID(&tmp.ID, &ASF_FileProperties))
+	while(NumObjects > 0 && (id = asf_next_object(&b, &obj)))
+	{
+		if(IsEqualGUID(id, &ASF_FileProperties))
 		{
-			_asf_read_file_properties(fp, &FileProperties, tmp.Size);
-			psong->song_length = le64_to_cpu(FileProperties.PlayDuration) / 10000;
-			psong->bitrate = le64_to_cpu(FileProperties.MaxBitrate);
-			psong->max_bitrate = psong->bitrate;
+			if(!_asf_read_file_properties(&obj, &FileProperties, obj.end - obj.p + sizeof(asf_object_t)))
+			{
+				psong->song_length = le64_to_cpu(FileProperties.PlayDuration) / 10000;
+				psong->bitrate = le32_to_cpu(FileProperties.MaxBitrate);
+				psong->max_bitrate = psong->bitrate;
+			}
 		}
-		else if(IsEqualGUID(&tmp.ID, &ASF_ContentDescription))
+		else if(IsEqualGUID(id, &ASF_ContentDescription))
 		{
-			TitleLength = fget_le16(fp);
-			AuthorLength = fget_le16(fp);
-			CopyrightLength = fget_le16(fp);
-			DescriptionLength = fget_le16(fp);
-			RatingLength = fget_le16(fp);
+			TitleLength = asf_get_le16(&obj);
+			AuthorLength = asf_get_le16(&obj);
+			asf_get(&obj, 6);       // Copyright, Description and Rating lengths
 
-			if(_asf_load_string(fp, ASF_VT_UNICODE, TitleLength, buf, sizeof(buf)))
+			if(_asf_load_string(&obj, ASF_VT_UNICODE, TitleLength, buf, sizeof(buf)))
 			{
 				if(buf[0])
 					psong->title = strdup(buf);
 			}
-			if(_asf_load_string(fp, ASF_VT_UNICODE, AuthorLength, buf, sizeof(buf)))
+			if(_asf_load_string(&obj, ASF_VT_UNICODE, AuthorLength, buf, sizeof(buf)))
 			{
 				if(buf[0])
 					psong->contributor[ROLE_TRACKARTIST] = strdup(buf);
 			}
-			if(CopyrightLength)
-				fseek(fp, CopyrightLength, SEEK_CUR);
-			if(DescriptionLength)
-				fseek(fp, DescriptionLength, SEEK_CUR);
-			if(RatingLength)
-				fseek(fp, RatingLength, SEEK_CUR);
 		}
-		else if(IsEqualGUID(&tmp.ID, &ASF_ExtendedContentDescription))
+		else if(IsEqualGUID(id, &ASF_ExtendedContentDescription))
 		{
-			NumEntries = fget_le16(fp);
-			while(NumEntries > 0)
+			NumEntries = asf_get_le16(&obj);
+			while(NumEntries > 0 && !obj.error)
 			{
-				NameLength = fget_le16(fp);
-				_asf_load_string(fp, ASF_VT_UNICODE, NameLength, buf, sizeof(buf));
-				ValueType = fget_le16(fp);
-				ValueLength = fget_le16(fp);
+				NameLength = asf_get_le16(&obj);
+				_asf_load_string(&obj, ASF_VT_UNICODE, NameLength, buf, sizeof(buf));
+				ValueType = asf_get_le16(&obj);
+				ValueLength = asf_get_le16(&obj);
 
 				if(!strcasecmp(buf, "AlbumTitle") || !strcasecmp(buf, "WM/AlbumTitle"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->album = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "AlbumArtist") || !strcasecmp(buf, "WM/AlbumArtist"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 					{
 						if(buf[0])
 							psong->contributor[ROLE_ALBUMARTIST] = strdup(buf);
@@ -626,79 +636,68 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 				}
 				else if(!strcasecmp(buf, "Description") || !strcasecmp(buf, "WM/Track"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->track = atoi(buf);
 				}
 				else if(!strcasecmp(buf, "Genre") || !strcasecmp(buf, "WM/Genre"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->genre = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "Year") || !strcasecmp(buf, "WM/Year"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->year = atoi(buf);
 				}
 				else if(!strcasecmp(buf, "WM/Director"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->contributor[ROLE_CONDUCTOR] = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "WM/Composer"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->contributor[ROLE_COMPOSER] = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "WM/Picture") && (ValueType == ASF_VT_BYTEARRAY))
 				{
-					psong->image = _asf_load_picture(fp, ValueLength, psong->image, &psong->image_size);
+					psong->image = _asf_load_picture(&obj, ValueLength, psong->image, &psong->image_size);
 				}
 				else if(!strcasecmp(buf, "TrackNumber") || !strcasecmp(buf, "WM/TrackNumber"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(&obj, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->track = atoi(buf);
 				}
 				else if(!strcasecmp(buf, "isVBR"))
 				{
-					fseek(fp, ValueLength, SEEK_CUR);
+					asf_get(&obj, ValueLength);
 					psong->vbr_scale = 0;
 				}
-				else if(ValueLength)
+				else
 				{
-					fseek(fp, ValueLength, SEEK_CUR);
+					asf_get(&obj, ValueLength);
 				}
 				NumEntries--;
 			}
 		}
-		else if(IsEqualGUID(&tmp.ID, &ASF_StreamHeader))
+		else if(IsEqualGUID(id, &ASF_StreamHeader))
 		{
-			_asf_read_stream_object(fp, psong, tmp.Size);
+			_asf_read_stream_object(&obj, psong);
 		}
-		else if(IsEqualGUID(&tmp.ID, &ASF_HeaderExtension))
+		else if(IsEqualGUID(id, &ASF_HeaderExtension))
 		{
-			_asf_read_header_extension(fp, psong, tmp.Size);
+			_asf_read_header_extension(&obj, psong);
 		}
-		pos += tmp.Size;
-		fseek(fp, pos, SEEK_SET);
 		NumObjects--;
 	}
 
-#if 0
-	if(sizeof(hdr) == fread(&hdr, 1, sizeof(hdr), fp) && IsEqualGUID(&hdr.ID, &ASF_DataObject))
-	{
-		if(psong->song_length)
-		{
-			psong->bitrate = (hdr.Size * 8000) / psong->song_length;
-		}
-	}
-#endif
+	free(data);
 
-	fclose(fp);
 	return 0;
 }
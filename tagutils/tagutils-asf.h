@@ -352,4 +352,7 @@ typedef struct _asf_header_object_t {
 #define ASF_VT_QWORD            (4)
 #define ASF_VT_WORD             (5)
 
-static int _get_asffileinfo(char *file, struct song_metadata *psong);
+/* Largest header object read, which includes any embedded cover art */
+#define ASF_MAX_HEADER          (32*1024*1024)
+
+static int _get_asffileinfo(char *file, FILE *fp, struct song_metadata *psong);
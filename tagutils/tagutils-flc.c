@@ -20,13 +20,132 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+static void
+_flc_block(char *filename, FLAC__StreamMetadata *block, struct song_metadata *psong)
+{
+	unsigned int sec, ms;
+	int i;
+
+	switch(block->type)
+	{
+	case FLAC__METADATA_TYPE_STREAMINFO:
+		if (!block->data.stream_info.sample_rate)
+			break; /* Info is crap, avoid div-by-zero. */
+		sec = (unsigned int)(block->data.stream_info.total_samples /
+		                     block->data.stream_info.sample_rate);
+		ms = (unsigned int)(((block->data.stream_info.total_samples %
+		                      block->data.stream_info.sample_rate) * 1000) /
+		                      block->data.stream_info.sample_rate);
+		if ((sec == 0) && (ms == 0))
+			break; /* Info is crap, escape div-by-zero. */
+		psong->song_length = (sec * 1000) + ms;
+		psong->bitrate = (((uint64_t)(psong->file_size) * 1000) / (psong->song_length / 8));
+		psong->samplerate = block->data.stream_info.sample_rate;
+		psong->channels = block->data.stream_info.channels;
+		break;
+
+	case FLAC__METADATA_TYPE_VORBIS_COMMENT:
+		for(i = 0; i < block->data.vorbis_comment.num_comments; i++)
+		{
+			vc_scan(psong,
+				(char*)block->data.vorbis_comment.comments[i].entry,
+				block->data.vorbis_comment.comments[i].length);
+		}
+		break;
+#if FLAC_API_VERSION_CURRENT >= 10
+	case FLAC__METADATA_TYPE_PICTURE:
+		if (psong->image) {
+			DPRINTF(E_MAXDEBUG, L_SCANNER, "Ignoring additional image [%s]\n", filename);
+			break;
+		}
+		psong->image_size = block->data.picture.data_length;
+		if((psong->image = malloc(psong->image_size)))
+			memcpy(psong->image, block->data.picture.data, psong->image_size);
+		else
+			DPRINTF(E_ERROR, L_SCANNER, "Out of memory [%s]\n", filename);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+#if FLAC_API_VERSION_CURRENT >= 8
+/* Let libFLAC read the metadata blocks from the stream readtags() opened */
+static size_t
+_flc_read(void *ptr, size_t size, size_t nmemb, FLAC__IOHandle handle)
+{
+	return fread(ptr, size, nmemb, (FILE *)handle);
+}
+
+static int
+_flc_seek(FLAC__IOHandle handle, FLAC__int64 offset, int whence)
+{
+	return fseeko((FILE *)handle, offset, whence);
+}
+
+static FLAC__int64
+_flc_tell(FLAC__IOHandle handle)
+{
+	return ftello((FILE *)handle);
+}
+
+static int
+_flc_eof(FLAC__IOHandle handle)
+{
+	return feof((FILE *)handle);
+}
+
+static const FLAC__IOCallbacks _flc_io = {
+	_flc_read, NULL, _flc_seek, _flc_tell, _flc_eof, NULL
+};
+
+static int
+_get_flctags(char *filename, FILE *fp, struct song_metadata *psong)
+{
+	FLAC__Metadata_Chain *chain;
+	FLAC__Metadata_Iterator *iterator = 0;
+	int err = 0;
+
+	if(!(chain = FLAC__metadata_chain_new()))
+	{
+		DPRINTF(E_FATAL, L_SCANNER, "Out of memory while FLAC__metadata_chain_new()\n");
+		return -1;
+	}
+
+	if(!FLAC__metadata_chain_read_with_callbacks(chain, (FLAC__IOHandle)fp, _flc_io))
+	{
+		DPRINTF(E_ERROR, L_SCANNER, "Cannot extract tag from %s [%s]\n", filename,
+			FLAC__Metadata_ChainStatusString[FLAC__metadata_chain_status(chain)]);
+		goto _exit;
+	}
+
+	if(!(iterator = FLAC__metadata_iterator_new()))
+	{
+		DPRINTF(E_FATAL, L_SCANNER, "Out of memory while FLAC__metadata_iterator_new()\n");
+		err = -1;
+		goto _exit;
+	}
+
+	FLAC__metadata_iterator_init(iterator, chain);
+	do {
+		_flc_block(filename, FLAC__metadata_iterator_get_block(iterator), psong);
+	}
+	while(FLAC__metadata_iterator_next(iterator));
+
+ _exit:
+	if(iterator)
+		FLAC__metadata_iterator_delete(iterator);
+	FLAC__metadata_chain_delete(chain);
+
+	return err;
+}
+#else
 static int
-_get_flctags(char *filename, struct song_metadata *psong)
+_get_flctags(char *filename, FILE *fp, struct song_metadata *psong)
 {
 	FLAC__Metadata_SimpleIterator *iterator = 0;
 	FLAC__StreamMetadata *block;
-	unsigned int sec, ms;
-	int i;
 	int err = 0;
 
 	if(!(iterator = FLAC__metadata_simple_iterator_new()))
@@ -49,49 +168,7 @@ _get_flctags(char *filename, struct song_metadata *psong)
 			err = -1;
 			goto _exit;
 		}
-
-		switch(block->type)
-		{
-		case FLAC__METADATA_TYPE_STREAMINFO:
-			if (!block->data.stream_info.sample_rate)
-				break; /* Info is crap, avoid div-by-zero. */
-			sec = (unsigned int)(block->data.stream_info.total_samples /
-			                     block->data.stream_info.sample_rate);
-			ms = (unsigned int)(((block->data.stream_info.total_samples %
-			                      block->data.stream_info.sample_rate) * 1000) /
-			                      block->data.stream_info.sample_rate);
-			if ((sec == 0) && (ms == 0))
-				break; /* Info is crap, escape div-by-zero. */
-			psong->song_length = (sec * 1000) + ms;
-			psong->bitrate = (((uint64_t)(psong->file_size) * 1000) / (psong->song_length / 8));
-			psong->samplerate = block->data.stream_info.sample_rate;
-			psong->channels = block->data.stream_info.channels;
-			break;
-
-		case FLAC__METADATA_TYPE_VORBIS_COMMENT:
-			for(i = 0; i < block->data.vorbis_comment.num_comments; i++)
-			{
-				vc_scan(psong,
-					(char*)block->data.vorbis_comment.comments[i].entry,
-					block->data.vorbis_comment.comments[i].length);
-			}
-			break;
-#if FLAC_API_VERSION_CURRENT >= 10
-		case FLAC__METADATA_TYPE_PICTURE:
-			if (psong->image) {
-				DPRINTF(E_MAXDEBUG, L_SCANNER, "Ignoring additional image [%s]\n", filename);
-				break;
-			}
-			psong->image_size = block->data.picture.data_length;
-			if((psong->image = malloc(psong->image_size)))
-				memcpy(psong->image, block->data.picture.data, psong->image_size);
-			else
-				DPRINTF(E_ERROR, L_SCANNER, "Out of memory [%s]\n", filename);
-			break;
-#endif
-		default:
-			break;
-		}
+		_flc_block(filename, block, psong);
 		FLAC__metadata_object_delete(block);
 	}
 	while(FLAC__metadata_simple_iterator_next(iterator));
@@ -102,9 +179,10 @@ _get_flctags(char *filename, struct song_metadata *psong)
 
 	return err;
 }
+#endif
 
 static int
-_get_flcfileinfo(char *filename, struct song_metadata *psong)
+_get_flcfileinfo(char *filename, FILE *fp, struct song_metadata *psong)
 {
 	psong->lossless = 1;
 	psong->vbr_scale = 1;
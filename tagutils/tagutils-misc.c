@@ -32,6 +32,55 @@ typedef enum {
 } iconv_result;
 
 #ifdef HAVE_ICONV
+/* Conversion descriptors are kept open per thread, since setting one up
+ * costs far more than converting a tag.  The scanner threads using them
+ * live no longer than the scanner process itself. */
+#define ICONV_CACHE_SIZE 4
+
+static __thread struct {
+	const char *to_ces;
+	const char *from_ces;
+	iconv_t cd;
+	unsigned int used;
+} iconv_cache[ICONV_CACHE_SIZE];
+static __thread unsigned int iconv_clock;
+
+static iconv_t
+_iconv_get(const char* to_ces, const char* from_ces)
+{
+	int i, victim = 0;
+	iconv_t cd;
+
+	for(i = 0; i < ICONV_CACHE_SIZE; i++)
+	{
+		if(iconv_cache[i].to_ces &&
+		   !strcmp(iconv_cache[i].to_ces, to_ces) &&
+		   !strcmp(iconv_cache[i].from_ces, from_ces))
+		{
+			iconv_cache[i].used = ++iconv_clock;
+			/* back to the initial shift state */
+			iconv(iconv_cache[i].cd, NULL, NULL, NULL, NULL);
+			return iconv_cache[i].cd;
+		}
+		if(iconv_cache[i].used < iconv_cache[victim].used)
+			victim = i;
+	}
+
+	cd = iconv_open(to_ces, from_ces);
+	if(cd == (iconv_t)-1)
+		return cd;
+
+	if(iconv_cache[victim].to_ces)
+		iconv_close(iconv_cache[victim].cd);
+	/* the names are all string constants */
+	iconv_cache[victim].to_ces = to_ces;
+	iconv_cache[victim].from_ces = from_ces;
+	iconv_cache[victim].cd = cd;
+	iconv_cache[victim].used = ++iconv_clock;
+
+	return cd;
+}
+
 static iconv_result
 do_iconv(const char* to_ces, const char* from_ces,
 	 ICONV_CONST char *inbuf,  size_t inbytesleft,
@@ -43,7 +92,7 @@ do_iconv(const char* to_ces, const char* from_ces,
 	size_t outbytesleft = outbytesleft_orig - 1;
 	char* outbuf = outbuf_orig;
 
-	iconv_t cd  = iconv_open(to_ces, from_ces);
+	iconv_t cd  = _iconv_get(to_ces, from_ces);
 
 	if(cd == (iconv_t)-1)
 	{
@@ -62,7 +111,6 @@ do_iconv(const char* to_ces, const char* from_ces,
 			memset(outbuf_orig, '\0', outbytesleft_orig);
 		}
 	}
-	iconv_close(cd);
 
 	return ret;
 }
@@ -87,7 +135,7 @@ struct {
 	{ "ko_KR",  { "CP949", "ISO-8859-1", 0 } },
 	{ 0,        { 0 } }
 };
-static int lang_index = -1;
+static __thread int lang_index = -1;
 
 static int
 _lang2cp(char *lang)
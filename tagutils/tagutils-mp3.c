@@ -25,7 +25,7 @@
  */
 
 static int
-_get_mp3tags(char *file, struct song_metadata *psong)
+_get_mp3tags(char *file, FILE *fp, struct song_metadata *psong)
 {
 	struct id3_file *pid3file;
 	struct id3_tag *pid3tag;
@@ -42,11 +42,18 @@ _get_mp3tags(char *file, struct song_metadata *psong)
 	int got_numeric_genre;
 	id3_byte_t const *image;
 	id3_length_t image_size = 0;
+	int fd;
 
-	pid3file = id3_file_open(file, ID3_FILE_MODE_READONLY);
+	/* libid3tag reads through a stream of its own; hand it a duplicate
+	 * of our descriptor rather than opening the file again.  readtags()
+	 * repositions 'fp' before anything else reads from it. */
+	fd = dup(fileno(fp));
+	pid3file = fd < 0 ? NULL : id3_file_fdopen(fd, ID3_FILE_MODE_READONLY);
 	if(!pid3file)
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Cannot open %s\n", file);
+		if(fd >= 0)
+			close(fd);
 		return -1;
 	}
 
@@ -318,7 +325,7 @@ _decode_mp3_frame(unsigned char *frame, struct mp3_frameinfo *pfi)
 		return -1;
 	}
 
-	if((sample_index < 0) || (sample_index >= 2))
+	if((sample_index < 0) || (sample_index > 2))
 	{
 		pfi->is_valid = 0;
 		return -1;
@@ -353,7 +360,7 @@ _decode_mp3_frame(unsigned char *frame, struct mp3_frameinfo *pfi)
 	pfi->bitrate = bitrate_tbl[layer_index][bitrate_index];
 	pfi->samplerate = sample_rate_tbl[sample_index][samplerate_index];
 
-	if((frame[3] & 0xC0 >> 6) == 3)
+	if(((frame[3] & 0xC0) >> 6) == 3)
 		pfi->stereo = 0;
 	else
 		pfi->stereo = 1;
@@ -383,9 +390,9 @@ _decode_mp3_frame(unsigned char *frame, struct mp3_frameinfo *pfi)
 	if(pfi->layer == 1)
 		pfi->frame_length = (12 * pfi->bitrate * 1000 / pfi->samplerate + pfi->padding) * 4;
 	else
-		pfi->frame_length = 144 * pfi->bitrate * 1000 / pfi->samplerate + pfi->padding;
+		pfi->frame_length = pfi->samples_per_frame / 8 * pfi->bitrate * 1000 / pfi->samplerate + pfi->padding;
 
-	if((pfi->frame_length > 2880) || (pfi->frame_length <= 0))
+	if((pfi->frame_length > MP3_MAX_FRAME) || (pfi->frame_length <= 0))
 	{
 		pfi->is_valid = 0;
 		return -1;
@@ -395,79 +402,121 @@ _decode_mp3_frame(unsigned char *frame, struct mp3_frameinfo *pfi)
 	return 0;
 }
 
-// _mp3_get_average_bitrate
-//    read from midle of file, and estimate
-static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, const char *fname)
+// _mp3_info_tag_offset
+//    where the first frame holds a Xing/Info or VBRI header, if it does
+static int
+_mp3_info_tag_offset(const unsigned char *frame, int len, const struct mp3_frameinfo *pfi)
 {
-	off_t file_size;
-	unsigned char frame_buffer[2900];
-	unsigned char header[4];
-	int index = 0;
-	int found = 0;
-	off_t pos;
-	struct mp3_frameinfo fi;
-	int frame_count = 0;
-	int bitrate_total = 0;
+	int off = pfi->xing_offset + 4;
 
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
+	if((off + 8 <= len) &&
+	   (!strncasecmp((char*)&frame[off], "XING", 4) || !memcmp(&frame[off], "Info", 4)))
+		return off;
+	// VBRI always follows 32 bytes of side info
+	if((36 + 18 <= len) && !memcmp(&frame[36], "VBRI", 4))
+		return 36;
 
-	pos = file_size >> 1;
+	return 0;
+}
 
-	/* now, find the first frame */
-	fseek(infile, pos, SEEK_SET);
-	if(fread(frame_buffer, 1, sizeof(frame_buffer), infile) != sizeof(frame_buffer))
-		return;
+// _mp3_parse_info_tag
+//    frame and byte counts of the stream from a Xing/Info or VBRI header,
+//    and encoder delay and padding from a LAME header after the former
+static int
+_mp3_parse_info_tag(const unsigned char *frame, int len, struct mp3_frameinfo *pfi)
+{
+	const unsigned char *p, *end = frame + len;
+	int off, flags;
 
-	while(!found)
+	if(!(off = _mp3_info_tag_offset(frame, len, pfi)))
+		return 0;
+	p = &frame[off];
+
+	if(!memcmp(p, "VBRI", 4))
 	{
-		while((frame_buffer[index] != 0xFF) && (index < (sizeof(frame_buffer) - 4)))
-			index++;
+		pfi->is_vbr = 1;
+		pfi->number_of_bytes = GET_MP3_INT32(p + 10);
+		pfi->number_of_frames = GET_MP3_INT32(p + 14);
+		return 1;
+	}
 
-		if(index >= (sizeof(frame_buffer) - 4))   // max mp3 framesize = 2880
-		{
-			DPRINTF(E_DEBUG, L_SCANNER, "Could not find frame for %s\n", basename((char *)fname));
-			return;
-		}
+	// "Info" is what LAME writes for CBR streams
+	pfi->is_vbr = (p[0] != 'I');
+	flags = GET_MP3_INT32(p + 4);
+	p += 8;
+	if(flags & 0x1)
+	{
+		if(p + 4 > end)
+			return 1;
+		pfi->number_of_frames = GET_MP3_INT32(p);
+		p += 4;
+	}
+	if(flags & 0x2)
+	{
+		if(p + 4 > end)
+			return 1;
+		pfi->number_of_bytes = GET_MP3_INT32(p);
+		p += 4;
+	}
+	if(flags & 0x4)                         // seek table
+	{
+		if(p + 100 > end)
+			return 1;
+		memcpy(pfi->toc, p, sizeof(pfi->toc));
+		pfi->has_toc = 1;
+		p += 100;
+	}
+	if(flags & 0x8)                         // quality
+		p += 4;
 
-		if(!_decode_mp3_frame(&frame_buffer[index], &fi))
-		{
-			/* see if next frame is valid */
-			fseek(infile, pos + index + fi.frame_length, SEEK_SET);
-			if(fread(header, 1, sizeof(header), infile) != sizeof(header))
-			{
-				DPRINTF(E_DEBUG, L_SCANNER, "Could not read frame header for %s\n", basename((char *)fname));
-				return;
-			}
+	if((p + 24 <= end) &&
+	   (!memcmp(p, "LAME", 4) || !memcmp(p, "Lavc", 4) || !memcmp(p, "Lavf", 4)))
+	{
+		pfi->encoder_delay = (p[21] << 4) | (p[22] >> 4);
+		pfi->encoder_padding = ((p[22] & 0x0F) << 8) | p[23];
+	}
 
-			if(!_decode_mp3_frame(header, &fi))
-				found = 1;
-		}
+	return 1;
+}
 
-		if(!found)
-			index++;
-	}
+// _mp3_get_average_bitrate
+//    read from middle of file, and estimate
+static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, const char *fname)
+{
+	unsigned char frame_buffer[32 * 1024];
+	int n_read;
+	int index = 0;
+	struct mp3_frameinfo fi;
+	int frame_count = 0;
+	int bitrate_total = 0;
 
-	pos += index;
+	/* one read covers a few dozen frames at any bitrate */
+	fseek(infile, _file_size(infile) >> 1, SEEK_SET);
+	n_read = fread(frame_buffer, 1, sizeof(frame_buffer), infile);
 
-	// got first frame
-	while(frame_count < 10)
+	/* now, find the first frame: a header followed by another one */
+	for(; index + 4 <= n_read; index++)
 	{
-		fseek(infile, pos, SEEK_SET);
-		if(fread(header, 1, sizeof(header), infile) != sizeof(header))
-		{
-			DPRINTF(E_DEBUG, L_SCANNER, "Could not read frame header for %s\n", basename((char *)fname));
-			return;
-		}
-		if(_decode_mp3_frame(header, &fi))
-		{
-			DPRINTF(E_DEBUG, L_SCANNER, "Invalid frame header while averaging %s\n", basename((char *)fname));
-			return;
-		}
+		if(frame_buffer[index] != 0xFF || _decode_mp3_frame(&frame_buffer[index], &fi))
+			continue;
+		if(index + fi.frame_length + 4 > n_read)
+			break;
+		if(!_decode_mp3_frame(&frame_buffer[index + fi.frame_length], &fi))
+			break;
+	}
 
+	// got first frame
+	while(index + 4 <= n_read && !_decode_mp3_frame(&frame_buffer[index], &fi))
+	{
 		bitrate_total += fi.bitrate;
 		frame_count++;
-		pos += fi.frame_length;
+		index += fi.frame_length;
+	}
+
+	if(!frame_count)
+	{
+		DPRINTF(E_DEBUG, L_SCANNER, "Could not find frame for %s\n", basename((char *)fname));
+		return;
 	}
 
 	pfi->bitrate = bitrate_total / frame_count;
@@ -476,73 +525,93 @@ static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, co
 }
 
 // _mp3_get_frame_count
-//   do brute scan
-static void __attribute__((unused))
-_mp3_get_frame_count(FILE *infile, struct mp3_frameinfo *pfi)
+//   do brute scan, streaming the audio from the first frame up to 'end',
+//   and note where frames start every so often for the seek index
+static void
+_mp3_get_frame_count(FILE *infile, struct mp3_frameinfo *pfi, off_t end, const char *fname,
+		     struct seek_index *idx)
 {
-	int pos;
-	int frames = 0;
-	unsigned char frame_buffer[4];
-	struct mp3_frameinfo fi;
-	off_t file_size;
-	int err = 0;
-	int cbr = 1;
+	unsigned char *buffer;
+	struct mp3_frameinfo fi, next;
+	off_t pos = pfi->frame_offset;          // of buffer[0]
+	int len = 0, index = 0, n_read;
+	int frames = 0, bytes = 0, skipped = 0;
+	int synced = 1;
 	int last_bitrate = 0;
+	int cbr = 1;
+	long long samples = 0;
+	uint32_t ms, interval, next_point = 0;
 
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
+	/* spread the points over what the first frame suggests the length is */
+	interval = (end - pos) * 8 / (pfi->bitrate ? pfi->bitrate : 128) / MP3_SEEK_POINTS;
+	if(interval < 1000)
+		interval = 1000;
 
-	pos = pfi->frame_offset;
+	if(!(buffer = malloc(MP3_SCAN_BUFFER)))
+		return;
 
+	fseek(infile, pos, SEEK_SET);
 	while(1)
 	{
-		err = 1;
-
-		fseek(infile, pos, SEEK_SET);
-		if(fread(frame_buffer, 1, sizeof(frame_buffer), infile) == sizeof(frame_buffer))
+		if((len - index < MP3_MAX_FRAME + 4) && (pos + len < end))
 		{
-			// valid frame?
-			if(!_decode_mp3_frame(frame_buffer, &fi))
-			{
-				frames++;
-				pos += fi.frame_length;
-				err = 0;
-
-				if((last_bitrate) && (fi.bitrate != last_bitrate))
-					cbr = 0;
-				last_bitrate = fi.bitrate;
+			memmove(buffer, buffer + index, len - index);
+			pos += index;
+			len -= index;
+			index = 0;
+			n_read = MP3_SCAN_BUFFER - len;
+			if(end - (pos + len) < n_read)
+				n_read = end - (pos + len);
+			n_read = fread(buffer + len, 1, n_read, infile);
+			if(n_read <= 0)
+				end = pos + len;
+			len += n_read;
+		}
+		if(index + 4 > len)
+			break;
 
-				// no sense to scan cbr
-				if(cbr && (frames > 100))
-				{
-					DPRINTF(E_DEBUG, L_SCANNER, "File appears to be CBR... quitting frame _mp3_get_frame_count()\n");
-					return;
-				}
-			}
+		if(_decode_mp3_frame(&buffer[index], &fi) ||
+		   /* after garbage, only trust a header the next frame confirms */
+		   (!synced && (index + fi.frame_length + 4 <= len) &&
+		    _decode_mp3_frame(&buffer[index + fi.frame_length], &next)))
+		{
+			synced = 0;
+			skipped++;
+			index++;
+			continue;
 		}
 
-		if(err)
+		synced = 1;
+		ms = samples * 1000 / fi.samplerate;
+		if(ms >= next_point)
 		{
-			if(pos > (file_size - 4096))
-			{
-				pfi->number_of_frames = frames;
-				return;
-			}
-			else
-			{
-				DPRINTF(E_ERROR, L_SCANNER, "Frame count aborted on error.  Pos=%d, Count=%d\n",
-					pos, frames);
-				return;
-			}
+			seek_index_add(idx, ms, pos + index);
+			next_point = ms + interval;
 		}
+		samples += fi.samples_per_frame;
+		frames++;
+		bytes += fi.frame_length;
+		index += fi.frame_length;
+
+		if((last_bitrate) && (fi.bitrate != last_bitrate))
+			cbr = 0;
+		last_bitrate = fi.bitrate;
 	}
+	free(buffer);
+
+	if(skipped)
+		DPRINTF(E_DEBUG, L_SCANNER, "Skipped %d bytes between frames of %s\n",
+			skipped, basename((char *)fname));
+
+	pfi->number_of_frames = frames;
+	pfi->number_of_bytes = bytes;
+	pfi->is_vbr = !cbr;
 }
 
 // _get_mp3fileinfo
 static int
-_get_mp3fileinfo(char *file, struct song_metadata *psong)
+_get_mp3fileinfo(char *file, FILE *infile, struct song_metadata *psong)
 {
-	FILE *infile;
 	struct id3header *pid3;
 	struct mp3_frameinfo fi;
 	unsigned int size = 0;
@@ -552,7 +621,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 	unsigned char buffer[1024];
 	int index;
 
-	int xing_flags;
 	int found;
 
 	int first_check = 0;
@@ -560,17 +628,9 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 	char id3v1taghdr[4];
 
-	if(!(infile = fopen(file, "rb")))
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", file);
-		return -1;
-	}
-
 	memset((void*)&fi, 0, sizeof(fi));
 
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
-	fseek(infile, 0, SEEK_SET);
+	file_size = _file_size(infile);
 
 	if(fread(buffer, 1, sizeof(buffer), infile) != sizeof(buffer))
 	{
@@ -582,7 +642,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 		{
 			DPRINTF(E_WARN, L_SCANNER, "File too small. Probably corrupted. [%s]\n", file);
 		}
-		fclose(infile);
 		return -1;
 	}
 
@@ -617,7 +676,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 		fseek(infile, fp_size, SEEK_SET);
 		if((n_read = fread(buffer, 1, sizeof(buffer), infile)) < 4)   // at least mp3 frame header size (i.e. 4 bytes)
 		{
-			fclose(infile);
 			return 0;
 		}
 
@@ -633,7 +691,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 				first_check = 0;
 				if(n_read < sizeof(buffer))
 				{
-					fclose(infile);
 					return 0;
 				}
 				break;
@@ -644,7 +701,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 				fp_size += index;
 				if(n_read < sizeof(buffer))
 				{
-					fclose(infile);
 					return 0;
 				}
 				break;
@@ -652,7 +708,7 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 			if(!_decode_mp3_frame(&buffer[index], &fi))
 			{
-				if(!strncasecmp((char*)&buffer[index + fi.xing_offset + 4], "XING", 4))
+				if(_mp3_info_tag_offset(&buffer[index], n_read - index, &fi))
 				{
 					/* no need to check further... if there is a xing header there,
 					 * this is definately a valid frame */
@@ -674,7 +730,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 					else
 					{
 						DPRINTF(E_ERROR, L_SCANNER, "Could not read frame header: %s\n", file);
-						fclose(infile);
 						return 0;
 					}
 
@@ -717,56 +772,71 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 	if(_decode_mp3_frame(&buffer[index], &fi))
 	{
-		fclose(infile);
 		DPRINTF(E_ERROR, L_SCANNER, "Could not find sync frame: %s\n", file);
 		return 0;
 	}
 
 	/* now check for an XING header */
 	psong->vbr_scale = -1;
-	if(!strncasecmp((char*)&buffer[index + fi.xing_offset + 4], "XING", 4))
+	if(index + 256 > n_read)
 	{
-		xing_flags = buffer[index+fi.xing_offset+4+4] << 24 |
-		             buffer[index+fi.xing_offset+4+5] << 16 |
-		             buffer[index+fi.xing_offset+4+6] << 8 |
-		             buffer[index+fi.xing_offset+4+7];
-		psong->vbr_scale = 78;
-
-		if(xing_flags & 0x1)
-		{
-			/* Frames field is valid... */
-			fi.number_of_frames = buffer[index+fi.xing_offset+4+8] << 24 |
-			                      buffer[index+fi.xing_offset+4+9] << 16 |
-			                      buffer[index+fi.xing_offset+4+10] << 8 |
-			                      buffer[index+fi.xing_offset+4+11];
-		}
+		fseek(infile, fp_size, SEEK_SET);
+		n_read = fread(buffer, 1, sizeof(buffer), infile);
+		index = 0;
 	}
-
-	if((fi.number_of_frames == 0) && (!psong->song_length))
+	if(_mp3_parse_info_tag(&buffer[index], n_read - index, &fi))
+	{
+		/* the frame holding it is silence, not part of the stream */
+		if(!fi.number_of_bytes)
+			fi.number_of_bytes = psong->audio_size - fi.frame_length;
+	}
+	else if((!psong->song_length) && GETFLAG(MP3_FRAME_SCAN_MASK))
 	{
-		_mp3_get_average_bitrate(infile, &fi, file);
+		_mp3_get_frame_count(infile, &fi, psong->audio_offset + psong->audio_size, file,
+				     &psong->seek_index);
 	}
 
-	psong->bitrate = fi.bitrate * 1000;
 	psong->samplerate = fi.samplerate;
 
-	if(!psong->song_length)
+	if(fi.number_of_frames)
 	{
-		if(fi.number_of_frames)
-		{
-			psong->song_length = (int)((double)(fi.number_of_frames * fi.samples_per_frame * 1000.) /
-						   (double)fi.samplerate);
+		/* exact, down to what the encoder padded the stream with */
+		long long samples = (long long)fi.number_of_frames * fi.samples_per_frame;
+
+		if(samples > fi.encoder_delay + fi.encoder_padding)
+			samples -= fi.encoder_delay + fi.encoder_padding;
+		psong->song_length = (int)(samples * 1000 / fi.samplerate);
+		psong->bitrate = (int)((double)fi.number_of_bytes * 8. * fi.samplerate / samples);
+		if(fi.is_vbr)
 			psong->vbr_scale = 78;
-		}
-		else
-		{
-			psong->song_length = (int)((double)(file_size - fp_size) * 8. /
+	}
+	else
+	{
+		if(!psong->song_length)
+			_mp3_get_average_bitrate(infile, &fi, file);
+
+		psong->bitrate = fi.bitrate * 1000;
+		if(!psong->song_length)
+			psong->song_length = (int)((double)psong->audio_size * 8. /
 						   (double)fi.bitrate);
-		}
 	}
 	psong->channels = fi.stereo ? 2 : 1;
 
-	fclose(infile);
+	/* time seek index: from the xing seek table, from the frames counted
+	 * above, or in a straight line when the bitrate is constant */
+	if(fi.has_toc && fi.number_of_bytes)
+	{
+		for(index = 0; index < 100; index++)
+			seek_index_add(&psong->seek_index, (uint32_t)((long long)psong->song_length * index / 100),
+				       psong->audio_offset + (uint64_t)fi.toc[index] * fi.number_of_bytes / 256);
+	}
+	else if(!psong->seek_index.len && psong->vbr_scale < 0)
+	{
+		seek_index_add(&psong->seek_index, 0, psong->audio_offset);
+	}
+	if(psong->seek_index.len)
+		seek_index_add(&psong->seek_index, psong->song_length, psong->audio_offset + psong->audio_size);
+
 	//DEBUG DPRINTF(E_INFO, L_SCANNER, "Got fileinfo successfully for file=%s song_length=%d\n", file, psong->song_length);
 
 	psong->blockalignment = 1;
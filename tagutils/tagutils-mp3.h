@@ -33,6 +33,12 @@ struct mp3_frameinfo {
 	int padding;                            // flag
 	int xing_offset;                        // for xing hdr
 	int number_of_frames;
+	int number_of_bytes;                    // audio bytes, from xing/vbri hdr
+	int encoder_delay;                      // samples, from lame hdr
+	int encoder_padding;                    // samples, from lame hdr
+	int is_vbr;                             // flag
+	unsigned char toc[100];                 // xing seek table
+	int has_toc;                            // flag
 
 	int frame_offset;
 
@@ -42,10 +48,24 @@ struct mp3_frameinfo {
 	int is_valid;
 };
 
-static int _get_mp3tags(char *file, struct song_metadata *psong);
-static int _get_mp3fileinfo(char *file, struct song_metadata *psong);
+static int _get_mp3tags(char *file, FILE *fp, struct song_metadata *psong);
+static int _get_mp3fileinfo(char *file, FILE *fp, struct song_metadata *psong);
 static int _decode_mp3_frame(unsigned char *frame, struct mp3_frameinfo *pfi);
 
+#define GET_MP3_INT32(p) ((((uint8_t)((p)[0])) << 24) |   \
+			  (((uint8_t)((p)[1])) << 16) |   \
+			  (((uint8_t)((p)[2])) << 8) |	   \
+			  (((uint8_t)((p)[3]))))
+
+// largest frame _decode_mp3_frame() accepts
+#define MP3_MAX_FRAME 2880
+
+// read size while walking every frame of a file
+#define MP3_SCAN_BUFFER (256*1024)
+
+// seek index points taken while walking every frame
+#define MP3_SEEK_POINTS 256
+
 // bitrate_tbl[layer_index][bitrate_index]
 static int bitrate_tbl[5][16] = {
 	{ 0, 32, 64,  96,  128, 160, 192, 224,	256,   288,  320, 352,	384,  416, 448, 0 },    /* MPEG1, L1 */
@@ -418,23 +418,14 @@ _ogg_get_next_page(FILE *f, ogg_sync_state *sync, ogg_page *page,
 
 
 static int
-_get_oggfileinfo(char *filename, struct song_metadata *psong)
+_get_oggfileinfo(char *filename, FILE *file, struct song_metadata *psong)
 {
-	FILE *file = fopen(filename, "rb");
 	ogg_sync_state sync;
 	ogg_page page;
 	ogg_stream_set *processors = _ogg_create_stream_set();
 	int gotpage = 0;
 	ogg_int64_t written = 0;
 
-	if(!file)
-	{
-		DPRINTF(E_FATAL, L_SCANNER,
-			"Error opening input file \"%s\": %s\n", filename,  strerror(errno));
-		_ogg_free_stream_set(processors);
-		return -1;
-	}
-
 	DPRINTF(E_MAXDEBUG, L_SCANNER, "Processing file \"%s\"...\n\n", filename);
 
 	ogg_sync_init(&sync);
@@ -448,7 +439,6 @@ _get_oggfileinfo(char *filename, struct song_metadata *psong)
 		{
 			DPRINTF(E_FATAL, L_SCANNER, "Could not find a processor for stream, bailing\n");
 			_ogg_free_stream_set(processors);
-			fclose(file);
 			return -1;
 		}
 
@@ -523,8 +513,6 @@ _get_oggfileinfo(char *filename, struct song_metadata *psong)
 
 	ogg_sync_clear(&sync);
 
-	fclose(file);
-
 	if(!gotpage)
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "No ogg data found in file \"%s\".\n", filename);
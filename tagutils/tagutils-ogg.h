@@ -20,4 +20,4 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-static int _get_oggfileinfo(char *filename, struct song_metadata *psong);
+static int _get_oggfileinfo(char *filename, FILE *fp, struct song_metadata *psong);
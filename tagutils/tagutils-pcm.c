@@ -22,18 +22,11 @@
  */
 
 static int
-_get_pcmfileinfo(char *filename, struct song_metadata *psong)
+_get_pcmfileinfo(char *filename, FILE *fp, struct song_metadata *psong)
 {
-	struct stat file;
 	uint32_t sec, ms;
 
-	if( stat(filename, &file) != 0 )
-	{
-		DPRINTF(E_WARN, L_SCANNER, "Could not stat %s\n", filename);
-		return -1;
-	}
-
-	psong->file_size = file.st_size;
+	psong->file_size = _file_size(fp);
 	psong->bitrate = 1411200;
 	psong->samplerate = 44100;
 	psong->channels = 2;
@@ -30,9 +30,8 @@
 			  (((uint8_t)((p)[0]))))
 
 static int
-_get_wavtags(char *filename, struct song_metadata *psong)
+_get_wavtags(char *filename, FILE *fp, struct song_metadata *psong)
 {
-	int fd;
 	uint32_t len;
 	unsigned char hdr[12];
 	unsigned char fmt[16];
@@ -51,17 +50,10 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 
 	//DEBUG DPRINTF(E_DEBUG,L_SCANNER,"Getting WAV file info\n");
 
-	if(!(fd = open(filename, O_RDONLY)))
-	{
-		DPRINTF(E_WARN, L_SCANNER, "Could not create file handle\n");
-		return -1;
-	}
-
 	len = 12;
-	if(!(len = read(fd, hdr, len)) || (len != 12))
+	if(!(len = fread(hdr, 1, len, fp)) || (len != 12))
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Could not read wav header from %s\n", filename);
-		close(fd);
 		return -1;
 	}
 
@@ -71,7 +63,6 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 	   strncmp((char*)hdr + 8, "WAVE", 4))
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Invalid wav header in %s\n", filename);
-		close(fd);
 		return -1;
 	}
 
@@ -82,9 +73,8 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 	while(current_offset + 8 < psong->file_size)
 	{
 		len = 8;
-		if(!(len = read(fd, hdr, len)) || (len != 8))
+		if(!(len = fread(hdr, 1, len, fp)) || (len != 8))
 		{
-			close(fd);
 			DPRINTF(E_WARN, L_SCANNER, "Error reading block: %s\n", filename);
 			return -1;
 		}
@@ -102,7 +92,6 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 
 		if(block_len > psong->file_size)
 		{
-			close(fd);
 			DPRINTF(E_WARN, L_SCANNER, "Bad block len: %s\n", filename);
 			return -1;
 		}
@@ -111,9 +100,8 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 		{
 			//DEBUG DPRINTF(E_DEBUG,L_SCANNER,"Found 'fmt ' header\n");
 			len = 16;
-			if(read(fd, fmt, len) != len)
+			if(fread(fmt, 1, len, fp) != len)
 			{
-				close(fd);
 				DPRINTF(E_WARN, L_SCANNER, "Bad .wav file: can't read fmt: %s\n",
 					filename);
 				return -1;
@@ -152,7 +140,7 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 			if(!tags)
 				goto next_block;
 
-			if(read(fd, tags, len) < len ||
+			if(fread(tags, 1, len, fp) < len ||
 			   strncmp(tags, "INFO", 4) != 0)
 			{
 				free(tags);
@@ -212,10 +200,9 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 			free(tags);
 		}
 next_block:
-		lseek(fd, current_offset + block_len, SEEK_SET);
+		fseek(fp, current_offset + block_len, SEEK_SET);
 		current_offset += block_len;
 	}
-	close(fd);
 
 	if(((format_data_length != 16) && (format_data_length != 18)) ||
 	   (compression_code != 1) ||
@@ -247,7 +234,7 @@ next_block:
 }
 
 static int
-_get_wavfileinfo(char *filename, struct song_metadata *psong)
+_get_wavfileinfo(char *filename, FILE *fp, struct song_metadata *psong)
 {
 	psong->lossless = 1;
 	/* Upon further review, WAV files should be little-endian, and DLNA requires the LPCM profile to be big-endian.
@@ -44,6 +44,7 @@
 #include "tagutils.h"
 #include "../metadata.h"
 #include "../utils.h"
+#include "../upnpglobalvars.h"
 #include "../log.h"
 
 struct id3header {
@@ -108,8 +109,8 @@ char *winamp_genre[] = {
 #include "tagutils-wav.h"
 #include "tagutils-pcm.h"
 
-static int _get_tags(char *file, struct song_metadata *psong);
-static int _get_fileinfo(char *file, struct song_metadata *psong);
+static int _get_tags(char *file, FILE *fp, struct song_metadata *psong);
+static int _get_fileinfo(char *file, FILE *fp, struct song_metadata *psong);
 
 
 /*
@@ -118,8 +119,8 @@ static int _get_fileinfo(char *file, struct song_metadata *psong);
 
 typedef struct {
 	char* type;
-	int (*get_tags)(char* file, struct song_metadata* psong);
-	int (*get_fileinfo)(char* file, struct song_metadata* psong);
+	int (*get_tags)(char* file, FILE* fp, struct song_metadata* psong);
+	int (*get_fileinfo)(char* file, FILE* fp, struct song_metadata* psong);
 } taghandler;
 
 static taghandler taghandlers[] = {
@@ -135,6 +136,20 @@ static taghandler taghandlers[] = {
 
 
 
+/* Each song is opened once, and both passes over it read through this
+ * buffer; it covers the headers of most formats in a single read. */
+#define TAG_READ_BUFFER (64*1024)
+
+static off_t
+_file_size(FILE *fp)
+{
+	struct stat st;
+
+	if(fstat(fileno(fp), &st) != 0)
+		return 0;
+	return st.st_size;
+}
+
 //*********************************************************************************
 #include "tagutils-misc.c"
 #include "tagutils-mp3.c"
@@ -173,11 +188,12 @@ freetags(struct song_metadata *psong)
 	MAYBEFREE(psong->musicbrainz_trackid);
 	MAYBEFREE(psong->musicbrainz_artistid);
 	MAYBEFREE(psong->musicbrainz_albumartistid);
+	seek_index_free(&psong->seek_index);
 }
 
 // _get_fileinfo
 static int
-_get_fileinfo(char *file, struct song_metadata *psong)
+_get_fileinfo(char *file, FILE *fp, struct song_metadata *psong)
 {
 	taghandler *hdl;
 
@@ -187,7 +203,7 @@ _get_fileinfo(char *file, struct song_metadata *psong)
 			break;
 
 	if(hdl->get_fileinfo)
-		return hdl->get_fileinfo(file, psong);
+		return hdl->get_fileinfo(file, fp, psong);
 
 	return 0;
 }
@@ -239,7 +255,7 @@ _make_composite_tags(struct song_metadata *psong)
 /*****************************************************************************/
 // _get_tags
 static int
-_get_tags(char *file, struct song_metadata *psong)
+_get_tags(char *file, FILE *fp, struct song_metadata *psong)
 {
 	taghandler *hdl;
 
@@ -250,7 +266,7 @@ _get_tags(char *file, struct song_metadata *psong)
 
 	if(hdl->get_tags)
 	{
-		return hdl->get_tags(file, psong);
+		return hdl->get_tags(file, fp, psong);
 	}
 
 	return 0;
@@ -262,6 +278,8 @@ int
 readtags(char *path, struct song_metadata *psong, struct stat *stat, char *lang, char *type)
 {
 	char *fname;
+	FILE *fp;
+	int ret;
 
 	if(lang_index == -1)
 		lang_index = _lang2cp(lang);
@@ -280,12 +298,23 @@ readtags(char *path, struct song_metadata *psong, struct stat *stat, char *lang,
 		psong->file_size = stat->st_size;
 	}
 
+	if(!(fp = fopen(path, "rb")))
+	{
+		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", path);
+		return -1;
+	}
+	setvbuf(fp, NULL, _IOFBF, TAG_READ_BUFFER);
+
 	// get tag
-	if( _get_tags(path, psong) == 0 )
+	if( _get_tags(path, fp, psong) == 0 )
 	{
 		_make_composite_tags(psong);
 	}
-	
+
 	// get fileinfo
-	return _get_fileinfo(path, psong);
+	rewind(fp);
+	ret = _get_fileinfo(path, fp, psong);
+	fclose(fp);
+
+	return ret;
 }
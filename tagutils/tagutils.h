@@ -33,6 +33,8 @@
 #include <stdint.h>
 #include <libgen.h>
 
+#include "../seekindex.h"
+
 #define ROLE_NOUSE 0
 #define ROLE_START 1
 #define ROLE_ARTIST 1
@@ -86,6 +88,7 @@ struct song_metadata {
 	int audio_offset;
 	int vbr_scale;
 	int lossless;
+	struct seek_index seek_index;           // for TimeSeekRange requests
 	int blockalignment;
 
 	char *mime;				// MIME type
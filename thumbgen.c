@@ -0,0 +1,578 @@
+/* Background generation of resized images for the art cache
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "thumbgen.h"
+#include "upnpglobalvars.h"
+#include "image_utils.h"
+#include "process.h"
+#include "utils.h"
+#include "sql.h"
+#include "log.h"
+
+/* Renditions the scanner and inotify hand over instead of producing them
+ * inline: album art scaled down for the ALBUM_ART table, and the JPEG_TN
+ * and JPEG_SM sizes of photos that /Resized/ would otherwise decode the
+ * full image for on every request.  Album art comes first, as the file
+ * is already referenced from the database.  Workers run at the lowest
+ * CPU and I/O priority. */
+enum thumb_kind {
+	THUMB_ALBUM_ART,
+	THUMB_PHOTO
+};
+
+struct thumb_job {
+	struct thumb_job *next;
+	enum thumb_kind kind;
+	char *src;
+	char *dest;		/* album art only */
+	int width, height;	/* photos: source size and rotation */
+	int rotation;
+};
+
+struct thumb_queue {
+	struct thumb_job *head;
+	struct thumb_job *tail;
+	int len;
+	int max;
+};
+
+/* Past these, album art is resized by the caller and photos are left for
+ * /Resized/ to render when they are first asked for */
+#define THUMB_ART_MAX    256
+#define THUMB_PHOTO_MAX  1024
+
+/* How long the main loop waits for the database to fold in renditions */
+#define RENDITION_BUSY_MS 50
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	struct thumb_queue art;
+	struct thumb_queue photos;
+	int running;
+	int stop;
+	int busy;
+	int nthreads;
+	pthread_t *threads;
+	unsigned int done, failed;
+} tg = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.art = { .max = THUMB_ART_MAX },
+	.photos = { .max = THUMB_PHOTO_MAX },
+};
+
+/* The sizes the ContentDirectory offers for photos, see upnpsoap.c */
+static const struct {
+	int width, height;
+	int min_width, min_height;	/* only offered for larger photos */
+} photo_sizes[] = {
+	{ 640, 480, 640, 480 },		/* JPEG_SM */
+	{ 160, 160, 0, 0 },		/* JPEG_TN */
+};
+#define PHOTO_SIZES (sizeof(photo_sizes) / sizeof(photo_sizes[0]))
+
+int
+thumbgen_rendition_path(char *buf, size_t len, const char *path,
+                        int width, int height, int rotation)
+{
+	int n;
+
+	if( rotation )
+		n = snprintf(buf, len, "%s/art_cache%s.resized/%dx%d-r%d.jpg",
+		             db_path, path, width, height, rotation);
+	else
+		n = snprintf(buf, len, "%s/art_cache%s.resized/%dx%d.jpg",
+		             db_path, path, width, height);
+
+	return (n > 0 && n < len) ? 0 : -1;
+}
+
+void
+thumbgen_remove(const char *path)
+{
+	char dir[MAXPATHLEN];
+
+	if( snprintf(dir, sizeof(dir), "%s/art_cache%s.resized", db_path, path) < sizeof(dir) )
+		remove_dir(dir);
+}
+
+/* Renditions /Resized/ serves are noted in a log next to files.db by the
+ * process serving them, which must not use the database it inherited
+ * across fork(), and entered into RENDITIONS by the main process later.
+ * Lines are "<used> <detail id> <size> <path>". */
+static void
+rendition_log_path(char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/renditions.log", db_path);
+}
+
+void
+thumbgen_rendition_used(const char *path, long long id, off_t size)
+{
+	char log[MAXPATHLEN], line[MAXPATHLEN + 64];
+	int fd, n;
+
+	if( runtime_vars.resized_cache_size <= 0 || strchr(path, '\n') )
+		return;
+	n = snprintf(line, sizeof(line), "%lld %lld %lld %s\n",
+	             (long long)time(NULL), id, (long long)size, path);
+	if( n <= 0 || n >= sizeof(line) )
+		return;
+	rendition_log_path(log, sizeof(log));
+	/* One write per line, so concurrent requests do not interleave */
+	fd = open(log, O_WRONLY|O_APPEND|O_CREAT, S_IRUSR|S_IWUSR);
+	if( fd < 0 )
+		return;
+	if( write(fd, line, n) != n )
+		DPRINTF(E_WARN, L_HTTP, "Error noting rendition %s\n", path);
+	close(fd);
+}
+
+/* Drop the renditions served least recently until the rest fit in
+ * resized_cache_size */
+static void
+trim_renditions(void)
+{
+	int64_t over;
+	char **result;
+	int rows, i;
+
+	over = sql_get_int64_field(db, "SELECT sum(SIZE) from RENDITIONS") -
+	       ((int64_t)runtime_vars.resized_cache_size << 20);
+	while( over > 0 )
+	{
+		if( sql_get_table(db, "SELECT PATH, SIZE from RENDITIONS order by USED, rowid limit 32",
+		                  &result, &rows, NULL) != SQLITE_OK )
+			return;
+		if( !rows )
+		{
+			sqlite3_free_table(result);
+			return;
+		}
+		for( i = 1; i <= rows && over > 0; i++ )
+		{
+			DPRINTF(E_DEBUG, L_ARTWORK, "Evicting rendition %s\n", result[i*2]);
+			unlink(result[i*2]);
+			sql_exec_bind(db, "DELETE from RENDITIONS where PATH = ?", "t", result[i*2]);
+			over -= strtoll(result[i*2+1], NULL, 10);
+		}
+		sqlite3_free_table(result);
+	}
+}
+
+void
+thumbgen_update_renditions(void)
+{
+	char log[MAXPATHLEN], work[MAXPATHLEN], line[MAXPATHLEN + 64];
+	long long used, id, size;
+	FILE *f;
+	int n;
+
+	if( runtime_vars.resized_cache_size <= 0 )
+		return;
+	rendition_log_path(log, sizeof(log));
+	snprintf(work, sizeof(work), "%s.work", log);
+	/* A log left by a fold that could not commit goes first */
+	if( access(work, F_OK) != 0 && rename(log, work) != 0 )
+		return;
+	f = fopen(work, "r");
+	if( !f )
+	{
+		unlink(work);
+		return;
+	}
+	/* This runs in the main loop, so don't wait long for the scanner or
+	 * inotify to let go of the database; the lines keep until next time */
+	sqlite3_busy_timeout(db, RENDITION_BUSY_MS);
+	if( sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK )
+	{
+		DPRINTF(E_DEBUG, L_ARTWORK, "Database busy; renditions are noted later\n");
+		goto done;
+	}
+	while( fgets(line, sizeof(line), f) )
+	{
+		line[strcspn(line, "\n")] = '\0';
+		if( sscanf(line, "%lld %lld %lld %n", &used, &id, &size, &n) != 3 || !line[n] )
+			continue;
+		/* Not for photos removed since */
+		sql_exec_bind(db, "INSERT or REPLACE into RENDITIONS (PATH, DETAIL_ID, SIZE, USED)"
+		                  " SELECT ?, ID, ?, ? from DETAILS_DATA where ID = ?", "tiii",
+		              line + n, (int64_t)size, (int64_t)used, (int64_t)id);
+	}
+	trim_renditions();
+	if( sql_exec(db, "COMMIT") == SQLITE_OK )
+		unlink(work);
+	else
+		sql_exec(db, "ROLLBACK");
+done:
+	sqlite3_busy_timeout(db, 5000);
+	fclose(f);
+}
+
+/* Write 'image' to 'dest' through a private temporary file */
+static int
+save_image(image_s *image, const char *dest)
+{
+	char tmp[MAXPATHLEN];
+	char dir[MAXPATHLEN];
+
+	strncpyt(dir, dest, sizeof(dir));
+	make_dir(dirname(dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+	snprintf(tmp, sizeof(tmp), "%s.%lx", dest, (unsigned long)pthread_self());
+	if( image_save_to_jpeg_file(image, tmp) && rename(tmp, dest) == 0 )
+		return 0;
+	unlink(tmp);
+
+	return -1;
+}
+
+static int
+render_album_art(struct thumb_job *job)
+{
+	image_s *imsrc, *imdst;
+	int dstw, dsth, ret;
+
+	if( access(job->dest, F_OK) == 0 )
+		return 0;
+	imsrc = image_new_from_jpeg(job->src, 1, NULL, 0, 1, ROTATE_NONE);
+	if( !imsrc )
+		return -1;
+	image_fit(imsrc->width, imsrc->height, 160, 160, &dstw, &dsth);
+	imdst = image_resize(imsrc, dstw, dsth);
+	image_free(imsrc);
+	if( !imdst )
+		return -1;
+	ret = save_image(imdst, job->dest);
+	image_free(imdst);
+
+	return ret;
+}
+
+/* Decode the photo once, at the largest libjpeg scaling the biggest
+ * rendition allows, and derive each size from the previous one.  The
+ * sizes are worked out exactly as SendResp_resizedimg() does for the
+ * URLs upnpsoap.c hands out, so that it finds them: those are fitted to
+ * the stored resolution, before rotation, except for the 160x160 album
+ * art URI of photos. */
+static int
+render_photo(struct thumb_job *job)
+{
+	char dest[MAXPATHLEN];
+	struct stat src_st, st;
+	image_s *imsrc = NULL, *imdst;
+	int srcw = job->width, srch = job->height;
+	int dstw, dsth, urlw, urlh, scale = 1;
+	int rotate, i, ret = 0;
+
+	switch( job->rotation )
+	{
+	case 90:
+		rotate = ROTATE_90;
+		srcw = job->height;
+		srch = job->width;
+		break;
+	case 270:
+		rotate = ROTATE_270;
+		srcw = job->height;
+		srch = job->width;
+		break;
+	case 180:
+		rotate = ROTATE_180;
+		break;
+	default:
+		rotate = ROTATE_NONE;
+		break;
+	}
+	if( srcw <= 0 || srch <= 0 || stat(job->src, &src_st) != 0 )
+		return -1;
+
+	for( i = 0; i < PHOTO_SIZES * 2; i++ )
+	{
+		int boxw = photo_sizes[i/2].width, boxh = photo_sizes[i/2].height;
+
+		if( job->width <= photo_sizes[i/2].min_width && job->height <= photo_sizes[i/2].min_height )
+			continue;
+		if( i % 2 == 0 )
+		{
+			image_fit(job->width, job->height, boxw, boxh, &urlw, &urlh);
+			image_fit(srcw, srch, urlw, urlh, &dstw, &dsth);
+		}
+		else if( boxw == boxh && rotate & (ROTATE_90|ROTATE_270) )
+			image_fit(srcw, srch, boxw, boxh, &dstw, &dsth);
+		else
+			continue;
+		if( dstw <= 0 || dsth <= 0 ||
+		    thumbgen_rendition_path(dest, sizeof(dest), job->src, dstw, dsth, job->rotation) != 0 )
+			continue;
+		if( stat(dest, &st) == 0 && st.st_mtime >= src_st.st_mtime )
+			continue;
+		if( !imsrc )
+		{
+			if( srcw>>4 >= dstw && srch>>4 >= dsth )
+				scale = 8;
+			else if( srcw>>3 >= dstw && srch>>3 >= dsth )
+				scale = 4;
+			else if( srcw>>2 >= dstw && srch>>2 >= dsth )
+				scale = 2;
+			imsrc = image_new_from_jpeg(job->src, 1, NULL, 0, scale, rotate);
+			if( !imsrc )
+				return -1;
+		}
+		imdst = image_resize(imsrc, dstw, dsth);
+		if( !imdst || save_image(imdst, dest) != 0 )
+			ret = -1;
+		/* The smaller sizes are made from this one */
+		if( imdst && i/2 + 1 < PHOTO_SIZES )
+		{
+			image_free(imsrc);
+			imsrc = imdst;
+		}
+		else if( imdst )
+			image_free(imdst);
+	}
+	if( imsrc )
+		image_free(imsrc);
+
+	return ret;
+}
+
+static struct thumb_job *
+dequeue(struct thumb_queue *q)
+{
+	struct thumb_job *job = q->head;
+
+	if( job )
+	{
+		q->head = job->next;
+		if( !q->head )
+			q->tail = NULL;
+		q->len--;
+	}
+
+	return job;
+}
+
+static void
+free_job(struct thumb_job *job)
+{
+	free(job->src);
+	free(job->dest);
+	free(job);
+}
+
+static void *
+thumbgen_worker(void *arg)
+{
+	struct thumb_job *job;
+	sigset_t set;
+	int ret;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	process_set_idle_cpu();
+	process_set_idle_io();
+
+	pthread_mutex_lock(&tg.lock);
+	for (;;)
+	{
+		job = dequeue(&tg.art);
+		if( !job )
+			job = dequeue(&tg.photos);
+		if( !job )
+		{
+			if( tg.stop )
+				break;
+			if( !tg.busy )
+				pthread_cond_broadcast(&tg.idle);
+			pthread_cond_wait(&tg.work, &tg.lock);
+			continue;
+		}
+		tg.busy++;
+		pthread_mutex_unlock(&tg.lock);
+
+		if( job->kind == THUMB_ALBUM_ART )
+			ret = render_album_art(job);
+		else
+			ret = render_photo(job);
+		if( ret != 0 )
+			DPRINTF(E_DEBUG, L_METADATA, "Unable to resize %s\n", job->src);
+		free_job(job);
+
+		pthread_mutex_lock(&tg.lock);
+		tg.busy--;
+		if( ret == 0 )
+			tg.done++;
+		else
+			tg.failed++;
+	}
+	pthread_mutex_unlock(&tg.lock);
+
+	return NULL;
+}
+
+static int
+enqueue(struct thumb_queue *q, struct thumb_job *job)
+{
+	pthread_mutex_lock(&tg.lock);
+	if( !tg.running || q->len >= q->max )
+	{
+		pthread_mutex_unlock(&tg.lock);
+		free_job(job);
+		return -1;
+	}
+	job->next = NULL;
+	if( q->tail )
+		q->tail->next = job;
+	else
+		q->head = job;
+	q->tail = job;
+	q->len++;
+	pthread_cond_signal(&tg.work);
+	pthread_mutex_unlock(&tg.lock);
+
+	return 0;
+}
+
+int
+thumbgen_queue_album_art(const char *src, const char *dest)
+{
+	struct thumb_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if( !job )
+		return -1;
+	job->kind = THUMB_ALBUM_ART;
+	job->src = strdup(src);
+	job->dest = strdup(dest);
+	if( !job->src || !job->dest )
+	{
+		free_job(job);
+		return -1;
+	}
+
+	return enqueue(&tg.art, job);
+}
+
+void
+thumbgen_queue_photo(const char *path, const char *resolution, int rotation)
+{
+	struct thumb_job *job;
+
+	if( !resolution || !tg.running )
+		return;
+	job = calloc(1, sizeof(*job));
+	if( !job )
+		return;
+	job->kind = THUMB_PHOTO;
+	job->rotation = rotation;
+	if( sscanf(resolution, "%dx%d", &job->width, &job->height) != 2 ||
+	    !(job->src = strdup(path)) )
+	{
+		free_job(job);
+		return;
+	}
+	enqueue(&tg.photos, job);
+}
+
+int
+thumbgen_running(void)
+{
+	return tg.running;
+}
+
+void
+thumbgen_start(void)
+{
+	int i, n;
+
+	if( tg.running )
+		return;
+	n = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+	n = MIN(MAX(n, 1), 4);
+	tg.threads = calloc(n, sizeof(pthread_t));
+	if( !tg.threads )
+		return;
+	tg.stop = 0;
+	tg.done = tg.failed = 0;
+	for( i = 0; i < n; i++ )
+	{
+		if( pthread_create(&tg.threads[i], NULL, thumbgen_worker, NULL) != 0 )
+			break;
+	}
+	tg.nthreads = i;
+	if( !i )
+	{
+		free(tg.threads);
+		tg.threads = NULL;
+		return;
+	}
+	tg.running = 1;
+}
+
+void
+thumbgen_stop(int finish)
+{
+	struct thumb_job *job;
+	int i;
+
+	if( !tg.running )
+		return;
+	pthread_mutex_lock(&tg.lock);
+	if( finish )
+	{
+		/* Photos can wait for their first request; don't hold up
+		 * whoever is stopping us for them */
+		while( (job = dequeue(&tg.photos)) )
+			free_job(job);
+		while( tg.art.head || tg.busy )
+			pthread_cond_wait(&tg.idle, &tg.lock);
+	}
+	tg.running = 0;
+	tg.stop = 1;
+	while( (job = dequeue(&tg.art)) || (job = dequeue(&tg.photos)) )
+		free_job(job);
+	pthread_cond_broadcast(&tg.work);
+	pthread_mutex_unlock(&tg.lock);
+
+	for( i = 0; i < tg.nthreads; i++ )
+		pthread_join(tg.threads[i], NULL);
+	free(tg.threads);
+	tg.threads = NULL;
+	tg.nthreads = 0;
+	if( tg.done || tg.failed )
+		DPRINTF(E_INFO, L_METADATA, "Pre-generated %u resized images (%u failed)\n",
+		        tg.done, tg.failed);
+}
@@ -0,0 +1,61 @@
+/* Background generation of resized images for the art cache
+ *
+ * MiniDLNA media server
+ * Copyright (C) 2008-2009  Justin Maggard
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __THUMBGEN_H__
+#define __THUMBGEN_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Start the low priority worker threads of this process.  Until then,
+ * and after thumbgen_stop(), the queueing functions do nothing. */
+void thumbgen_start(void);
+
+/* Stop the workers.  With 'finish' set, queued album art, which the
+ * database already points to, is generated first; photos still queued are
+ * dropped either way. */
+void thumbgen_stop(int finish);
+
+int thumbgen_running(void);
+
+/* Scale the cover art file 'src' to fit 160x160 and save it as 'dest'.
+ * Returns -1 if the queue is full or not running, for the caller to do it. */
+int thumbgen_queue_album_art(const char *src, const char *dest);
+
+/* Render the JPEG_TN and JPEG_SM sizes a client is offered for the photo
+ * at 'path', given its RESOLUTION and ROTATION in degrees */
+void thumbgen_queue_photo(const char *path, const char *resolution, int rotation);
+
+/* Art cache file for a 'width' x 'height' rendition of the photo at 'path' */
+int thumbgen_rendition_path(char *buf, size_t len, const char *path,
+                            int width, int height, int rotation);
+
+/* Note that a rendition was just served or saved.  Safe in the process
+ * serving a request; the database is only written by the next call to
+ * thumbgen_update_renditions() in the main process. */
+void thumbgen_rendition_used(const char *path, long long id, off_t size);
+
+/* Record what was noted in RENDITIONS and keep them within
+ * resized_cache_size, least recently used going first */
+void thumbgen_update_renditions(void);
+
+/* Drop every cached rendition of the photo at 'path' */
+void thumbgen_remove(const char *path);
+
+#endif
@@ -66,7 +66,7 @@
 #endif
 
 #define USE_FORK 1
-#define DB_VERSION 9
+#define DB_VERSION 17
 
 #ifdef ENABLE_NLS
 #define _(string) gettext(string)
@@ -188,6 +188,10 @@ extern uint32_t runtime_flags;
 #define SYSTEMD_MASK          0x0010
 #define MERGE_MEDIA_DIRS_MASK 0x0020
 #define WIDE_LINKS_MASK       0x0040
+#define BROWSE_SNAPSHOT_MASK  0x0080
+#define RESCAN_MASK           0x0100
+#define FAST_SCAN_MASK        0x0200
+#define MP3_FRAME_SCAN_MASK   0x0400
 
 #define SETFLAG(mask)	runtime_flags |= mask
 #define GETFLAG(mask)	(runtime_flags & mask)
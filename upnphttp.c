@@ -62,6 +62,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <limits.h>
+#include <libgen.h>
 
 #include "config.h"
 #include "upnpglobalvars.h"
@@ -81,6 +82,9 @@
 #include "clients.h"
 #include "process.h"
 #include "sendfile.h"
+#include "snapshot.h"
+#include "thumbgen.h"
+#include "seekindex.h"
 
 #define MAX_BUFFER_SIZE 2147483647
 #define MIN_BUFFER_SIZE 65536
@@ -140,6 +144,43 @@ Delete_upnphttp(struct upnphttp * h)
 	}
 }
 
+/* An NPT time, either seconds or h:mm:ss, with an optional fraction.
+ * Returns milliseconds, or -1 if there isn't a valid time at 'p'. */
+static long
+parse_npt_time(const char *p, char **end)
+{
+	long ms, min, sec;
+	int i;
+
+	if( !isdigit(*p) )
+		return -1;
+	ms = strtol(p, end, 10);
+	p = *end;
+	if( *p == ':' )
+	{
+		/* npt-hhmmss: the seconds come after the minutes */
+		if( !isdigit(p[1]) || !isdigit(p[2]) || p[3] != ':' ||
+		    !isdigit(p[4]) || !isdigit(p[5]) )
+			return -1;
+		min = (p[1] - '0') * 10 + (p[2] - '0');
+		sec = (p[4] - '0') * 10 + (p[5] - '0');
+		if( min > 59 || sec > 59 )
+			return -1;
+		ms = (ms * 60 + min) * 60 + sec;
+		p += 6;
+	}
+	ms *= 1000;
+	if( *p == '.' )
+	{
+		p++;
+		for( i = 100; isdigit(*p); i /= 10, p++ )
+			ms += (*p - '0') * i;
+	}
+	*end = (char *)p;
+
+	return ms;
+}
+
 /* parse HttpHeaders of the REQUEST */
 static void
 ParseHttpHeaders(struct upnphttp * h)
@@ -381,7 +422,25 @@ ParseHttpHeaders(struct upnphttp * h)
 			}
 			else if(strncasecmp(line, "TimeSeekRange.dlna.org", 22)==0)
 			{
+				p = colon + 1;
+				while(isspace(*p))
+					p++;
 				h->reqflags |= FLAG_TIMESEEK;
+				h->req_TimeSeekEnd = -1;
+				if( strncasecmp(p, "npt=", 4) != 0 ||
+				    (h->req_TimeSeekStart = parse_npt_time(p + 4, &p)) < 0 ||
+				    *p++ != '-' )
+				{
+					h->reqflags |= FLAG_INVALID_REQ;
+				}
+				else if( isdigit(*p) )
+				{
+					h->req_TimeSeekEnd = parse_npt_time(p, &p);
+					if( h->req_TimeSeekEnd <= h->req_TimeSeekStart )
+						h->reqflags |= FLAG_INVALID_REQ;
+				}
+				DPRINTF(E_DEBUG, L_HTTP, "TimeSeek Start-End: %ld - %ld\n",
+					h->req_TimeSeekStart, h->req_TimeSeekEnd);
 			}
 			else if(strncasecmp(line, "PlaySpeed.dlna.org", 18)==0)
 			{
@@ -644,6 +703,8 @@ SendResp_presentation(struct upnphttp * h)
 	struct string_s str;
 	char body[4096];
 	int a, v, p, i;
+	uint32_t objects;
+	int64_t size, cache;
 
 	INIT_STR(str, body);
 
@@ -665,6 +726,16 @@ SendResp_presentation(struct upnphttp * h)
 		"<tr><td>Image files</td><td>%d</td></tr>"
 		"</table>", a, v, p);
 
+	size = sql_get_db_size(db, &cache);
+	strcatf(&str,
+		"<br>Database: %lld KB, page cache limit %lld KB<br>",
+		(long long)size / 1024, (long long)cache / 1024);
+
+	if (snapshot_footprint(&objects))
+		strcatf(&str,
+			"<br>Browse snapshot: %u objects, %lu KB mapped<br>",
+			objects, (unsigned long)(snapshot_footprint(NULL) / 1024));
+
 	if (scanning)
 		strcatf(&str,
 			"<br><i>* Media scan in progress</i><br>");
@@ -935,9 +1006,11 @@ ProcessHttpQuery_upnphttp(struct upnphttp * h)
 			Send400(h);
 			return;
 		}
-		/* 7.3.33.4 */
+		/* 7.3.33.4; time seeks are answered for indexed items only */
 		else if( (h->reqflags & (FLAG_TIMESEEK|FLAG_PLAYSPEED)) &&
-		         !(h->reqflags & FLAG_RANGE) )
+		         !(h->reqflags & FLAG_RANGE) &&
+		         ((h->reqflags & FLAG_PLAYSPEED) ||
+		          strncmp(HttpUrl, "/MediaItems/", 12) != 0) )
 		{
 			DPRINTF(E_WARN, L_HTTP, "DLNA %s requested, responding ERROR 406\n",
 				h->reqflags&FLAG_TIMESEEK ? "TimeSeek" : "PlaySpeed");
@@ -1488,7 +1561,7 @@ SendResp_albumArt(struct upnphttp * h, char * object)
 
 	id = strtoll(object, NULL, 10);
 
-	path = sql_get_text_field(db, "SELECT PATH from ALBUM_ART where ID = '%lld'", id);
+	path = sql_get_text_field_bind(db, "SELECT PATH from ALBUM_ART where ID = ?", "i", (int64_t)id);
 	if( !path )
 	{
 		DPRINTF(E_WARN, L_HTTP, "ALBUM_ART ID %s not found, responding ERROR 404\n", object);
@@ -1538,7 +1611,7 @@ SendResp_caption(struct upnphttp * h, char * object)
 
 	id = strtoll(object, NULL, 10);
 
-	path = sql_get_text_field(db, "SELECT PATH from CAPTIONS where ID = %lld", id);
+	path = sql_get_text_field_bind(db, "SELECT PATH from CAPTIONS where ID = ?", "i", (int64_t)id);
 	if( !path )
 	{
 		DPRINTF(E_WARN, L_HTTP, "CAPTION ID %s not found, responding ERROR 404\n", object);
@@ -1578,11 +1651,17 @@ static void
 SendResp_thumbnail(struct upnphttp * h, char * object)
 {
 	char header[512];
+	char sql[128];
+	char **result;
 	char *path;
 	long long id;
 	ExifData *ed;
 	ExifLoader *l;
 	struct string_s str;
+	struct stat st;
+	unsigned char soi[2];
+	off_t offset;
+	int fd, rows = 0, size;
 
 	if( h->reqflags & (FLAG_XFERSTREAMING|FLAG_RANGE) )
 	{
@@ -1592,28 +1671,60 @@ SendResp_thumbnail(struct upnphttp * h, char * object)
 	}
 
 	id = strtoll(object, NULL, 10);
-	path = sql_get_text_field(db, "SELECT PATH from DETAILS where ID = '%lld'", id);
-	if( !path )
+	snprintf(sql, sizeof(sql), "SELECT PATH, TIMESTAMP, THUMB_OFFSET, THUMB_SIZE"
+	                           " from DETAILS_DATA where ID = %lld", id);
+	if( sql_get_table(db, sql, &result, &rows, NULL) != SQLITE_OK )
+	{
+		Send500(h);
+		return;
+	}
+	if( !rows || !(path = result[4]) )
 	{
 		DPRINTF(E_WARN, L_HTTP, "DETAIL ID %s not found, responding ERROR 404\n", object);
+		sqlite3_free_table(result);
 		Send404(h);
 		return;
 	}
 	DPRINTF(E_INFO, L_HTTP, "Serving thumbnail for ObjectId: %lld [%s]\n", id, path);
 
-	if( access(path, F_OK) != 0 )
+	fd = open(path, O_RDONLY);
+	if( fd < 0 )
 	{
 		DPRINTF(E_ERROR, L_HTTP, "Error accessing %s\n", path);
 		Send404(h);
-		sqlite3_free(path);
+		sqlite3_free_table(result);
 		return;
 	}
 
+	INIT_STR(str, header);
+	start_dlna_header(&str, 200, "Interactive", "image/jpeg");
+
+	/* Send the thumbnail straight from where the scanner found it, as long
+	 * as the file is the one that was scanned */
+	offset = result[6] ? strtoll(result[6], NULL, 10) : 0;
+	size = result[7] ? atoi(result[7]) : 0;
+	if( size > 0 && fstat(fd, &st) == 0 &&
+	    result[5] && st.st_mtime == strtoll(result[5], NULL, 10) &&
+	    offset + size <= st.st_size &&
+	    pread(fd, soi, 2, offset) == 2 && soi[0] == 0xFF && soi[1] == 0xD8 )
+	{
+		sqlite3_free_table(result);
+		strcatf(&str, "Content-Length: %d\r\n"
+		              "contentFeatures.dlna.org: DLNA.ORG_PN=JPEG_TN;DLNA.ORG_CI=1\r\n\r\n",
+		              size);
+		if( send_data(h, str.data, str.off, 0) == 0 && h->req_command != EHead )
+			send_file(h, fd, offset, offset + size - 1);
+		close(fd);
+		CloseSocket_upnphttp(h);
+		return;
+	}
+	close(fd);
+
 	l = exif_loader_new();
 	exif_loader_write_file(l, path);
 	ed = exif_loader_get_data(l);
 	exif_loader_unref(l);
-	sqlite3_free(path);
+	sqlite3_free_table(result);
 
 	if( !ed || !ed->size )
 	{
@@ -1623,9 +1734,6 @@ SendResp_thumbnail(struct upnphttp * h, char * object)
 		return;
 	}
 
-	INIT_STR(str, header);
-
-	start_dlna_header(&str, 200, "Interactive", "image/jpeg");
 	strcatf(&str, "Content-Length: %jd\r\n"
 	              "contentFeatures.dlna.org: DLNA.ORG_PN=JPEG_TN;DLNA.ORG_CI=1\r\n\r\n",
 	              (intmax_t)ed->size);
@@ -1639,6 +1747,114 @@ SendResp_thumbnail(struct upnphttp * h, char * object)
 	CloseSocket_upnphttp(h);
 }
 
+/* A rendition of a photo saved in the art cache, by thumbgen or by an
+ * earlier request, as long as it is newer than the photo itself */
+static int
+open_rendition(const char *cache_file, time_t mtime, off_t *size)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(cache_file, O_RDONLY);
+	if( fd < 0 )
+		return -1;
+	if( fstat(fd, &st) != 0 || st.st_mtime < mtime || st.st_size <= 0 )
+	{
+		close(fd);
+		return -1;
+	}
+	*size = st.st_size;
+
+	return fd;
+}
+
+static int
+save_rendition(const char *cache_file, const unsigned char *data, int size)
+{
+	char tmp[PATH_MAX];
+	char *dir;
+	int fd, ok;
+
+	dir = strdup(cache_file);
+	if( !dir )
+		return -1;
+	make_dir(dirname(dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+	free(dir);
+	snprintf(tmp, sizeof(tmp), "%s.%d", cache_file, (int)getpid());
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if( fd < 0 )
+		return -1;
+	ok = (write(fd, data, size) == size);
+	close(fd);
+	if( !ok || rename(tmp, cache_file) != 0 )
+	{
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Keep a new rendition in the art cache, to be accounted for by the
+ * main process */
+static void
+store_rendition(const char *cache_file, long long id, const unsigned char *data, int size)
+{
+	if( save_rendition(cache_file, data, size) == 0 )
+		thumbgen_rendition_used(cache_file, id, size);
+}
+
+/* Where image_resize_jpeg_stream() output goes: out as HTTP chunks, the
+ * response header ahead of the first, and into 'buf' as well when the
+ * whole image is wanted for the rendition cache or a Content-Length */
+struct resized_out {
+	struct upnphttp *h;
+	struct string_s *hdr;
+	int chunked;
+	int keep;
+	unsigned char *buf;
+	size_t len;
+	size_t alloc;
+};
+
+static int
+resized_write(void *arg, const uint8_t *data, size_t len)
+{
+	struct resized_out *out = arg;
+	unsigned char *p;
+	char size[16];
+	int n;
+
+	if( out->keep )
+	{
+		if( out->len + len > out->alloc )
+		{
+			out->alloc = (out->len + len) * 2;
+			p = realloc(out->buf, out->alloc);
+			if( !p )
+				return -1;
+			out->buf = p;
+		}
+		memcpy(out->buf + out->len, data, len);
+		out->len += len;
+	}
+	if( !out->chunked )
+		return 0;
+	if( out->hdr )
+	{
+		if( send_data(out->h, out->hdr->data, out->hdr->off, MSG_MORE) != 0 )
+			return -1;
+		out->hdr = NULL;
+	}
+	n = snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)len);
+	if( send_data(out->h, size, n, MSG_MORE) != 0 ||
+	    send_data(out->h, (char *)data, len, MSG_MORE) != 0 ||
+	    send_data(out->h, "\r\n", 2, MSG_MORE) != 0 )
+		return -1;
+
+	return 0;
+}
+
 static void
 SendResp_resizedimg(struct upnphttp * h, char * object)
 {
@@ -1655,11 +1871,15 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 	char *resolution = NULL;
 	char *key, *val;
 	char *saveptr, *item = NULL;
-	int rotate;
+	char cache_file[PATH_MAX];
+	struct stat st;
+	int rotate, degrees, cacheable = 0, cachefd = -1;
+	off_t cachesize = 0;
 	int pixw = 0, pixh = 0;
 	long long id;
 	int rows=0, chunked, ret;
 	image_s *imsrc = NULL, *imdst = NULL;
+	struct resized_out out;
 	int scale = 1;
 	const char *tmode;
 
@@ -1677,7 +1897,7 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 		resolution = result[4];
 		rotate = result[5] ? atoi(result[5]) : 0;
 	}
-	if( !file_path || !resolution || (access(file_path, F_OK) != 0) )
+	if( !file_path || !resolution || (stat(file_path, &st) != 0) )
 	{
 		DPRINTF(E_WARN, L_HTTP, "%s not found, responding ERROR 404\n", object);
 		sqlite3_free_table(result);
@@ -1707,7 +1927,7 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 		else if( strcasecmp(key, "rotation") == 0 )
 		{
 			rotate = (rotate + atoi(val)) % 360;
-			sql_exec(db, "UPDATE DETAILS set ROTATION = %d where ID = %lld", rotate, id);
+			sql_exec(db, "UPDATE DETAILS_DATA set ROTATION = %d where ID = %lld", rotate, id);
 		}
 		else if( strcasecmp(key, "pixelshape") == 0 )
 		{
@@ -1736,6 +1956,7 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 	DPRINTF(E_INFO, L_HTTP, "Serving resized image for ObjectId: %lld [%s]\n", id, file_path);
 	if( rotate )
 		DPRINTF(E_DEBUG, L_HTTP, "Rotating image %d degrees\n", rotate);
+	degrees = rotate;
 	switch( rotate )
 	{
 		case 90:
@@ -1761,13 +1982,7 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 		return;
 	}
 	/* Figure out the best destination resolution we can use */
-	dstw = width;
-	dsth = ((((width<<10)/srcw)*srch)>>10);
-	if( dsth > height )
-	{
-		dsth = height;
-		dstw = (((height<<10)/srch) * srcw>>10);
-	}
+	image_fit(srcw, srch, width, height, &dstw, &dsth);
 	/* Account for pixel shape */
 	if( pixw && pixh )
 	{
@@ -1786,6 +2001,17 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 	else
 		strcpy(dlna_pn, "DLNA.ORG_PN=JPEG_LRG;");
 
+	/* The JPEG_TN and JPEG_SM sizes are always kept in the art cache, the
+	 * rest as long as resized_cache_size leaves room for them */
+	if( (runtime_vars.resized_cache_size > 0 || (dstw <= 640 && dsth <= 480)) &&
+	    thumbgen_rendition_path(cache_file, sizeof(cache_file), file_path, dstw, dsth, degrees) == 0 )
+	{
+		cacheable = 1;
+		cachefd = open_rendition(cache_file, st.st_mtime, &cachesize);
+		if( cachefd >= 0 )
+			DPRINTF(E_DEBUG, L_HTTP, "Using cached rendition %s\n", cache_file);
+	}
+
 	if( srcw>>4 >= dstw && srch>>4 >= dsth)
 		scale = 8;
 	else if( srcw>>3 >= dstw && srch>>3 >= dsth )
@@ -1805,28 +2031,77 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 	strcatf(&str, "contentFeatures.dlna.org: %sDLNA.ORG_CI=1;DLNA.ORG_FLAGS=%08X%024X\r\n",
 	              dlna_pn, dlna_flags, 0);
 
-	if( strcmp(h->HttpVer, "HTTP/1.0") == 0 )
+	if( cachefd >= 0 )
 	{
-		chunked = 0;
-		imsrc = image_new_from_jpeg(file_path, 1, NULL, 0, scale, rotate);
+		strcatf(&str, "Content-Length: %jd\r\n\r\n", (intmax_t)cachesize);
+		if( send_data(h, str.data, str.off, 0) == 0 && h->req_command != EHead )
+			send_file(h, cachefd, 0, cachesize - 1);
+		close(cachefd);
+		thumbgen_rendition_used(cache_file, id, cachesize);
+		goto resized_done;
 	}
-	else
-	{
-		chunked = 1;
+
+	chunked = (strcmp(h->HttpVer, "HTTP/1.0") != 0);
+	if( chunked )
 		strcatf(&str, "Transfer-Encoding: chunked\r\n\r\n");
+
+	/* Shrink while decoding and send each piece as it is encoded, without
+	 * ever holding a full frame.  Rotated images and ones that would have
+	 * to be enlarged go the long way below. */
+	if( rotate == ROTATE_NONE && !(chunked && h->req_command == EHead) )
+	{
+		memset(&out, 0, sizeof(out));
+		out.h = h;
+		out.hdr = &str;
+		out.chunked = chunked;
+		out.keep = !chunked || cacheable;
+		ret = image_resize_jpeg_stream(file_path, scale, dstw, dsth, resized_write, &out);
+		if( ret == 0 && out.keep )
+		{
+			data = out.buf;
+			size = out.len;
+			if( cacheable )
+				store_rendition(cache_file, id, data, size);
+		}
+		else
+			free(out.buf);
+		if( ret < 0 && !chunked )
+		{
+			DPRINTF(E_WARN, L_HTTP, "Unable to resize image %s!\n", file_path);
+			Send500(h);
+			goto resized_error;
+		}
+		else if( ret < 0 )
+		{
+			DPRINTF(E_WARN, L_HTTP, "Failed sending resized %s\n", file_path);
+			goto resized_done;
+		}
+		if( ret == 0 && chunked )
+		{
+			send_data(h, "0\r\n\r\n", 5, 0);
+			goto resized_done;
+		}
 	}
 
+	if( !chunked && !data )
+		imsrc = image_new_from_jpeg(file_path, 1, NULL, 0, scale, rotate);
+
 	if( !chunked )
 	{
-		if( !imsrc )
+		if( !data && !imsrc )
 		{
 			DPRINTF(E_WARN, L_HTTP, "Unable to open image %s!\n", file_path);
 			Send500(h);
 			goto resized_error;
 		}
 
-		imdst = image_resize(imsrc, dstw, dsth);
-		data = image_save_to_jpeg_buf(imdst, &size);
+		if( !data )
+		{
+			imdst = image_resize(imsrc, dstw, dsth);
+			data = image_save_to_jpeg_buf(imdst, &size);
+			if( data && cacheable )
+				store_rendition(cache_file, id, data, size);
+		}
 
 		strcatf(&str, "Content-Length: %d\r\n\r\n", size);
 	}
@@ -1844,6 +2119,8 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 			}
 			imdst = image_resize(imsrc, dstw, dsth);
 			data = image_save_to_jpeg_buf(imdst, &size);
+			if( data && cacheable )
+				store_rendition(cache_file, id, data, size);
 
 			ret = sprintf(buf, "%x\r\n", size);
 			send_data(h, buf, ret, MSG_MORE);
@@ -1855,11 +2132,13 @@ SendResp_resizedimg(struct upnphttp * h, char * object)
 			send_data(h, (char *)data, size, 0);
 		}
 	}
+resized_done:
 	DPRINTF(E_INFO, L_HTTP, "Done serving %s\n", file_path);
 	if( imsrc )
 		image_free(imsrc);
 	if( imdst )
 		image_free(imdst);
+	free(data);
 	CloseSocket_upnphttp(h);
 resized_error:
 	sqlite3_free_table(result);
@@ -1880,6 +2159,10 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 	off_t total, offset, size;
 	int64_t id;
 	int sendfh;
+	uint8_t *seek = NULL;
+	int seek_len = 0;
+	uint32_t duration;
+	int64_t seek_end;
 	uint32_t dlna_flags = DLNA_FLAG_DLNA_V1_5|DLNA_FLAG_HTTP_STALLING|DLNA_FLAG_TM_B;
 	uint32_t cflags = h->req_client ? h->req_client->type->flags : 0;
 	const char *tmode;
@@ -1889,6 +2172,7 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 	                char path[PATH_MAX];
 	                char mime[32];
 	                char dlna[96];
+	                int seekable;
 	              } last_file = { 0, 0 };
 #if USE_FORK
 	pid_t newpid = 0;
@@ -1900,7 +2184,7 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 		if( strstr(object, "?albumArt=true") )
 		{
 			char *art;
-			art = sql_get_text_field(db, "SELECT ALBUM_ART from DETAILS where ID = '%lld'", id);
+			art = sql_get_text_field_bind(db, "SELECT ALBUM_ART from DETAILS where ID = ?", "i", id);
 			if (art)
 			{
 				SendResp_albumArt(h, art);
@@ -1913,7 +2197,7 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 	}
 	if( id != last_file.id || ctype != last_file.client )
 	{
-		snprintf(buf, sizeof(buf), "SELECT PATH, MIME, DLNA_PN from DETAILS where ID = '%lld'", (long long)id);
+		snprintf(buf, sizeof(buf), "SELECT PATH, MIME, DLNA_PN, SEEKABLE from DETAILS where ID = '%lld'", (long long)id);
 		ret = sql_get_table(db, buf, &result, &rows, NULL);
 		if( (ret != SQLITE_OK) )
 		{
@@ -1921,7 +2205,7 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 			Send500(h);
 			return;
 		}
-		if( !rows || !result[3] || !result[4] )
+		if( !rows || !result[4] || !result[5] )
 		{
 			DPRINTF(E_WARN, L_HTTP, "%s not found, responding ERROR 404\n", object);
 			sqlite3_free_table(result);
@@ -1931,10 +2215,10 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 		/* Cache the result */
 		last_file.id = id;
 		last_file.client = ctype;
-		strncpy(last_file.path, result[3], sizeof(last_file.path)-1);
-		if( result[4] )
+		strncpy(last_file.path, result[4], sizeof(last_file.path)-1);
+		if( result[5] )
 		{
-			strncpy(last_file.mime, result[4], sizeof(last_file.mime)-1);
+			strncpy(last_file.mime, result[5], sizeof(last_file.mime)-1);
 			/* From what I read, Samsung TV's expect a [wrong] MIME type of x-mkv. */
 			if( cflags & FLAG_SAMSUNG )
 			{
@@ -1954,10 +2238,11 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 					strcpy(last_file.mime+6, "divx");
 			}
 		}
-		if( result[5] )
-			snprintf(last_file.dlna, sizeof(last_file.dlna), "DLNA.ORG_PN=%s;", result[5]);
+		if( result[6] )
+			snprintf(last_file.dlna, sizeof(last_file.dlna), "DLNA.ORG_PN=%s;", result[6]);
 		else
 			last_file.dlna[0] = '\0';
+		last_file.seekable = result[7] && atoi(result[7]);
 		sqlite3_free_table(result);
 	}
 #if USE_FORK
@@ -2001,6 +2286,25 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 		}
 	}
 
+	/* Only a time seek needs the index itself */
+	if( (h->reqflags & FLAG_TIMESEEK) && !(h->reqflags & FLAG_RANGE) && last_file.seekable )
+	{
+		seek = sql_get_blob_field_bind(db, &seek_len, "SELECT DATA from SEEK_INDEX where ID = ?",
+		                               "i", (int64_t)id);
+		if( seek && seek_len < 2 * SEEK_POINT_SIZE )
+		{
+			sqlite3_free(seek);
+			seek = NULL;
+		}
+	}
+	if( (h->reqflags & FLAG_TIMESEEK) && !(h->reqflags & FLAG_RANGE) && !seek )
+	{
+		DPRINTF(E_WARN, L_HTTP, "TimeSeek requested on %s without an index, responding ERROR 406\n",
+			last_file.path);
+		Send406(h);
+		goto error;
+	}
+
 	sendfh = _open_file(last_file.path);
 	if( sendfh < 0 ) {
 		if (sendfh == -403)
@@ -2063,6 +2367,45 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 		              (intmax_t)total, (intmax_t)h->req_RangeStart,
 		              (intmax_t)h->req_RangeEnd, (intmax_t)size);
 	}
+	else if( h->reqflags & FLAG_TIMESEEK )
+	{
+		duration = seek_index_duration(seek, seek_len);
+		if( h->req_TimeSeekStart >= (long)duration )
+		{
+			DPRINTF(E_WARN, L_HTTP, "Specified time was past the end!\n");
+			Send416(h);
+			close(sendfh);
+			goto error;
+		}
+		if( h->req_TimeSeekEnd < 0 || h->req_TimeSeekEnd > (long)duration )
+			h->req_TimeSeekEnd = duration;
+
+		/* Anything ahead of the first point, such as tags, goes along
+		 * when starting from the beginning */
+		offset = h->req_TimeSeekStart ? seek_index_lookup(seek, seek_len, h->req_TimeSeekStart) : 0;
+		if( h->req_TimeSeekEnd < (long)duration )
+			seek_end = seek_index_lookup(seek, seek_len, h->req_TimeSeekEnd) - 1;
+		else
+			seek_end = size - 1;
+		if( seek_end >= size )
+			seek_end = size - 1;
+		if( offset < 0 || offset > seek_end )
+		{
+			DPRINTF(E_WARN, L_HTTP, "Specified time range maps outside of %s!\n", last_file.path);
+			Send416(h);
+			close(sendfh);
+			goto error;
+		}
+		h->req_RangeEnd = seek_end;
+		total = h->req_RangeEnd - offset + 1;
+		strcatf(&str, "Content-Length: %jd\r\n"
+		              "TimeSeekRange.dlna.org: npt=%ld.%03ld-%ld.%03ld/%u.%03u bytes=%jd-%jd/%jd\r\n",
+		              (intmax_t)total,
+		              h->req_TimeSeekStart / 1000, h->req_TimeSeekStart % 1000,
+		              h->req_TimeSeekEnd / 1000, h->req_TimeSeekEnd % 1000,
+		              duration / 1000, duration % 1000,
+		              (intmax_t)offset, (intmax_t)h->req_RangeEnd, (intmax_t)size);
+	}
 	else
 	{
 		h->req_RangeEnd = size - 1;
@@ -2084,14 +2427,14 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 
 	if( h->reqflags & FLAG_CAPTION )
 	{
-		if( sql_get_int_field(db, "SELECT ID from CAPTIONS where ID = '%lld'", (long long)id) > 0 )
+		if( sql_get_int_field_bind(db, "SELECT ID from CAPTIONS where ID = ?", "i", (int64_t)id) > 0 )
 			strcatf(&str, "CaptionInfo.sec: http://%s:%d/Captions/%lld.srt\r\n",
 			              lan_addr[h->iface].str, runtime_vars.port, (long long)id);
 	}
 
 	strcatf(&str, "Accept-Ranges: bytes\r\n"
 	              "contentFeatures.dlna.org: %sDLNA.ORG_OP=%02X;DLNA.ORG_CI=%X;DLNA.ORG_FLAGS=%08X%024X\r\n\r\n",
-	              last_file.dlna, 1, 0, dlna_flags, 0);
+	              last_file.dlna, last_file.seekable ? 0x11 : 0x01, 0, dlna_flags, 0);
 
 	//DEBUG DPRINTF(E_DEBUG, L_HTTP, "RESPONSE: %s\n", str.data);
 	if( send_data(h, str.data, str.off, MSG_MORE) == 0 )
@@ -2103,6 +2446,7 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 
 	CloseSocket_upnphttp(h);
 error:
+	sqlite3_free(seek);
 #if USE_FORK
 	if( newpid == 0 )
 		_exit(0);
@@ -98,6 +98,8 @@ struct upnphttp {
 	int req_SIDLen;
 	off_t req_RangeStart;
 	off_t req_RangeEnd;
+	long req_TimeSeekStart;		/* milliseconds */
+	long req_TimeSeekEnd;		/* -1 when open ended */
 	long int req_chunklen;
 	uint32_t reqflags;
 	/* response */
@@ -69,6 +69,7 @@
 #include "upnpreplyparse.h"
 #include "getifaddr.h"
 #include "scanner.h"
+#include "snapshot.h"
 #include "sql.h"
 #include "log.h"
 
@@ -746,7 +747,7 @@ get_child_count(const char *object, struct magic_container_s *magic)
 		ret = sql_get_int_field(db, "SELECT count(*) from %s", magic->child_count);
 	else if (magic && magic->objectid && *(magic->objectid))
 		ret = sql_get_int_field(db, "SELECT count(*) from OBJECTS where PARENT_ID = '%s';", *(magic->objectid));
-	else
+	else if ((ret = snapshot_child_count(object)) < 0)
 		ret = sql_get_int_field(db, "SELECT count(*) from OBJECTS where PARENT_ID = '%s';", object);
 
 	return (ret > 0) ? ret : 0;
@@ -764,7 +765,8 @@ object_exists(const char *object)
 #define COLUMNS "o.DETAIL_ID, o.CLASS," \
                 " d.SIZE, d.TITLE, d.DURATION, d.BITRATE, d.SAMPLERATE, d.ARTIST," \
                 " d.ALBUM, d.GENRE, d.COMMENT, d.CHANNELS, d.TRACK, d.DATE, d.RESOLUTION," \
-                " d.THUMBNAIL, d.CREATOR, d.DLNA_PN, d.MIME, d.ALBUM_ART, d.ROTATION, d.DISC "
+                " d.THUMBNAIL, d.CREATOR, d.DLNA_PN, d.MIME, d.ALBUM_ART, d.ROTATION, d.DISC," \
+                " d.SEEKABLE "
 #define SELECT_COLUMNS "SELECT o.OBJECT_ID, o.PARENT_ID, o.REF_ID, " COLUMNS
 
 #define NON_ZERO(x) (x && atoi(x))
@@ -777,7 +779,8 @@ callback(void *args, int argc, char **argv, char **azColName)
 	char *id = argv[0], *parent = argv[1], *refID = argv[2], *detailID = argv[3], *class = argv[4], *size = argv[5], *title = argv[6],
 	     *duration = argv[7], *bitrate = argv[8], *sampleFrequency = argv[9], *artist = argv[10], *album = argv[11],
 	     *genre = argv[12], *comment = argv[13], *nrAudioChannels = argv[14], *track = argv[15], *date = argv[16], *resolution = argv[17],
-	     *tn = argv[18], *creator = argv[19], *dlna_pn = argv[20], *mime = argv[21], *album_art = argv[22], *rotate = argv[23];
+	     *tn = argv[18], *creator = argv[19], *dlna_pn = argv[20], *mime = argv[21], *album_art = argv[22], *rotate = argv[23],
+	     *seekable = argv[25];
 	char dlna_buf[128];
 	const char *ext;
 	struct string_s *str = passed_args->str;
@@ -818,6 +821,7 @@ callback(void *args, int argc, char **argv, char **azColName)
 	{
 		uint32_t dlna_flags = DLNA_FLAG_DLNA_V1_5|DLNA_FLAG_HTTP_STALLING|DLNA_FLAG_TM_B;
 		char *alt_title = NULL;
+		int op = 0x01;
 		/* We may need special handling for certain MIME types */
 		if( *mime == 'v' )
 		{
@@ -905,18 +909,21 @@ callback(void *args, int argc, char **argv, char **azColName)
 		}
 		else
 			dlna_flags |= DLNA_FLAG_TM_I;
+		/* Time seeks are served for items with a seek index */
+		if( *mime != 'i' && (passed_args->flags & FLAG_DLNA || dlna_pn) && NON_ZERO(seekable) )
+			op = 0x11;
 
 		if( dlna_pn )
 			snprintf(dlna_buf, sizeof(dlna_buf), "DLNA.ORG_PN=%s;"
-			                                     "DLNA.ORG_OP=01;"
+			                                     "DLNA.ORG_OP=%02X;"
 			                                     "DLNA.ORG_CI=0;"
 			                                     "DLNA.ORG_FLAGS=%08X%024X",
-			                                     dlna_pn, dlna_flags, 0);
+			                                     dlna_pn, op, dlna_flags, 0);
 		else if( passed_args->flags & FLAG_DLNA )
-			snprintf(dlna_buf, sizeof(dlna_buf), "DLNA.ORG_OP=01;"
+			snprintf(dlna_buf, sizeof(dlna_buf), "DLNA.ORG_OP=%02X;"
 			                                     "DLNA.ORG_CI=0;"
 			                                     "DLNA.ORG_FLAGS=%08X%024X",
-			                                     dlna_flags, 0);
+			                                     op, dlna_flags, 0);
 		else
 			strcpy(dlna_buf, "*");
 
@@ -1356,13 +1363,24 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 			goto browse_error;
 		}
 
-		sql = sqlite3_mprintf("SELECT %s, %s, %s, " COLUMNS
-		                      "from OBJECTS o left join DETAILS d on (d.ID = o.DETAIL_ID)"
-				      " where %s %s limit %d, %d;",
-				      objectid_sql, parentid_sql, refid_sql,
-				      where, THISORNUL(orderBy), StartingIndex, RequestedCount);
-		DPRINTF(E_DEBUG, L_HTTP, "Browse SQL: %s\n", sql);
-		ret = sqlite3_exec(db, sql, callback, (void *) &args, &zErrMsg);
+		/* Plain folders in default order can come straight from the snapshot */
+		sql = NULL;
+		if( !magic && !orderBy &&
+		    snapshot_browse(ObjectID, StartingIndex, RequestedCount, callback, (void *) &args) >= 0 )
+		{
+			DPRINTF(E_DEBUG, L_HTTP, "Browse served from snapshot\n");
+			ret = SQLITE_OK;
+		}
+		else
+		{
+			sql = sqlite3_mprintf("SELECT %s, %s, %s, " COLUMNS
+			                      "from OBJECTS o left join DETAILS d on (d.ID = o.DETAIL_ID)"
+			                      " where %s %s limit %d, %d;",
+			                      objectid_sql, parentid_sql, refid_sql,
+			                      where, THISORNUL(orderBy), StartingIndex, RequestedCount);
+			DPRINTF(E_DEBUG, L_HTTP, "Browse SQL: %s\n", sql);
+			ret = sqlite3_exec(db, sql, callback, (void *) &args, &zErrMsg);
+		}
 	}
 	if( (ret != SQLITE_OK) && (zErrMsg != NULL) )
 	{
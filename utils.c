@@ -29,6 +29,7 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <ftw.h>
 
 #include "minidlnatypes.h"
 #include "upnpglobalvars.h"
@@ -291,6 +292,23 @@ make_dir(char * path, mode_t mode)
 	} while (1);
 }
 
+static int
+_remove_entry(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	if (remove(fpath) < 0 && errno != ENOENT)
+		DPRINTF(E_WARN, L_GENERAL, "remove_dir: cannot remove '%s' [%s]\n", fpath, strerror(errno));
+	return 0;
+}
+
+/* Recursively delete 'path', like rm -rf, without following symlinks */
+int
+remove_dir(const char * path)
+{
+	if (access(path, F_OK) != 0)
+		return 0;
+	return nftw(path, _remove_entry, 16, FTW_DEPTH|FTW_PHYS);
+}
+
 /* Simple, efficient hash function from Daniel J. Bernstein */
 unsigned int
 DJBHash(uint8_t *data, int len)
@@ -306,6 +324,22 @@ DJBHash(uint8_t *data, int len)
 	return hash;
 }
 
+/* 64-bit FNV-1a, for content that is looked up by its hash alone */
+uint64_t
+hash64(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while( len-- )
+	{
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 const char *
 mime_to_ext(const char * mime)
 {
@@ -444,17 +478,25 @@ is_album_art(const char * name)
 
 int
 resolve_unknown_type(const char * path, media_types dir_type)
+{
+	return resolve_unknown_type_at(AT_FDCWD, path, path, dir_type);
+}
+
+/* Same as resolve_unknown_type(), looking up 'name' relative to the
+ * directory 'dirfd'; 'path' is its full path. */
+int
+resolve_unknown_type_at(int dirfd, const char *name, const char *path, media_types dir_type)
 {
 	struct stat entry;
 	unsigned char type = TYPE_UNKNOWN;
 	char str_buf[PATH_MAX];
 	ssize_t len;
 
-	if( lstat(path, &entry) == 0 )
+	if( fstatat(dirfd, name, &entry, AT_SYMLINK_NOFOLLOW) == 0 )
 	{
 		if( S_ISLNK(entry.st_mode) )
 		{
-			if( (len = readlink(path, str_buf, PATH_MAX-1)) > 0 )
+			if( (len = readlinkat(dirfd, name, str_buf, PATH_MAX-1)) > 0 )
 			{
 				str_buf[len] = '\0';
 				//DEBUG DPRINTF(E_DEBUG, L_GENERAL, "Checking for recursive symbolic link: %s (%s)\n", path, str_buf);
@@ -464,7 +506,7 @@ resolve_unknown_type(const char * path, media_types dir_type)
 					return type;
 				}
 			}
-			stat(path, &entry);
+			fstatat(dirfd, name, &entry, 0);
 		}
 
 		if( S_ISDIR(entry.st_mode) )
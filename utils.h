@@ -90,10 +90,13 @@ int is_playlist(const char * file);
 int is_caption(const char * file);
 int is_album_art(const char * name);
 int resolve_unknown_type(const char * path, media_types dir_type);
+int resolve_unknown_type_at(int dirfd, const char *name, const char *path, media_types dir_type);
 const char *mime_to_ext(const char * mime);
 
 /* Others */
 int make_dir(char * path, mode_t mode);
+int remove_dir(const char * path);
 unsigned int DJBHash(uint8_t *data, int len);
+uint64_t hash64(const void *data, size_t len);
 
 #endif